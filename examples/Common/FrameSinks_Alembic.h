@@ -0,0 +1,131 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Alembic points sink for VFXEpoch::IO::AsyncFrameWriter. The archive and the
+* points schema are created up front, every frame adds one sample at 24 fps.
+* 2D simulations usually want their plane laid on the ground, xz_plane maps
+* the frame's (x, y) points to (x, 0, y).
+*
+* Positions and ids are handed to Alembic straight from the frame (a 3 float
+* point is laid out as an Imath::V3f), only the xz_plane swizzle goes through
+* a scratch buffer that is kept between frames. Point attributes of the frame
+* become array properties of the schema: 1 component as float, 3 as vector,
+* "Cs" as color.
+*
+* Header only so that only the examples including it link against Alembic.
+*******************************************************************************/
+#ifndef _FRAME_SINKS_ALEMBIC_H_
+#define _FRAME_SINKS_ALEMBIC_H_
+
+#include "io/IO_FrameWriter.h"
+
+#include <Alembic/AbcGeom/All.h>
+#include <Alembic/AbcCoreOgawa/All.h>
+
+#include <string>
+#include <vector>
+
+namespace Helpers
+{
+	class AlembicPointsSink : public VFXEpoch::IO::FrameSink
+	{
+	public:
+		AlembicPointsSink(const std::string& filename, bool _xz_plane = false, const std::string& object_name = "Particles",
+		                  double frame_time = 1.0 / 24.0) :
+			archive(Alembic::AbcCoreOgawa::WriteArchive(), filename),
+			xz_plane(_xz_plane){
+			Alembic::AbcGeom::OObject top(archive, Alembic::AbcGeom::kTop);
+			Alembic::AbcGeom::TimeSampling ts(frame_time, 0.0);
+			tsidx = archive.addTimeSampling(ts);
+			points = Alembic::AbcGeom::OPoints(top, object_name, tsidx);
+		}
+
+		bool write(const VFXEpoch::IO::Frame& frame){
+			size_t num = (size_t)frame.num_points;
+			const Imath::V3f* positions = num ? (const Imath::V3f*)&frame.points[0] : NULL;
+			if(xz_plane && num){
+				if(scratch.size() < num) scratch.resize(num);
+				for(size_t i = 0; i != num; i++){
+					const float* p = &frame.points[i * 3];
+					scratch[i] = Imath::V3f(p[0], 0.0f, p[1]);
+				}
+				positions = &scratch[0];
+			}
+
+			const Alembic::Util::uint64_t* id = NULL;
+			if(frame.has_ids){
+				id = num ? (const Alembic::Util::uint64_t*)&frame.ids[0] : NULL;
+			}
+			else{
+				// Without ids the index is the best guess, right while nothing dies
+				while(index_ids.size() < num) index_ids.push_back((Alembic::Util::uint64_t)index_ids.size());
+				id = num ? &index_ids[0] : NULL;
+			}
+
+			Alembic::AbcGeom::OPointsSchema::Sample sample(Alembic::AbcGeom::V3fArraySample(positions, num),
+			                                               Alembic::AbcGeom::UInt64ArraySample(id, num));
+			points.getSchema().set(sample);
+
+			for(int i = 0; i != frame.num_attributes; i++){
+				const VFXEpoch::IO::FrameAttribute& a = frame.attributes[i];
+				const float* data = num ? &a.data[0] : NULL;
+				if(1 == a.components)
+					floatProperty(a.name).set(Alembic::AbcGeom::FloatArraySample(data, num));
+				else if(3 == a.components && "Cs" == a.name)
+					colorProperty(a.name).set(Alembic::AbcGeom::C3fArraySample((const Imath::C3f*)data, num));
+				else if(3 == a.components)
+					vectorProperty(a.name).set(Alembic::AbcGeom::V3fArraySample((const Imath::V3f*)data, num));
+			}
+			return true;
+		}
+
+	private:
+		Alembic::AbcCoreAbstract::MetaData varying() const {
+			Alembic::AbcCoreAbstract::MetaData md;
+			Alembic::AbcGeom::SetGeometryScope(md, Alembic::AbcGeom::kVaryingScope);
+			return md;
+		}
+
+		// Properties are created the first time a frame carries the attribute
+		Alembic::AbcGeom::OFloatArrayProperty& floatProperty(const std::string& name){
+			for(size_t i = 0; i != float_properties.size(); i++)
+				if(float_properties[i].getName() == name) return float_properties[i];
+			float_properties.push_back(Alembic::AbcGeom::OFloatArrayProperty(points.getSchema(), name, varying(), tsidx));
+			return float_properties.back();
+		}
+
+		Alembic::AbcGeom::OV3fArrayProperty& vectorProperty(const std::string& name){
+			for(size_t i = 0; i != vector_properties.size(); i++)
+				if(vector_properties[i].getName() == name) return vector_properties[i];
+			vector_properties.push_back(Alembic::AbcGeom::OV3fArrayProperty(points.getSchema(), name, varying(), tsidx));
+			return vector_properties.back();
+		}
+
+		Alembic::AbcGeom::OC3fArrayProperty& colorProperty(const std::string& name){
+			for(size_t i = 0; i != color_properties.size(); i++)
+				if(color_properties[i].getName() == name) return color_properties[i];
+			color_properties.push_back(Alembic::AbcGeom::OC3fArrayProperty(points.getSchema(), name, varying(), tsidx));
+			return color_properties.back();
+		}
+
+		Alembic::AbcGeom::OArchive archive;
+		Alembic::AbcGeom::OPoints points;
+		Alembic::Util::uint32_t tsidx;
+		bool xz_plane;
+		std::vector<Imath::V3f> scratch;
+		std::vector<Alembic::Util::uint64_t> index_ids;
+		std::vector<Alembic::AbcGeom::OFloatArrayProperty> float_properties;
+		std::vector<Alembic::AbcGeom::OV3fArrayProperty> vector_properties;
+		std::vector<Alembic::AbcGeom::OC3fArrayProperty> color_properties;
+	};
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* OpenEXR sink for VFXEpoch::IO::AsyncFrameWriter. Writes one channel of the
+* frame (e.g. "density") as a grey half float image per frame, row 0 of the
+* grid at the bottom of the image.
+*
+* Header only so that only the examples including it link against OpenEXR.
+*******************************************************************************/
+#ifndef _FRAME_SINKS_EXR_H_
+#define _FRAME_SINKS_EXR_H_
+
+#include "io/IO_FrameWriter.h"
+
+#include <OpenEXR/ImfRgbaFile.h>
+#include <OpenEXR/ImfArray.h>
+#include <OpenEXR/ImfNamespace.h>
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+namespace Helpers
+{
+	class ExrChannelSink : public VFXEpoch::IO::FrameSink
+	{
+	public:
+		ExrChannelSink(const std::string& _pattern, const std::string& _channel, float _scale = 1.0f) :
+			pattern(_pattern), channel(_channel), scale(_scale){}
+
+		bool write(const VFXEpoch::IO::Frame& frame){
+			const VFXEpoch::IO::FrameChannel* source = frame.channel(channel.c_str());
+			if(!source) return true;
+
+			int width = source->dims[0], height = source->dims[1];
+			pixels.resizeErase(height, width);
+			for(int i = 0; i != height; i++){
+				for(int j = 0; j != width; j++){
+					half value = source->data[i * width + j] * scale;
+					Imf::Rgba& pixel = pixels[height - 1 - i][j];
+					pixel.r = pixel.g = pixel.b = value;
+					pixel.a = 1.0f;
+				}
+			}
+
+			char filename[1024];
+			snprintf(filename, sizeof(filename), pattern.c_str(), frame.index);
+			try{
+				Imf::RgbaOutputFile file(filename, width, height, Imf::WRITE_RGBA);
+				file.setFrameBuffer(&pixels[0][0], 1, width);
+				file.writePixels(height);
+			}
+			catch(const std::exception& e){
+				std::cout << "WARNING: " << e.what() << std::endl;
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		std::string pattern;
+		std::string channel;
+		float scale;
+		Imf::Array2D<Imf::Rgba> pixels;
+	};
+}
+
+#endif
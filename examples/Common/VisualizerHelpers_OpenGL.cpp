@@ -126,6 +126,40 @@ OpenGL_Utility::draw_particles2d(const std::vector<VFXEpoch::Particle2Df>& parti
   glEnd(); 
 }
 
+void
+OpenGL_Utility::draw_particles2d(const VFXEpoch::ParticleView2Df& particles,
+  int particle_size, VFXEpoch::Vector3Df color, bool is_round_point) {
+
+  glColor3f(color.m_x, color.m_y, color.m_z);
+  glPointSize(particle_size);
+
+  if (is_round_point)
+    glEnable( GL_POINT_SMOOTH );
+
+  glBegin(GL_POINTS);
+  for(int i = 0; i < particles.count; ++i) {
+    glVertex2f(particles.pos_x[i], particles.pos_y[i]);
+  }
+  glEnd();
+}
+
+void
+OpenGL_Utility::draw_points(const float* xyz, int count, int particle_size, VFXEpoch::Vector3Df color, bool is_round_point) {
+  if(!xyz || count <= 0)
+    return;
+
+  glColor3f(color.m_x, color.m_y, color.m_z);
+  glPointSize(particle_size);
+
+  if (is_round_point)
+    glEnable( GL_POINT_SMOOTH );
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(3, GL_FLOAT, 0, xyz);
+  glDrawArrays(GL_POINTS, 0, count);
+  glDisableClientState(GL_VERTEX_ARRAY);
+}
+
 void 
 OpenGL_Utility::draw_arrows(VFXEpoch::Solvers::EulerGAS2D* solver, float arrow_len, VFXEpoch::Vector3Df color){
   if(!solver){
@@ -9,6 +9,7 @@
 #include "utl/UTL_Vector.h"
 #include "utl/UTL_Grid.h"
 #include "utl/UTL_General.h"
+#include "utl/UTL_Particles.h"
 #include "Helpers.h"
 
 namespace VFXEpoch{
@@ -18,6 +19,9 @@ namespace VFXEpoch{
         void draw_particles2d(const std::vector<VFXEpoch::Vector2Df>& particles_container, int particle_size = 1, VFXEpoch::Vector3Df color = VFXEpoch::Vector3Df(0.0, 1.0, 0.0), bool is_round_point = false);
         void draw_particles2d(const std::vector<VFXEpoch::Particle2Dd>& particles_container, int particle_size = 1, VFXEpoch::Vector3Df color = VFXEpoch::Vector3Df(0.0, 1.0, 0.0), bool is_round_point = false);
         void draw_particles2d(const std::vector<VFXEpoch::Particle2Df>& particles_container, int particle_size = 1, VFXEpoch::Vector3Df color = VFXEpoch::Vector3Df(0.0, 1.0, 0.0), bool is_round_point = false);
+        void draw_particles2d(const VFXEpoch::ParticleView2Df& particles, int particle_size = 1, VFXEpoch::Vector3Df color = VFXEpoch::Vector3Df(0.0, 1.0, 0.0), bool is_round_point = false);
+        // Draws count xyz points straight from memory, e.g. a mapped cache channel
+        void draw_points(const float* xyz, int count, int particle_size = 1, VFXEpoch::Vector3Df color = VFXEpoch::Vector3Df(0.0, 1.0, 0.0), bool is_round_point = false);
         void draw_arrows(VFXEpoch::Solvers::EulerGAS2D* solver, float header_len, VFXEpoch::Vector3Df color = VFXEpoch::Vector3Df(0.7, 0.7, 0.7));
         void draw_circle2d(const VFXEpoch::Vector2Df& center, double rad, int segs, VFXEpoch::Vector3Df color = VFXEpoch::Vector3Df(0.7, 0.7, 0.7));
     }
@@ -13,6 +13,10 @@
 #include "Helpers.h"
 #include "VisualizerHelpers.h"
 #include "VisualizerHelpers_OpenGL.h"
+#include "FrameSinks_EXR.h"
+#include "FrameSinks_Alembic.h"
+#include "io/IO_FrameWriter.h"
+#include "io/IO_Cache.h"
 
 #include <OpenEXR/ImfRgbaFile.h>
 #include <OpenEXR/ImfStringAttribute.h>
@@ -69,6 +73,10 @@ void timer(int arg);
 bool preview = true;
 bool outputParticles = false;
 bool outputAlembic = false;
+bool outputDensity = false;
+bool outputVolume = false;
+bool outputCache = false;
+VFXEpoch::IO::AsyncFrameWriter* frame_writer = NULL;
 /***************************** For Visualization ******************************/
 
 EulerGAS2D::Parameters params;
@@ -97,27 +105,63 @@ float boundary_phi(const VFXEpoch::Vector2Df& position) {
 }
 /****************************** For Dbuge ******************************/
 
-//write tracer particle data to a file so that can be visulized by matlab
-void write_file(double *pos_x, double *pos_y, int num, int frame)
+// Snapshots the particles and the density of this frame, the writer thread
+// writes them out while the next step runs
+void write_frame(int frame)
 {
-	char filename[256];
-	sprintf(filename,"../../outputs/sims/Particle_data%04d.bin",frame);
-	float *data;
-	data = new float[num*4];
-	for (int i=0;i<num;i++)
-	{
-		data[i*4+0] = pos_x[i];
-		data[i*4+1] = pos_y[i];
-		data[i*4+2] = 0;
-		data[i*4+3] = 1;
+	if (!frame_writer)
+		return;
+	VFXEpoch::IO::Frame* snapshot = frame_writer->acquire();
+	snapshot->index = frame;
+	if (outputParticles || outputAlembic || outputCache)
+		snapshot->setParticles(gas_solver->get_particle_view());
+	if (outputDensity || outputVolume || outputCache)
+		snapshot->setChannel("density", gas_solver->get_density());
+	if (outputVolume || outputCache) {
+		snapshot->setChannel("temperature", gas_solver->get_temperature());
+		snapshot->setChannel("vorticity", gas_solver->get_vorticity());
 	}
-	FILE *f;
-	f = fopen(filename,"wb");
-	fwrite(&num, sizeof(int), 1, f);
-	fwrite(data,sizeof(float),4*num,f);
+	frame_writer->submit(snapshot);
+}
 
-	delete[]data;
-	fclose(f);
+bool init_frame_writer()
+{
+	if (!outputParticles && !outputAlembic && !outputDensity && !outputVolume && !outputCache)
+		return false;
+	frame_writer = new VFXEpoch::IO::AsyncFrameWriter();
+	if (outputParticles)
+		frame_writer->addSink(new VFXEpoch::IO::RawParticleSink("../../outputs/sims/Particle_data%04d.bin"));
+	if (outputAlembic)
+		frame_writer->addSink(new Helpers::AlembicPointsSink("../../outputs/sims/smoke_particles.abc"));
+	if (outputDensity)
+		frame_writer->addSink(new Helpers::ExrChannelSink("../../outputs/sims/density_%04d.exr", "density"));
+	if (outputVolume) {
+		// Half floats, cells below 1e-4 are treated as empty air
+		VFXEpoch::IO::VolumeOptions options;
+		options.threshold = 1e-4f;
+		options.precision = VFXEpoch::IO::VOLUME_PRECISION::HALF;
+		frame_writer->addSink(new VFXEpoch::IO::VolumeFrameSink("../../outputs/sims/smoke_%04d.vol", options));
+	}
+	// Every frame in one mapped file, viz2D plays it back without parsing.
+	// The scalar fields are only looked at, so they are stored quantised;
+	// the particles stay raw to be drawn straight from the mapping.
+	if (outputCache) {
+		VFXEpoch::IO::CacheFrameSink* cache = new VFXEpoch::IO::CacheFrameSink("../../outputs/sims/smoke.vfxcache");
+		cache->setPolicy("density", VFXEpoch::IO::CompressionPolicy(VFXEpoch::IO::CODEC::QUANTIZE_LZ, 1e-4f));
+		cache->setPolicy("temperature", VFXEpoch::IO::CompressionPolicy(VFXEpoch::IO::CODEC::QUANTIZE_LZ, 1e-3f));
+		cache->setPolicy("vorticity", VFXEpoch::IO::CompressionPolicy(VFXEpoch::IO::CODEC::SHUFFLE_LZ));
+		frame_writer->addSink(cache);
+	}
+	return true;
+}
+
+void close_frame_writer()
+{
+	if (!frame_writer)
+		return;
+	frame_writer->close();
+	delete frame_writer;
+	frame_writer = NULL;
 }
 
 bool process_cmd_params(int argc, char* argv[])
@@ -222,7 +266,7 @@ void display()
 
 	OpenGL_Utility::draw_circle2d(c0, rad0, 100, VFXEpoch::Vector3Df(0.0, 1.0, 0.0));
 	
-	OpenGL_Utility::draw_particles2d(gas_solver->get_particles(), 10, VFXEpoch::Vector3Df(1.0, 0.0, 0.0), true);
+	OpenGL_Utility::draw_particles2d(gas_solver->get_particle_view(), 10, VFXEpoch::Vector3Df(1.0, 0.0, 0.0), true);
 
 	OpenGL_Utility::draw_arrows(gas_solver, 0.1f, VFXEpoch::Vector3Df(0.0, 1.0, 0.0));
 
@@ -247,6 +291,7 @@ void timer(int arg)
 		int i = (total_frames - arg) + 1;
 		cout << "****************** Frame " << i << " ******************" << endl;
 		gas_solver->step();
+		write_frame(i);
 		cout << "**************** Step " << i << " done ****************" << endl;
 		cout << endl;
 		glutPostRedisplay();
@@ -256,6 +301,7 @@ void timer(int arg)
 		int i = (total_frames - arg) + 1;
 		cout << "****************** Frame " << i << " ******************" << endl;
 		gas_solver->step();
+		write_frame(i);
 		cout << "**************** Step " << i << " done ****************" << endl;
 		cout << endl;
 		glutPostRedisplay();
@@ -263,6 +309,7 @@ void timer(int arg)
 	}
 	else {
 		std::cout << total_frames << " steps of simulation is done" << std::endl;
+		close_frame_writer();
 		exit(-1);
 	}
 }
@@ -275,6 +322,7 @@ int main(int argc, char** argv)
 		return -1;
 	}
 	init_solver_params();
+	init_frame_writer();
 
 	solver = new VFXEpoch::Solvers::EulerGAS2D();
 	if (!solver) {
@@ -311,6 +359,7 @@ int main(int argc, char** argv)
 		for(int i = 0; i != total_frames; i++){
 			cout << "****************** Frame " << i << " ******************" << endl;
 			gas_solver->step();
+			write_frame(i);
 			cout << "**************** Step " << i << " done ****************" << endl;
 			cout << endl;
 		}
@@ -361,6 +410,7 @@ int main(int argc, char** argv)
 		Gluvi::run();
 	}
 
+	close_frame_writer();
 	gas_solver->close();
 	if(solver) 
 		delete solver;
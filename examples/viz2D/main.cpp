@@ -23,6 +23,7 @@
 #include "VisualizerHelpers.h"
 #include "VisualizerHelpers_OpenGL.h"
 #include "Helpers.h"
+#include "io/IO_Cache.h"
 
 using namespace VFXEpoch::Gluvi;
 using namespace VFXEpoch::OpenGL_Utility;
@@ -31,6 +32,7 @@ using namespace IMF;
 using namespace IMATH_NAMESPACE;
 
 bool load_bin(const char* filename);
+bool load_cache_frame(int slot);
 void write_exrs(const char fileName[], const Rgba *pixels, int width, int height);
 void convert_to_exr_rgba(GLubyte* in_pixels, Array2D<Imf::Rgba>& out_pixels, int width, int height);
 void init_data();
@@ -46,6 +48,16 @@ unsigned int width = 960;
 unsigned int height = 280;
 bool is_write_to_disk = true;
 
+// Cached runs are played straight from the mapping, frames ahead of the
+// playhead are prefetched so the timer never waits on the disk
+const char* cache_filename = "../../outputs/sims/vortex_rings.vfxcache";
+const int cache_prefetch = 4;
+VFXEpoch::IO::CacheReader cache;
+bool use_cache = false;
+const float* cache_points = NULL;
+int cache_num_points = 0;
+std::vector<float> cache_decoded;
+
 float pan_zoom_cam_bottom = -2.5f;
 float pan_zoom_cam_height = 5.0f;
 float pan_zoom_cam_left = 0.0f;
@@ -55,6 +67,8 @@ PanZoom2D cam(pan_zoom_cam_bottom, pan_zoom_cam_bottom + pan_zoom_cam_height, pa
 int main(int argc, char **argv)
 {   
    //Setup viewer stuff
+   if(argc > 1)
+      cache_filename = argv[1];
    Gluvi::init("2D Particles Visualizer", &argc, argv, width, height);
    init_data();
    Gluvi::camera=&cam;
@@ -72,6 +86,14 @@ void
 init_data(){
     // TODO: Initialize data
     frame_counter = 0;
+    if(cache.open(cache_filename)){
+        use_cache = load_cache_frame(0);
+        if(use_cache){
+            cout << "Playing " << cache.numFrames() << " frames from " << cache_filename << endl;
+            return;
+        }
+    }
+
     char filename[256];
     bool result;
     sprintf(filename, "../../outputs/sims/Particle_data%04d.bin", frame_counter);
@@ -110,6 +132,25 @@ load_bin(const char* filename){
     return true;
 }
 
+bool
+load_cache_frame(int slot){
+    if(slot >= cache.numFrames())
+        return false;
+    const VFXEpoch::IO::CacheChannel* channel = cache.channel(slot, "P");
+    if(!channel || channel->type != VFXEpoch::IO::CACHE_TYPE::FLOAT32 || channel->components != 3)
+        return false;
+    // Compressed positions are decoded, raw ones are drawn from the mapping
+    cache_points = cache.data<float>(channel);
+    if(!cache_points){
+        if(!cache.read(channel, cache_decoded))
+            return false;
+        cache_points = &cache_decoded[0];
+    }
+    cache_num_points = (int)channel->count;
+    cache.prefetch(slot + 1, cache_prefetch);
+    return true;
+}
+
 void
 write_exrs(const char fileName[], const Rgba *pixels, int width, int height){
     RgbaOutputFile file (fileName, width, height, WRITE_RGBA);
@@ -134,7 +175,10 @@ convert_to_exr_rgba(GLubyte* in_pixels, Array2D<Imf::Rgba>& out_pixels, int widt
 void
 display(){
     glPointSize(1);
-    OpenGL_Utility::draw_particles2d(particles);
+    if(use_cache)
+        OpenGL_Utility::draw_points(cache_points, cache_num_points);
+    else
+        OpenGL_Utility::draw_particles2d(particles);
 }
 
 void 
@@ -153,8 +197,16 @@ timer(int junk){
     char filename[256];
     bool result;
     frame_counter++;
-    sprintf(filename, "../../outputs/sims/Particle_data%04d.bin", frame_counter);
-    result = load_bin(filename);
+    if(use_cache){
+        // End of the cached run
+        if(!load_cache_frame(frame_counter))
+            exit(0);
+        result = true;
+    }
+    else{
+        sprintf(filename, "../../outputs/sims/Particle_data%04d.bin", frame_counter);
+        result = load_bin(filename);
+    }
     if(!result){
 #ifdef __linux__
         string str_filename(filename);
@@ -4,17 +4,13 @@
 #include <random>
 #include <math.h>
 
-// For exporting alembic files (Points) including the following headers
-#include <Alembic/AbcGeom/All.h>
-#include <Alembic/AbcCoreOgawa/All.h>
-// #include <Alembic/Util/Assert.h>
-#include <ImathRandom.h>
+// Frames are written by a background thread, raw dumps, a playback cache
+// and Alembic points
+#include "io/IO_FrameWriter.h"
+#include "io/IO_Cache.h"
+#include "FrameSinks_Alembic.h"
 
 using namespace std;
-namespace AbcG = Alembic::AbcGeom;
-using namespace AbcG;
-using Alembic::AbcCoreAbstract::chrono_t;
-using Alembic::AbcCoreAbstract::index_t;
 
 //define the mollify radius
 #define EPS 0.01
@@ -41,16 +37,9 @@ struct vortex2D
 	}
 };
 
-struct particle2D
-{
-	std::vector<V3f> pos;
-	std::vector<Alembic::Util::uint64_t> id;
-};
-
 // Global variables
 bool is_export_alembic = true;
 std::vector<vortex2D> vortex_particles;
-particle2D particles;
 
 //u component of velocity from a single vortex
 double compute_u_from_single_vortex(double x, double y, vortex2D &vortex)
@@ -106,29 +95,6 @@ void rk3_integrate_pos(double &x, double &y, std::vector<vortex2D> &vortex, doub
 	y += 0.222222222222*dt*v0 + 0.333333333333*dt*v1 + 0.444444444444*dt*v2;
 }
 
-//write tracer particle data to a file so that can be visulized by matlab
-void write_file(double *pos_x, double *pos_y, int num, int frame)
-{
-	char filename[256];
-	sprintf(filename,"../../outputs/sims/Particle_data%04d.bin",frame);
-	float *data;
-	data = new float[num*4];
-	for (int i=0;i<num;i++)
-	{
-		data[i*4+0] = pos_x[i];
-		data[i*4+1] = pos_y[i];
-		data[i*4+2] = 0;
-		data[i*4+3] = 1;
-	}
-	FILE *f;
-	f = fopen(filename,"wb");
-	fwrite(&num, sizeof(int), 1, f);
-	fwrite(data,sizeof(float),4*num,f);
-
-	delete[]data;
-	fclose(f);
-}
-
 // our main function computes two vortex ring leapforgging
 int main(int argc, char * argv[])
 {
@@ -155,47 +121,43 @@ int main(int argc, char * argv[])
 		pos_x[num] = x;
 		pos_y[num] = y;
 		num++;
-		particles.id.push_back(num);
 	}
 
-	// Create the time sampling type.
-	OArchive archive(Alembic::AbcCoreOgawa::WriteArchive(), "vortex_particles.abc");
-	OObject topObj(archive, kTop);
-	TimeSampling ts(1.f / 24.f, 0.0);
-	Alembic::Util::uint32_t tsidx = topObj.getArchive().addTimeSampling(ts);
-	
-	// Create our object.
-	OPoints partsOut( topObj, "Particles", tsidx );
-	std::cout << "Created Particles" << std::endl;
-	
-	// Add attributes
-	OPointsSchema &pSchema = partsOut.getSchema();
-	MetaData mdata;
-	SetGeometryScope( mdata, kVaryingScope );
+	// Tracer dumps for matlab, plus the Alembic points laid on the xz plane
+	VFXEpoch::IO::AsyncFrameWriter writer;
+	writer.addSink(new VFXEpoch::IO::RawParticleSink("../../outputs/sims/Particle_data%04d.bin"));
+	writer.addSink(new VFXEpoch::IO::CacheFrameSink("../../outputs/sims/vortex_rings.vfxcache"));
+	if(is_export_alembic)
+		writer.addSink(new Helpers::AlembicPointsSink("vortex_particles.abc", true));
 
 	//our simulation
 	double dt = 0.1;
 	for (int T=0;T<300;T++)
 	{
-		write_file(pos_x,pos_y,num_tracer,T);
+		// Snapshot the tracers, they are written while the next frame is simulated,
+		// straight into the pooled buffers of the frame
+		VFXEpoch::IO::Frame* frame = writer.acquire();
+		frame->index = T;
+		float* xyz = frame->mapPoints(num_tracer);
+		unsigned long long* ids = frame->mapIds();
+		#pragma omp parallel for
+		for (int i=0;i<num_tracer;i++)
+		{
+			xyz[i*3+0] = pos_x[i];
+			xyz[i*3+1] = pos_y[i];
+			xyz[i*3+2] = 0.0f;
+			ids[i] = i + 1;
+		}
+		writer.submit(frame);
 
 		//few substeps, not necessary
 		for(int substep=0;substep<4;substep++)
 		{
 		//integrate tracers, we are going to use rk3 integrator
 			#pragma omp parallel for
-			particles.pos.clear();
 			for (int i=0;i<num_tracer;i++)
 			{
 				rk3_integrate_pos(pos_x[i],pos_y[i],vortex_particles, dt);
-				if(is_export_alembic) {
-					particles.pos.push_back(V3f(pos_x[i], 0.0f, pos_y[i]));
-				}
-			}
-
-			if(is_export_alembic){
-				OPointsSchema::Sample point_sample(V3fArraySample(particles.pos), UInt64ArraySample(particles.id));
-				pSchema.set(point_sample);
 			}
 		
 			//integrate vortex particles
@@ -233,8 +195,7 @@ int main(int argc, char * argv[])
 		printf("step %d done\n",T);
 	}
 	
+	writer.close();
 	delete[]pos_x; delete[]pos_y;
-	particles.pos.clear();
-	particles.id.clear();
 	return 0;
 }
\ No newline at end of file
@@ -38,6 +38,11 @@
 #include <Alembic/AbcCoreOgawa/All.h>
 // #include <Alembic/Util/Assert.h>
 #include <ImathRandom.h>
+#include <cstring>
+
+// Frames go through the library's pooled frame writer to the Alembic sink
+#include "io/IO_FrameWriter.h"
+#include "FrameSinks_Alembic.h"
 
 namespace AbcG = Alembic::AbcGeom;
 using namespace AbcG;
@@ -151,21 +156,24 @@ void ParticleSystem::advectExisting( chrono_t dt )
 void ParticleSystem::destroyOld( chrono_t dt )
 {
     // Delete everybody whose age is greater than lifespan.
-    // We delete by simply swapping out with the last position.
-    size_t numParticles = m_id.size();
-    size_t lastParticle = numParticles - 1;
-    for ( size_t part = 0; part < numParticles; ++part )
+    // Survivors are moved down in a single pass, so they keep their order
+    // and every particle is tested once; shrinking keeps the capacity.
+    size_t numParticles = 0;
+    for ( size_t part = 0; part < m_id.size(); ++part )
     {
         if ( m_age[part] >= m_params.lifespan )
         {
-            std::swap( m_id[part],              m_id[lastParticle] );
-            std::swap( m_position[part],        m_position[lastParticle] );
-            std::swap( m_color[part],           m_color[lastParticle] );
-            std::swap( m_velocity[part],        m_velocity[lastParticle] );
-            std::swap( m_age[part],             m_age[lastParticle] );
-            --numParticles;
-            --lastParticle;
+            continue;
         }
+        if ( part != numParticles )
+        {
+            m_id[numParticles]       = m_id[part];
+            m_position[numParticles] = m_position[part];
+            m_color[numParticles]    = m_color[part];
+            m_velocity[numParticles] = m_velocity[part];
+            m_age[numParticles]      = m_age[part];
+        }
+        ++numParticles;
     }
 
     m_id.resize( numParticles );
@@ -227,27 +235,17 @@ void ParticleSystem::emitNew( chrono_t dt )
 //-*****************************************************************************
 //-*****************************************************************************
 //-*****************************************************************************
-void RunAndWriteParticles(OObject &iParent, const ParticleSystem::Parameters &iParams, size_t iNumFrames, chrono_t iFps)
+void RunAndWriteParticles(const std::string &iFileName, const ParticleSystem::Parameters &iParams, size_t iNumFrames, chrono_t iFps)
 {
     // Make the particle system.
     ParticleSystem parts( iParams );
 
-    // Create the time sampling type.
-    TimeSampling ts(iFps, 0.0);
-    Alembic::Util::uint32_t tsidx = iParent.getArchive().addTimeSampling(ts);
-
-    // Create our object.
-    OPoints partsOut( iParent, "simpleParticles", tsidx );
+    // The sink creates the archive, the time sampling and the points object,
+    // the attributes become properties of the points schema.
+    VFXEpoch::IO::AsyncFrameWriter writer;
+    writer.addSink( new Helpers::AlembicPointsSink( iFileName, false, "simpleParticles", iFps ) );
     std::cout << "Created Simple Particles" << std::endl;
 
-    // Add attributes
-    OPointsSchema &pSchema = partsOut.getSchema();
-    MetaData mdata;
-    SetGeometryScope( mdata, kVaryingScope );
-    OV3fArrayProperty velOut( pSchema, "velocity", mdata, tsidx );
-    OC3fArrayProperty rgbOut( pSchema, "Cs", tsidx );
-    OFloatArrayProperty ageOut( pSchema, "age", tsidx );
-
     // Get seconds per frame.
     chrono_t iSpf = 1.0 / iFps;
 
@@ -268,25 +266,39 @@ void RunAndWriteParticles(OObject &iParent, const ParticleSystem::Parameters &iP
     for ( index_t sampIndex = 0;
           sampIndex < ( index_t )iNumFrames; ++sampIndex )
     {
-        // First, write the sample.
-        OPointsSchema::Sample psamp(
-            V3fArraySample( parts.positionVec() ),
-            UInt64ArraySample( parts.idVec() ) );
-        pSchema.set( psamp );
-        velOut.set( V3fArraySample( parts.velocityVec() ) );
-        rgbOut.set( C3fArraySample( parts.colorVec() ) );
-        ageOut.set( FloatArraySample( parts.ageVec() ) );
+        // First, snapshot the sample into a pooled frame, it is written
+        // while the next step runs.
+        size_t num = parts.numParticles();
+        VFXEpoch::IO::Frame* frame = writer.acquire();
+        frame->index = ( int )sampIndex;
+        // The channels are mapped even for an empty frame so every sample
+        // has the same layout, an empty map is NULL and must not be copied to.
+        float* points = frame->mapPoints( ( int )num );
+        unsigned long long* ids = frame->mapIds();
+        float* velocity = frame->mapAttribute( "velocity", 3 );
+        float* color = frame->mapAttribute( "Cs", 3 );
+        float* age = frame->mapAttribute( "age", 1 );
+        if ( num )
+        {
+            memcpy( points, parts.positionVec().data(), num * sizeof( V3f ) );
+            memcpy( ids, parts.idVec().data(), num * sizeof( Alembic::Util::uint64_t ) );
+            memcpy( velocity, parts.velocityVec().data(), num * sizeof( V3f ) );
+            memcpy( color, parts.colorVec().data(), num * sizeof( C3f ) );
+            memcpy( age, parts.ageVec().data(), num * sizeof( float ) );
+        }
+        writer.submit( frame );
 
         // Now time step.
         parts.timeStep( iSpf );
 
         // Print!
-        std::cout << "Wrote " << parts.numParticles()
+        std::cout << "Wrote " << num
                   << " particles to frame: " << sampIndex << std::endl;
     }
 
     // End it.
     std::cout << "Finished Sim, About to finish writing" << std::endl;
+    writer.close();
 }
 
 //-*****************************************************************************
@@ -552,13 +564,7 @@ int main( int argc, char *argv[] )
     params.emitColorSpread = 0.25f;
     params.emitColor = C3f( 0.85f, 0.9f, 0.1f );
 
-    {
-        OArchive archive( Alembic::AbcCoreOgawa::WriteArchive(),
-                          "particlesOut1.abc" );
-        OObject topObj( archive, kTop );
-
-        RunAndWriteParticles( topObj, params, 20, 1.0/24.0 );
-    }
+    RunAndWriteParticles( "particlesOut1.abc", params, 20, 1.0/24.0 );
 
     std::cout << "Wrote particlesOut1.abc" << std::endl;
 
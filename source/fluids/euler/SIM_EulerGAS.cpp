@@ -8,9 +8,36 @@
 *******************************************************************************/
 #include "SIM_EulerGAS.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+
+// Uniform in [0, 1) from a particle id, the same on any number of threads
+static float
+particle_random(unsigned long long seed, unsigned long long stream){
+  unsigned long long z = seed * 2654435761ull + stream * 0x9e3779b97f4a7c15ull;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  z ^= z >> 31;
+  return (float)(z >> 40) * (1.0f / 16777216.0f);
+}
+
 // Public
 EulerGAS2D::EulerGAS2D(){
   user_params.clear();
+  verbose = true;
+  particle_sort_interval = 0; steps_since_sort = 0;
+  particle_min_per_cell = 0; particle_max_per_cell = 0;
+  particle_min_density = 0.0f;
+  remove_dead_particles = false;
+  particle_reseed_color = VFXEpoch::Vector3Df(1.0f, 1.0f, 1.0f);
+  particle_epoch = 0;
+  velocity_transfer = VELOCITY_TRANSFER::SEMI_LAGRANGIAN; flip_ratio = 0.95f;
+  extrapolation_layers = 5;
+  mixed_precision_pressure = false;
+  fast_poisson_preconditioner = false;
+  u_extrapolation.epoch = v_extrapolation.epoch = 0;
   u.clear(); u0.clear();
   v.clear(); v0.clear();
   uw.clear(); vw.clear();
@@ -18,7 +45,8 @@ EulerGAS2D::EulerGAS2D(){
   t.clear(); t0.clear();
   omega.clear(); omega0.clear();
   inside_mask.clear(); inside_mask0.clear();
-  nodal_solid_phi.clear();
+  nodal_solid_phi.clear(); static_solid_phi.clear();
+  colliders.clear(); dirty_boxes.clear();
   pressure_solver_params.clear();
   particles_container.clear();
   source_locations.clear();
@@ -43,14 +71,43 @@ EulerGAS2D::EulerGAS2D(const EulerGAS2D& src){
   omega = src.v; omega0 = src.v0;
   user_params = src.user_params;
   inside_mask = src.inside_mask; inside_mask0 = src.inside_mask0;
-  nodal_solid_phi = src.nodal_solid_phi;
+  nodal_solid_phi = src.nodal_solid_phi; static_solid_phi = src.static_solid_phi;
+  colliders = src.colliders;
+  // The copy starts without a pressure matrix, every row is built again
+  mark_dirty_nodes(0, nodal_solid_phi.getDimY() - 1, 0, nodal_solid_phi.getDimX() - 1);
   particles_container = src.particles_container;
+  particle_cell_start = src.particle_cell_start;
+  particle_sort_interval = src.particle_sort_interval; steps_since_sort = src.steps_since_sort;
+  emitters = src.emitters; emitter_carry = src.emitter_carry;
+  particle_min_per_cell = src.particle_min_per_cell; particle_max_per_cell = src.particle_max_per_cell;
+  particle_min_density = src.particle_min_density;
+  remove_dead_particles = src.remove_dead_particles;
+  particle_reseed_color = src.particle_reseed_color;
+  particle_epoch = src.particle_epoch;
+  velocity_transfer = src.velocity_transfer; flip_ratio = src.flip_ratio;
+  u_extrapolation = src.u_extrapolation; v_extrapolation = src.v_extrapolation;
+  extrapolation_layers = src.extrapolation_layers;
+  mixed_precision_pressure = src.mixed_precision_pressure;
+  fast_poisson_preconditioner = src.fast_poisson_preconditioner;
   source_locations = src.source_locations;
   external_force_locations = src.external_force_locations;
+  verbose = src.verbose;
 }
 
 // Public
 EulerGAS2D::EulerGAS2D(Parameters _user_params):user_params(_user_params){
+  verbose = true;
+  particle_sort_interval = 0; steps_since_sort = 0;
+  particle_min_per_cell = 0; particle_max_per_cell = 0;
+  particle_min_density = 0.0f;
+  remove_dead_particles = false;
+  particle_reseed_color = VFXEpoch::Vector3Df(1.0f, 1.0f, 1.0f);
+  particle_epoch = 0;
+  velocity_transfer = VELOCITY_TRANSFER::SEMI_LAGRANGIAN; flip_ratio = 0.95f;
+  extrapolation_layers = 5;
+  mixed_precision_pressure = false;
+  fast_poisson_preconditioner = false;
+  u_extrapolation.epoch = v_extrapolation.epoch = 0;
   v.Reset(_user_params.dimension.m_x, _user_params.dimension.m_y + 1, _user_params.h, _user_params.h); v0 = v;
   u.Reset(_user_params.dimension.m_x + 1, _user_params.dimension.m_y, _user_params.h, _user_params.h); u0 = u;
   uw.Reset(_user_params.dimension.m_x + 1, _user_params.dimension.m_y, _user_params.h, _user_params.h);
@@ -59,6 +116,8 @@ EulerGAS2D::EulerGAS2D(Parameters _user_params):user_params(_user_params){
   t.Reset(_user_params.dimension.m_x, _user_params.dimension.m_y, _user_params.h, _user_params.h); t0 = t;
   omega.Reset(_user_params.dimension.m_x + 2, _user_params.dimension.m_y + 2, _user_params.h, _user_params.h); omega0 = omega;
   nodal_solid_phi.Reset(_user_params.dimension.m_x + 1, _user_params.dimension.m_y + 1, _user_params.h, _user_params.h);
+  static_solid_phi = nodal_solid_phi;
+  mark_dirty_nodes(0, nodal_solid_phi.getDimY() - 1, 0, nodal_solid_phi.getDimX() - 1);
   inside_mask.Reset(_user_params.dimension.m_x + 1, _user_params.dimension.m_y + 1, _user_params.h, _user_params.h); inside_mask0 = inside_mask;
   particles_container.resize(_user_params.num_particles);
   source_locations.resize(0);
@@ -75,10 +134,28 @@ EulerGAS2D::operator=(const EulerGAS2D& rhs){
   t = rhs.v; t0 = rhs.v0;
   omega = rhs.v; omega0 = rhs.v0;
   inside_mask = rhs.inside_mask; inside_mask0 = rhs.inside_mask0;
+  nodal_solid_phi = rhs.nodal_solid_phi; static_solid_phi = rhs.static_solid_phi;
+  colliders = rhs.colliders;
+  dirty_boxes.clear();
+  mark_dirty_nodes(0, nodal_solid_phi.getDimY() - 1, 0, nodal_solid_phi.getDimX() - 1);
   user_params = rhs.user_params;
   particles_container = rhs.particles_container;
+  particle_cell_start = rhs.particle_cell_start;
+  particle_sort_interval = rhs.particle_sort_interval; steps_since_sort = rhs.steps_since_sort;
+  emitters = rhs.emitters; emitter_carry = rhs.emitter_carry;
+  particle_min_per_cell = rhs.particle_min_per_cell; particle_max_per_cell = rhs.particle_max_per_cell;
+  particle_min_density = rhs.particle_min_density;
+  remove_dead_particles = rhs.remove_dead_particles;
+  particle_reseed_color = rhs.particle_reseed_color;
+  particle_epoch = rhs.particle_epoch;
+  velocity_transfer = rhs.velocity_transfer; flip_ratio = rhs.flip_ratio;
+  u_extrapolation = rhs.u_extrapolation; v_extrapolation = rhs.v_extrapolation;
+  extrapolation_layers = rhs.extrapolation_layers;
+  mixed_precision_pressure = rhs.mixed_precision_pressure;
+  fast_poisson_preconditioner = rhs.fast_poisson_preconditioner;
   source_locations = rhs.source_locations;
   external_force_locations = rhs.external_force_locations;
+  verbose = rhs.verbose;
   return *this;
 }
 
@@ -100,7 +177,13 @@ EulerGAS2D::init(Parameters params){
   t.Reset(user_params.dimension.m_x, user_params.dimension.m_y, user_params.h, user_params.h); t0 = t;
   omega.Reset(user_params.dimension.m_x + 2, user_params.dimension.m_y + 2, user_params.h, user_params.h); omega0 = omega;
   nodal_solid_phi.Reset(user_params.dimension.m_x + 1, user_params.dimension.m_y + 1, user_params.h, user_params.h);
+  static_solid_phi = nodal_solid_phi;
+  dirty_boxes.clear();
+  mark_dirty_nodes(0, nodal_solid_phi.getDimY() - 1, 0, nodal_solid_phi.getDimX() - 1);
+  for(size_t c = 0; c != colliders.size(); c++) colliders[c].node_i1 = colliders[c].node_i0 - 1;
   particles_container.resize(user_params.num_particles);
+  particle_cell_start.clear();
+  steps_since_sort = 0;
 
   // Make the mask all as boundaries in initialization
   inside_mask.Reset(user_params.dimension.m_x + 1, user_params.dimension.m_y + 1, user_params.h, user_params.h); inside_mask0 = inside_mask;
@@ -118,22 +201,41 @@ EulerGAS2D::init(Parameters params){
 // Overload from SIM_Base.h -> class Euler_Fluid2D_Base
 void
 EulerGAS2D::step(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "step");
+  if(0 != colliders.size() || 0 != dirty_boxes.size()) update_colliders();
   if(0 != source_locations.size())  add_source();
-  cout << "--> Advect particles" << endl;
+  if(0 != emitters.size()) emit_particles();
+  if(verbose) cout << "--> Advect particles" << endl;
   advect_particles();
-  cout << "--> Advect velocity (Self-Advection)" << endl;
+  remove_particles();
+  if(particle_min_per_cell > 0) reseed_particles();
+  if(particle_sort_interval > 0 && ++steps_since_sort >= particle_sort_interval){
+    if(verbose) cout << "--> Sort particles" << endl;
+    sort_particles();
+  }
+  if(verbose) cout << "--> Advect velocity (Self-Advection)" << endl;
   advect_vel();
+  if(VELOCITY_TRANSFER::SEMI_LAGRANGIAN != velocity_transfer){
+    if(verbose) cout << "--> Particles to grid" << endl;
+    particles_to_grid();
+  }
   if(0 != external_force_locations.size()) add_force();
-  cout << "--> Solving pressure" << endl;
+  if(verbose) cout << "--> Solving pressure" << endl;
   project();
-  cout << "--> Pressure linear solver (pcg) outputs:" << endl;
-  cout << " ->  Tolerance:" << user_params.out_tolerance << endl;
-  cout << " ->  iterations:" << user_params.out_iterations << endl;
-  cout << "--> Looking for boundaries" << endl;
-  find_boundary(u, uw, inside_mask, inside_mask0);
-  find_boundary(v, vw, inside_mask, inside_mask0);
-  cout << "--> Solving boundary conditions" << endl;
+  if(verbose){
+    cout << "--> Pressure linear solver (pcg) outputs:" << endl;
+    cout << " ->  Tolerance:" << user_params.out_tolerance << endl;
+    cout << " ->  iterations:" << user_params.out_iterations << endl;
+    cout << "--> Looking for boundaries" << endl;
+  }
+  extrapolate_vel(u, uw, u_extrapolation);
+  extrapolate_vel(v, vw, v_extrapolation);
+  if(verbose) cout << "--> Solving boundary conditions" << endl;
   correct_vel();
+  if(VELOCITY_TRANSFER::SEMI_LAGRANGIAN != velocity_transfer){
+    if(verbose) cout << "--> Grid to particles" << endl;
+    grid_to_particles();
+  }
 
 }
 
@@ -147,9 +249,16 @@ EulerGAS2D::close(){
   t.clear(); t0.clear();
   omega.clear(); omega0.clear();
   inside_mask.clear(); inside_mask0.clear();
-  nodal_solid_phi.clear();
+  nodal_solid_phi.clear(); static_solid_phi.clear();
+  colliders.clear(); dirty_boxes.clear();
+  u_extrapolation = Extrapolation(); v_extrapolation = Extrapolation();
+  u_extrapolation.epoch = v_extrapolation.epoch = 0;
   user_params.clear();
   particles_container.clear();
+  particle_cells.clear(); particle_cell_start.clear();
+  particle_cell_count.clear(); particle_keep.clear();
+  u_old.clear(); v_old.clear(); u_mass.clear(); v_mass.clear();
+  emitters.clear(); emitter_carry.clear();
   source_locations.clear();
 }
 
@@ -164,6 +273,7 @@ EulerGAS2D::set_source_location(int i, int j){
 // Overload from SIM_Base.h -> class Euler_Fluid2D_Base
 void
 EulerGAS2D::add_source(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "add_source");
   for(std::vector<VFXEpoch::Vector2Di>::iterator ite = source_locations.begin(); ite != source_locations.end(); ite++){
     assert(ite->m_x >= 0 && ite->m_x < d.getDimY() && ite->m_y >= 0 && ite->m_y < d.getDimX());
     d(ite->m_x, ite->m_y) = user_params.density_source;
@@ -189,6 +299,7 @@ EulerGAS2D::set_external_force_location(VFXEpoch::VECTOR_COMPONENTS component, i
 // Protected
 void
 EulerGAS2D::add_force(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "add_force");
   // In this function, we use the the last compoenent of a 3D vector to specify adding the source
   // to u component or v compoenent
   for(std::vector<VFXEpoch::Vector3Di>::iterator ite = external_force_locations.begin(); ite != external_force_locations.end(); ite++){
@@ -209,6 +320,145 @@ EulerGAS2D::add_force(){
   }
 }
 
+// Protected
+// Turns the transform changes of the last step into collider velocities and
+// rebuilds the solid phi of the nodes that a collider left or entered
+void
+EulerGAS2D::update_colliders(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "update_colliders");
+  float h = user_params.h;
+  float dt = user_params.dt;
+  int rows = nodal_solid_phi.getDimY(), cols = nodal_solid_phi.getDimX();
+  for(size_t c = 0; c != colliders.size(); c++){
+    Collider& collider = colliders[c];
+    if(!collider.placed) continue;
+    collider.velocity = (collider.position - collider.previous_position) / dt;
+    // Angles set by the user may jump by whole turns, take the shortest
+    // rotation in (-pi, pi]
+    float turn = 2.0f * (float)UTL_PI;
+    float rotation = std::fmod(collider.angle - collider.previous_angle, turn);
+    if(rotation > 0.5f * turn) rotation -= turn;
+    else if(rotation <= -0.5f * turn) rotation += turn;
+    collider.angular_velocity = rotation / dt;
+    bool moved = collider.position.m_x != collider.previous_position.m_x ||
+                 collider.position.m_y != collider.previous_position.m_y ||
+                 collider.angle != collider.previous_angle;
+    collider.previous_position = collider.position;
+    collider.previous_angle = collider.angle;
+    if(!moved && collider.node_i1 >= collider.node_i0) continue;
+
+    // Nodes under the transformed sdf box, one more node around it so the
+    // faces that leave the collider see a positive phi
+    float cosine = std::cos(collider.angle), sine = std::sin(collider.angle);
+    float extent_x = (collider.sdf.getDimX() - 1) * collider.sdf_h;
+    float extent_y = (collider.sdf.getDimY() - 1) * collider.sdf_h;
+    float min_x = FLT_MAX, max_x = -FLT_MAX, min_y = FLT_MAX, max_y = -FLT_MAX;
+    for(int corner = 0; corner != 4; corner++){
+      float local_x = collider.sdf_origin.m_x + (corner & 1 ? extent_x : 0.0f);
+      float local_y = collider.sdf_origin.m_y + (corner & 2 ? extent_y : 0.0f);
+      float x = collider.position.m_x + cosine * local_x - sine * local_y - user_params.origin.m_x;
+      float y = collider.position.m_y + sine * local_x + cosine * local_y - user_params.origin.m_y;
+      min_x = std::min(min_x, x); max_x = std::max(max_x, x);
+      min_y = std::min(min_y, y); max_y = std::max(max_y, y);
+    }
+    int i0 = std::max(0, (int)std::floor(min_y / h) - 1), i1 = std::min(rows - 1, (int)std::ceil(max_y / h) + 1);
+    int j0 = std::max(0, (int)std::floor(min_x / h) - 1), j1 = std::min(cols - 1, (int)std::ceil(max_x / h) + 1);
+    // The nodes it left and the nodes it covers now, one box when they overlap
+    bool overlap = collider.node_i0 <= i1 && i0 <= collider.node_i1 &&
+                   collider.node_j0 <= j1 && j0 <= collider.node_j1;
+    if(overlap){
+      mark_dirty_nodes(std::min(i0, collider.node_i0), std::max(i1, collider.node_i1),
+                       std::min(j0, collider.node_j0), std::max(j1, collider.node_j1));
+    } else {
+      mark_dirty_nodes(collider.node_i0, collider.node_i1, collider.node_j0, collider.node_j1);
+      mark_dirty_nodes(i0, i1, j0, j1);
+    }
+    collider.node_i0 = i0; collider.node_i1 = i1;
+    collider.node_j0 = j0; collider.node_j1 = j1;
+  }
+
+  // Outside of every collider box the colliders only add a positive distance,
+  // the sign of the solid phi and so the face weights are those of the
+  // static solids there
+  for(size_t b = 0; b != dirty_boxes.size(); b++){
+    NodeBox box = dirty_boxes[b];
+    VFXEpoch::Parallel::ParallelFor(box.i0, box.i1 + 1, [&](int begin, int end){
+      for(int i = begin; i != end; i++){
+        for(int j = box.j0; j <= box.j1; j++){
+          float phi = static_solid_phi(i, j);
+          VFXEpoch::Vector2Df pos(j * h + user_params.origin.m_x, i * h + user_params.origin.m_y);
+          for(size_t c = 0; c != colliders.size(); c++){
+            const Collider& collider = colliders[c];
+            if(i < collider.node_i0 || i > collider.node_i1 || j < collider.node_j0 || j > collider.node_j1) continue;
+            phi = std::min(phi, get_collider_phi((int)c, pos));
+          }
+          nodal_solid_phi(i, j) = phi;
+        }
+      }
+    });
+  }
+}
+
+// Protected
+// Signed distance of a collider at a world position. Outside of the cached
+// sdf the distance to the sdf box is added to the nearest sample
+float
+EulerGAS2D::get_collider_phi(int collider, const Vector2Df& world_pos){
+  const Collider& c = colliders[collider];
+  float cosine = std::cos(c.angle), sine = std::sin(c.angle);
+  float dx = world_pos.m_x - c.position.m_x, dy = world_pos.m_y - c.position.m_y;
+  float x = (cosine * dx + sine * dy - c.sdf_origin.m_x) / c.sdf_h;
+  float y = (-sine * dx + cosine * dy - c.sdf_origin.m_y) / c.sdf_h;
+  float max_x = (float)(c.sdf.getDimX() - 1), max_y = (float)(c.sdf.getDimY() - 1);
+  float clamped_x = std::max(0.0f, std::min(max_x, x));
+  float clamped_y = std::max(0.0f, std::min(max_y, y));
+  int j = std::min((int)clamped_x, c.sdf.getDimX() - 2);
+  int i = std::min((int)clamped_y, c.sdf.getDimY() - 2);
+  float fx = clamped_x - j, fy = clamped_y - i;
+  float phi = (1.0f - fy) * ((1.0f - fx) * c.sdf(i, j) + fx * c.sdf(i, j + 1)) +
+              fy * ((1.0f - fx) * c.sdf(i + 1, j) + fx * c.sdf(i + 1, j + 1));
+  float outside = std::sqrt((x - clamped_x) * (x - clamped_x) + (y - clamped_y) * (y - clamped_y));
+  return phi + outside * c.sdf_h;
+}
+
+// Protected
+// Velocity of the solid at a position in grid space, the collider with the
+// smallest phi wins over the static solids unless they are deeper
+Vector2Df
+EulerGAS2D::get_solid_vel(const Vector2Df& pos){
+  VFXEpoch::Vector2Df vel(0.0f, 0.0f);
+  if(colliders.empty()) return vel;
+  VFXEpoch::Vector2Df world_pos = pos + user_params.origin;
+  int nearest = -1;
+  float nearest_phi = VFXEpoch::InterpolateGrid(pos / (float)user_params.h, static_solid_phi);
+  for(size_t c = 0; c != colliders.size(); c++){
+    if(!colliders[c].placed) continue;
+    float phi = get_collider_phi((int)c, world_pos);
+    if(phi < nearest_phi){
+      nearest_phi = phi;
+      nearest = (int)c;
+    }
+  }
+  if(nearest < 0) return vel;
+  const Collider& c = colliders[nearest];
+  VFXEpoch::Vector2Df r = world_pos - c.position;
+  vel.m_x = c.velocity.m_x - c.angular_velocity * r.m_y;
+  vel.m_y = c.velocity.m_y + c.angular_velocity * r.m_x;
+  return vel;
+}
+
+// Protected
+// Nodes whose solid phi changed, clamped to the nodal grid. An empty range is
+// ignored
+void
+EulerGAS2D::mark_dirty_nodes(int i0, int i1, int j0, int j1){
+  NodeBox box;
+  box.i0 = std::max(0, i0); box.i1 = std::min(nodal_solid_phi.getDimY() - 1, i1);
+  box.j0 = std::max(0, j0); box.j1 = std::min(nodal_solid_phi.getDimX() - 1, j1);
+  if(box.i1 < box.i0 || box.j1 < box.j0) return;
+  dirty_boxes.push_back(box);
+}
+
 // Public
 void
 EulerGAS2D::add_particles(VFXEpoch::Particle2Df p){
@@ -244,15 +494,224 @@ EulerGAS2D::set_domain_boundary(const VFXEpoch::BOUNDARY boundary_type, const VF
 void
 EulerGAS2D::set_static_boundary(float (*phi)(const VFXEpoch::Vector2Df&)){
   LOOP_GRID2D(nodal_solid_phi){
-    VFXEpoch::Vector2Df position(i * user_params.h, j * user_params.h);
-    nodal_solid_phi(i, j) = phi(position + user_params.origin);
+    // i is the row (y), j the column (x), same as the sampling in advect_particles
+    VFXEpoch::Vector2Df position(j * user_params.h, i * user_params.h);
+    static_solid_phi(i, j) = phi(position + user_params.origin);
+  }
+  nodal_solid_phi = static_solid_phi;
+  mark_dirty_nodes(0, nodal_solid_phi.getDimY() - 1, 0, nodal_solid_phi.getDimX() - 1);
+}
+
+// Public
+// Nodal solid signed distance sampled by the caller, (m_x + 1) x (m_y + 1)
+void
+EulerGAS2D::set_static_boundary(const Grid2DfScalarField& phi){
+  assert(phi.getDimX() == nodal_solid_phi.getDimX() && phi.getDimY() == nodal_solid_phi.getDimY());
+  static_solid_phi = phi;
+  nodal_solid_phi = static_solid_phi;
+  mark_dirty_nodes(0, nodal_solid_phi.getDimY() - 1, 0, nodal_solid_phi.getDimX() - 1);
+}
+
+// Public
+void
+EulerGAS2D::set_static_boundary(const Grid2DiScalarField& occupancy){
+  assert(occupancy.getDimX() == nodal_solid_phi.getDimX() && occupancy.getDimY() == nodal_solid_phi.getDimY());
+  VFXEpoch::DistanceField::FromOccupancy(static_solid_phi, occupancy, user_params.h);
+  nodal_solid_phi = static_solid_phi;
+  mark_dirty_nodes(0, nodal_solid_phi.getDimY() - 1, 0, nodal_solid_phi.getDimX() - 1);
+}
+
+// Public
+void
+EulerGAS2D::set_static_boundary(const VFXEpoch::PolylineBVH& obstacle){
+  VFXEpoch::DistanceField::FromPolyline(static_solid_phi, obstacle, user_params.origin, user_params.h);
+  nodal_solid_phi = static_solid_phi;
+  mark_dirty_nodes(0, nodal_solid_phi.getDimY() - 1, 0, nodal_solid_phi.getDimX() - 1);
+}
+
+// Public
+int
+EulerGAS2D::add_collider(const Grid2DfScalarField& sdf, VFXEpoch::Vector2Df sdf_origin, float sdf_h){
+  assert(sdf.getDimX() > 1 && sdf.getDimY() > 1 && sdf_h > 0.0f);
+  Collider collider;
+  collider.sdf = sdf;
+  collider.sdf_origin = sdf_origin;
+  collider.sdf_h = sdf_h;
+  collider.position = collider.previous_position = VFXEpoch::Vector2Df(0.0f, 0.0f);
+  collider.angle = collider.previous_angle = 0.0f;
+  collider.velocity = VFXEpoch::Vector2Df(0.0f, 0.0f);
+  collider.angular_velocity = 0.0f;
+  collider.placed = false;
+  collider.node_i0 = collider.node_j0 = 0;
+  collider.node_i1 = collider.node_j1 = -1;
+  colliders.push_back(collider);
+  return (int)colliders.size() - 1;
+}
+
+// Public
+// The first transform of a collider places it without giving it a velocity
+void
+EulerGAS2D::set_collider_transform(int collider, VFXEpoch::Vector2Df position, float angle){
+  assert(collider >= 0 && collider < (int)colliders.size());
+  Collider& c = colliders[collider];
+  c.position = position;
+  c.angle = angle;
+  if(!c.placed){
+    c.previous_position = position;
+    c.previous_angle = angle;
+    c.placed = true;
+  }
+}
+
+// Public
+void
+EulerGAS2D::set_collider_sdf(int collider, const Grid2DfScalarField& sdf, VFXEpoch::Vector2Df sdf_origin, float sdf_h){
+  assert(collider >= 0 && collider < (int)colliders.size());
+  assert(sdf.getDimX() > 1 && sdf.getDimY() > 1 && sdf_h > 0.0f);
+  Collider& c = colliders[collider];
+  c.sdf = sdf;
+  c.sdf_origin = sdf_origin;
+  c.sdf_h = sdf_h;
+  // The nodes it covered are rebuilt now, the new box on the next step
+  mark_dirty_nodes(c.node_i0, c.node_i1, c.node_j0, c.node_j1);
+  c.node_i0 = c.node_j0 = 0;
+  c.node_i1 = c.node_j1 = -1;
+}
+
+// Public
+void
+EulerGAS2D::clear_colliders(){
+  for(size_t c = 0; c != colliders.size(); c++){
+    mark_dirty_nodes(colliders[c].node_i0, colliders[c].node_i1, colliders[c].node_j0, colliders[c].node_j1);
   }
+  colliders.clear();
+}
+
+// Public
+// Turns the per stage progress messages of step() on or off
+void
+EulerGAS2D::set_verbose(bool _verbose){
+  verbose = _verbose;
 }
 
 // Public
 vector<VFXEpoch::Particle2Df> 
 EulerGAS2D::get_particles(){
-  return particles_container;
+  vector<VFXEpoch::Particle2Df> particles;
+  particles_container.copyTo(particles);
+  return particles;
+}
+
+// Public
+VFXEpoch::ParticleView2Df
+EulerGAS2D::get_particle_view() const {
+  return particles_container.view();
+}
+
+// Public
+void
+EulerGAS2D::set_particle_sort_interval(int interval){
+  particle_sort_interval = interval;
+  steps_since_sort = 0;
+}
+
+// Public
+// Counting sort by the density cell the particle is in, particles outside the
+// grid go to the nearest border cell. Keeps the particles of a cell together
+// so that the interpolation in advect_particles() walks the grid in order
+void
+EulerGAS2D::sort_particles(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "sort_particles");
+  int nx = d.getDimX(), ny = d.getDimY();
+  int n = particles_container.size();
+  if(0 == nx * ny) return;
+  float inv_h = 1.0f / user_params.h;
+  particle_cells.resize(n);
+  VFXEpoch::Parallel::ParallelFor(0, n, [this, nx, ny, inv_h](int begin, int end){
+    const float* x = &particles_container.pos_x[0];
+    const float* y = &particles_container.pos_y[0];
+    for(int p = begin; p != end; p++){
+      int j = (int)(x[p] * inv_h), i = (int)(y[p] * inv_h);
+      j = j < 0 ? 0 : (j >= nx ? nx - 1 : j);
+      i = i < 0 ? 0 : (i >= ny ? ny - 1 : i);
+      particle_cells[p] = i * nx + j;
+    }
+  });
+  particles_container.sortByKey(particle_cells, nx * ny, particle_cell_start);
+  steps_since_sort = 0;
+}
+
+// Public
+const vector<int>&
+EulerGAS2D::get_particle_cell_start() const {
+  return particle_cell_start;
+}
+
+// Public
+int
+EulerGAS2D::add_emitter(const Emitter& emitter){
+  Emitter e = emitter;
+  if(e.phi){
+    for(int i = 0; i != d.getDimY(); i++){
+      for(int j = 0; j != d.getDimX(); j++){
+        VFXEpoch::Vector2Df position((j+0.5f) * user_params.h, (i+0.5f) * user_params.h);
+        if(e.phi(position + user_params.origin) < 0.0f) e.cells.push_back(VFXEpoch::Vector2Di(i, j));
+      }
+    }
+  }
+  for(size_t c = 0; c != e.cells.size(); c++)
+    assert(e.cells[c].m_x >= 0 && e.cells[c].m_x < d.getDimY() && e.cells[c].m_y >= 0 && e.cells[c].m_y < d.getDimX());
+  emitters.push_back(e);
+  emitter_carry.push_back(0.0f);
+  return (int)emitters.size() - 1;
+}
+
+// Public
+void
+EulerGAS2D::clear_emitters(){
+  emitters.clear();
+  emitter_carry.clear();
+}
+
+// Public
+void
+EulerGAS2D::set_dead_particle_removal(bool remove){
+  remove_dead_particles = remove;
+}
+
+// Public
+void
+EulerGAS2D::set_particle_budget(int min_per_cell, int max_per_cell, float min_density, VFXEpoch::Vector3Df color){
+  particle_min_per_cell = min_per_cell;
+  particle_max_per_cell = max_per_cell;
+  particle_min_density = min_density;
+  particle_reseed_color = color;
+}
+
+// Public
+void
+EulerGAS2D::set_velocity_transfer(VELOCITY_TRANSFER mode, float ratio){
+  velocity_transfer = mode;
+  flip_ratio = ratio;
+}
+
+// Public
+void
+EulerGAS2D::set_extrapolation_layers(int layers){
+  assert(layers >= 0);
+  extrapolation_layers = layers;
+}
+
+// Public
+void
+EulerGAS2D::set_mixed_precision_pressure(bool enable){
+  mixed_precision_pressure = enable;
+}
+
+// Public
+void
+EulerGAS2D::set_fast_poisson_preconditioner(bool enable){
+  fast_poisson_preconditioner = enable;
 }
 
 // Public
@@ -272,6 +731,175 @@ EulerGAS2D::get_grid_velocity(VFXEpoch::Vector2Df pos) {
   return get_vel(pos);
 }
 
+// Public
+const Grid2DfScalarField&
+EulerGAS2D::get_density() const {
+  return d;
+}
+
+// Public
+const Grid2DfScalarField&
+EulerGAS2D::get_temperature() const {
+  return t;
+}
+
+// Public
+// Cell centred curl with a ring of ghost cells, (m_x + 2) x (m_y + 2)
+const Grid2DfScalarField&
+EulerGAS2D::get_vorticity() const {
+  return omega;
+}
+
+// Public
+// Writes the whole simulation state. The temporaries (u0, weights and the
+// pressure system) are rebuilt by the next step and are not stored
+bool
+EulerGAS2D::save_checkpoint(const std::string& filename, bool compress) const {
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "save_checkpoint");
+  VFXEpoch::IO::CheckpointWriter writer;
+  if(!writer.open(filename, "EulerGAS2D", compress ? VFXEpoch::IO::CODEC::SHUFFLE_LZ : VFXEpoch::IO::CODEC::NONE))
+    return false;
+
+  // Fixed order, append new parameters at the end and bump the version
+  double params[] = {
+    user_params.origin.m_x, user_params.origin.m_y,
+    (double)user_params.dimension.m_x, (double)user_params.dimension.m_y,
+    user_params.h, user_params.dt,
+    user_params.buoyancy_alpha, user_params.buoyancy_beta,
+    user_params.vort_conf_eps,
+    user_params.out_tolerance, user_params.min_tolerance,
+    user_params.density_source, user_params.external_force_strength,
+    user_params.diff, user_params.visc,
+    (double)user_params.max_iterations, (double)user_params.out_iterations,
+    (double)user_params.num_particles, user_params.use_gravity ? 1.0 : 0.0
+  };
+  writer.writeArray("params", params, sizeof(params), sizeof(double));
+  writer.writeArray("domain_boundaries", domain_boundaries, sizeof(domain_boundaries), sizeof(int));
+  writer.writeGrid("u", u);
+  writer.writeGrid("v", v);
+  writer.writeGrid("d", d);
+  writer.writeGrid("t", t);
+  writer.writeGrid("omega", omega);
+  writer.writeGrid("nodal_solid_phi", static_solid_phi);
+  writer.writeGrid("inside_mask", inside_mask);
+  writer.writeGrid("inside_mask0", inside_mask0);
+  // Stored in the array of structures layout the format has always used
+  vector<VFXEpoch::Particle2Df> particles;
+  particles_container.copyTo(particles);
+  writer.writeArray("particles", particles);
+  writer.writeArray("particle_ids", particles_container.id);
+  double transfer[] = {(double)(int)velocity_transfer, flip_ratio};
+  writer.writeArray("velocity_transfer", transfer, sizeof(transfer), sizeof(double));
+  const char* affine_names[4] = {"particle_affine_0", "particle_affine_1", "particle_affine_2", "particle_affine_3"};
+  for(int c = 0; c != 4; c++) writer.writeArray(affine_names[c], particles_container.affine[c]);
+  // The emitters and the budget are set up by the caller, only the counters
+  // they advance are part of the state
+  unsigned long long counters[] = {particle_epoch, (unsigned long long)steps_since_sort};
+  writer.writeArray("particle_counters", counters, sizeof(counters), sizeof(unsigned long long));
+  writer.writeArray("emitter_carry", emitter_carry);
+  writer.writeArray("sources", source_locations);
+  writer.writeArray("forces", external_force_locations);
+  return writer.close();
+}
+
+// Public
+// Replaces the current state. The solver is re-initialized from the stored
+// parameters first so that the grids match the stored resolution
+bool
+EulerGAS2D::load_checkpoint(const std::string& filename){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "load_checkpoint");
+  VFXEpoch::IO::CheckpointReader reader;
+  if(!reader.open(filename)) return false;
+  if("EulerGAS2D" != reader.solver()){
+    std::cout << "WARNING: " << filename << " was written by " << reader.solver() << ", not EulerGAS2D" << endl;
+    return false;
+  }
+
+  double params[19];
+  if(!reader.readArray("params", params, sizeof(params))) return false;
+  Parameters stored;
+  stored.origin = Vector2Df((float)params[0], (float)params[1]);
+  stored.dimension = Vector2Di((int)params[2], (int)params[3]);
+  stored.h = params[4];
+  stored.dt = params[5];
+  stored.buoyancy_alpha = params[6]; stored.buoyancy_beta = params[7];
+  stored.vort_conf_eps = params[8];
+  stored.out_tolerance = params[9]; stored.min_tolerance = params[10];
+  stored.density_source = params[11];
+  stored.external_force_strength = params[12];
+  stored.diff = params[13];
+  stored.visc = params[14];
+  stored.max_iterations = (int)params[15]; stored.out_iterations = (int)params[16];
+  stored.num_particles = (int)params[17];
+  stored.use_gravity = 0.0 != params[18];
+  init(stored);
+
+  vector<VFXEpoch::Particle2Df> particles;
+  bool ok = reader.readArray("domain_boundaries", domain_boundaries, sizeof(domain_boundaries)) &&
+            reader.readGrid("u", u) &&
+            reader.readGrid("v", v) &&
+            reader.readGrid("d", d) &&
+            reader.readGrid("t", t) &&
+            reader.readGrid("omega", omega) &&
+            reader.readGrid("nodal_solid_phi", nodal_solid_phi) &&
+            reader.readGrid("inside_mask", inside_mask) &&
+            reader.readGrid("inside_mask0", inside_mask0) &&
+            reader.readArray("particles", particles) &&
+            reader.readArray("sources", source_locations) &&
+            reader.readArray("forces", external_force_locations);
+  if(!ok){
+    std::cout << "WARNING: Checkpoint " << filename << " is incomplete, the solver state is undefined" << endl;
+    return false;
+  }
+  particles_container.assign(particles);
+  // Older checkpoints have no ids, the particles keep the ones assign() gave
+  vector<unsigned long long> ids;
+  if(reader.has("particle_ids") && reader.readArray("particle_ids", ids) && ids.size() == particles.size()){
+    particles_container.id = ids;
+    for(size_t i = 0; i != ids.size(); i++){
+      if(ids[i] >= particles_container.next_id) particles_container.next_id = ids[i] + 1;
+    }
+  }
+  // Version 2 checkpoints have no transfer chunks and keep the current mode
+  // with zero APIC gradients
+  double transfer[2];
+  if(reader.has("velocity_transfer") && reader.readArray("velocity_transfer", transfer, sizeof(transfer))){
+    velocity_transfer = (VELOCITY_TRANSFER)(int)transfer[0];
+    flip_ratio = (float)transfer[1];
+  }
+  const char* affine_names[4] = {"particle_affine_0", "particle_affine_1", "particle_affine_2", "particle_affine_3"};
+  for(int c = 0; c != 4; c++){
+    vector<float> affine;
+    if(reader.has(affine_names[c]) && reader.readArray(affine_names[c], affine) && affine.size() == particles.size())
+      particles_container.affine[c].swap(affine);
+  }
+  // Version 3 checkpoints have no counters. The carry only applies when the
+  // emitters were added before loading, in the order they had when saving
+  unsigned long long counters[2];
+  if(reader.has("particle_counters") && reader.readArray("particle_counters", counters, sizeof(counters))){
+    particle_epoch = counters[0];
+    steps_since_sort = (int)counters[1];
+  }
+  vector<float> carry;
+  if(reader.has("emitter_carry") && reader.readArray("emitter_carry", carry) && carry.size() == emitters.size())
+    emitter_carry.swap(carry);
+  u0 = u; v0 = v; d0 = d; t0 = t; omega0 = omega;
+  // Colliders are not stored, the stored solid phi becomes the static one
+  static_solid_phi = nodal_solid_phi;
+  return true;
+}
+
+// Public
+bool
+EulerGAS2D::save_volume(const std::string& filename, const VFXEpoch::IO::VolumeOptions& options) const {
+  VFXEpoch::IO::VolumeWriter writer;
+  if(!writer.open(filename)) return false;
+  bool ok = writer.writeGrid("density", d, options) &&
+            writer.writeGrid("temperature", t, options) &&
+            writer.writeGrid("vorticity", omega, options);
+  return writer.close() && ok;
+}
+
 // Protected
 void 
 EulerGAS2D::set_domain_boundary_wrapper(Grid2DfScalarField& field){
@@ -283,38 +911,56 @@ EulerGAS2D::set_domain_boundary_wrapper(Grid2DfScalarField& field){
 
 // Protected
 // TODO: Check fast linear solvercorrectness for dx, dy, dimension in vertical & horizontal
+// Over-relaxed red-black sweeps, done once the residual is under min_tolerance
+// relative to the source
 void
 EulerGAS2D::density_diffuse(Grid2DfScalarField& dest, Grid2DfScalarField ref){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "density_diffuse");
   float a = user_params.diff * user_params.dt * user_params.dimension.m_x * user_params.dimension.m_y;
-  VFXEpoch::LinearSolver::GSSolve(dest, ref, domain_boundaries, a, 1+4*a, user_params.max_iterations);
+  float omega = VFXEpoch::LinearSolver::SOROmega(dest.getDimX(), dest.getDimY(), a, 1+4*a);
+  VFXEpoch::LinearSolver::RBSORSolve(dest, ref, domain_boundaries, a, 1+4*a, omega, user_params.max_iterations, user_params.min_tolerance);
 }
 
 // Protected
 // TODO: Check fast linear solver correctness for dx, dy, dimension in vertical & horizontal
+// Over-relaxed red-black sweeps, done once the residual is under min_tolerance
+// relative to the source
 void 
 EulerGAS2D::dynamic_diffuse(Grid2DfScalarField& dest, Grid2DfScalarField ref){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "dynamic_diffuse");
   float a = user_params.visc * user_params.dt * user_params.dimension.m_x * user_params.dimension.m_y;
-  VFXEpoch::LinearSolver::GSSolve(dest, ref, domain_boundaries, a, 1+4*a, user_params.max_iterations);
+  float omega = VFXEpoch::LinearSolver::SOROmega(dest.getDimX(), dest.getDimY(), a, 1+4*a);
+  VFXEpoch::LinearSolver::RBSORSolve(dest, ref, domain_boundaries, a, 1+4*a, omega, user_params.max_iterations, user_params.min_tolerance);
 }
 
 // Protected
 // Overload from SIM_Base.h -> class Euler_Fluid2D_Base
 void
 EulerGAS2D::advect_vel(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "advect_vel");
   // Using RK2 method time integration
   // advect u component of velocity field
-  LOOP_GRID2D(u0){
-    VFXEpoch::Vector2Df pos(j * user_params.h, (i+0.5f) * user_params.h);
-    pos = trace_rk2(pos, -user_params.dt);
-    u0(i, j) = get_vel(pos).m_x;
-  }
+  // Rows are independent, u and v are only read while u0 and v0 are written
+  VFXEpoch::Parallel::ParallelFor(0, u0.getDimY(), [this](int begin, int end){
+    for(int i = begin; i != end; i++){
+      for(int j = 0; j != u0.getDimX(); j++){
+        VFXEpoch::Vector2Df pos(j * user_params.h, (i+0.5f) * user_params.h);
+        pos = trace_rk2(pos, -user_params.dt);
+        u0(i, j) = get_vel(pos).m_x;
+      }
+    }
+  });
 
   // advect v component of velocity field
-  LOOP_GRID2D(v0){
-    VFXEpoch::Vector2Df pos((j+0.5f) * user_params.h, i * user_params.h);
-    pos = trace_rk2(pos, -user_params.dt);
-    v0(i, j) = get_vel(pos).m_y;
-  }
+  VFXEpoch::Parallel::ParallelFor(0, v0.getDimY(), [this](int begin, int end){
+    for(int i = begin; i != end; i++){
+      for(int j = 0; j != v0.getDimX(); j++){
+        VFXEpoch::Vector2Df pos((j+0.5f) * user_params.h, i * user_params.h);
+        pos = trace_rk2(pos, -user_params.dt);
+        v0(i, j) = get_vel(pos).m_y;
+      }
+    }
+  });
   u = u0;
   v = v0;
 }
@@ -322,66 +968,405 @@ EulerGAS2D::advect_vel(){
 // Protected
 void 
 EulerGAS2D::advect_den(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "advect_den");
   // Using RK2 method time integration
   // advect density field
   // Brutal turning over the boundaries
   assert(d0.getDimX() == inside_mask.getDimX() && d0.getDimY() == inside_mask.getDimY());
-  LOOP_GRID2D(d0){
-      VFXEpoch::Vector2Df pos((j+0.5f) * user_params.h, (i+0.5f) * user_params.h);
-      pos = trace_rk2(pos, -user_params.dt);
-      d0(i, j) = get_den(pos);
-  }
+  VFXEpoch::Parallel::ParallelFor(0, d0.getDimY(), [this](int begin, int end){
+    for(int i = begin; i != end; i++){
+      for(int j = 0; j != d0.getDimX(); j++){
+        VFXEpoch::Vector2Df pos((j+0.5f) * user_params.h, (i+0.5f) * user_params.h);
+        pos = trace_rk2(pos, -user_params.dt);
+        d0(i, j) = get_den(pos);
+      }
+    }
+  });
   d = d0;
 }
 
 // Protected
 void
 EulerGAS2D::advect_tmp(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "advect_tmp");
   assert(t0.getDimX() == inside_mask.getDimX() && t0.getDimY() == inside_mask.getDimY());
-  LOOP_GRID2D(t0){
-      VFXEpoch::Vector2Df pos((j+0.5f) * user_params.h, (i+0.5f) * user_params.h);
-      pos = trace_rk2(pos, -user_params.dt);
-      t0(i, j) = get_tmp(pos);
-  }
+  VFXEpoch::Parallel::ParallelFor(0, t0.getDimY(), [this](int begin, int end){
+    for(int i = begin; i != end; i++){
+      for(int j = 0; j != t0.getDimX(); j++){
+        VFXEpoch::Vector2Df pos((j+0.5f) * user_params.h, (i+0.5f) * user_params.h);
+        pos = trace_rk2(pos, -user_params.dt);
+        t0(i, j) = get_tmp(pos);
+      }
+    }
+  });
   t = t0;
 }
 
 // Protected
 void
 EulerGAS2D::advect_curl(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "advect_curl");
   // Using RK2 method time integration
   // advect curl field
   assert(omega0.getDimX() == omega.getDimX() && omega0.getDimY() == omega0.getDimY());
-  LOOP_GRID2D(omega0){
-    VFXEpoch::Vector2Df pos((j+0.5f) * user_params.h, (i+0.5f) * user_params.h);
-    pos = trace_rk2(pos, -user_params.dt);
-    omega0(i, j) = get_curl(pos);
-  }
+  VFXEpoch::Parallel::ParallelFor(0, omega0.getDimY(), [this](int begin, int end){
+    for(int i = begin; i != end; i++){
+      for(int j = 0; j != omega0.getDimX(); j++){
+        VFXEpoch::Vector2Df pos((j+0.5f) * user_params.h, (i+0.5f) * user_params.h);
+        pos = trace_rk2(pos, -user_params.dt);
+        omega0(i, j) = get_curl(pos);
+      }
+    }
+  });
   omega = omega0;
 }
 
 // Protected
+// Chunks of particles run in parallel. Inside a chunk, blocks of particles go
+// through each stage together: the velocity and solid lookups of a stage are
+// one batched loop over the SoA positions instead of a call chain per
+// particle. Only the few particles that end up inside a solid take the per
+// particle projection path.
 void
 EulerGAS2D::advect_particles(){
-  std::vector<VFXEpoch::Particle2Df>::iterator ite(0);
-  for(ite = particles_container.begin(); ite != particles_container.end(); ite++){
-    ite->pos = trace_rk2(ite->pos, user_params.dt);
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "advect_particles");
+  VFXEpoch::Parallel::ParallelFor(0, particles_container.size(), [this](int begin, int end){
+    const int block = 256;
+    float mid_x[block], mid_y[block], vel_x[block], vel_y[block];
+    float scratch_x[block], scratch_y[block], phi[block];
+    float h = user_params.h;
+    float dt = user_params.dt;
+    float half_dt = 0.5f * dt;
+
+    for(int first = begin; first < end; first += block){
+      int n = end - first < block ? end - first : block;
+      float* x = &particles_container.pos_x[first];
+      float* y = &particles_container.pos_y[first];
+
+      // RK2, same arithmetic as trace_rk2
+      get_vel(x, y, n, vel_x, vel_y, scratch_x, scratch_y);
+      for(int p = 0; p != n; p++){
+        mid_x[p] = x[p] + vel_x[p] * half_dt;
+        mid_y[p] = y[p] + vel_y[p] * half_dt;
+      }
+      get_vel(mid_x, mid_y, n, vel_x, vel_y, scratch_x, scratch_y);
+      for(int p = 0; p != n; p++){
+        x[p] = x[p] + vel_x[p] * dt;
+        y[p] = y[p] + vel_y[p] * dt;
+        scratch_x[p] = x[p] / h;
+        scratch_y[p] = y[p] / h;
+      }
+
+      // Correction particles at the boundaries
+      VFXEpoch::InterpolateGrid(scratch_x, scratch_y, n, nodal_solid_phi, phi);
+      for(int p = 0; p != n; p++){
+        if(phi[p] >= 0.0f) continue;
+        VFXEpoch::Vector2Df pos(x[p], y[p]);
+        VFXEpoch::Vector2Df normal;
+        VFXEpoch::InterpolateGradient(normal, pos / h, nodal_solid_phi);
+        normal.normalize();
+        pos -= phi[p] * normal;
+        x[p] = pos.m_x;
+        y[p] = pos.m_y;
+      }
+    }
+  }, 1024);
+}
 
-    // Correction particles at the boundaries
+// Protected
+// Every cell of an emitter gets the same number of particles per step, the
+// fraction left over is carried to the next step
+void
+EulerGAS2D::emit_particles(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "emit_particles");
+  for(size_t e = 0; e != emitters.size(); e++){
+    const Emitter& emitter = emitters[e];
+    float per_cell = emitter.rate * (float)user_params.dt + emitter_carry[e];
+    int k = (int)per_cell;
+    emitter_carry[e] = per_cell - k;
+    if(0 == k || emitter.cells.empty()) continue;
+
+    int first = particles_container.size();
+    particles_container.resize(first + k * (int)emitter.cells.size());
+    VFXEpoch::Parallel::ParallelFor(0, (int)emitter.cells.size(), [this, &emitter, first, k](int begin, int end){
+      float h = user_params.h;
+      for(int c = begin; c != end; c++){
+        for(int q = 0; q != k; q++){
+          int p = first + c * k + q;
+          unsigned long long id = particles_container.id[p];
+          particles_container.pos_x[p] = (emitter.cells[c].m_y + particle_random(id, 0)) * h;
+          particles_container.pos_y[p] = (emitter.cells[c].m_x + particle_random(id, 1)) * h;
+          particles_container.vel_x[p] = emitter.vel.m_x;
+          particles_container.vel_y[p] = emitter.vel.m_y;
+          particles_container.color[0][p] = emitter.color.m_x;
+          particles_container.color[1][p] = emitter.color.m_y;
+          particles_container.color[2][p] = emitter.color.m_z;
+        }
+      }
+    });
+  }
+  particle_cell_start.clear();
+}
+
+// Protected
+// Drops particles outside the domain or inside solids when removal is on. With
+// a maximum budget the particles of a crowded cell survive with probability
+// max / count, drawn from the id and a per step epoch so the result does not
+// depend on threads
+void
+EulerGAS2D::remove_particles(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "remove_particles");
+  int n = particles_container.size();
+  int nx = d.getDimX(), ny = d.getDimY();
+  bool budget = particle_min_per_cell > 0 || particle_max_per_cell > 0;
+  if(0 == nx * ny || (!budget && !remove_dead_particles)) return;
+  if(0 == n){
+    if(budget) particle_cell_count.assign(nx * ny, 0);
+    return;
+  }
+
+  // Cell of every live particle, -1 for the dead ones
+  particle_cells.resize(n);
+  particle_keep.resize(n);
+  VFXEpoch::Parallel::ParallelFor(0, n, [this, nx, ny](int begin, int end){
+    const int block = 256;
+    float scratch_x[block], scratch_y[block], phi[block];
     float h = user_params.h;
-    float corrections = VFXEpoch::InterpolateGrid(ite->pos / h, nodal_solid_phi);
-    if(corrections < 0.0f){
-      VFXEpoch::Vector2Df normal;
-      VFXEpoch::InterpolateGradient(normal, ite->pos / h, nodal_solid_phi);
-      normal.normalize();
-      ite->pos -= corrections * normal;
+    for(int first = begin; first < end; first += block){
+      int count = end - first < block ? end - first : block;
+      const float* x = &particles_container.pos_x[first];
+      const float* y = &particles_container.pos_y[first];
+      for(int p = 0; p != count; p++){
+        scratch_x[p] = x[p] / h;
+        scratch_y[p] = y[p] / h;
+      }
+      VFXEpoch::InterpolateGrid(scratch_x, scratch_y, count, nodal_solid_phi, phi);
+      for(int p = 0; p != count; p++){
+        bool inside = scratch_x[p] >= 0.0f && scratch_x[p] < nx && scratch_y[p] >= 0.0f && scratch_y[p] < ny;
+        bool alive = inside && phi[p] >= 0.0f;
+        particle_cells[first + p] = alive ? (int)scratch_y[p] * nx + (int)scratch_x[p] : -1;
+        particle_keep[first + p] = alive || !remove_dead_particles ? 1 : 0;
+      }
+    }
+  }, 1024);
+
+  if(budget) VFXEpoch::CountKeys(particle_cells, nx * ny, particle_cell_count);
+  if(particle_max_per_cell > 0){
+    float max_per_cell = (float)particle_max_per_cell;
+    unsigned long long epoch = particle_epoch;
+    VFXEpoch::Parallel::ParallelFor(0, n, [this, max_per_cell, epoch](int begin, int end){
+      for(int p = begin; p != end; p++){
+        if(!particle_keep[p] || particle_cells[p] < 0) continue;
+        int count = particle_cell_count[particle_cells[p]];
+        if(count <= max_per_cell) continue;
+        if(particle_random(particles_container.id[p], epoch + 2) * count >= max_per_cell) particle_keep[p] = 0;
+      }
+    });
+  }
+  particle_epoch++;
+
+  if(particles_container.compact(particle_keep) != n) particle_cell_start.clear();
+}
+
+// Protected
+// Tops up cells that have smoke but too few particles, the new particles take
+// the grid velocity. Uses the per cell counts of remove_particles()
+void
+EulerGAS2D::reseed_particles(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "reseed_particles");
+  int nx = d.getDimX(), ny = d.getDimY();
+  if(0 == nx * ny) return;
+  if((int)particle_cell_count.size() != nx * ny) particle_cell_count.assign(nx * ny, 0);
+
+  // Offsets of the new particles of every cell, the counts become deficits
+  int first = particles_container.size();
+  int total = 0;
+  for(int i = 0; i != ny; i++){
+    for(int j = 0; j != nx; j++){
+      int& count = particle_cell_count[i * nx + j];
+      int deficit = 0;
+      if(count < particle_min_per_cell && d(i, j) > particle_min_density &&
+         VFXEpoch::InterpolateGrid(j + 0.5f, i + 0.5f, nodal_solid_phi) >= 0.0f)
+        deficit = particle_min_per_cell - count;
+      count = total;
+      total += deficit;
+    }
+  }
+  if(0 == total) return;
+
+  particles_container.resize(first + total);
+  VFXEpoch::Parallel::ParallelFor(0, ny, [this, nx, ny, first, total](int begin, int end){
+    float h = user_params.h;
+    for(int i = begin; i != end; i++){
+      for(int j = 0; j != nx; j++){
+        int c = i * nx + j;
+        int last = c + 1 < nx * ny ? particle_cell_count[c + 1] : total;
+        for(int p = first + particle_cell_count[c]; p != first + last; p++){
+          unsigned long long id = particles_container.id[p];
+          VFXEpoch::Vector2Df pos((j + particle_random(id, 0)) * h, (i + particle_random(id, 1)) * h);
+          VFXEpoch::Vector2Df vel = get_vel(pos);
+          particles_container.pos_x[p] = pos.m_x;
+          particles_container.pos_y[p] = pos.m_y;
+          particles_container.vel_x[p] = vel.m_x;
+          particles_container.vel_y[p] = vel.m_y;
+          particles_container.color[0][p] = particle_reseed_color.m_x;
+          particles_container.color[1][p] = particle_reseed_color.m_y;
+          particles_container.color[2][p] = particle_reseed_color.m_z;
+        }
+      }
+    }
+  });
+  particle_cell_start.clear();
+}
+
+// Accumulates the bilinear weights of a sample at (x, y), in grid index space,
+// onto the face grid. c is the APIC gradient of the sample per cell
+static void
+splat(Grid2DfScalarField& sum, Grid2DfScalarField& mass, float x, float y, float value, float cx, float cy){
+  int nx = sum.getDimX(), ny = sum.getDimY();
+  int j = (int)floorf(x), i = (int)floorf(y);
+  float fx = x - j, fy = y - i;
+  for(int di = 0; di != 2; di++){
+    int r = i + di;
+    if(r < 0 || r >= ny) continue;
+    float wy = di ? fy : 1.0f - fy;
+    for(int dj = 0; dj != 2; dj++){
+      int c = j + dj;
+      if(c < 0 || c >= nx) continue;
+      float w = wy * (dj ? fx : 1.0f - fx);
+      sum.data[r * nx + c] += w * (value + cx * (dj - fx) + cy * (di - fy));
+      mass.data[r * nx + c] += w;
     }
   }
 }
 
+// Protected
+// Splats the particle velocities onto the faces. Particles are sorted by cell
+// first; a block of cell rows only writes the face rows next to it, so blocks
+// two apart never touch the same face and every other block runs in parallel.
+// The sum per face does not depend on the number of threads
+void
+EulerGAS2D::particles_to_grid(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "particles_to_grid");
+  if(u_old.getDimX() != u.getDimX() || u_old.getDimY() != u.getDimY()){
+    u_old.Reset(u.getDimX(), u.getDimY(), user_params.h, user_params.h); u_mass = u_old;
+  }
+  if(v_old.getDimX() != v.getDimX() || v_old.getDimY() != v.getDimY()){
+    v_old.Reset(v.getDimX(), v.getDimY(), user_params.h, user_params.h); v_mass = v_old;
+  }
+  std::fill(u_old.data.begin(), u_old.data.end(), 0.0f); std::fill(u_mass.data.begin(), u_mass.data.end(), 0.0f);
+  std::fill(v_old.data.begin(), v_old.data.end(), 0.0f); std::fill(v_mass.data.begin(), v_mass.data.end(), 0.0f);
+  sort_particles();
+
+  int nx = d.getDimX(), ny = d.getDimY();
+  const int rows = 4;
+  int blocks = (ny + rows - 1) / rows;
+  bool apic = VELOCITY_TRANSFER::APIC == velocity_transfer;
+  for(int colour = 0; colour != 2; colour++){
+    VFXEpoch::Parallel::ParallelFor(0, (blocks + 1 - colour) / 2, [this, nx, ny, rows, colour, apic](int begin, int end){
+      float h = user_params.h;
+      for(int b = begin; b != end; b++){
+        int block = 2 * b + colour;
+        int first = particle_cell_start[block * rows * nx];
+        int last = particle_cell_start[std::min((block + 1) * rows, ny) * nx];
+        for(int p = first; p != last; p++){
+          float x = particles_container.pos_x[p] / h, y = particles_container.pos_y[p] / h;
+          if(!(x >= 0.0f && x < nx && y >= 0.0f && y < ny)) continue;
+          splat(u_old, u_mass, x, y - 0.5f, particles_container.vel_x[p],
+                apic ? particles_container.affine[0][p] : 0.0f, apic ? particles_container.affine[1][p] : 0.0f);
+          splat(v_old, v_mass, x - 0.5f, y, particles_container.vel_y[p],
+                apic ? particles_container.affine[2][p] : 0.0f, apic ? particles_container.affine[3][p] : 0.0f);
+        }
+      }
+    }, 1);
+  }
+
+  // Faces covered by less than one particle weight fall back to the
+  // semi-Lagrangian velocity. u_old keeps the result for FLIP
+  VFXEpoch::Parallel::ParallelFor(0, (int)u.data.size(), [this](int begin, int end){
+    for(int f = begin; f != end; f++){
+      float m = u_mass.data[f];
+      float rest = m < 1.0f ? 1.0f - m : 0.0f;
+      u.data[f] = (u_old.data[f] + rest * u.data[f]) / (m + rest);
+      u_old.data[f] = u.data[f];
+    }
+  });
+  VFXEpoch::Parallel::ParallelFor(0, (int)v.data.size(), [this](int begin, int end){
+    for(int f = begin; f != end; f++){
+      float m = v_mass.data[f];
+      float rest = m < 1.0f ? 1.0f - m : 0.0f;
+      v.data[f] = (v_old.data[f] + rest * v.data[f]) / (m + rest);
+      v_old.data[f] = v.data[f];
+    }
+  });
+}
+
+// Protected
+// Takes the grid velocity after forces and projection back to the particles
+void
+EulerGAS2D::grid_to_particles(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "grid_to_particles");
+  // u_old and v_old become the change of the grid velocity over the step
+  VFXEpoch::Parallel::ParallelFor(0, (int)u.data.size(), [this](int begin, int end){
+    for(int f = begin; f != end; f++) u_old.data[f] = u.data[f] - u_old.data[f];
+  });
+  VFXEpoch::Parallel::ParallelFor(0, (int)v.data.size(), [this](int begin, int end){
+    for(int f = begin; f != end; f++) v_old.data[f] = v.data[f] - v_old.data[f];
+  });
+
+  VFXEpoch::Parallel::ParallelFor(0, particles_container.size(), [this](int begin, int end){
+    const int block = 256;
+    float pic_x[block], pic_y[block], delta_x[block], delta_y[block];
+    float scratch_x[block], scratch_y[block], value[block];
+    float h = user_params.h;
+    float ratio = flip_ratio;
+    for(int first = begin; first < end; first += block){
+      int n = end - first < block ? end - first : block;
+      const float* x = &particles_container.pos_x[first];
+      const float* y = &particles_container.pos_y[first];
+      float* vel_x = &particles_container.vel_x[first];
+      float* vel_y = &particles_container.vel_y[first];
+      get_vel(x, y, n, pic_x, pic_y, scratch_x, scratch_y);
+
+      switch(velocity_transfer){
+      case VELOCITY_TRANSFER::FLIP:
+        for(int p = 0; p != n; p++){ scratch_x[p] = x[p] / h; scratch_y[p] = y[p] / h - 0.5f; }
+        VFXEpoch::InterpolateGrid(scratch_x, scratch_y, n, u_old, delta_x);
+        for(int p = 0; p != n; p++){ scratch_x[p] = x[p] / h - 0.5f; scratch_y[p] = y[p] / h; }
+        VFXEpoch::InterpolateGrid(scratch_x, scratch_y, n, v_old, delta_y);
+        for(int p = 0; p != n; p++){
+          vel_x[p] = ratio * (vel_x[p] + delta_x[p]) + (1.0f - ratio) * pic_x[p];
+          vel_y[p] = ratio * (vel_y[p] + delta_y[p]) + (1.0f - ratio) * pic_y[p];
+        }
+        break;
+      case VELOCITY_TRANSFER::APIC:
+        for(int p = 0; p != n; p++){ scratch_x[p] = x[p] / h; scratch_y[p] = y[p] / h - 0.5f; }
+        VFXEpoch::InterpolateGradient(scratch_x, scratch_y, n, u, &particles_container.affine[0][first],
+                                      &particles_container.affine[1][first], value);
+        for(int p = 0; p != n; p++){ scratch_x[p] = x[p] / h - 0.5f; scratch_y[p] = y[p] / h; }
+        VFXEpoch::InterpolateGradient(scratch_x, scratch_y, n, v, &particles_container.affine[2][first],
+                                      &particles_container.affine[3][first], value);
+        // The velocity itself is the PIC one
+        for(int p = 0; p != n; p++){
+          vel_x[p] = pic_x[p];
+          vel_y[p] = pic_y[p];
+        }
+        break;
+      default:
+        for(int p = 0; p != n; p++){
+          vel_x[p] = pic_x[p];
+          vel_y[p] = pic_y[p];
+        }
+        break;
+      }
+    }
+  }, 1024);
+}
+
 // Protected
 void
 EulerGAS2D::project(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "project");
   pressure_solve();
   apply_gradients();
 }
@@ -389,6 +1374,7 @@ EulerGAS2D::project(){
 // Protected
 void
 EulerGAS2D::apply_buoyancy(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "apply_buoyancy");
   // Dimension check
   assert(v0.getDimX() == v.getDimX() && v0.getDimY() == v.getDimY());
 
@@ -417,27 +1403,84 @@ EulerGAS2D::trace_rk2(const Vector2Df& pos, float dt){
 // Overload from SIM_Base.h -> class Euler_Fluid2D_Base
 void
 EulerGAS2D::pressure_solve(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "pressure_solve");
   // System size check and resize;
   int system_size = user_params.dimension.m_x * user_params.dimension.m_y;
   if(pressure_solver_params.pressure.size() != system_size){
     pressure_solver_params.rhs.resize(system_size);
     pressure_solver_params.pressure.resize(system_size);
     pressure_solver_params.sparse_matrix.resize(system_size);
+    pressure_solver_params.fast_poisson.clear();
+    mark_dirty_nodes(0, nodal_solid_phi.getDimY() - 1, 0, nodal_solid_phi.getDimX() - 1);
   }
 
   VFXEpoch::Grid2DdScalarField div(user_params.dimension.m_x, user_params.dimension.m_y, user_params.h, user_params.h);
+  // Weights and matrix rows only change where the solid phi did
   get_grid_weights();
   VFXEpoch::Analysis::computeDivergence_with_weights_mac(div, user_params.h, u, v, uw, vw);
   pressure_solver_params.rhs = div.toVector();
+  if(0 != colliders.size()) add_solid_divergence();
   setup_pressure_coef_matrix();
+  dirty_boxes.clear();
+
+  // Same coefficient as the matrix rows
+  float dx = user_params.h;
+  float dt = user_params.dt;
+  double a = dt / std::pow(dx, 2.0f);
+  VFXEpoch::BndConditionPerEdge edges[4];
+  bool laplacian = get_pressure_edges(edges);
+  VFXEpoch::FastPoissonSolver& fast_poisson = pressure_solver_params.fast_poisson;
+  if(laplacian || fast_poisson_preconditioner){
+    fast_poisson.setup(user_params.dimension.m_x, user_params.dimension.m_y, edges);
+  }
+  if(laplacian && fast_poisson.ready()){
+    // Every row is the 5 point Laplacian, solved directly
+    fast_poisson.solve(pressure_solver_params.rhs, pressure_solver_params.pressure, a, 4 * a);
+    user_params.out_iterations = 0;
+    user_params.out_tolerance = 0.0;
+    return;
+  }
+  if(fast_poisson_preconditioner && fast_poisson.ready()){
+    // Cells inside solids have empty rows and keep zero pressure, as with MIC(0)
+    std::vector<unsigned char>& active = pressure_solver_params.active_rows;
+    active.resize(system_size);
+    for(int i = 0; i != system_size; i++){
+      active[i] = 0.0 != pressure_solver_params.sparse_matrix(i, i);
+    }
+    pressure_solver_params.pcg_solver.set_preconditioner([&fast_poisson, &active, a](const std::vector<double>& x, std::vector<double>& result){
+      fast_poisson.solve(x, result, a, 4 * a);
+      for(size_t i = 0; i != result.size(); i++){
+        if(!active[i]) result[i] = 0.0;
+      }
+    });
+    pressure_solver_params.mixed_pcg_solver.set_preconditioner([&fast_poisson, &active, a](const std::vector<float>& x, std::vector<float>& result){
+      fast_poisson.solve(x, result, a, 4 * a);
+      for(size_t i = 0; i != result.size(); i++){
+        if(!active[i]) result[i] = 0.0f;
+      }
+    });
+  } else {
+    pressure_solver_params.pcg_solver.set_preconditioner(nullptr);
+    pressure_solver_params.mixed_pcg_solver.set_preconditioner(nullptr);
+  }
 
   // TODO: Invoke pcgsolver interface to setup the solver inside parameters
-  pressure_solver_params.pcg_solver.set_solver_parameters(user_params.min_tolerance, user_params.max_iterations);
-  bool success = pressure_solver_params.pcg_solver.solve(pressure_solver_params.sparse_matrix,
-                                                         pressure_solver_params.rhs,
-                                                         pressure_solver_params.pressure,
-                                                         user_params.out_tolerance,
-                                                         user_params.out_iterations);
+  bool success;
+  if(mixed_precision_pressure){
+    pressure_solver_params.mixed_pcg_solver.set_solver_parameters((float)user_params.min_tolerance, user_params.max_iterations);
+    success = pressure_solver_params.mixed_pcg_solver.solve_refined(pressure_solver_params.sparse_matrix,
+                                                                    pressure_solver_params.rhs,
+                                                                    pressure_solver_params.pressure,
+                                                                    user_params.out_tolerance,
+                                                                    user_params.out_iterations);
+  } else {
+    pressure_solver_params.pcg_solver.set_solver_parameters(user_params.min_tolerance, user_params.max_iterations);
+    success = pressure_solver_params.pcg_solver.solve(pressure_solver_params.sparse_matrix,
+                                                      pressure_solver_params.rhs,
+                                                      pressure_solver_params.pressure,
+                                                      user_params.out_tolerance,
+                                                      user_params.out_iterations);
+  }
   if(!success){
     #ifdef __linux__
     std:: cout << "\033[1;33mWARNING: Pressure solve failed!\033[0m" << endl;
@@ -448,17 +1491,20 @@ EulerGAS2D::pressure_solve(){
 }
 
 // Protected
-// Issues here, when no value set for nodal_solid_phi. Program crashes
-// as accessing out of range of pressure
+// Faces on the outer border of the grid have a cell on one side only and get
+// no pressure gradient
 void
 EulerGAS2D::apply_gradients(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "apply_gradients");
   VFXEpoch::Grid2DdScalarField _pressure(user_params.dimension.m_x, user_params.dimension.m_y);
   std::vector<double> solvedPressure(pressure_solver_params.pressure.begin(), pressure_solver_params.pressure.end());
   VFXEpoch::DataFromVectorToGrid(solvedPressure, _pressure);
   float dt = user_params.dt;
   float dx = user_params.h;
+  int row = user_params.dimension.m_y;
+  int col = user_params.dimension.m_x;
   LOOP_GRID2D(u){
-    if(uw(i, j) > 0){
+    if(uw(i, j) > 0 && j > 0 && j < col){
       u(i, j) -= dt * (_pressure(i, j) - _pressure(i, j - 1)) / dx;
     } else {
       u(i, j) = 0.0f;
@@ -466,7 +1512,7 @@ EulerGAS2D::apply_gradients(){
   }
 
   LOOP_GRID2D(v){
-    if(vw(i, j) > 0){
+    if(vw(i, j) > 0 && i > 0 && i < row){
       v(i, j) -= dt * (_pressure(i, j) - _pressure(i - 1, j)) / dx;
     } else {
       v(i, j) = 0.0f;
@@ -476,70 +1522,165 @@ EulerGAS2D::apply_gradients(){
 
 // Protected
 void
-EulerGAS2D::find_boundary(Grid2DfScalarField& grid, 
-                        const Grid2DfScalarField& weights, 
-                        Grid2DCellTypes& mask, 
-                        Grid2DCellTypes& mask0){
-  LOOP_GRID2D(grid){
-    mask(i, j) = weights(i, j) > 0.0f ? BOUNDARY_MASK::NOTHING : BOUNDARY_MASK::SOMETHING;
-  }
-
-  for(int i = 0; i != 5; i++){
-    mask0 = mask;
-    LOOP_GRID2D_WITHOUT_DOMAIN_BOUNDARY(grid){
-      float sum = 0.0f;
-      int count = 0;
-
-      if(BOUNDARY_MASK::SOMETHING == mask0(i, j)){
-        if(BOUNDARY_MASK::NOTHING == mask0(i, j+1)){
-          sum += grid(i, j+1);
-          ++count;
-        }
+EulerGAS2D::get_grid_weights(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "get_grid_weights");
+  // u face (i, j) lies between nodes (i, j) and (i+1, j), v face (i, j)
+  // between nodes (i, j) and (i, j+1)
+  for(size_t b = 0; b != dirty_boxes.size(); b++){
+    const NodeBox& box = dirty_boxes[b];
+    for(int i = std::max(0, box.i0 - 1); i <= std::min(uw.getDimY() - 1, box.i1); i++){
+      for(int j = box.j0; j <= std::min(uw.getDimX() - 1, box.j1); j++){
+        uw(i, j) = 1 - VFXEpoch::InteralFrac(nodal_solid_phi(i+1, j), nodal_solid_phi(i, j));
+      }
+    }
 
-        if(BOUNDARY_MASK::NOTHING == mask0(i, j-1)){
-          sum += grid(i, j-1);
-          ++count;
-        }
+    for(int i = box.i0; i <= std::min(vw.getDimY() - 1, box.i1); i++){
+      for(int j = std::max(0, box.j0 - 1); j <= std::min(vw.getDimX() - 1, box.j1); j++){
+        vw(i, j) = 1 - VFXEpoch::InteralFrac(nodal_solid_phi(i, j+1), nodal_solid_phi(i, j));
+      }
+    }
 
-        if(BOUNDARY_MASK::NOTHING == mask0(i+1, j)){
-          sum += grid(i+1, j);
-          ++count;
-        }
+    // A face is a seed depending on its four neighbours, one more face around
+    // the changed ones
+    update_extrapolation_seeds(uw, u_extrapolation, box.i0 - 2, box.i1 + 1, box.j0 - 1, box.j1 + 1);
+    update_extrapolation_seeds(vw, v_extrapolation, box.i0 - 1, box.i1 + 1, box.j0 - 2, box.j1 + 1);
+  }
+}
 
-        if(BOUNDARY_MASK::NOTHING == mask0(i-1, j)){
-          sum += grid(i-1, j);
-          ++count;
-        } 
+// Protected
+// Searches faces (i0..i1, j0..j1) again for seeds of the extrapolation. Only
+// faces off the domain boundary are extrapolated
+void
+EulerGAS2D::update_extrapolation_seeds(const Grid2DfScalarField& weights, Extrapolation& extrapolation,
+                                       int i0, int i1, int j0, int j1){
+  int nx = weights.getDimX(), ny = weights.getDimY();
+  i0 = std::max(1, i0); i1 = std::min(ny - 2, i1);
+  j0 = std::max(1, j0); j1 = std::min(nx - 2, j1);
+  if(i1 < i0 || j1 < j0) return;
+  vector<int>& seeds = extrapolation.seeds;
+  seeds.erase(std::remove_if(seeds.begin(), seeds.end(), [=](int f){
+    int i = f / nx, j = f % nx;
+    return i >= i0 && i <= i1 && j >= j0 && j <= j1;
+  }), seeds.end());
+  for(int i = i0; i <= i1; i++){
+    for(int j = j0; j <= j1; j++){
+      if(weights(i, j) > 0.0f) continue;
+      if(weights(i, j+1) > 0.0f || weights(i, j-1) > 0.0f || weights(i+1, j) > 0.0f || weights(i-1, j) > 0.0f)
+        seeds.push_back(i * nx + j);
+    }
+  }
+  std::sort(seeds.begin(), seeds.end());
+}
 
-        else {
-          /* TODO: ... */
+// Protected
+// Gives the zero weight faces next to the fluid the average of their known
+// neighbours, one layer of faces at a time. A layer only reads the fluid and
+// the layers before it, and the next layer is found from the current one, so
+// a call costs the number of faces along the solid boundary
+void
+EulerGAS2D::extrapolate_vel(Grid2DfScalarField& grid, const Grid2DfScalarField& weights, Extrapolation& extrapolation){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "extrapolate_vel");
+  int nx = grid.getDimX(), ny = grid.getDimY();
+  Extrapolation& e = extrapolation;
+  if(e.stamps.size() != grid.data.size() || e.epoch > UINT_MAX - 2 * (unsigned int)(extrapolation_layers + 1)){
+    e.stamps.assign(grid.data.size(), 0);
+    e.epoch = 0;
+  }
+  unsigned int base = e.epoch + 1;
+  e.epoch += extrapolation_layers + 1;
+  vector<unsigned int>& stamps = e.stamps;
+  e.layer = e.seeds;
+  for(int l = 0; l != extrapolation_layers && !e.layer.empty(); l++){
+    unsigned int done = base + l;
+    e.values.resize(e.layer.size());
+    VFXEpoch::Parallel::ParallelFor(0, (int)e.layer.size(), [&](int begin, int end){
+      for(int q = begin; q != end; q++){
+        int f = e.layer[q];
+        // Same order as the neighbours were always summed in
+        int neighbours[4] = {f + 1, f - 1, f + nx, f - nx};
+        float sum = 0.0f;
+        int count = 0;
+        for(int n = 0; n != 4; n++){
+          int g = neighbours[n];
+          if(weights.data[g] > 0.0f || (stamps[g] >= base && stamps[g] < done)){
+            sum += grid.data[g];
+            ++count;
+          }
         }
+        e.values[q] = count > 0 ? sum / (float)count : grid.data[f];
+      }
+    }, 1024);
+    VFXEpoch::Parallel::ParallelFor(0, (int)e.layer.size(), [&](int begin, int end){
+      for(int q = begin; q != end; q++){
+        grid.data[e.layer[q]] = e.values[q];
+        stamps[e.layer[q]] = done;
+      }
+    }, 1024);
+    if(l + 1 == extrapolation_layers) break;
 
-        if(count > 0){
-          grid(i, j) = sum / (float)count;
-          mask(i, j) = BOUNDARY_MASK::NOTHING;
+    // Untouched zero weight neighbours form the next layer
+    int chunks = std::max(1, std::min(VFXEpoch::Parallel::NumThreads() * 4, (int)e.layer.size() / 1024));
+    vector<vector<int> > found(chunks);
+    VFXEpoch::Parallel::ParallelFor(0, chunks, [&](int first, int last){
+      for(int c = first; c != last; c++){
+        int begin = (int)((long long)e.layer.size() * c / chunks), end = (int)((long long)e.layer.size() * (c + 1) / chunks);
+        for(int q = begin; q != end; q++){
+          int f = e.layer[q];
+          int i = f / nx, j = f % nx;
+          if(j + 1 < nx - 1) found[c].push_back(f + 1);
+          if(j - 1 > 0) found[c].push_back(f - 1);
+          if(i + 1 < ny - 1) found[c].push_back(f + nx);
+          if(i - 1 > 0) found[c].push_back(f - nx);
         }
+        found[c].erase(std::remove_if(found[c].begin(), found[c].end(), [&](int g){
+          return weights.data[g] > 0.0f || stamps[g] >= base;
+        }), found[c].end());
+      }
+    }, 1);
+    // A face is queued once by stamping it with the layer that will write it,
+    // which the averaging above does not count as known yet. The order of a
+    // layer does not matter, its faces only read earlier layers
+    e.next.clear();
+    for(int c = 0; c != chunks; c++){
+      for(size_t q = 0; q != found[c].size(); q++){
+        int g = found[c][q];
+        if(stamps[g] >= base) continue;
+        stamps[g] = done + 1;
+        e.next.push_back(g);
       }
     }
-  }                       
+    e.layer.swap(e.next);
+  }
 }
 
 // Protected
+// The solid covers 1 - weight of a face and moves with the solid velocity,
+// its flux goes into the right hand side the same way the fluid flux does
 void
-EulerGAS2D::get_grid_weights(){
-  LOOP_GRID2D(uw){
-    // TODO: Access out of range "nodal_solid_phi"
-    uw(i, j) = 1 - VFXEpoch::InteralFrac(nodal_solid_phi(i+1, j), nodal_solid_phi(i, j));
-  }
-
-  LOOP_GRID2D(vw){
-    vw(i, j) = 1 - VFXEpoch::InteralFrac(nodal_solid_phi(i, j+1), nodal_solid_phi(i, j));
-  }
+EulerGAS2D::add_solid_divergence(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "add_solid_divergence");
+  float h = user_params.h;
+  int row = user_params.dimension.m_y;
+  int col = user_params.dimension.m_x;
+  VFXEpoch::Parallel::ParallelFor(1, row - 1, [&](int begin, int end){
+    for(int i = begin; i != end; i++){
+      for(int j = 1; j != col - 1; j++){
+        if(uw(i, j) == 1.0f && uw(i, j+1) == 1.0f && vw(i, j) == 1.0f && vw(i+1, j) == 1.0f) continue;
+        double flux = 0.0;
+        if(uw(i, j+1) < 1.0f) flux -= (1.0f - uw(i, j+1)) * get_solid_vel(VFXEpoch::Vector2Df((j+1) * h, (i+0.5f) * h)).m_x / h;
+        if(uw(i, j) < 1.0f) flux += (1.0f - uw(i, j)) * get_solid_vel(VFXEpoch::Vector2Df(j * h, (i+0.5f) * h)).m_x / h;
+        if(vw(i+1, j) < 1.0f) flux -= (1.0f - vw(i+1, j)) * get_solid_vel(VFXEpoch::Vector2Df((j+0.5f) * h, (i+1) * h)).m_y / h;
+        if(vw(i, j) < 1.0f) flux += (1.0f - vw(i, j)) * get_solid_vel(VFXEpoch::Vector2Df((j+0.5f) * h, i * h)).m_y / h;
+        pressure_solver_params.rhs[i * col + j] += flux;
+      }
+    }
+  });
 }
 
 // Protected
 void
 EulerGAS2D::correct_vel(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "correct_vel");
   u0 = u; v0 = v;
   float h = user_params.h;
   LOOP_GRID2D(u){
@@ -549,7 +1690,7 @@ EulerGAS2D::correct_vel(){
       VFXEpoch::Vector2Df normal(0.0f, 0.0f);
       VFXEpoch::InterpolateGradient(normal, pos / h, nodal_solid_phi);
       normal.normalize();
-      float correction_component = VFXEpoch::Vector2Df::dot(vel, normal);
+      float correction_component = VFXEpoch::Vector2Df::dot(vel - get_solid_vel(pos), normal);
       vel -= correction_component * normal;
       u0(i, j) = vel.m_x;
     }
@@ -562,7 +1703,7 @@ EulerGAS2D::correct_vel(){
       VFXEpoch::Vector2Df normal(0.0f, 0.0f);
       VFXEpoch::InterpolateGradient(normal, pos / h, nodal_solid_phi);
       normal.normalize();
-      float correction_component = VFXEpoch::Vector2Df::dot(vel, normal);
+      float correction_component = VFXEpoch::Vector2Df::dot(vel - get_solid_vel(pos), normal);
       vel -= correction_component * normal;
       v0(i, j) = vel.m_y;
     }
@@ -573,6 +1714,7 @@ EulerGAS2D::correct_vel(){
 // Protected
 void
 EulerGAS2D::setup_pressure_coef_matrix(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS2D", "setup_pressure_coef_matrix");
   int row = user_params.dimension.m_y;
   int col = user_params.dimension.m_x;
   int idx = 0;
@@ -580,24 +1722,76 @@ EulerGAS2D::setup_pressure_coef_matrix(){
   float dx = user_params.h;
   float dt = user_params.dt;
   int grid_each_row_elements = user_params.dimension.m_x;
-  pressure_solver_params.sparse_matrix.zero();
-  LOOP_GRID2D_WITHOUT_DOMAIN_BOUNDARY(row, col){
-    idx = i * user_params.dimension.m_x + j;
-    val = uw(i, j+1) * dt / std::pow(dx, 2.0f);
-    pressure_solver_params.sparse_matrix.add_to_element(idx, idx,val);
-    pressure_solver_params.sparse_matrix.add_to_element(idx, idx + 1, -val);
-    val = uw(i, j) * dt / std::pow(dx, 2.0f);
-    pressure_solver_params.sparse_matrix.add_to_element(idx, idx, val);
-    pressure_solver_params.sparse_matrix.add_to_element(idx, idx - 1, -val);
-    val = vw(i+1, j) * dt / std::pow(dx, 2.0f);
-    pressure_solver_params.sparse_matrix.add_to_element(idx, idx, val);
-    pressure_solver_params.sparse_matrix.add_to_element(idx, idx + grid_each_row_elements, -val);
-    val = vw(i, j) * dt / std::pow(dx, 2.0f);
-    pressure_solver_params.sparse_matrix.add_to_element(idx, idx, val);
-    pressure_solver_params.sparse_matrix.add_to_element(idx, idx - grid_each_row_elements, -val);
+  // Cell (i, j) reads u faces (i, j), (i, j+1) and v faces (i, j), (i+1, j),
+  // only the rows of cells next to a face in a dirty box are built again
+  for(size_t b = 0; b != dirty_boxes.size(); b++){
+    const NodeBox& box = dirty_boxes[b];
+    for(int i = std::max(1, box.i0 - 1); i <= std::min(row - 2, box.i1); i++){
+      for(int j = std::max(1, box.j0 - 1); j <= std::min(col - 2, box.j1); j++){
+        idx = i * user_params.dimension.m_x + j;
+        pressure_solver_params.sparse_matrix.index[idx].resize(0);
+        pressure_solver_params.sparse_matrix.value[idx].resize(0);
+        // The ring of cells around the domain has no rows and holds zero
+        // pressure, leaving its columns out keeps the matrix symmetric
+        val = uw(i, j+1) * dt / std::pow(dx, 2.0f);
+        pressure_solver_params.sparse_matrix.add_to_element(idx, idx,val);
+        if(j + 1 < col - 1) pressure_solver_params.sparse_matrix.add_to_element(idx, idx + 1, -val);
+        val = uw(i, j) * dt / std::pow(dx, 2.0f);
+        pressure_solver_params.sparse_matrix.add_to_element(idx, idx, val);
+        if(j - 1 > 0) pressure_solver_params.sparse_matrix.add_to_element(idx, idx - 1, -val);
+        val = vw(i+1, j) * dt / std::pow(dx, 2.0f);
+        pressure_solver_params.sparse_matrix.add_to_element(idx, idx, val);
+        if(i + 1 < row - 1) pressure_solver_params.sparse_matrix.add_to_element(idx, idx + grid_each_row_elements, -val);
+        val = vw(i, j) * dt / std::pow(dx, 2.0f);
+        pressure_solver_params.sparse_matrix.add_to_element(idx, idx, val);
+        if(i - 1 > 0) pressure_solver_params.sparse_matrix.add_to_element(idx, idx - grid_each_row_elements, -val);
+      }
+    }
   }
 }
 
+// Protected
+// Boundaries of the 5 point Laplacian the pressure rows come down to: an edge
+// whose faces are all open sees the zero pressure ring (STREAK) and one closed
+// all along is a wall (NEUMANN_OPEN). Partly covered edges are taken as open.
+// Returns whether the rows are exactly that Laplacian, i.e. no solid covers
+// any part of a face they read
+bool
+EulerGAS2D::get_pressure_edges(VFXEpoch::BndConditionPerEdge edges[4]) const {
+  int row = user_params.dimension.m_y;
+  int col = user_params.dimension.m_x;
+  bool laplacian = true;
+  for(int i = 1; i <= row - 2 && laplacian; i++){
+    for(int j = 2; j <= col - 2; j++){
+      if(uw(i, j) < 1.0f){ laplacian = false; break; }
+    }
+  }
+  for(int i = 2; i <= row - 2 && laplacian; i++){
+    for(int j = 1; j <= col - 2; j++){
+      if(vw(i, j) < 1.0f){ laplacian = false; break; }
+    }
+  }
+  // Smallest and largest weight along the left, right, top and bottom edge
+  float lowest[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+  float highest[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  for(int i = 1; i <= row - 2; i++){
+    lowest[0] = std::min(lowest[0], uw(i, 1)); highest[0] = std::max(highest[0], uw(i, 1));
+    lowest[1] = std::min(lowest[1], uw(i, col - 1)); highest[1] = std::max(highest[1], uw(i, col - 1));
+  }
+  for(int j = 1; j <= col - 2; j++){
+    lowest[2] = std::min(lowest[2], vw(1, j)); highest[2] = std::max(highest[2], vw(1, j));
+    lowest[3] = std::min(lowest[3], vw(row - 1, j)); highest[3] = std::max(highest[3], vw(row - 1, j));
+  }
+  VFXEpoch::EDGES_2DSIM sides[4] = {VFXEpoch::EDGES_2DSIM::LEFT, VFXEpoch::EDGES_2DSIM::RIGHT,
+                                    VFXEpoch::EDGES_2DSIM::TOP, VFXEpoch::EDGES_2DSIM::BOTTOM};
+  for(int e = 0; e != 4; e++){
+    edges[e].side = sides[e];
+    edges[e].boundaryType = highest[e] <= 0.0f ? VFXEpoch::BOUNDARY::NEUMANN_OPEN : VFXEpoch::BOUNDARY::STREAK;
+    if(highest[e] > 0.0f && lowest[e] < 1.0f) laplacian = false;
+  }
+  return laplacian;
+}
+
 // Protected
 Vector2Df
 EulerGAS2D::get_vel(const Vector2Df& pos){
@@ -607,6 +1801,23 @@ EulerGAS2D::get_vel(const Vector2Df& pos){
   return Vector2Df(_u, _v);
 }
 
+// Protected
+// Batched get_vel, the scratch arrays hold count floats each
+void
+EulerGAS2D::get_vel(const float* x, const float* y, int count, float* vel_x, float* vel_y, float* scratch_x, float* scratch_y) const {
+  float h = user_params.h;
+  for(int p = 0; p != count; p++){
+    scratch_x[p] = x[p] / h - 0.0f;
+    scratch_y[p] = y[p] / h - 0.5f;
+  }
+  VFXEpoch::InterpolateGrid(scratch_x, scratch_y, count, u, vel_x);
+  for(int p = 0; p != count; p++){
+    scratch_x[p] = x[p] / h - 0.5f;
+    scratch_y[p] = y[p] / h - 0.0f;
+  }
+  VFXEpoch::InterpolateGrid(scratch_x, scratch_y, count, v, vel_y);
+}
+
 // Protected
 float
 EulerGAS2D::get_den(const Vector2Df& pos){
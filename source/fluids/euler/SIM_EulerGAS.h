@@ -14,6 +14,13 @@
 #include "utl/PCGSolver/sparse_matrix.h"
 #include "utl/PCGSolver/blas_wrapper.h"
 #include "utl/PCGSolver/pcg_solver.h"
+#include "utl/UTL_Trace.h"
+#include "utl/UTL_Parallel.h"
+#include "utl/UTL_Particles.h"
+#include "utl/UTL_DistanceField.h"
+#include "utl/UTL_FastPoisson.h"
+#include "io/IO_Checkpoint.h"
+#include "io/IO_Volume.h"
 
 /********************************* For Debug *********************************/
 /********************************* For Debug *********************************/
@@ -39,8 +46,9 @@ namespace VFXEpoch{
           h = 0.0;
           dt = 0.0;
           buoyancy_alpha = buoyancy_beta = 0.0;
-          min_tolerance = 0.0;
-          max_iterations = 0;
+          vort_conf_eps = 0.0;
+          min_tolerance = out_tolerance = 0.0;
+          max_iterations = out_iterations = 0;
           num_particles = 0;
           density_source = 0.0;
           external_force_strength = 0.0;
@@ -61,10 +69,11 @@ namespace VFXEpoch{
           h = src.h;
           dt = src.dt;
           buoyancy_alpha = src.buoyancy_alpha; buoyancy_beta = src.buoyancy_beta;
-          min_tolerance = src.min_tolerance;
+          vort_conf_eps = src.vort_conf_eps;
+          min_tolerance = src.min_tolerance; out_tolerance = src.out_tolerance;
           visc = src.visc;
           diff = src.diff;
-          max_iterations = src.max_iterations;
+          max_iterations = src.max_iterations; out_iterations = src.out_iterations;
           num_particles = src.num_particles;
           density_source = src.density_source;
           external_force_strength = src.external_force_strength;
@@ -76,10 +85,11 @@ namespace VFXEpoch{
           h = rhs.h;
           dt = rhs.dt;
           buoyancy_alpha = rhs.buoyancy_alpha; buoyancy_beta = rhs.buoyancy_beta;
-          min_tolerance = rhs.min_tolerance;
+          vort_conf_eps = rhs.vort_conf_eps;
+          min_tolerance = rhs.min_tolerance; out_tolerance = rhs.out_tolerance;
           diff = rhs.diff;
           visc = rhs.visc;
-          max_iterations = rhs.max_iterations;
+          max_iterations = rhs.max_iterations; out_iterations = rhs.out_iterations;
           num_particles = rhs.num_particles;
           density_source = rhs.density_source;
           external_force_strength = rhs.external_force_strength;
@@ -94,10 +104,11 @@ namespace VFXEpoch{
           h = 0.0;
           dt = 0.0;
           buoyancy_alpha = buoyancy_beta = 0.0;
-          min_tolerance = 0.0;
+          vort_conf_eps = 0.0;
+          min_tolerance = out_tolerance = 0.0;
           diff = 0.0;
           visc = 0.0;
-          max_iterations = 0;
+          max_iterations = out_iterations = 0;
           num_particles = 0;
           density_source = 0.0;
           external_force_strength = 0.0;
@@ -160,12 +171,87 @@ namespace VFXEpoch{
       void set_source_location(int i, int j);
       void set_external_force_location(VFXEpoch::VECTOR_COMPONENTS component, int i, int j);
       void add_particles(VFXEpoch::Particle2Df p);
+      void set_verbose(bool _verbose);
+      // Copy in the array of structures layout, prefer get_particle_view()
       vector<VFXEpoch::Particle2Df> get_particles();
+      // Zero-copy view on the particle arrays, valid until particles are added
+      VFXEpoch::ParticleView2Df get_particle_view() const;
+      // Sorts the particles by grid cell every interval steps, 0 turns it off.
+      // Particle indices change on every sort, ids do not
+      void set_particle_sort_interval(int interval);
+      void sort_particles();
+      // Particles of cell (i, j) are [start[i * nx + j], start[i * nx + j + 1])
+      // as of the last sort, empty if the particles were never sorted
+      const vector<int>& get_particle_cell_start() const;
+
+      // Particle emission and removal
+    public:
+      struct Emitter{
+        Emitter() : phi(NULL), rate(0.0f), vel(0.0f, 0.0f), color(1.0f, 1.0f, 1.0f){}
+        vector<VFXEpoch::Vector2Di> cells;        // (i, j) as in set_source_location
+        float (*phi)(const VFXEpoch::Vector2Df&); // Or every cell whose center has phi < 0
+        float rate;                               // Particles per cell per second
+        VFXEpoch::Vector2Df vel;
+        VFXEpoch::Vector3Df color;
+      };
+      // Emitters seed particles at jittered positions before advection, returns the index
+      int add_emitter(const Emitter& emitter);
+      void clear_emitters();
+      // Particles that left the domain or ended up in a solid are kept unless
+      // removal is turned on, they are then dropped after advection
+      void set_dead_particle_removal(bool remove);
+      // After advection cells holding more than max_per_cell particles are thinned
+      // and cells with fewer than min_per_cell and a density above min_density are
+      // reseeded, 0 turns a limit off. Dead particles count for no cell
+      void set_particle_budget(int min_per_cell, int max_per_cell, float min_density = 0.0f,
+                               VFXEpoch::Vector3Df color = VFXEpoch::Vector3Df(1.0f, 1.0f, 1.0f));
+
+      // Velocity transfer
+    public:
+      // SEMI_LAGRANGIAN only advects the grid velocity. The other modes carry
+      // velocity on the particles and splat it onto the faces they cover every
+      // step: PIC, FLIP (blended with PIC by flip_ratio) or APIC with a per
+      // particle velocity gradient. Faces without particles keep the
+      // semi-Lagrangian velocity
+      enum class VELOCITY_TRANSFER { SEMI_LAGRANGIAN, PIC, FLIP, APIC };
+      void set_velocity_transfer(VELOCITY_TRANSFER mode, float flip_ratio = 0.95f);
+      // Layers of faces next to the fluid that get an extrapolated velocity
+      // after the projection, 5 by default
+      void set_extrapolation_layers(int layers);
+      // Solves the pressure with float matrix, vectors and preconditioner and
+      // refines the result in double until it meets min_tolerance, which
+      // halves the memory traffic of the solve. Off by default
+      void set_mixed_precision_pressure(bool enable);
+      // When no solid cuts the faces inside the domain, and each edge of it is
+      // either open or closed all along, the pressure is always solved directly
+      // with sine and cosine transforms. Otherwise this makes PCG use that
+      // direct solve as its preconditioner instead of MIC(0), which pays off
+      // when the solids are few and small. Off by default
+      void set_fast_poisson_preconditioner(bool enable);
       // About boundaries
     public:
       void set_inside_boundary(Grid2DCellTypes boundaries);
       void set_domain_boundary(VFXEpoch::BOUNDARY boundary_type, VFXEpoch::EDGES_2DSIM edge);
       void set_static_boundary(float (*phi)(const VFXEpoch::Vector2Df&));
+      void set_static_boundary(const Grid2DfScalarField& phi);
+      // Nodal occupancy, nonzero is solid. The distance is built by fast sweeping
+      void set_static_boundary(const Grid2DiScalarField& occupancy);
+      // Closed polyline in world space, voxelized through its BVH
+      void set_static_boundary(const VFXEpoch::PolylineBVH& obstacle);
+
+      // Moving colliders
+    public:
+      // A collider is a signed distance cached once on its own grid: sdf(i, j)
+      // is the distance at sdf_origin + (j, i) * sdf_h in the collider frame.
+      // Returns the index of the collider
+      int add_collider(const Grid2DfScalarField& sdf, VFXEpoch::Vector2Df sdf_origin, float sdf_h);
+      // Places the collider frame at position, turned counter clockwise by angle
+      // (radians). Call it once per step, the velocity the collider imposes on
+      // the fluid is the change of the transform over the step
+      void set_collider_transform(int collider, VFXEpoch::Vector2Df position, float angle);
+      // Replaces the shape of a deforming collider, the transform is kept
+      void set_collider_sdf(int collider, const Grid2DfScalarField& sdf, VFXEpoch::Vector2Df sdf_origin, float sdf_h);
+      void clear_colliders();
 
       /********************************* Debug the field *********************************/
       // TODO: Ensure to close following functions
@@ -176,10 +262,25 @@ namespace VFXEpoch{
       void set_user_params(Parameters params);
       EulerGAS2D::Parameters get_user_params() const;
       Vector2Df get_grid_velocity(VFXEpoch::Vector2Df pos);
+      const Grid2DfScalarField& get_density() const;
+      const Grid2DfScalarField& get_temperature() const;
+      const Grid2DfScalarField& get_vorticity() const;
+
+      // Checkpoint / restart
+    public:
+      bool save_checkpoint(const std::string& filename, bool compress = true) const;
+      bool load_checkpoint(const std::string& filename);
+      // Sparse volume of density, temperature and vorticity for rendering
+      bool save_volume(const std::string& filename, const VFXEpoch::IO::VolumeOptions& options = VFXEpoch::IO::VolumeOptions()) const;
 
     protected:
       void add_source(); // Overload
       void add_force();
+      void update_colliders();
+      float get_collider_phi(int collider, const Vector2Df& world_pos);
+      Vector2Df get_solid_vel(const Vector2Df& pos);
+      void mark_dirty_nodes(int i0, int i1, int j0, int j1);
+      void add_solid_divergence();
       void set_domain_boundary_wrapper(Grid2DfScalarField& field);
       void density_diffuse(Grid2DfScalarField& dest, Grid2DfScalarField ref);
       void dynamic_diffuse(Grid2DfScalarField& dest, Grid2DfScalarField ref);
@@ -188,18 +289,23 @@ namespace VFXEpoch{
       void advect_den();
       void advect_tmp();
       void advect_particles();
+      void emit_particles();
+      void remove_particles();
+      void reseed_particles();
+      void particles_to_grid();
+      void grid_to_particles();
       void project();
     protected:
       void apply_buoyancy();
       void pressure_solve(); // Overload
       void apply_gradients();
-      void find_boundary(Grid2DfScalarField& grid, const Grid2DfScalarField& weights, 
-                           Grid2DCellTypes& mask, Grid2DCellTypes& mask0);
       void get_grid_weights();
       void correct_vel();
       void setup_pressure_coef_matrix();
+      bool get_pressure_edges(VFXEpoch::BndConditionPerEdge edges[4]) const;
       Vector2Df trace_rk2(const Vector2Df& pos, float dt);
       Vector2Df get_vel(const Vector2Df& pos);
+      void get_vel(const float* x, const float* y, int count, float* vel_x, float* vel_y, float* scratch_x, float* scratch_y) const;
       float get_den(const Vector2Df& pos);
       float get_curl(const Vector2Df& pos);
       float get_tmp(const Vector2Df& pos);
@@ -207,18 +313,57 @@ namespace VFXEpoch{
     /*********************** Pressure Solver Parameters ************************/
       struct PressureSolverParams{
         PCGSolver<double> pcg_solver;
+        PCGSolver<float> mixed_pcg_solver;
         SparseMatrixd sparse_matrix;
+        VFXEpoch::FastPoissonSolver fast_poisson;
+        vector<unsigned char> active_rows; // rows with a diagonal, for the fast_poisson preconditioner
         vector<double> rhs;
         vector<double> pressure;
         
         inline void clear(){
           pcg_solver.clear();
+          mixed_pcg_solver.clear();
+          fast_poisson.clear();
+          active_rows.clear();
           sparse_matrix.clear();
           rhs.clear();
           pressure.clear();
         }
       };
     /*********************** Pressure Solver Parameters END ********************/
+      struct Collider{
+        Grid2DfScalarField sdf;
+        VFXEpoch::Vector2Df sdf_origin;
+        float sdf_h;
+        VFXEpoch::Vector2Df position, previous_position;
+        float angle, previous_angle;
+        VFXEpoch::Vector2Df velocity;
+        float angular_velocity;
+        bool placed;
+        // Nodes the collider covered when nodal_solid_phi was last rebuilt,
+        // empty when max < min
+        int node_i0, node_i1, node_j0, node_j1;
+      };
+      // Inclusive range of nodes whose solid phi changed since the last
+      // pressure solve
+      struct NodeBox{
+        int i0, i1, j0, j1;
+      };
+      // Velocity extrapolation into the zero weight faces of one component
+      struct Extrapolation{
+        // Zero weight faces next to a face with weight, sorted. Only the
+        // faces around the dirty boxes are searched again
+        vector<int> seeds;
+        vector<int> layer, next;
+        vector<float> values;
+        // epoch + layer of the faces written by the last call
+        vector<unsigned int> stamps;
+        unsigned int epoch;
+      };
+    protected:
+      void update_extrapolation_seeds(const Grid2DfScalarField& weights, Extrapolation& extrapolation,
+                                      int i0, int i1, int j0, int j1);
+      void extrapolate_vel(Grid2DfScalarField& grid, const Grid2DfScalarField& weights, Extrapolation& extrapolation);
     private:
       Grid2DfScalarField u, u0;
       Grid2DfScalarField v, v0;
@@ -227,9 +372,33 @@ namespace VFXEpoch{
       Grid2DfScalarField t, t0;
       Grid2DfScalarField omega, omega0;
       Grid2DfScalarField nodal_solid_phi;
+      // Solids set by set_static_boundary, nodal_solid_phi adds the colliders
+      Grid2DfScalarField static_solid_phi;
+      vector<Collider> colliders;
+      // Face weights and pressure rows are only rebuilt inside these boxes
+      vector<NodeBox> dirty_boxes;
+      Extrapolation u_extrapolation, v_extrapolation;
+      int extrapolation_layers;
+      bool mixed_precision_pressure;
+      bool fast_poisson_preconditioner;
       Grid2DCellTypes inside_mask, inside_mask0;
       BndConditionPerEdge domain_boundaries[4];
-      vector<VFXEpoch::Particle2Df> particles_container;
+      VFXEpoch::ParticleStore2Df particles_container;
+      vector<int> particle_cells, particle_cell_start;
+      int particle_sort_interval, steps_since_sort;
+      vector<Emitter> emitters;
+      vector<float> emitter_carry;
+      int particle_min_per_cell, particle_max_per_cell;
+      float particle_min_density;
+      bool remove_dead_particles;
+      VFXEpoch::Vector3Df particle_reseed_color;
+      vector<int> particle_cell_count;
+      vector<unsigned char> particle_keep;
+      unsigned long long particle_epoch;
+      VELOCITY_TRANSFER velocity_transfer;
+      float flip_ratio;
+      // Transfer temporaries, the old grid velocity for FLIP and the splat weights
+      Grid2DfScalarField u_old, v_old, u_mass, v_mass;
       vector<VFXEpoch::Vector2Di> source_locations;
 
       // The last component is used to specify velocity component
@@ -238,6 +407,7 @@ namespace VFXEpoch{
       
       Parameters user_params;
       PressureSolverParams pressure_solver_params;
+      bool verbose;
     };
   }
 }
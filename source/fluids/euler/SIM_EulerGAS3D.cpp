@@ -0,0 +1,627 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "SIM_EulerGAS3D.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Cells per tile along each axis
+static const int TILE = 8;
+
+// Trilinear interpolation at (x, y, z) in index space, clamped to the grid
+// like the 2D InterpolateGrid
+static inline float
+sample(const Grid3DfScalarField& field, float x, float y, float z){
+  int nx = field.getDimX(), ny = field.getDimY(), nz = field.getDimZ();
+  int i, j, k;
+  float fx, fy, fz;
+  VFXEpoch::get_barycentric(x, k, fx, 0, nx);
+  VFXEpoch::get_barycentric(y, j, fy, 0, ny);
+  VFXEpoch::get_barycentric(z, i, fz, 0, nz);
+  size_t sy = nx, sz = (size_t)nx * ny;
+  const float* p = &field.data[i * sz + j * sy + k];
+  float c00 = p[0] + fx * (p[1] - p[0]);
+  float c10 = p[sy] + fx * (p[sy + 1] - p[sy]);
+  float c01 = p[sz] + fx * (p[sz + 1] - p[sz]);
+  float c11 = p[sz + sy] + fx * (p[sz + sy + 1] - p[sz + sy]);
+  float c0 = c00 + fy * (c10 - c00);
+  float c1 = c01 + fy * (c11 - c01);
+  return c0 + fz * (c1 - c0);
+}
+
+// Open fraction of a face from the solid phi at its four corners, the
+// average of the open fractions of two opposite edges
+static inline float
+face_weight(float a, float b, float c, float d){
+  return 1.0f - 0.5f * (VFXEpoch::InteralFrac(a, b) + VFXEpoch::InteralFrac(c, d));
+}
+
+// A tile of cells covers the faces of a grid that has one more sample along
+// an axis up to and including the last one
+static inline int
+tile_last(int end, int cells, int samples){
+  return end == cells ? samples : end;
+}
+
+// Public
+EulerGAS3D::EulerGAS3D(){
+  user_params.clear();
+  verbose = true;
+}
+
+// Public
+EulerGAS3D::EulerGAS3D(Parameters _user_params){
+  verbose = true;
+  init(_user_params);
+}
+
+// Public
+EulerGAS3D::~EulerGAS3D(){
+  close();
+}
+
+// Public
+// Overload from SIM_Base.h -> class Euler_Fluid3D_Base
+bool
+EulerGAS3D::init(Parameters params){
+  user_params = params;
+  int nx = user_params.dimension.m_x, ny = user_params.dimension.m_y, nz = user_params.dimension.m_z;
+  float h = user_params.h;
+  u.Reset(nx + 1, ny, nz, h, h, h); u0 = u; uw = u;
+  v.Reset(nx, ny + 1, nz, h, h, h); v0 = v; vw = v;
+  w.Reset(nx, ny, nz + 1, h, h, h); w0 = w; ww = w;
+  d.Reset(nx, ny, nz, h, h, h); d0 = d;
+  t.Reset(nx, ny, nz, h, h, h); t0 = t;
+  nodal_solid_phi.Reset(nx + 1, ny + 1, nz + 1, h, h, h);
+  std::fill(nodal_solid_phi.data.begin(), nodal_solid_phi.data.end(), h);
+
+  tile_begin.clear(); tile_end.clear();
+  for(int i = 0; i < nz; i += TILE){
+    for(int j = 0; j < ny; j += TILE){
+      for(int k = 0; k < nx; k += TILE){
+        tile_begin.push_back(Vector3Di(k, j, i));
+        tile_end.push_back(Vector3Di(std::min(k + TILE, nx), std::min(j + TILE, ny), std::min(i + TILE, nz)));
+      }
+    }
+  }
+
+  int cells = nx * ny * nz;
+  pressure.assign(cells, 0.0f);
+  residual.assign(cells, 0.0f);
+  search.assign(cells, 0.0f);
+  aux.assign(cells, 0.0f);
+  diagonal.assign(cells, 0.0f);
+  dot_partial.assign(tile_begin.size(), 0.0);
+  max_partial.assign(tile_begin.size(), 0.0);
+  source_locations.clear();
+  get_grid_weights();
+  return true;
+}
+
+// Public
+// Overload from SIM_Base.h -> class Euler_Fluid3D_Base
+void
+EulerGAS3D::step(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS3D", "step");
+  if(0 != source_locations.size()) add_source();
+  if(verbose) cout << "--> Advect particles" << endl;
+  advect_particles();
+  if(verbose) cout << "--> Advect density and temperature" << endl;
+  advect_scalars();
+  if(verbose) cout << "--> Advect velocity (Self-Advection)" << endl;
+  advect_vel();
+  apply_buoyancy();
+  if(verbose) cout << "--> Solving pressure" << endl;
+  pressure_solve();
+  apply_gradients();
+  if(verbose){
+    cout << "--> Pressure linear solver (pcg) outputs:" << endl;
+    cout << " ->  Tolerance:" << user_params.out_tolerance << endl;
+    cout << " ->  iterations:" << user_params.out_iterations << endl;
+  }
+}
+
+// Public
+// Overload from SIM_Base.h -> class Euler_Fluid3D_Base
+void
+EulerGAS3D::close(){
+  u.clear(); u0.clear();
+  v.clear(); v0.clear();
+  w.clear(); w0.clear();
+  uw.clear(); vw.clear(); ww.clear();
+  d.clear(); d0.clear();
+  t.clear(); t0.clear();
+  nodal_solid_phi.clear();
+  tile_begin.clear(); tile_end.clear();
+  source_locations.clear();
+  particle_x.clear(); particle_y.clear(); particle_z.clear();
+  particle_color.clear();
+  pressure.clear(); residual.clear(); search.clear(); aux.clear(); diagonal.clear();
+  dot_partial.clear(); max_partial.clear();
+  user_params.clear();
+}
+
+// Public
+// Turns the per stage progress messages of step() on or off
+void
+EulerGAS3D::set_verbose(bool _verbose){
+  verbose = _verbose;
+}
+
+// Public
+void
+EulerGAS3D::set_source_location(int i, int j, int k){
+  assert(i >= 0 && j >= 0 && k >= 0 && i < user_params.dimension.m_z && j < user_params.dimension.m_y && k < user_params.dimension.m_x);
+  source_locations.push_back(VFXEpoch::Vector3Di(i, j, k));
+}
+
+// Public
+void
+EulerGAS3D::add_particles(VFXEpoch::Particle3Df p){
+  particle_x.push_back(p.pos.m_x);
+  particle_y.push_back(p.pos.m_y);
+  particle_z.push_back(p.pos.m_z);
+  particle_color.push_back(p.color);
+}
+
+// Public
+vector<VFXEpoch::Particle3Df>
+EulerGAS3D::get_particles(){
+  vector<VFXEpoch::Particle3Df> particles(particle_x.size());
+  for(size_t p = 0; p != particles.size(); p++){
+    particles[p].pos = Vector3Df(particle_x[p], particle_y[p], particle_z[p]);
+    particles[p].vel = get_vel(particles[p].pos);
+    particles[p].color = particle_color[p];
+  }
+  return particles;
+}
+
+// Public
+int
+EulerGAS3D::get_particle_count() const {
+  return (int)particle_x.size();
+}
+
+// Public
+void
+EulerGAS3D::set_static_boundary(float (*phi)(const VFXEpoch::Vector3Df&)){
+  float h = user_params.h;
+  const Vector3Df& o = user_params.origin;
+  LOOP_GRID3D(nodal_solid_phi){
+    // i is the depth (z), j the row (y) and k the column (x)
+    nodal_solid_phi(i, j, k) = phi(Vector3Df(k * h + o.m_x, j * h + o.m_y, i * h + o.m_z));
+  }
+  get_grid_weights();
+}
+
+// Public
+// Nodal solid signed distance sampled by the caller, (m_x + 1) x (m_y + 1) x (m_z + 1)
+void
+EulerGAS3D::set_static_boundary(const Grid3DfScalarField& phi){
+  assert(phi.getDimX() == nodal_solid_phi.getDimX() && phi.getDimY() == nodal_solid_phi.getDimY() && phi.getDimZ() == nodal_solid_phi.getDimZ());
+  nodal_solid_phi = phi;
+  get_grid_weights();
+}
+
+// Public
+void
+EulerGAS3D::set_static_boundary(const Grid3DiScalarField& occupancy){
+  assert(occupancy.getDimX() == nodal_solid_phi.getDimX() && occupancy.getDimY() == nodal_solid_phi.getDimY() && occupancy.getDimZ() == nodal_solid_phi.getDimZ());
+  VFXEpoch::DistanceField::FromOccupancy(nodal_solid_phi, occupancy, user_params.h);
+  get_grid_weights();
+}
+
+// Public
+void
+EulerGAS3D::set_static_boundary(const VFXEpoch::TriangleBVH& obstacle){
+  VFXEpoch::DistanceField::FromMesh(nodal_solid_phi, obstacle, user_params.origin, user_params.h);
+  get_grid_weights();
+}
+
+// Public
+EulerGAS3D::Parameters
+EulerGAS3D::get_user_params() const {
+  return user_params;
+}
+
+// Public
+Vector3Df
+EulerGAS3D::get_grid_velocity(VFXEpoch::Vector3Df pos){
+  return get_vel(pos);
+}
+
+// Public
+const Grid3DfScalarField&
+EulerGAS3D::get_density() const {
+  return d;
+}
+
+// Public
+const Grid3DfScalarField&
+EulerGAS3D::get_temperature() const {
+  return t;
+}
+
+// Protected
+// Overload from SIM_Base.h -> class Euler_Fluid3D_Base
+void
+EulerGAS3D::add_source(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS3D", "add_source");
+  for(size_t s = 0; s != source_locations.size(); s++){
+    const Vector3Di& c = source_locations[s];
+    d(c.m_x, c.m_y, c.m_z) = user_params.density_source;
+    t(c.m_x, c.m_y, c.m_z) = user_params.temperature_source;
+  }
+}
+
+// Protected
+// u, v and w are only read while u0, v0 and w0 are written, every tile
+// traces the faces on its low sides and the last tiles the far walls too
+void
+EulerGAS3D::advect_vel(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS3D", "advect_vel");
+  VFXEpoch::Parallel::ParallelFor(0, (int)tile_begin.size(), [this](int first, int last){
+    int nx = d.getDimX(), ny = d.getDimY(), nz = d.getDimZ();
+    float h = user_params.h;
+    float dt = user_params.dt;
+    for(int tile = first; tile != last; tile++){
+      const Vector3Di& b = tile_begin[tile];
+      const Vector3Di& e = tile_end[tile];
+      for(int i = b.m_z; i != e.m_z; i++){
+        for(int j = b.m_y; j != e.m_y; j++){
+          for(int k = b.m_x; k != tile_last(e.m_x, nx, nx + 1); k++){
+            Vector3Df pos = trace_rk2(Vector3Df(k * h, (j + 0.5f) * h, (i + 0.5f) * h), -dt);
+            u0(i, j, k) = sample(u, pos.m_x / h, pos.m_y / h - 0.5f, pos.m_z / h - 0.5f);
+          }
+        }
+      }
+      for(int i = b.m_z; i != e.m_z; i++){
+        for(int j = b.m_y; j != tile_last(e.m_y, ny, ny + 1); j++){
+          for(int k = b.m_x; k != e.m_x; k++){
+            Vector3Df pos = trace_rk2(Vector3Df((k + 0.5f) * h, j * h, (i + 0.5f) * h), -dt);
+            v0(i, j, k) = sample(v, pos.m_x / h - 0.5f, pos.m_y / h, pos.m_z / h - 0.5f);
+          }
+        }
+      }
+      for(int i = b.m_z; i != tile_last(e.m_z, nz, nz + 1); i++){
+        for(int j = b.m_y; j != e.m_y; j++){
+          for(int k = b.m_x; k != e.m_x; k++){
+            Vector3Df pos = trace_rk2(Vector3Df((k + 0.5f) * h, (j + 0.5f) * h, i * h), -dt);
+            w0(i, j, k) = sample(w, pos.m_x / h - 0.5f, pos.m_y / h - 0.5f, pos.m_z / h);
+          }
+        }
+      }
+    }
+  }, 1);
+  u.data.swap(u0.data);
+  v.data.swap(v0.data);
+  w.data.swap(w0.data);
+}
+
+// Protected
+// Density and temperature share the back traced position
+void
+EulerGAS3D::advect_scalars(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS3D", "advect_scalars");
+  VFXEpoch::Parallel::ParallelFor(0, (int)tile_begin.size(), [this](int first, int last){
+    float h = user_params.h;
+    float dt = user_params.dt;
+    for(int tile = first; tile != last; tile++){
+      const Vector3Di& b = tile_begin[tile];
+      const Vector3Di& e = tile_end[tile];
+      for(int i = b.m_z; i != e.m_z; i++){
+        for(int j = b.m_y; j != e.m_y; j++){
+          for(int k = b.m_x; k != e.m_x; k++){
+            Vector3Df pos = trace_rk2(Vector3Df((k + 0.5f) * h, (j + 0.5f) * h, (i + 0.5f) * h), -dt);
+            float x = pos.m_x / h - 0.5f, y = pos.m_y / h - 0.5f, z = pos.m_z / h - 0.5f;
+            d0(i, j, k) = sample(d, x, y, z);
+            t0(i, j, k) = sample(t, x, y, z);
+          }
+        }
+      }
+    }
+  }, 1);
+  d.data.swap(d0.data);
+  t.data.swap(t0.data);
+}
+
+// Protected
+// RK2 in blocks of particles. Particles are kept inside the domain and pushed
+// out of solids along the gradient of the solid phi
+void
+EulerGAS3D::advect_particles(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS3D", "advect_particles");
+  VFXEpoch::Parallel::ParallelFor(0, (int)particle_x.size(), [this](int begin, int end){
+    float h = user_params.h;
+    float dt = user_params.dt;
+    float size_x = d.getDimX() * h, size_y = d.getDimY() * h, size_z = d.getDimZ() * h;
+    for(int p = begin; p != end; p++){
+      Vector3Df pos = trace_rk2(Vector3Df(particle_x[p], particle_y[p], particle_z[p]), dt);
+      pos.m_x = std::max(0.0f, std::min(size_x, pos.m_x));
+      pos.m_y = std::max(0.0f, std::min(size_y, pos.m_y));
+      pos.m_z = std::max(0.0f, std::min(size_z, pos.m_z));
+      float x = pos.m_x / h, y = pos.m_y / h, z = pos.m_z / h;
+      float phi = sample(nodal_solid_phi, x, y, z);
+      if(phi < 0.0f){
+        float gx = sample(nodal_solid_phi, x + 0.5f, y, z) - sample(nodal_solid_phi, x - 0.5f, y, z);
+        float gy = sample(nodal_solid_phi, x, y + 0.5f, z) - sample(nodal_solid_phi, x, y - 0.5f, z);
+        float gz = sample(nodal_solid_phi, x, y, z + 0.5f) - sample(nodal_solid_phi, x, y, z - 0.5f);
+        float length = std::sqrt(gx * gx + gy * gy + gz * gz);
+        if(length > 0.0f){
+          pos.m_x -= phi * gx / length;
+          pos.m_y -= phi * gy / length;
+          pos.m_z -= phi * gz / length;
+        }
+      }
+      particle_x[p] = pos.m_x;
+      particle_y[p] = pos.m_y;
+      particle_z[p] = pos.m_z;
+    }
+  }, 1024);
+}
+
+// Protected
+// Dense smoke sinks, hot smoke rises along y
+void
+EulerGAS3D::apply_buoyancy(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS3D", "apply_buoyancy");
+  float a = user_params.buoyancy_alpha * user_params.dt;
+  float b = user_params.buoyancy_beta * user_params.dt;
+  if(0.0f == a && 0.0f == b) return;
+  VFXEpoch::Parallel::ParallelFor(0, (int)tile_begin.size(), [this, a, b](int first, int last){
+    for(int tile = first; tile != last; tile++){
+      const Vector3Di& lo = tile_begin[tile];
+      const Vector3Di& hi = tile_end[tile];
+      for(int i = lo.m_z; i != hi.m_z; i++){
+        for(int j = std::max(lo.m_y, 1); j != hi.m_y; j++){
+          for(int k = lo.m_x; k != hi.m_x; k++){
+            float density = 0.5f * (d(i, j, k) + d(i, j - 1, k));
+            float temperature = 0.5f * (t(i, j, k) + t(i, j - 1, k));
+            v(i, j, k) += b * temperature - a * density;
+          }
+        }
+      }
+    }
+  }, 1);
+}
+
+// Protected
+// Open fraction of every face, the domain walls are closed
+void
+EulerGAS3D::get_grid_weights(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS3D", "get_grid_weights");
+  const Grid3DfScalarField& n = nodal_solid_phi;
+  LOOP_GRID3D(uw){
+    bool wall = 0 == k || uw.getDimX() - 1 == k;
+    uw(i, j, k) = wall ? 0.0f : face_weight(n(i, j, k), n(i, j+1, k), n(i+1, j, k), n(i+1, j+1, k));
+  }
+  LOOP_GRID3D(vw){
+    bool wall = 0 == j || vw.getDimY() - 1 == j;
+    vw(i, j, k) = wall ? 0.0f : face_weight(n(i, j, k), n(i, j, k+1), n(i+1, j, k), n(i+1, j, k+1));
+  }
+  LOOP_GRID3D(ww){
+    bool wall = 0 == i || ww.getDimZ() - 1 == i;
+    ww(i, j, k) = wall ? 0.0f : face_weight(n(i, j, k), n(i, j, k+1), n(i, j+1, k), n(i, j+1, k+1));
+  }
+}
+
+// Protected
+// result = A x over every tile, dot_partial of a tile gets its part of x . Ax
+void
+EulerGAS3D::apply_laplacian(const vector<float>& x, vector<float>& result, vector<double>& partial){
+  VFXEpoch::Parallel::ParallelFor(0, (int)tile_begin.size(), [this, &x, &result, &partial](int first, int last){
+    int nx = d.getDimX(), ny = d.getDimY();
+    float scale = user_params.dt / (user_params.h * user_params.h);
+    size_t sy = nx, sz = (size_t)nx * ny;
+    for(int tile = first; tile != last; tile++){
+      const Vector3Di& b = tile_begin[tile];
+      const Vector3Di& e = tile_end[tile];
+      double dot = 0.0;
+      for(int i = b.m_z; i != e.m_z; i++){
+        for(int j = b.m_y; j != e.m_y; j++){
+          size_t c = i * sz + j * sy + b.m_x;
+          const float* wu = &uw.data[(i * ny + j) * (size_t)(nx + 1) + b.m_x];
+          const float* wv = &vw.data[(i * (ny + 1) + j) * (size_t)nx + b.m_x];
+          const float* ws = &ww.data[c];
+          for(int k = b.m_x; k != e.m_x; k++, c++, wu++, wv++, ws++){
+            float xc = x[c];
+            float sum = 0.0f;
+            if(wu[0] > 0.0f) sum += wu[0] * (xc - x[c - 1]);
+            if(wu[1] > 0.0f) sum += wu[1] * (xc - x[c + 1]);
+            if(wv[0] > 0.0f) sum += wv[0] * (xc - x[c - sy]);
+            if(wv[nx] > 0.0f) sum += wv[nx] * (xc - x[c + sy]);
+            if(ws[0] > 0.0f) sum += ws[0] * (xc - x[c - sz]);
+            if(ws[sz] > 0.0f) sum += ws[sz] * (xc - x[c + sz]);
+            result[c] = scale * sum;
+            dot += (double)xc * result[c];
+          }
+        }
+      }
+      partial[tile] = dot;
+    }
+  }, 1);
+}
+
+// Sum of the tile partials in tile order, the same for any number of threads
+static double
+reduce_sum(const vector<double>& partial){
+  double sum = 0.0;
+  for(size_t t = 0; t != partial.size(); t++) sum += partial[t];
+  return sum;
+}
+
+static double
+reduce_max(const vector<double>& partial){
+  double result = 0.0;
+  for(size_t t = 0; t != partial.size(); t++) result = std::max(result, partial[t]);
+  return result;
+}
+
+// Protected
+// Overload from SIM_Base.h -> class Euler_Fluid3D_Base
+// Matrix free Jacobi preconditioned conjugate gradient, warm started from the
+// pressure of the last step. Cells with no open face are left out
+void
+EulerGAS3D::pressure_solve(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS3D", "pressure_solve");
+  user_params.out_iterations = 0;
+  user_params.out_tolerance = 0.0;
+  if(tile_begin.empty()) return;
+
+  // residual = -div u - A pressure, diagonal of A and the largest |rhs|
+  apply_laplacian(pressure, aux, dot_partial);
+  VFXEpoch::Parallel::ParallelFor(0, (int)tile_begin.size(), [this](int first, int last){
+    int nx = d.getDimX(), ny = d.getDimY();
+    float h = user_params.h;
+    float scale = user_params.dt / (h * h);
+    for(int tile = first; tile != last; tile++){
+      const Vector3Di& b = tile_begin[tile];
+      const Vector3Di& e = tile_end[tile];
+      double largest = 0.0;
+      for(int i = b.m_z; i != e.m_z; i++){
+        for(int j = b.m_y; j != e.m_y; j++){
+          for(int k = b.m_x; k != e.m_x; k++){
+            size_t c = ((size_t)i * ny + j) * nx + k;
+            float w_left = uw(i, j, k), w_right = uw(i, j, k + 1);
+            float w_bottom = vw(i, j, k), w_top = vw(i, j + 1, k);
+            float w_back = ww(i, j, k), w_front = ww(i + 1, j, k);
+            diagonal[c] = scale * (w_left + w_right + w_bottom + w_top + w_back + w_front);
+            float div = (w_right * u(i, j, k + 1) - w_left * u(i, j, k) +
+                         w_top * v(i, j + 1, k) - w_bottom * v(i, j, k) +
+                         w_front * w(i + 1, j, k) - w_back * w(i, j, k)) / h;
+            largest = std::max(largest, (double)std::fabs(div));
+            residual[c] = diagonal[c] > 0.0f ? -div - aux[c] : 0.0f;
+          }
+        }
+      }
+      max_partial[tile] = largest;
+    }
+  }, 1);
+  double tolerance = std::max(user_params.min_tolerance, 1e-30) * reduce_max(max_partial);
+  if(0.0 == tolerance) return;
+
+  // Steps pressure and residual along the search direction, aux holds A s on
+  // the way in and z = M^-1 r on the way out. Also gives rho = r . z and the
+  // largest |r|
+  auto precondition = [this](float alpha){
+    VFXEpoch::Parallel::ParallelFor(0, (int)tile_begin.size(), [this, alpha](int first, int last){
+      int nx = d.getDimX(), ny = d.getDimY();
+      for(int tile = first; tile != last; tile++){
+        const Vector3Di& b = tile_begin[tile];
+        const Vector3Di& e = tile_end[tile];
+        double dot = 0.0, largest = 0.0;
+        for(int i = b.m_z; i != e.m_z; i++){
+          for(int j = b.m_y; j != e.m_y; j++){
+            size_t c = ((size_t)i * ny + j) * nx + b.m_x;
+            for(int k = b.m_x; k != e.m_x; k++, c++){
+              pressure[c] += alpha * search[c];
+              residual[c] -= alpha * aux[c];
+              aux[c] = diagonal[c] > 0.0f ? residual[c] / diagonal[c] : 0.0f;
+              dot += (double)residual[c] * aux[c];
+              largest = std::max(largest, (double)std::fabs(residual[c]));
+            }
+          }
+        }
+        dot_partial[tile] = dot;
+        max_partial[tile] = largest;
+      }
+    }, 1);
+  };
+
+  std::fill(aux.begin(), aux.end(), 0.0f);
+  std::fill(search.begin(), search.end(), 0.0f);
+  precondition(0.0f);
+  double residual_max = reduce_max(max_partial);
+  double rho = reduce_sum(dot_partial);
+  user_params.out_tolerance = residual_max;
+  if(residual_max <= tolerance) return;
+  search = aux;
+
+  for(int iteration = 1; iteration <= user_params.max_iterations; iteration++){
+    apply_laplacian(search, aux, dot_partial);
+    double sigma = reduce_sum(dot_partial);
+    if(0.0 == sigma) break;
+    precondition((float)(rho / sigma));
+    residual_max = reduce_max(max_partial);
+    user_params.out_iterations = iteration;
+    user_params.out_tolerance = residual_max;
+    if(residual_max <= tolerance) return;
+
+    double rho_new = reduce_sum(dot_partial);
+    float beta = (float)(rho_new / rho);
+    rho = rho_new;
+    VFXEpoch::Parallel::ParallelFor(0, (int)search.size(), [this, beta](int begin, int end){
+      for(int c = begin; c != end; c++) search[c] = aux[c] + beta * search[c];
+    });
+  }
+
+  #ifdef __linux__
+  std:: cout << "\033[1;33mWARNING: Pressure solve failed!\033[0m" << endl;
+  #elif __WIN32__
+  std::cout <<  "WARNING: Pressure solve failed!" << endl;
+  #endif
+}
+
+// Protected
+// Open faces get the pressure gradient, closed ones no flow
+void
+EulerGAS3D::apply_gradients(){
+  VFXEPOCH_TRACE_SCOPE("EulerGAS3D", "apply_gradients");
+  VFXEpoch::Parallel::ParallelFor(0, (int)tile_begin.size(), [this](int first, int last){
+    int nx = d.getDimX(), ny = d.getDimY(), nz = d.getDimZ();
+    float scale = user_params.dt / user_params.h;
+    size_t sy = nx, sz = (size_t)nx * ny;
+    for(int tile = first; tile != last; tile++){
+      const Vector3Di& b = tile_begin[tile];
+      const Vector3Di& e = tile_end[tile];
+      for(int i = b.m_z; i != e.m_z; i++){
+        for(int j = b.m_y; j != e.m_y; j++){
+          for(int k = b.m_x; k != tile_last(e.m_x, nx, nx + 1); k++){
+            size_t c = i * sz + j * sy + k;
+            u(i, j, k) = uw(i, j, k) > 0.0f ? u(i, j, k) - scale * (pressure[c] - pressure[c - 1]) : 0.0f;
+          }
+        }
+      }
+      for(int i = b.m_z; i != e.m_z; i++){
+        for(int j = b.m_y; j != tile_last(e.m_y, ny, ny + 1); j++){
+          for(int k = b.m_x; k != e.m_x; k++){
+            size_t c = i * sz + j * sy + k;
+            v(i, j, k) = vw(i, j, k) > 0.0f ? v(i, j, k) - scale * (pressure[c] - pressure[c - sy]) : 0.0f;
+          }
+        }
+      }
+      for(int i = b.m_z; i != tile_last(e.m_z, nz, nz + 1); i++){
+        for(int j = b.m_y; j != e.m_y; j++){
+          for(int k = b.m_x; k != e.m_x; k++){
+            size_t c = i * sz + j * sy + k;
+            w(i, j, k) = ww(i, j, k) > 0.0f ? w(i, j, k) - scale * (pressure[c] - pressure[c - sz]) : 0.0f;
+          }
+        }
+      }
+    }
+  }, 1);
+}
+
+// Protected
+Vector3Df
+EulerGAS3D::trace_rk2(const Vector3Df& pos, float dt) const {
+  Vector3Df vel = get_vel(pos);
+  vel = get_vel(Vector3Df(pos.m_x + 0.5f * dt * vel.m_x, pos.m_y + 0.5f * dt * vel.m_y, pos.m_z + 0.5f * dt * vel.m_z));
+  return Vector3Df(pos.m_x + dt * vel.m_x, pos.m_y + dt * vel.m_y, pos.m_z + dt * vel.m_z);
+}
+
+// Protected
+Vector3Df
+EulerGAS3D::get_vel(const Vector3Df& pos) const {
+  assert(user_params.h != 0);
+  float x = pos.m_x / user_params.h, y = pos.m_y / user_params.h, z = pos.m_z / user_params.h;
+  return Vector3Df(sample(u, x, y - 0.5f, z - 0.5f),
+                   sample(v, x - 0.5f, y, z - 0.5f),
+                   sample(w, x - 0.5f, y - 0.5f, z));
+}
@@ -0,0 +1,167 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Smoke on a 3D MAC grid.
+*
+* The same model as EulerGAS2D: density and temperature sources, buoyancy,
+* static solids given by a nodal signed distance and passive particles. Every
+* grid pass works on 8 x 8 x 8 tiles of cells that run in parallel, so a
+* thread streams through a few pages of each field at a time.
+*
+* The pressure solve never builds a matrix. The Poisson operator is applied
+* from the face weights on the fly inside a Jacobi preconditioned conjugate
+* gradient; dot products are summed per tile and the tiles added in a fixed
+* order, so the solve gives the same result on any number of threads.
+*
+* Grids follow Grid3D: (i, j, k) is (z, y, x), y is up.
+*******************************************************************************/
+#ifndef _SIM_EULER_GAS_3D_H_
+#define _SIM_EULER_GAS_3D_H_
+
+#include "fluids/euler/SIM_FluidBase.h"
+#include "utl/UTL_Trace.h"
+#include "utl/UTL_Parallel.h"
+#include "utl/UTL_DistanceField.h"
+
+using namespace VFXEpoch;
+using namespace VFXEpoch::Solvers;
+
+namespace VFXEpoch{
+  namespace Solvers{
+
+    class EulerGAS3D : public Euler_Fluid3D_Base{
+    /***************************** User Parameters *****************************/
+    public:
+      struct Parameters{
+      public:
+        Parameters(){ clear(); }
+        Parameters(Vector3Df _origin, Vector3Di _dimension, double _h, double _dt,
+                   double _buoyancy_alpha, double _buoyancy_beta, double _min_tolerance,
+                   int _max_iterations, double _density_source, double _temperature_source):
+                   origin(_origin), dimension(_dimension), h(_h), dt(_dt),
+                   buoyancy_alpha(_buoyancy_alpha), buoyancy_beta(_buoyancy_beta),
+                   out_tolerance(0.0), min_tolerance(_min_tolerance),
+                   density_source(_density_source), temperature_source(_temperature_source),
+                   max_iterations(_max_iterations), out_iterations(0){}
+      public:
+        inline void clear(){
+          origin.m_x = origin.m_y = origin.m_z = 0.0f;
+          dimension.m_x = dimension.m_y = dimension.m_z = 0;
+          h = 0.0;
+          dt = 0.0;
+          buoyancy_alpha = buoyancy_beta = 0.0;
+          min_tolerance = out_tolerance = 0.0;
+          density_source = temperature_source = 0.0;
+          max_iterations = out_iterations = 0;
+        }
+
+        friend inline ostream&
+        operator<<(ostream& os, const Parameters& params) {
+          os << std::setprecision(6) << setiosflags(ios::fixed);
+          os << "Origin = (" << params.origin.m_x << ", " << params.origin.m_y << ", " << params.origin.m_z << ")" << endl;
+          os << "Dimension = " << params.dimension.m_x << " x " << params.dimension.m_y << " x " << params.dimension.m_z << endl;
+          os << "Increment h = " << params.h << endl;
+          os << "Time step = " << params.dt << endl;
+          os << "Buoyancy alpha & beta = "
+             << params.buoyancy_alpha << ", "
+             << params.buoyancy_beta << endl;
+          os << "Density source = " << params.density_source << endl;
+          os << "Temperature source = " << params.temperature_source << endl;
+          os << "Maximum iterations in pressure solver = " << params.max_iterations << endl;
+          os << "Minimum tolerance in pressure solver = " << params.min_tolerance << endl;
+          return os;
+        }
+      public:
+        Vector3Df origin;
+        Vector3Di dimension;
+        double h;
+        double dt;
+        double buoyancy_alpha, buoyancy_beta;
+        double out_tolerance;
+        double min_tolerance;
+        double density_source;
+        double temperature_source;
+        int max_iterations;
+        int out_iterations;
+      };
+    /***************************** User Parameters END *************************/
+
+    public:
+      EulerGAS3D();
+      EulerGAS3D(Parameters _user_params);
+      ~EulerGAS3D();
+    public:
+      bool init(Parameters params); // Overload
+      void step(); // Overload
+      void close(); // Overload
+      void set_verbose(bool _verbose);
+      // Cell (i, j, k) = (z, y, x) is set to the density and temperature source every step
+      void set_source_location(int i, int j, int k);
+      void add_particles(VFXEpoch::Particle3Df p);
+      // Positions and colors, the velocity is the grid velocity at the particle
+      vector<VFXEpoch::Particle3Df> get_particles();
+      int get_particle_count() const;
+
+      // About boundaries
+    public:
+      // Solids are where the nodal phi < 0, the domain walls are always closed
+      void set_static_boundary(float (*phi)(const VFXEpoch::Vector3Df&));
+      void set_static_boundary(const Grid3DfScalarField& phi);
+      // Nodal occupancy, nonzero is solid. The distance is built by fast sweeping
+      void set_static_boundary(const Grid3DiScalarField& occupancy);
+      // Closed triangle mesh in world space, voxelized through its BVH
+      void set_static_boundary(const VFXEpoch::TriangleBVH& obstacle);
+
+    public:
+      EulerGAS3D::Parameters get_user_params() const;
+      Vector3Df get_grid_velocity(VFXEpoch::Vector3Df pos);
+      const Grid3DfScalarField& get_density() const;
+      const Grid3DfScalarField& get_temperature() const;
+
+    protected:
+      void add_source(); // Overload
+      void advect_vel();
+      void advect_scalars();
+      void advect_particles();
+      void apply_buoyancy();
+      void get_grid_weights();
+      void pressure_solve(); // Overload
+      void apply_gradients();
+      void apply_laplacian(const vector<float>& x, vector<float>& result, vector<double>& dot_partial);
+      Vector3Df trace_rk2(const Vector3Df& pos, float dt) const;
+      Vector3Df get_vel(const Vector3Df& pos) const;
+    private:
+      // Cells of tile t are [tile_begin[t], tile_end[t]) along z, y and x
+      vector<Vector3Di> tile_begin, tile_end;
+      Grid3DfScalarField u, u0;
+      Grid3DfScalarField v, v0;
+      Grid3DfScalarField w, w0;
+      Grid3DfScalarField uw, vw, ww;
+      Grid3DfScalarField d, d0;
+      Grid3DfScalarField t, t0;
+      Grid3DfScalarField nodal_solid_phi;
+      vector<VFXEpoch::Vector3Di> source_locations;
+
+      // Particles, one array per coordinate
+      vector<float> particle_x, particle_y, particle_z;
+      vector<VFXEpoch::Vector3Df> particle_color;
+
+      // Conjugate gradient vectors over all cells and the per tile partial sums
+      vector<float> pressure, residual, search, aux, diagonal;
+      vector<double> dot_partial, max_partial;
+
+      Parameters user_params;
+      bool verbose;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,605 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "SIM_EulerLiquid.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Smallest fraction of a cell the surface is allowed to sit from a liquid
+// cell centre, keeps the ghost fluid coefficients bounded
+static const float MIN_THETA = 0.01f;
+
+// Public
+EulerLiquid2D::EulerLiquid2D(){
+  user_params.clear();
+  verbose = true;
+  visit_epoch = 0;
+}
+
+// Public
+EulerLiquid2D::EulerLiquid2D(Parameters _user_params){
+  verbose = true;
+  init(_user_params);
+}
+
+// Public
+EulerLiquid2D::~EulerLiquid2D(){
+  close();
+}
+
+// Public
+// Overload from SIM_Base.h -> class Euler_Fluid2D_Base
+bool
+EulerLiquid2D::init(Parameters params){
+  user_params = params;
+  int nx = user_params.dimension.m_x, ny = user_params.dimension.m_y;
+  float h = user_params.h;
+  u.Reset(nx + 1, ny, h, h); u0 = u; uw = u;
+  v.Reset(nx, ny + 1, h, h); v0 = v; vw = v;
+  u_valid.Reset(nx + 1, ny, h, h);
+  v_valid.Reset(nx, ny + 1, h, h);
+
+  // No liquid and no solids to begin with
+  float limit = user_params.band_width * h;
+  phi.Reset(nx, ny, h, h);
+  std::fill(phi.data.begin(), phi.data.end(), limit); phi0 = phi;
+  nodal_solid_phi.Reset(nx + 1, ny + 1, h, h);
+  std::fill(nodal_solid_phi.data.begin(), nodal_solid_phi.data.end(), limit);
+
+  band_cells.clear(); active_cells.clear(); fluid_cells.clear();
+  u_faces.clear(); v_faces.clear();
+  fluid_index.assign(nx * ny, -1);
+  visited.assign(nx * ny, 0);
+  visit_epoch = 0;
+  get_grid_weights();
+  return true;
+}
+
+// Public
+// Overload from SIM_Base.h -> class Euler_Fluid2D_Base
+void
+EulerLiquid2D::step(){
+  VFXEPOCH_TRACE_SCOPE("EulerLiquid2D", "step");
+  if(verbose) cout << "--> Advect level set" << endl;
+  advect_phi();
+  redistance();
+  build_active();
+  if(verbose) cout << "--> Advect velocity (Self-Advection)" << endl;
+  advect_vel();
+  add_gravity();
+  if(verbose) cout << "--> Solving pressure over " << fluid_cells.size() << " liquid cells" << endl;
+  pressure_solve();
+  apply_gradients();
+  if(verbose){
+    cout << "--> Pressure linear solver (pcg) outputs:" << endl;
+    cout << " ->  Tolerance:" << user_params.out_tolerance << endl;
+    cout << " ->  iterations:" << user_params.out_iterations << endl;
+    cout << "--> Extrapolating velocity" << endl;
+  }
+  extrapolate_vel();
+  constrain_vel();
+}
+
+// Public
+// Overload from SIM_Base.h -> class Euler_Fluid2D_Base
+void
+EulerLiquid2D::close(){
+  u.clear(); u0.clear();
+  v.clear(); v0.clear();
+  uw.clear(); vw.clear();
+  phi.clear(); phi0.clear();
+  nodal_solid_phi.clear();
+  u_valid.clear(); v_valid.clear();
+  band_cells.clear(); active_cells.clear(); fluid_cells.clear();
+  u_faces.clear(); v_faces.clear();
+  fluid_index.clear(); visited.clear();
+  pcg_solver.clear();
+  sparse_matrix.clear();
+  rhs.clear(); pressure.clear();
+  user_params.clear();
+}
+
+// Public
+// Turns the per stage progress messages of step() on or off
+void
+EulerLiquid2D::set_verbose(bool _verbose){
+  verbose = _verbose;
+}
+
+// Public
+void
+EulerLiquid2D::add_liquid(float (*liquid_phi)(const VFXEpoch::Vector2Df&)){
+  float h = user_params.h;
+  float limit = user_params.band_width * h;
+  band_cells.clear();
+  LOOP_GRID2D(phi){
+    VFXEpoch::Vector2Df position((j+0.5f) * h, (i+0.5f) * h);
+    float value = std::min(phi(i, j), liquid_phi(position + user_params.origin));
+    phi(i, j) = std::max(-limit, std::min(limit, value));
+    // The caller's phi need not be a distance, search the whole grid once
+    int c = i * phi.getDimX() + j;
+    band_cells.push_back(c);
+    // Seeds build_active with liquid that may have no surface in the band
+    if(phi(i, j) < 0.0f && fluid_index[c] < 0) fluid_cells.push_back(c);
+  }
+  redistance();
+  build_active();
+}
+
+// Public
+void
+EulerLiquid2D::set_static_boundary(float (*solid_phi)(const VFXEpoch::Vector2Df&)){
+  LOOP_GRID2D(nodal_solid_phi){
+    VFXEpoch::Vector2Df position(j * user_params.h, i * user_params.h);
+    nodal_solid_phi(i, j) = solid_phi(position + user_params.origin);
+  }
+  get_grid_weights();
+}
+
+// Public
+// Nodal solid signed distance sampled by the caller, (m_x + 1) x (m_y + 1)
+void
+EulerLiquid2D::set_static_boundary(const Grid2DfScalarField& solid_phi){
+  assert(solid_phi.getDimX() == nodal_solid_phi.getDimX() && solid_phi.getDimY() == nodal_solid_phi.getDimY());
+  nodal_solid_phi = solid_phi;
+  get_grid_weights();
+}
+
+// Public
+EulerLiquid2D::Parameters
+EulerLiquid2D::get_user_params() const {
+  return user_params;
+}
+
+// Public
+Vector2Df
+EulerLiquid2D::get_grid_velocity(VFXEpoch::Vector2Df pos){
+  return get_vel(pos);
+}
+
+// Public
+const Grid2DfScalarField&
+EulerLiquid2D::get_liquid_phi() const {
+  return phi;
+}
+
+// Public
+int
+EulerLiquid2D::get_fluid_cell_count() const {
+  return (int)fluid_cells.size();
+}
+
+// Public
+int
+EulerLiquid2D::get_band_cell_count() const {
+  return (int)band_cells.size();
+}
+
+// Protected
+// Rebuilds the narrow band from the cells next to a sign change. Those keep
+// their advected value, the layers around them are filled outwards with the
+// first order eikonal update from the layers already done. Cells the search
+// does not reach leave the band and are clamped to the band width
+void
+EulerLiquid2D::redistance(){
+  VFXEPOCH_TRACE_SCOPE("EulerLiquid2D", "redistance");
+  int nx = phi.getDimX(), ny = phi.getDimY();
+  float h = user_params.h;
+  float limit = user_params.band_width * h;
+  float* p = &phi.data[0];
+  visit_epoch += 2;
+  unsigned int known = visit_epoch, queued = visit_epoch + 1;
+
+  vector<int> frontier, next;
+  for(size_t k = 0; k != band_cells.size(); k++){
+    int c = band_cells[k];
+    int i = c / nx, j = c % nx;
+    bool inside = p[c] < 0.0f;
+    bool surface = (j > 0 && (p[c - 1] < 0.0f) != inside) || (j + 1 < nx && (p[c + 1] < 0.0f) != inside) ||
+                   (i > 0 && (p[c - nx] < 0.0f) != inside) || (i + 1 < ny && (p[c + nx] < 0.0f) != inside);
+    if(!surface) continue;
+    p[c] = inside ? std::max(p[c], -h) : std::min(p[c], h);
+    visited[c] = known;
+    frontier.push_back(c);
+  }
+
+  vector<int> reached(frontier);
+  vector<float> distance;
+  for(int layer = 1; layer <= user_params.band_width && !frontier.empty(); layer++){
+    next.clear();
+    for(size_t k = 0; k != frontier.size(); k++){
+      int c = frontier[k];
+      int i = c / nx, j = c % nx;
+      int neighbours[4] = {j > 0 ? c - 1 : -1, j + 1 < nx ? c + 1 : -1, i > 0 ? c - nx : -1, i + 1 < ny ? c + nx : -1};
+      for(int n = 0; n != 4; n++){
+        if(neighbours[n] < 0 || visited[neighbours[n]] >= known) continue;
+        visited[neighbours[n]] = queued;
+        next.push_back(neighbours[n]);
+      }
+    }
+
+    // Every cell of a layer only reads the layers before it
+    distance.resize(next.size());
+    for(size_t k = 0; k != next.size(); k++){
+      int c = next[k];
+      int i = c / nx, j = c % nx;
+      float a = limit, b = limit;
+      if(j > 0 && known == visited[c - 1]) a = std::min(a, std::fabs(p[c - 1]));
+      if(j + 1 < nx && known == visited[c + 1]) a = std::min(a, std::fabs(p[c + 1]));
+      if(i > 0 && known == visited[c - nx]) b = std::min(b, std::fabs(p[c - nx]));
+      if(i + 1 < ny && known == visited[c + nx]) b = std::min(b, std::fabs(p[c + nx]));
+      float d = std::fabs(a - b) >= h ? std::min(a, b) + h : 0.5f * (a + b + std::sqrt(2.0f * h * h - (a - b) * (a - b)));
+      distance[k] = std::min(d, limit);
+    }
+    for(size_t k = 0; k != next.size(); k++){
+      int c = next[k];
+      p[c] = p[c] < 0.0f ? -distance[k] : distance[k];
+      visited[c] = known;
+    }
+    reached.insert(reached.end(), next.begin(), next.end());
+    frontier.swap(next);
+  }
+
+  for(size_t k = 0; k != band_cells.size(); k++){
+    int c = band_cells[k];
+    if(known != visited[c]) p[c] = p[c] < 0.0f ? -limit : limit;
+  }
+  band_cells.clear();
+  for(size_t k = 0; k != reached.size(); k++){
+    if(std::fabs(p[reached[k]]) < limit) band_cells.push_back(reached[k]);
+  }
+}
+
+// Protected
+// Active cells are the liquid and the band. They are found by a flood fill from
+// the band and the liquid of the last step, so the cost follows the liquid
+// volume, and kept in row order so the pressure system does not depend on the
+// search. Each active cell owns its left and bottom face, and its right and top
+// face where the neighbour is not active
+void
+EulerLiquid2D::build_active(){
+  VFXEPOCH_TRACE_SCOPE("EulerLiquid2D", "build_active");
+  int nx = phi.getDimX(), ny = phi.getDimY();
+  float limit = user_params.band_width * user_params.h;
+  const float* p = &phi.data[0];
+  visit_epoch += 2;
+  unsigned int found = visit_epoch;
+
+  // Every found cell widens the column span of its row
+  vector<int> stack, first(ny, nx), last(ny, -1);
+  for(size_t k = 0; k != band_cells.size(); k++){
+    int c = band_cells[k];
+    if(found == visited[c]) continue;
+    visited[c] = found;
+    stack.push_back(c);
+  }
+  for(size_t k = 0; k != fluid_cells.size(); k++){
+    int c = fluid_cells[k];
+    fluid_index[c] = -1;
+    if(p[c] >= limit || found == visited[c]) continue;
+    visited[c] = found;
+    stack.push_back(c);
+  }
+  // Liquid that left the band or grew past the last step's liquid
+  while(!stack.empty()){
+    int c = stack.back();
+    stack.pop_back();
+    int i = c / nx, j = c % nx;
+    first[i] = std::min(first[i], j);
+    last[i] = std::max(last[i], j);
+    int neighbours[4] = {j > 0 ? c - 1 : -1, j + 1 < nx ? c + 1 : -1, i > 0 ? c - nx : -1, i + 1 < ny ? c + nx : -1};
+    for(int n = 0; n != 4; n++){
+      if(neighbours[n] < 0 || found == visited[neighbours[n]] || p[neighbours[n]] >= limit) continue;
+      visited[neighbours[n]] = found;
+      stack.push_back(neighbours[n]);
+    }
+  }
+  active_cells.clear();
+  for(int i = 0; i != ny; i++){
+    for(int c = i * nx + first[i]; c <= i * nx + last[i]; c++){
+      if(found == visited[c]) active_cells.push_back(c);
+    }
+  }
+
+  // A face that leaves the active set must not stay valid, extrapolation reads
+  // the stamps of neighbours outside the face lists. apply_gradients stamps
+  // the new faces again
+  for(size_t k = 0; k != u_faces.size(); k++) u_valid.data[u_faces[k]] = 0;
+  for(size_t k = 0; k != v_faces.size(); k++) v_valid.data[v_faces[k]] = 0;
+  fluid_cells.clear();
+  u_faces.clear(); v_faces.clear();
+  for(size_t k = 0; k != active_cells.size(); k++){
+    int c = active_cells[k];
+    int i = c / nx, j = c % nx;
+    if(p[c] < 0.0f){
+      fluid_index[c] = (int)fluid_cells.size();
+      fluid_cells.push_back(c);
+    }
+    u_faces.push_back(i * (nx + 1) + j);
+    if(j + 1 == nx || p[c + 1] >= limit) u_faces.push_back(i * (nx + 1) + j + 1);
+    v_faces.push_back(i * nx + j);
+    if(i + 1 == ny || p[c + nx] >= limit) v_faces.push_back((i + 1) * nx + j);
+  }
+}
+
+// Protected
+void
+EulerLiquid2D::advect_phi(){
+  VFXEPOCH_TRACE_SCOPE("EulerLiquid2D", "advect_phi");
+  VFXEpoch::Parallel::ParallelFor(0, (int)band_cells.size(), [this](int begin, int end){
+    int nx = phi.getDimX();
+    float h = user_params.h;
+    for(int k = begin; k != end; k++){
+      int c = band_cells[k];
+      VFXEpoch::Vector2Df pos((c % nx + 0.5f) * h, (c / nx + 0.5f) * h);
+      phi0.data[c] = get_phi(trace_rk2(pos, -user_params.dt));
+    }
+  });
+  VFXEpoch::Parallel::ParallelFor(0, (int)band_cells.size(), [this](int begin, int end){
+    for(int k = begin; k != end; k++) phi.data[band_cells[k]] = phi0.data[band_cells[k]];
+  });
+}
+
+// Protected
+void
+EulerLiquid2D::advect_vel(){
+  VFXEPOCH_TRACE_SCOPE("EulerLiquid2D", "advect_vel");
+  // Active faces only read u and v while u0 and v0 are written
+  VFXEpoch::Parallel::ParallelFor(0, (int)u_faces.size(), [this](int begin, int end){
+    int stride = u.getDimX();
+    float h = user_params.h;
+    for(int k = begin; k != end; k++){
+      int f = u_faces[k];
+      VFXEpoch::Vector2Df pos((f % stride) * h, (f / stride + 0.5f) * h);
+      u0.data[f] = get_vel(trace_rk2(pos, -user_params.dt)).m_x;
+    }
+  });
+  VFXEpoch::Parallel::ParallelFor(0, (int)v_faces.size(), [this](int begin, int end){
+    int stride = v.getDimX();
+    float h = user_params.h;
+    for(int k = begin; k != end; k++){
+      int f = v_faces[k];
+      VFXEpoch::Vector2Df pos((f % stride + 0.5f) * h, (f / stride) * h);
+      v0.data[f] = get_vel(trace_rk2(pos, -user_params.dt)).m_y;
+    }
+  });
+  VFXEpoch::Parallel::ParallelFor(0, (int)u_faces.size(), [this](int begin, int end){
+    for(int k = begin; k != end; k++) u.data[u_faces[k]] = u0.data[u_faces[k]];
+  });
+  VFXEpoch::Parallel::ParallelFor(0, (int)v_faces.size(), [this](int begin, int end){
+    for(int k = begin; k != end; k++) v.data[v_faces[k]] = v0.data[v_faces[k]];
+  });
+}
+
+// Protected
+void
+EulerLiquid2D::add_gravity(){
+  VFXEPOCH_TRACE_SCOPE("EulerLiquid2D", "add_gravity");
+  float dv = (float)(user_params.gravity * user_params.dt);
+  VFXEpoch::Parallel::ParallelFor(0, (int)v_faces.size(), [this, dv](int begin, int end){
+    for(int k = begin; k != end; k++) v.data[v_faces[k]] += dv;
+  });
+}
+
+// Protected
+// Open fraction of every face, the domain walls are closed
+void
+EulerLiquid2D::get_grid_weights(){
+  VFXEPOCH_TRACE_SCOPE("EulerLiquid2D", "get_grid_weights");
+  LOOP_GRID2D(uw){
+    bool wall = 0 == j || uw.getDimX() - 1 == j;
+    uw(i, j) = wall ? 0.0f : 1 - VFXEpoch::InteralFrac(nodal_solid_phi(i+1, j), nodal_solid_phi(i, j));
+  }
+
+  LOOP_GRID2D(vw){
+    bool wall = 0 == i || vw.getDimY() - 1 == i;
+    vw(i, j) = wall ? 0.0f : 1 - VFXEpoch::InteralFrac(nodal_solid_phi(i, j+1), nodal_solid_phi(i, j));
+  }
+}
+
+// Protected
+// Overload from SIM_Base.h -> class Euler_Fluid2D_Base
+// One unknown per liquid cell. A neighbour across the surface is a ghost
+// cell with zero pressure at the interpolated surface position theta
+void
+EulerLiquid2D::pressure_solve(){
+  VFXEPOCH_TRACE_SCOPE("EulerLiquid2D", "pressure_solve");
+  int system_size = (int)fluid_cells.size();
+  user_params.out_iterations = 0;
+  user_params.out_tolerance = 0.0;
+  rhs.assign(system_size, 0.0);
+  pressure.assign(system_size, 0.0);
+  if(0 == system_size) return;
+  sparse_matrix.resize(system_size);
+  sparse_matrix.zero();
+
+  int nx = phi.getDimX();
+  float h = user_params.h;
+  double scale = user_params.dt / ((double)h * h);
+  const float* p = &phi.data[0];
+  for(int k = 0; k != system_size; k++){
+    int c = fluid_cells[k];
+    int i = c / nx, j = c % nx;
+    // Right, left, top and bottom face: open fraction, velocity, neighbour, outward sign
+    float w[4] = {uw(i, j + 1), uw(i, j), vw(i + 1, j), vw(i, j)};
+    float vel[4] = {u(i, j + 1), u(i, j), v(i + 1, j), v(i, j)};
+    int neighbour[4] = {c + 1, c - 1, c + nx, c - nx};
+    float sign[4] = {1.0f, -1.0f, 1.0f, -1.0f};
+    double diagonal = 0.0;
+    for(int f = 0; f != 4; f++){
+      if(w[f] <= 0.0f) continue;
+      rhs[k] -= sign[f] * w[f] * vel[f] / h;
+      int n = neighbour[f];
+      if(p[n] < 0.0f){
+        diagonal += w[f] * scale;
+        sparse_matrix.add_to_element(k, fluid_index[n], -w[f] * scale);
+      } else {
+        float theta = std::max(MIN_THETA, p[c] / (p[c] - p[n]));
+        diagonal += w[f] * scale / theta;
+      }
+    }
+    sparse_matrix.add_to_element(k, k, diagonal);
+  }
+
+  pcg_solver.set_solver_parameters(user_params.min_tolerance, user_params.max_iterations);
+  bool success = pcg_solver.solve(sparse_matrix, rhs, pressure, user_params.out_tolerance, user_params.out_iterations);
+  if(!success){
+    #ifdef __linux__
+    std:: cout << "\033[1;33mWARNING: Pressure solve failed!\033[0m" << endl;
+    #elif __WIN32__
+    std::cout <<  "WARNING: Pressure solve failed!" << endl;
+    #endif
+  }
+}
+
+// Protected
+// Faces with liquid on at least one side get the pressure gradient and become
+// valid, every other active face is cleared for extrapolation
+void
+EulerLiquid2D::apply_gradients(){
+  VFXEPOCH_TRACE_SCOPE("EulerLiquid2D", "apply_gradients");
+  float scale = user_params.dt / user_params.h;
+  VFXEpoch::Parallel::ParallelFor(0, (int)u_faces.size(), [this, scale](int begin, int end){
+    int nx = phi.getDimX(), stride = u.getDimX();
+    for(int k = begin; k != end; k++){
+      int f = u_faces[k];
+      int i = f / stride, j = f % stride;
+      int valid = 0;
+      if(uw.data[f] > 0.0f){
+        float left = phi.data[i * nx + j - 1], right = phi.data[i * nx + j];
+        if(left < 0.0f || right < 0.0f){
+          double p_left = left < 0.0f ? pressure[fluid_index[i * nx + j - 1]] : 0.0;
+          double p_right = right < 0.0f ? pressure[fluid_index[i * nx + j]] : 0.0;
+          float theta = 1.0f;
+          if(left >= 0.0f) theta = std::max(MIN_THETA, right / (right - left));
+          if(right >= 0.0f) theta = std::max(MIN_THETA, left / (left - right));
+          u.data[f] -= (float)(scale * (p_right - p_left) / theta);
+          valid = 1;
+        }
+      }
+      if(!valid) u.data[f] = 0.0f;
+      u_valid.data[f] = valid;
+    }
+  });
+
+  VFXEpoch::Parallel::ParallelFor(0, (int)v_faces.size(), [this, scale](int begin, int end){
+    int nx = phi.getDimX();
+    for(int k = begin; k != end; k++){
+      int f = v_faces[k];
+      int i = f / nx, j = f % nx;
+      int valid = 0;
+      if(vw.data[f] > 0.0f){
+        float bottom = phi.data[(i - 1) * nx + j], top = phi.data[i * nx + j];
+        if(bottom < 0.0f || top < 0.0f){
+          double p_bottom = bottom < 0.0f ? pressure[fluid_index[(i - 1) * nx + j]] : 0.0;
+          double p_top = top < 0.0f ? pressure[fluid_index[i * nx + j]] : 0.0;
+          float theta = 1.0f;
+          if(bottom >= 0.0f) theta = std::max(MIN_THETA, top / (top - bottom));
+          if(top >= 0.0f) theta = std::max(MIN_THETA, bottom / (bottom - top));
+          v.data[f] -= (float)(scale * (p_top - p_bottom) / theta);
+          valid = 1;
+        }
+      }
+      if(!valid) v.data[f] = 0.0f;
+      v_valid.data[f] = valid;
+    }
+  });
+}
+
+// Averages the known neighbours of every unknown active face, band_width
+// layers deep. A face filled in layer l is stamped l + 1 and only read from
+// layer l + 1 on
+static void
+extrapolate_faces(Grid2DfScalarField& vel, Grid2DfScalarField& scratch, Grid2DiScalarField& valid,
+                  const vector<int>& faces, int layers){
+  vector<unsigned char> filled(faces.size());
+  int nx = vel.getDimX(), ny = vel.getDimY();
+  for(int layer = 1; layer <= layers; layer++){
+    VFXEpoch::Parallel::ParallelFor(0, (int)faces.size(), [&](int begin, int end){
+      for(int k = begin; k != end; k++){
+        int f = faces[k];
+        filled[k] = 0;
+        if(valid.data[f]) continue;
+        int i = f / nx, j = f % nx;
+        int neighbours[4] = {j > 0 ? f - 1 : -1, j + 1 < nx ? f + 1 : -1, i > 0 ? f - nx : -1, i + 1 < ny ? f + nx : -1};
+        float sum = 0.0f;
+        int count = 0;
+        for(int n = 0; n != 4; n++){
+          if(neighbours[n] < 0) continue;
+          int stamp = valid.data[neighbours[n]];
+          if(stamp > 0 && stamp <= layer){
+            sum += vel.data[neighbours[n]];
+            ++count;
+          }
+        }
+        if(count > 0){
+          scratch.data[f] = sum / (float)count;
+          filled[k] = 1;
+        }
+      }
+    });
+    VFXEpoch::Parallel::ParallelFor(0, (int)faces.size(), [&](int begin, int end){
+      for(int k = begin; k != end; k++){
+        if(!filled[k]) continue;
+        vel.data[faces[k]] = scratch.data[faces[k]];
+        valid.data[faces[k]] = layer + 1;
+      }
+    });
+  }
+}
+
+// Protected
+void
+EulerLiquid2D::extrapolate_vel(){
+  VFXEPOCH_TRACE_SCOPE("EulerLiquid2D", "extrapolate_vel");
+  extrapolate_faces(u, u0, u_valid, u_faces, user_params.band_width);
+  extrapolate_faces(v, v0, v_valid, v_faces, user_params.band_width);
+}
+
+// Protected
+// Solids are static, closed faces carry no flow
+void
+EulerLiquid2D::constrain_vel(){
+  VFXEPOCH_TRACE_SCOPE("EulerLiquid2D", "constrain_vel");
+  VFXEpoch::Parallel::ParallelFor(0, (int)u_faces.size(), [this](int begin, int end){
+    for(int k = begin; k != end; k++){
+      if(0.0f == uw.data[u_faces[k]]) u.data[u_faces[k]] = 0.0f;
+    }
+  });
+  VFXEpoch::Parallel::ParallelFor(0, (int)v_faces.size(), [this](int begin, int end){
+    for(int k = begin; k != end; k++){
+      if(0.0f == vw.data[v_faces[k]]) v.data[v_faces[k]] = 0.0f;
+    }
+  });
+}
+
+// Protected
+Vector2Df
+EulerLiquid2D::trace_rk2(const Vector2Df& pos, float dt){
+  Vector2Df vel = get_vel(pos);
+  vel = get_vel(pos + 0.5f * dt * vel);
+  return Vector2Df(pos + dt * vel);
+}
+
+// Protected
+Vector2Df
+EulerLiquid2D::get_vel(const Vector2Df& pos){
+  assert(user_params.h != 0);
+  float _u = VFXEpoch::InterpolateGrid(pos / (float)user_params.h - Vector2Df(0.0f, 0.5f), u);
+  float _v = VFXEpoch::InterpolateGrid(pos / (float)user_params.h - Vector2Df(0.5f, 0.0f), v);
+  return Vector2Df(_u, _v);
+}
+
+// Protected
+float
+EulerLiquid2D::get_phi(const Vector2Df& pos){
+  assert(user_params.h != 0);
+  float h = user_params.h;
+  return VFXEpoch::InterpolateGrid(pos / h - Vector2Df(0.5f, 0.5f), phi);
+}
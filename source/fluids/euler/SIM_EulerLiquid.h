@@ -0,0 +1,161 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Free surface liquid on a MAC grid.
+*
+* The liquid is the negative region of a signed distance field stored at cell
+* centres. The field is only kept accurate in a narrow band of band_width
+* cells around the surface, everything further away is clamped to plus or
+* minus the band width. Each step the solver collects the active cells (the
+* liquid and the band) and only advects, solves and extrapolates over them:
+* the pressure system holds one unknown per liquid cell, with ghost fluid
+* conditions at the surface and cut cell face weights at solids. Cost grows
+* with the liquid volume rather than the domain.
+*******************************************************************************/
+#ifndef _SIM_EULER_LIQUID_H_
+#define _SIM_EULER_LIQUID_H_
+
+#include "fluids/euler/SIM_FluidBase.h"
+#include "utl/PCGSolver/util.h"
+#include "utl/PCGSolver/sparse_matrix.h"
+#include "utl/PCGSolver/blas_wrapper.h"
+#include "utl/PCGSolver/pcg_solver.h"
+#include "utl/UTL_Trace.h"
+#include "utl/UTL_Parallel.h"
+
+using namespace VFXEpoch;
+using namespace VFXEpoch::Solvers;
+
+namespace VFXEpoch{
+  namespace Solvers{
+
+    class EulerLiquid2D : public Euler_Fluid2D_Base{
+    /***************************** User Parameters *****************************/
+    public:
+      struct Parameters{
+      public:
+        Parameters(){ clear(); }
+        Parameters(Vector2Df _origin, Vector2Di _dimension, double _h, double _dt,
+                   double _gravity, int _band_width, double _min_tolerance, int _max_iterations):
+                   origin(_origin), dimension(_dimension), h(_h), dt(_dt),
+                   gravity(_gravity), band_width(_band_width),
+                   out_tolerance(0.0), min_tolerance(_min_tolerance),
+                   max_iterations(_max_iterations), out_iterations(0){}
+      public:
+        inline void clear(){
+          origin.m_x = origin.m_y = 0.0f;
+          dimension.m_x = dimension.m_y = 0;
+          h = 0.0;
+          dt = 0.0;
+          gravity = -9.8;
+          band_width = 5;
+          min_tolerance = out_tolerance = 0.0;
+          max_iterations = out_iterations = 0;
+        }
+
+        friend inline ostream&
+        operator<<(ostream& os, const Parameters& params) {
+          os << std::setprecision(6) << setiosflags(ios::fixed);
+          os << "Origin = (" << params.origin.m_x << ", " << params.origin.m_y << ")" << endl;
+          os << "Dimension = " << params.dimension.m_x << " x " << params.dimension.m_y << endl;
+          os << "Increment h = " << params.h << endl;
+          os << "Time step = " << params.dt << endl;
+          os << "Gravity = " << params.gravity << endl;
+          os << "Narrow band width = " << params.band_width << " cells" << endl;
+          os << "Maximum iterations in pressure solver = " << params.max_iterations << endl;
+          os << "Minimum tolerance in pressure solver = " << params.min_tolerance << endl;
+          return os;
+        }
+      public:
+        Vector2Df origin;
+        Vector2Di dimension;
+        double h;
+        double dt;
+        double gravity;
+        int band_width;
+        double out_tolerance;
+        double min_tolerance;
+        int max_iterations;
+        int out_iterations;
+      };
+    /***************************** User Parameters END *************************/
+
+    public:
+      EulerLiquid2D();
+      EulerLiquid2D(Parameters _user_params);
+      ~EulerLiquid2D();
+    public:
+      bool init(Parameters params); // Overload
+      void step(); // Overload
+      void close(); // Overload
+      void set_verbose(bool _verbose);
+      // Adds the region where phi < 0 to the liquid
+      void add_liquid(float (*phi)(const VFXEpoch::Vector2Df&));
+      // Solids are where the nodal phi < 0, as for EulerGAS2D. The domain walls
+      // are always closed
+      void set_static_boundary(float (*phi)(const VFXEpoch::Vector2Df&));
+      void set_static_boundary(const Grid2DfScalarField& phi);
+
+    public:
+      EulerLiquid2D::Parameters get_user_params() const;
+      Vector2Df get_grid_velocity(VFXEpoch::Vector2Df pos);
+      const Grid2DfScalarField& get_liquid_phi() const;
+      // Unknowns of the last pressure solve and cells in the narrow band
+      int get_fluid_cell_count() const;
+      int get_band_cell_count() const;
+
+    protected:
+      void redistance();
+      void build_active();
+      void advect_phi();
+      void advect_vel();
+      void add_gravity();
+      void get_grid_weights();
+      void pressure_solve(); // Overload
+      void apply_gradients();
+      void extrapolate_vel();
+      void constrain_vel();
+      Vector2Df trace_rk2(const Vector2Df& pos, float dt);
+      Vector2Df get_vel(const Vector2Df& pos);
+      float get_phi(const Vector2Df& pos);
+    private:
+      Grid2DfScalarField u, u0;
+      Grid2DfScalarField v, v0;
+      Grid2DfScalarField uw, vw;
+      Grid2DfScalarField phi, phi0;
+      Grid2DfScalarField nodal_solid_phi;
+      // Face validity for extrapolation, 1 where the velocity is known
+      Grid2DiScalarField u_valid, v_valid;
+
+      // Cell lists, a cell is i * dimension.m_x + j
+      vector<int> band_cells;
+      vector<int> active_cells;
+      vector<int> fluid_cells;
+      // Faces owned by the active cells, every face once
+      vector<int> u_faces, v_faces;
+      // Row of a liquid cell in the pressure system, -1 for any other cell
+      vector<int> fluid_index;
+      // Visit stamps for the band search, compared against visit_epoch
+      vector<unsigned int> visited;
+      unsigned int visit_epoch;
+
+      PCGSolver<double> pcg_solver;
+      SparseMatrixd sparse_matrix;
+      vector<double> rhs;
+      vector<double> pressure;
+
+      Parameters user_params;
+      bool verbose;
+    };
+  }
+}
+
+#endif
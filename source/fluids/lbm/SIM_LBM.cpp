@@ -140,9 +140,36 @@ LBM2D::_set_sim_params(float rho, float tau)
 	params.tau = tau;
 }
 
+// Fill every population with the equilibrium of a uniform flow (rho, u, v)
+void
+LBM2D::_set_equilibrium(float rho, float u, float v)
+{
+	float weight0 = 4.0f / 9.0f;
+	float weight1 = 1.0f / 9.0f;
+	float weight2 = 1.0f / 36.0f;
+	float v_sqr = u * u + v * v;
+
+	for (int i = 0; i != resolutionY; i++){
+		for (int j = 0; j != resolutionX; j++){
+			v0(i, j) = rho * weight0 * (1.0f - 1.5f * v_sqr);
+			v1(i, j) = rho * weight1 * (1.0f + 3.0f * u + 4.5f * u * u - 1.5f * v_sqr);
+			v2(i, j) = rho * weight1 * (1.0f + 3.0f * v + 4.5f * v * v - 1.5f * v_sqr);
+			v3(i, j) = rho * weight1 * (1.0f - 3.0f * u + 4.5f * u * u - 1.5f * v_sqr);
+			v4(i, j) = rho * weight1 * (1.0f - 3.0f * v + 4.5f * v * v - 1.5f * v_sqr);
+			v5(i, j) = rho * weight2 * (1.0f + 3.0f * (u + v) + 4.5f * (u + v) * (u + v) - 1.5f * v_sqr);
+			v6(i, j) = rho * weight2 * (1.0f + 3.0f * (-u + v) + 4.5f * (-u + v) * (-u + v) - 1.5f * v_sqr);
+			v7(i, j) = rho * weight2 * (1.0f + 3.0f * (-u - v) + 4.5f * (u + v) * (u + v) - 1.5f * v_sqr);
+			v8(i, j) = rho * weight2 * (1.0f + 3.0f * (u - v) + 4.5f * (u - v) * (u - v) - 1.5f * v_sqr);
+			vel(i, j) = VFXEpoch::Vector2Df(u, v);
+			mag_vel(i, j) = sqrt(v_sqr);
+		}
+	}
+}
+
 void
 LBM2D::_stream()
 {
+	VFXEPOCH_TRACE_SCOPE("LBM2D", "stream");
 	if (resolutionX <= 0 || resolutionY <= 0)
 		return;
 
@@ -179,6 +206,7 @@ LBM2D::_stream()
 void
 LBM2D::_collide()
 {
+	VFXEPOCH_TRACE_SCOPE("LBM2D", "collide");
 	float rtau = 1.0f / params.tau, v_sqr = 0.0f;
 	float rho, u, v;
 	float eq0, eq1, eq2, eq3, eq4, eq5, eq6, eq7, eq8;
@@ -247,12 +275,13 @@ void
 LBM2D::_set_solid_at_cell(BOUNDARY_MASK flag, int x, int y)
 {
 	assert(x >= 0 && x < solid_mask.getDimX() && y >= 0 && y < solid_mask.getDimY());
-	solid_mask(x, y) = flag;
+	solid_mask(y, x) = flag;
 }
 
 void
 LBM2D::_bounce_back()
 {
+	VFXEPOCH_TRACE_SCOPE("LBM2D", "bounce_back");
 	if (resolutionX == 0 || resolutionY == 0) return;
 
 	float v1_prev, v2_prev, v3_prev, v4_prev, v5_prev, v6_prev, v7_prev, v8_prev;
@@ -304,3 +333,61 @@ LBM2D::_clear()
 	auxv6.clear();
 	auxv7.clear();
 }
+
+// Stores the populations with the solid mask and the macroscopic fields, the
+// auxiliary populations are scratch space of _stream() and are not stored
+bool
+LBM2D::_save_checkpoint(const std::string& filename, bool compress) const
+{
+	VFXEPOCH_TRACE_SCOPE("LBM2D", "save_checkpoint");
+	VFXEpoch::IO::CheckpointWriter writer;
+	if (!writer.open(filename, "LBM2D", compress ? VFXEpoch::IO::CODEC::SHUFFLE_LZ : VFXEpoch::IO::CODEC::NONE))
+		return false;
+
+	float sim_params[2] = { params.rho, params.tau };
+	writer.writeArray("params", sim_params, sizeof(sim_params), sizeof(float));
+	writer.writeGrid("v0", v0);
+	writer.writeGrid("v1", v1);
+	writer.writeGrid("v2", v2);
+	writer.writeGrid("v3", v3);
+	writer.writeGrid("v4", v4);
+	writer.writeGrid("v5", v5);
+	writer.writeGrid("v6", v6);
+	writer.writeGrid("v7", v7);
+	writer.writeGrid("v8", v8);
+	writer.writeGrid("solid_mask", solid_mask);
+	writer.writeGrid("vel", vel);
+	writer.writeGrid("mag_vel", mag_vel);
+	return writer.close();
+}
+
+bool
+LBM2D::_load_checkpoint(const std::string& filename)
+{
+	VFXEPOCH_TRACE_SCOPE("LBM2D", "load_checkpoint");
+	VFXEpoch::IO::CheckpointReader reader;
+	if (!reader.open(filename))
+		return false;
+	if ("LBM2D" != reader.solver())
+	{
+		std::cout << "WARNING: " << filename << " was written by " << reader.solver() << ", not LBM2D" << std::endl;
+		return false;
+	}
+
+	const VFXEpoch::IO::ChunkHeader* populations = reader.find("v0");
+	float sim_params[2];
+	if (!populations || !reader.readArray("params", sim_params, sizeof(sim_params)))
+		return false;
+	_initialize(populations->dims[0], populations->dims[1]);
+	_set_sim_params(sim_params[0], sim_params[1]);
+
+	bool ok = reader.readGrid("v0", v0) && reader.readGrid("v1", v1) && reader.readGrid("v2", v2) &&
+			  reader.readGrid("v3", v3) && reader.readGrid("v4", v4) && reader.readGrid("v5", v5) &&
+			  reader.readGrid("v6", v6) && reader.readGrid("v7", v7) && reader.readGrid("v8", v8) &&
+			  reader.readGrid("solid_mask", solid_mask) &&
+			  reader.readGrid("vel", vel) &&
+			  reader.readGrid("mag_vel", mag_vel);
+	if (!ok)
+		std::cout << "WARNING: Checkpoint " << filename << " is incomplete, the solver state is undefined" << std::endl;
+	return ok;
+}
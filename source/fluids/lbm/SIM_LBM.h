@@ -23,6 +23,8 @@
 #include "../../utl/UTL_Vector.h"
 #include "../../utl/UTL_General.h"
 #include "../../utl/UTL_LinearSolvers.h"
+#include "../../utl/UTL_Trace.h"
+#include "../../io/IO_Checkpoint.h"
 
 #include <math.h>
 
@@ -67,12 +69,15 @@ namespace VFXEpoch
 		public:
 			bool _initialize(int x, int y);
 			void _set_sim_params(float rho, float tau);
+			void _set_equilibrium(float rho, float u, float v);
 			void _stream();
 			void _collide();
 			void _process_boundary();
 			void _set_solid_at_cell(BOUNDARY_MASK flag, int x, int y);
 			void _bounce_back();
 			void _clear();
+			bool _save_checkpoint(const std::string& filename, bool compress = true) const;
+			bool _load_checkpoint(const std::string& filename);
 
 		private:
 			int resolutionX, fieldX;
@@ -0,0 +1,322 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "IO_Cache.h"
+#include "utl/UTL_Trace.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace VFXEpoch
+{
+	namespace IO
+	{
+		static const char CACHE_MAGIC[8] = {'V', 'F', 'X', 'E', 'C', 'A', 'C', 'H'};
+		static const char CACHE_TOC_MAGIC[8] = {'V', 'F', 'X', 'E', 'C', 'T', 'O', 'C'};
+		// Cache line aligned so that mapped channels can be fed to SIMD loads
+		static const size_t CACHE_ALIGNMENT = 64;
+
+		static_assert(0 == sizeof(CacheFrame) % 8 && 0 == sizeof(CacheChannel) % 8, "Cache table entries must stay aligned");
+
+		static size_t
+		type_size(CACHE_TYPE type){
+			switch(type){
+			case CACHE_TYPE::FLOAT64:
+			case CACHE_TYPE::UINT64:
+				return 8;
+			default:
+				return 4;
+			}
+		}
+
+		CacheWriter::CacheWriter() : in_frame(false){}
+
+		CacheWriter::~CacheWriter(){
+			if(file.good()) close();
+		}
+
+		bool
+		CacheWriter::open(const std::string& filename){
+			frames.clear();
+			channels.clear();
+			policies.clear();
+			in_frame = false;
+			if(!file.open(filename)){
+				std::cout << "WARNING: Cannot open cache " << filename << " for writing" << std::endl;
+				return false;
+			}
+			CacheHeader header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+			header.version = CACHE_VERSION;
+			return file.writeValue(header);
+		}
+
+		bool
+		CacheWriter::close(){
+			if(!file.good()){
+				file.close();
+				return false;
+			}
+			if(in_frame) endFrame();
+
+			file.align(16);
+			CacheTrailer trailer;
+			trailer.toc_offset = file.tell();
+			memcpy(trailer.magic, CACHE_TOC_MAGIC, sizeof(trailer.magic));
+
+			CacheTOC toc;
+			memset(&toc, 0, sizeof(toc));
+			toc.num_frames = (unsigned int)frames.size();
+			toc.num_channels = (unsigned int)channels.size();
+			file.writeValue(toc);
+			if(!frames.empty()) file.write(&frames[0], frames.size() * sizeof(CacheFrame));
+			if(!channels.empty()) file.write(&channels[0], channels.size() * sizeof(CacheChannel));
+			file.writeValue(trailer);
+			std::vector<char>().swap(scratch);
+			return file.close();
+		}
+
+		bool
+		CacheWriter::beginFrame(int index, float time){
+			if(in_frame) endFrame();
+			CacheFrame frame;
+			frame.index = index;
+			frame.time = time;
+			frame.first_channel = (unsigned int)channels.size();
+			frame.num_channels = 0;
+			frames.push_back(frame);
+			in_frame = true;
+			return file.good();
+		}
+
+		bool
+		CacheWriter::endFrame(){
+			if(!in_frame) return false;
+			frames.back().num_channels = (unsigned int)channels.size() - frames.back().first_channel;
+			in_frame = false;
+			return file.good();
+		}
+
+		bool
+		CacheWriter::addChannel(const char* name, CACHE_TYPE type, int components, const int dims[3], float spacing,
+		                        const void* data, unsigned long long count){
+			VFXEPOCH_TRACE_SCOPE("IO", "cache_channel");
+			if(!in_frame){
+				std::cout << "WARNING: Cache channel " << name << " added outside of a frame" << std::endl;
+				return false;
+			}
+			if(!file.align(CACHE_ALIGNMENT)) return false;
+
+			CacheChannel channel;
+			memset(&channel, 0, sizeof(channel));
+			strncpy(channel.name, name, sizeof(channel.name) - 1);
+			channel.type = type;
+			channel.components = components;
+			memcpy(channel.dims, dims, sizeof(channel.dims));
+			channel.spacing = spacing;
+			channel.codec = CODEC::NONE;
+			channel.count = count;
+			channel.offset = file.tell();
+			channel.bytes = CacheReader::rawBytes(&channel);
+
+			const void* stored = data;
+			std::map<std::string, CompressionPolicy>::const_iterator it = policies.find(channel.name);
+			if(policies.end() != it && CODEC::NONE != it->second.codec && channel.bytes){
+				scratch.clear();
+				Compress(it->second, data, (size_t)channel.bytes, type_size(type), scratch);
+				if(scratch.size() < channel.bytes){
+					channel.codec = it->second.codec;
+					channel.bytes = scratch.size();
+					stored = &scratch[0];
+				}
+			}
+			if(channel.bytes && !file.write(stored, (size_t)channel.bytes)) return false;
+			channels.push_back(channel);
+			return true;
+		}
+
+		bool
+		CacheWriter::addGrid(const char* name, const Grid2DfScalarField& grid){
+			int dims[3] = {grid.m_xCell, grid.m_yCell, 1};
+			return addChannel(name, CACHE_TYPE::FLOAT32, 1, dims, grid.dx,
+			                  grid.data.empty() ? NULL : &grid.data[0], grid.data.size());
+		}
+
+		bool
+		CacheWriter::addPoints(const char* name, const float* xyz, int count){
+			int dims[3] = {count, 1, 1};
+			return addChannel(name, CACHE_TYPE::FLOAT32, 3, dims, 0.0f, xyz, count);
+		}
+
+		bool
+		CacheWriter::addIds(const char* name, const unsigned long long* ids, int count){
+			int dims[3] = {count, 1, 1};
+			return addChannel(name, CACHE_TYPE::UINT64, 1, dims, 0.0f, ids, count);
+		}
+
+		CacheReader::CacheReader() : toc(NULL), frames(NULL), channels(NULL){}
+
+		CacheReader::~CacheReader(){
+			close();
+		}
+
+		bool
+		CacheReader::open(const std::string& filename){
+			close();
+			if(!file.open(filename)){
+				std::cout << "WARNING: Cannot open cache " << filename << std::endl;
+				return false;
+			}
+
+			const char* begin = file.data();
+			size_t size = file.size();
+			if(size < sizeof(CacheHeader) + sizeof(CacheTrailer) || 0 != memcmp(begin, CACHE_MAGIC, sizeof(CACHE_MAGIC))){
+				std::cout << "WARNING: " << filename << " is not a VFXEpoch cache" << std::endl;
+				close();
+				return false;
+			}
+			// Caches are transient, an old one is simply exported again
+			if(((const CacheHeader*)begin)->version != CACHE_VERSION){
+				std::cout << "WARNING: " << filename << " has cache version " << ((const CacheHeader*)begin)->version
+				          << ", this build reads version " << CACHE_VERSION << std::endl;
+				close();
+				return false;
+			}
+
+			const CacheTrailer* trailer = (const CacheTrailer*)(begin + size - sizeof(CacheTrailer));
+			size_t table_end = size - sizeof(CacheTrailer);
+			if(0 != memcmp(trailer->magic, CACHE_TOC_MAGIC, sizeof(CACHE_TOC_MAGIC)) ||
+			   trailer->toc_offset + sizeof(CacheTOC) > table_end){
+				std::cout << "WARNING: Cache " << filename << " has no table of contents, it was not closed" << std::endl;
+				close();
+				return false;
+			}
+
+			const CacheTOC* table = (const CacheTOC*)(begin + trailer->toc_offset);
+			size_t table_size = sizeof(CacheTOC) + table->num_frames * sizeof(CacheFrame) + table->num_channels * sizeof(CacheChannel);
+			if(trailer->toc_offset + table_size > table_end){
+				std::cout << "WARNING: Cache " << filename << " has a truncated table of contents" << std::endl;
+				close();
+				return false;
+			}
+			const CacheFrame* frame_table = (const CacheFrame*)(table + 1);
+			const CacheChannel* channel_table = (const CacheChannel*)(frame_table + table->num_frames);
+
+			for(unsigned int i = 0; i != table->num_channels; i++){
+				if(channel_table[i].offset > trailer->toc_offset || channel_table[i].bytes > trailer->toc_offset - channel_table[i].offset){
+					std::cout << "WARNING: Cache " << filename << " channel " << channel_table[i].name << " is out of range" << std::endl;
+					close();
+					return false;
+				}
+			}
+			for(unsigned int i = 0; i != table->num_frames; i++){
+				if((unsigned long long)frame_table[i].first_channel + frame_table[i].num_channels > table->num_channels){
+					std::cout << "WARNING: Cache " << filename << " frame " << frame_table[i].index << " is out of range" << std::endl;
+					close();
+					return false;
+				}
+			}
+
+			toc = table;
+			frames = frame_table;
+			channels = channel_table;
+			return true;
+		}
+
+		void
+		CacheReader::close(){
+			toc = NULL;
+			frames = NULL;
+			channels = NULL;
+			file.close();
+		}
+
+		int
+		CacheReader::findFrame(int index) const{
+			// Frames are usually written in order, try the direct slot first
+			int n = numFrames();
+			if(index >= 0 && index < n && frames[index].index == index) return index;
+			for(int i = 0; i != n; i++){
+				if(frames[i].index == index) return i;
+			}
+			return -1;
+		}
+
+		const CacheChannel*
+		CacheReader::channel(int slot, const char* name) const{
+			if(slot < 0 || slot >= numFrames()) return NULL;
+			const CacheFrame& f = frames[slot];
+			for(unsigned int i = 0; i != f.num_channels; i++){
+				const CacheChannel* c = &channels[f.first_channel + i];
+				if(0 == strncmp(c->name, name, sizeof(c->name))) return c;
+			}
+			return NULL;
+		}
+
+		unsigned long long
+		CacheReader::rawBytes(const CacheChannel* c){
+			return c->count * c->components * type_size(c->type);
+		}
+
+		bool
+		CacheReader::read(const CacheChannel* c, void* dest) const{
+			if(!c || !toc) return false;
+			if(!Decompress(c->codec, file.data() + c->offset, (size_t)c->bytes, type_size(c->type), dest, (size_t)rawBytes(c))){
+				std::cout << "WARNING: Cache channel " << c->name << " cannot be decoded" << std::endl;
+				return false;
+			}
+			return true;
+		}
+
+		void
+		CacheReader::prefetch(int slot, int count) const{
+			int n = numFrames();
+			for(int s = slot; s < slot + count && s < n; s++){
+				if(s < 0) continue;
+				const CacheFrame& f = frames[s];
+				for(unsigned int i = 0; i != f.num_channels; i++){
+					const CacheChannel& c = channels[f.first_channel + i];
+					file.willNeed((size_t)c.offset, (size_t)c.bytes);
+				}
+			}
+		}
+
+		CacheFrameSink::CacheFrameSink(const std::string& filename, float _frame_time) : frame_time(_frame_time){
+			writer.open(filename);
+		}
+
+		bool
+		CacheFrameSink::write(const Frame& frame){
+			bool ok = writer.beginFrame(frame.index, frame.index * frame_time);
+			for(int i = 0; i != frame.num_channels; i++){
+				const FrameChannel& c = frame.channels[i];
+				int dims[3] = {c.dims[0], c.dims[1], 1};
+				ok = ok && writer.addChannel(c.name.c_str(), CACHE_TYPE::FLOAT32, 1, dims, c.spacing,
+				                             c.data.empty() ? NULL : &c.data[0], c.data.size());
+			}
+			if(frame.num_points){
+				ok = ok && writer.addPoints("P", &frame.points[0], frame.num_points);
+				if(frame.has_ids)
+					ok = ok && writer.addIds("id", &frame.ids[0], frame.num_points);
+				for(int i = 0; i != frame.num_attributes; i++){
+					const FrameAttribute& a = frame.attributes[i];
+					int dims[3] = {frame.num_points, 1, 1};
+					ok = ok && writer.addChannel(a.name.c_str(), CACHE_TYPE::FLOAT32, a.components, dims, 0.0f,
+					                             &a.data[0], frame.num_points);
+				}
+			}
+			return writer.endFrame() && ok;
+		}
+
+		void
+		CacheFrameSink::close(){
+			writer.close();
+		}
+	}
+}
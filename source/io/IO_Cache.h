@@ -0,0 +1,206 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Single file simulation cache with random frame access.
+*
+* Frames are appended as they are simulated, each frame is a set of named
+* channels (scalar grids, particle positions, ids, ...). The table of
+* contents listing every frame and channel with its offset is written when
+* the cache is closed, followed by a fixed size trailer pointing at it:
+*
+*   CacheHeader
+*   channel payloads, 64 byte aligned            (frame 0, frame 1, ...)
+*   CacheTOC, CacheFrame[num_frames], CacheChannel[num_channels]
+*   CacheTrailer
+*
+* CacheReader maps the file and reads only the trailer and the table, any
+* channel of any frame is then a pointer into the mapping: nothing is parsed
+* or copied, and the OS pages the data in on first touch. prefetch() asks
+* the kernel to read the next frames ahead of playback.
+*
+* Channels are stored raw unless the writer was given a CompressionPolicy
+* for their name. Compressed channels trade the zero-copy access for size:
+* data() returns NULL for them and read() decodes them into a buffer, so
+* keep whatever is drawn every frame raw.
+*
+*   VFXEpoch::IO::CacheReader cache;
+*   cache.open("smoke.vfxcache");
+*   const VFXEpoch::IO::CacheChannel* p = cache.channel(frame, "P");
+*   const float* xyz = cache.data<float>(p);    // p->count points
+*******************************************************************************/
+#ifndef _IO_CACHE_H_
+#define _IO_CACHE_H_
+
+#include "utl/UTL_Grid.h"
+#include "io/IO_Stream.h"
+#include "io/IO_FrameWriter.h"
+#include "io/IO_Compression.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace VFXEpoch
+{
+	namespace IO
+	{
+		// Version 2 adds per channel compression
+		static const unsigned int CACHE_VERSION = 2;
+
+		enum class CACHE_TYPE : unsigned int
+		{
+			FLOAT32 = 0,
+			FLOAT64 = 1,
+			INT32 = 2,
+			UINT64 = 3
+		};
+
+		typedef struct _cache_header
+		{
+			char magic[8];				// "VFXECACH"
+			unsigned int version;
+			unsigned int reserved;
+		}CacheHeader;
+
+		typedef struct _cache_toc
+		{
+			unsigned int num_frames;
+			unsigned int num_channels;
+			unsigned int reserved[2];
+		}CacheTOC;
+
+		typedef struct _cache_frame
+		{
+			int index;
+			float time;
+			unsigned int first_channel;
+			unsigned int num_channels;
+		}CacheFrame;
+
+		typedef struct _cache_channel
+		{
+			char name[32];
+			CACHE_TYPE type;
+			int components;				// Values per element, 3 for positions
+			int dims[3];				// Grid cells x, y, z, or count, 1, 1
+			float spacing;
+			CODEC codec;
+			unsigned int reserved;
+			unsigned long long count;	// Elements, values = count * components
+			unsigned long long offset;	// From the start of the file
+			unsigned long long bytes;	// Stored, equals rawBytes() when not compressed
+		}CacheChannel;
+
+		typedef struct _cache_trailer
+		{
+			unsigned long long toc_offset;
+			char magic[8];				// "VFXECTOC"
+		}CacheTrailer;
+
+		class CacheWriter
+		{
+		public:
+			CacheWriter();
+			~CacheWriter();
+
+			bool open(const std::string& filename);
+			// Writes the table of contents, a cache without it cannot be read
+			bool close();
+
+			bool beginFrame(int index, float time);
+			bool endFrame();
+
+			// Compresses the channels named name from now on
+			void setPolicy(const char* name, const CompressionPolicy& policy){ policies[name] = policy; }
+
+			bool addChannel(const char* name, CACHE_TYPE type, int components, const int dims[3], float spacing,
+			                const void* data, unsigned long long count);
+			bool addGrid(const char* name, const Grid2DfScalarField& grid);
+			bool addPoints(const char* name, const float* xyz, int count);
+			bool addIds(const char* name, const unsigned long long* ids, int count);
+
+		private:
+			CacheWriter(const CacheWriter&);
+			CacheWriter& operator=(const CacheWriter&);
+
+			FileWriter file;
+			std::vector<CacheFrame> frames;
+			std::vector<CacheChannel> channels;
+			std::map<std::string, CompressionPolicy> policies;
+			std::vector<char> scratch;
+			bool in_frame;
+		};
+
+		class CacheReader
+		{
+		public:
+			CacheReader();
+			~CacheReader();
+
+			bool open(const std::string& filename);
+			void close();
+
+			int numFrames() const { return toc ? (int)toc->num_frames : 0; }
+			const CacheFrame& frame(int slot) const { return frames[slot]; }
+			// Slot of the frame with that index, -1 when it is not cached
+			int findFrame(int index) const;
+
+			const CacheChannel* channel(int slot, const char* name) const;
+			const CacheChannel* channel(int slot, int i) const { return &channels[frames[slot].first_channel + i]; }
+
+			// Zero-copy view into the mapping, NULL for compressed channels
+			template <class T>
+			const T* data(const CacheChannel* c) const {
+				return c && CODEC::NONE == c->codec ? (const T*)(file.data() + c->offset) : NULL;
+			}
+
+			static unsigned long long rawBytes(const CacheChannel* c);
+			// Copies or decodes a channel into dest, which holds rawBytes(c)
+			bool read(const CacheChannel* c, void* dest) const;
+
+			template <class T>
+			bool read(const CacheChannel* c, std::vector<T>& values) const {
+				if(!c) return false;
+				values.resize((size_t)(rawBytes(c) / sizeof(T)));
+				return read(c, values.empty() ? NULL : &values[0]);
+			}
+
+			// Hints the kernel to page in frames [slot, slot + count)
+			void prefetch(int slot, int count = 1) const;
+
+		private:
+			CacheReader(const CacheReader&);
+			CacheReader& operator=(const CacheReader&);
+
+			MappedFile file;
+			const CacheTOC* toc;
+			const CacheFrame* frames;
+			const CacheChannel* channels;
+		};
+
+		// Appends every frame of an AsyncFrameWriter to one cache: the grid
+		// channels under their names, points as "P", ids as "id" and the
+		// point attributes under their names
+		class CacheFrameSink : public FrameSink
+		{
+		public:
+			CacheFrameSink(const std::string& filename, float _frame_time = 1.0f / 24.0f);
+			bool write(const Frame& frame);
+			void close();
+			void setPolicy(const char* name, const CompressionPolicy& policy){ writer.setPolicy(name, policy); }
+		private:
+			CacheWriter writer;
+			float frame_time;
+		};
+	}
+}
+
+#endif
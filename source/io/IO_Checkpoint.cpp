@@ -0,0 +1,203 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "IO_Checkpoint.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace VFXEpoch
+{
+	namespace IO
+	{
+		static const char CHECKPOINT_MAGIC[8] = {'V', 'F', 'X', 'E', 'C', 'K', 'P', 'T'};
+		static const size_t CHUNK_ALIGNMENT = 16;
+
+		static_assert(0 == sizeof(CheckpointHeader) % CHUNK_ALIGNMENT, "Checkpoint header breaks the payload alignment");
+		static_assert(0 == sizeof(ChunkHeader) % CHUNK_ALIGNMENT, "Chunk header breaks the payload alignment");
+
+		static void
+		copy_name(char* dest, size_t size, const char* name){
+			memset(dest, 0, size);
+			strncpy(dest, name ? name : "", size - 1);
+		}
+
+		CheckpointWriter::CheckpointWriter() : codec(CODEC::NONE){}
+
+		CheckpointWriter::~CheckpointWriter(){
+			if(file.good()) close();
+		}
+
+		bool
+		CheckpointWriter::open(const std::string& filename, const char* solver, CODEC _codec){
+			if(!file.open(filename)){
+				std::cout << "WARNING: Cannot open checkpoint " << filename << " for writing" << std::endl;
+				return false;
+			}
+			codec = _codec;
+			policies.clear();
+
+			CheckpointHeader header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+			header.version = CHECKPOINT_VERSION;
+			copy_name(header.solver, sizeof(header.solver), solver);
+			return file.writeValue(header);
+		}
+
+		bool
+		CheckpointWriter::close(){
+			if(!file.good()){
+				file.close();
+				return false;
+			}
+			int dims[3] = {0, 0, 0};
+			float spacing[3] = {0.0f, 0.0f, 0.0f};
+			writeChunk("END", CHUNK_TYPE::END, dims, spacing, NULL, 0, 1);
+			std::vector<char>().swap(scratch);
+			return file.close();
+		}
+
+		bool
+		CheckpointWriter::writeArray(const char* name, const void* data, size_t bytes, size_t element_size){
+			int dims[3] = {(int)(element_size ? bytes / element_size : bytes), 1, 1};
+			float spacing[3] = {0.0f, 0.0f, 0.0f};
+			return writeChunk(name, CHUNK_TYPE::ARRAY, dims, spacing, data, bytes, element_size);
+		}
+
+		bool
+		CheckpointWriter::writeChunk(const char* name, CHUNK_TYPE type, const int dims[3], const float spacing[3],
+		                             const void* data, size_t bytes, size_t element_size){
+			ChunkHeader chunk;
+			memset(&chunk, 0, sizeof(chunk));
+			copy_name(chunk.name, sizeof(chunk.name), name);
+			chunk.type = type;
+			chunk.codec = CODEC::NONE;
+			chunk.element_size = (unsigned int)element_size;
+			memcpy(chunk.dims, dims, sizeof(chunk.dims));
+			memcpy(chunk.spacing, spacing, sizeof(chunk.spacing));
+			chunk.raw_size = bytes;
+
+			std::map<std::string, CompressionPolicy>::const_iterator it = policies.find(chunk.name);
+			CompressionPolicy policy = policies.end() != it ? it->second : CompressionPolicy(codec);
+
+			const void* stored = data;
+			size_t stored_size = bytes;
+			if(CODEC::NONE != policy.codec && bytes){
+				scratch.clear();
+				Compress(policy, data, bytes, element_size, scratch);
+				if(scratch.size() < bytes){
+					chunk.codec = policy.codec;
+					stored = &scratch[0];
+					stored_size = scratch.size();
+				}
+			}
+			chunk.stored_size = stored_size;
+			chunk.checksum = Checksum(stored, stored_size);
+
+			return file.writeValue(chunk) &&
+			       (!stored_size || file.write(stored, stored_size)) &&
+			       file.align(CHUNK_ALIGNMENT);
+		}
+
+		CheckpointReader::CheckpointReader() : header(NULL){}
+
+		CheckpointReader::~CheckpointReader(){
+			close();
+		}
+
+		bool
+		CheckpointReader::open(const std::string& filename){
+			close();
+			if(!file.open(filename)){
+				std::cout << "WARNING: Cannot open checkpoint " << filename << std::endl;
+				return false;
+			}
+
+			const char* begin = file.data();
+			size_t size = file.size();
+			if(size < sizeof(CheckpointHeader) || 0 != memcmp(begin, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC))){
+				std::cout << "WARNING: " << filename << " is not a VFXEpoch checkpoint" << std::endl;
+				close();
+				return false;
+			}
+			header = (const CheckpointHeader*)begin;
+			if(header->version > CHECKPOINT_VERSION){
+				std::cout << "WARNING: " << filename << " has checkpoint version " << header->version
+				          << ", this build reads up to version " << CHECKPOINT_VERSION << std::endl;
+				close();
+				return false;
+			}
+
+			size_t offset = sizeof(CheckpointHeader);
+			while(true){
+				if(offset + sizeof(ChunkHeader) > size) break;
+				const ChunkHeader* chunk = (const ChunkHeader*)(begin + offset);
+				if(CHUNK_TYPE::END == chunk->type) return true;
+				if(chunk->stored_size > size - offset - sizeof(ChunkHeader)) break;
+				chunks.push_back(chunk);
+				offset += sizeof(ChunkHeader) + (size_t)chunk->stored_size;
+				offset += (CHUNK_ALIGNMENT - offset % CHUNK_ALIGNMENT) % CHUNK_ALIGNMENT;
+			}
+
+			std::cout << "WARNING: Checkpoint " << filename << " is truncated" << std::endl;
+			close();
+			return false;
+		}
+
+		void
+		CheckpointReader::close(){
+			chunks.clear();
+			header = NULL;
+			file.close();
+		}
+
+		std::string
+		CheckpointReader::solver() const{
+			if(!header) return std::string();
+			return std::string(header->solver, strnlen(header->solver, sizeof(header->solver)));
+		}
+
+		const ChunkHeader*
+		CheckpointReader::find(const char* name) const{
+			for(size_t i = 0; i != chunks.size(); i++){
+				if(0 == strncmp(chunks[i]->name, name, sizeof(chunks[i]->name))) return chunks[i];
+			}
+			return NULL;
+		}
+
+		bool
+		CheckpointReader::readArray(const char* name, void* dest, size_t bytes) const{
+			const ChunkHeader* chunk = find(name);
+			return chunk && decode(chunk, dest, bytes);
+		}
+
+		const void*
+		CheckpointReader::view(const char* name, size_t* bytes) const{
+			const ChunkHeader* chunk = find(name);
+			if(!chunk || CODEC::NONE != chunk->codec) return NULL;
+			if(bytes) *bytes = (size_t)chunk->raw_size;
+			return payload(chunk);
+		}
+
+		bool
+		CheckpointReader::decode(const ChunkHeader* chunk, void* dest, size_t bytes) const{
+			if(chunk->raw_size != bytes){
+				std::cout << "WARNING: Checkpoint chunk " << chunk->name << " holds " << chunk->raw_size
+				          << " bytes, expected " << bytes << std::endl;
+				return false;
+			}
+			if(chunk->checksum != Checksum(payload(chunk), (size_t)chunk->stored_size)){
+				std::cout << "WARNING: Checkpoint chunk " << chunk->name << " is corrupted" << std::endl;
+				return false;
+			}
+			if(!bytes) return true;
+			return Decompress(chunk->codec, payload(chunk), (size_t)chunk->stored_size, chunk->element_size, dest, bytes);
+		}
+	}
+}
@@ -0,0 +1,187 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Versioned binary checkpoint files for restarting a simulation.
+*
+* Layout (little endian, every payload starts on a 16 byte boundary):
+*   CheckpointHeader
+*   ChunkHeader, payload, padding
+*   ChunkHeader, payload, padding
+*   ...
+*   ChunkHeader named "END" with an empty payload
+*
+* A chunk is one named field: a grid with its dimensions and spacing, or a
+* plain array. Fields are written one at a time straight to the file and a
+* chunk falls back to being stored raw when compressing does not shrink it.
+* The default codec applies to every chunk, setPolicy() overrides it per
+* field, e.g. a lossy tolerance for a density that is only kept for display.
+* The reader maps the file and looks chunks up by name, so unknown chunks
+* are skipped and raw payloads are copied directly out of the page cache.
+*******************************************************************************/
+#ifndef _IO_CHECKPOINT_H_
+#define _IO_CHECKPOINT_H_
+
+#include "utl/UTL_Grid.h"
+#include "io/IO_Stream.h"
+#include "io/IO_Compression.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace VFXEpoch
+{
+	namespace IO
+	{
+		// Version 2 adds the tiled SHUFFLE_LZ and QUANTIZE_LZ codecs, version 3
+		// the EulerGAS2D velocity transfer and APIC gradient chunks, version 4
+		// its particle counters and emitter carry. Older files stay readable,
+		// solvers skip the chunks they lack
+		static const unsigned int CHECKPOINT_VERSION = 4;
+
+		enum class CHUNK_TYPE : unsigned int
+		{
+			ARRAY = 0,
+			GRID2D = 1,
+			GRID3D = 2,
+			END = 0xFFFFFFFF
+		};
+
+		typedef struct _checkpoint_header
+		{
+			char magic[8];			// "VFXECKPT"
+			unsigned int version;
+			unsigned int reserved;
+			char solver[32];		// Name of the solver that wrote the file
+		}CheckpointHeader;
+
+		typedef struct _chunk_header
+		{
+			char name[32];
+			CHUNK_TYPE type;
+			CODEC codec;
+			unsigned int element_size;
+			unsigned int checksum;	// FNV-1a of the stored payload
+			int dims[3];
+			float spacing[3];
+			unsigned int reserved[2];
+			unsigned long long raw_size;
+			unsigned long long stored_size;
+		}ChunkHeader;
+
+		class CheckpointWriter
+		{
+		public:
+			CheckpointWriter();
+			~CheckpointWriter();
+
+			bool open(const std::string& filename, const char* solver, CODEC codec = CODEC::SHUFFLE_LZ);
+			// Writes the END chunk and closes the file, false if any write failed
+			bool close();
+
+			// Codec of the chunks named name, set before writing them
+			void setPolicy(const char* name, const CompressionPolicy& policy){ policies[name] = policy; }
+
+			bool writeArray(const char* name, const void* data, size_t bytes, size_t element_size);
+
+			template <class T>
+			bool writeArray(const char* name, const std::vector<T>& values){
+				return writeArray(name, values.empty() ? NULL : &values[0], values.size() * sizeof(T), sizeof(T));
+			}
+
+			template <class T>
+			bool writeGrid(const char* name, const Grid2D<T>& grid){
+				int dims[3] = {grid.m_xCell, grid.m_yCell, 1};
+				float spacing[3] = {grid.dx, grid.dy, 0.0f};
+				return writeChunk(name, CHUNK_TYPE::GRID2D, dims, spacing,
+				                  grid.data.empty() ? NULL : &grid.data[0], grid.data.size() * sizeof(T), sizeof(T));
+			}
+
+			template <class T>
+			bool writeGrid(const char* name, const Grid3D<T>& grid){
+				int dims[3] = {grid.m_xCell, grid.m_yCell, grid.m_zCell};
+				float spacing[3] = {grid.dx, grid.dy, grid.dz};
+				return writeChunk(name, CHUNK_TYPE::GRID3D, dims, spacing,
+				                  grid.data.empty() ? NULL : &grid.data[0], grid.data.size() * sizeof(T), sizeof(T));
+			}
+
+		private:
+			CheckpointWriter(const CheckpointWriter&);
+			CheckpointWriter& operator=(const CheckpointWriter&);
+			bool writeChunk(const char* name, CHUNK_TYPE type, const int dims[3], const float spacing[3],
+			                const void* data, size_t bytes, size_t element_size);
+
+			FileWriter file;
+			CODEC codec;
+			std::map<std::string, CompressionPolicy> policies;
+			std::vector<char> scratch;
+		};
+
+		class CheckpointReader
+		{
+		public:
+			CheckpointReader();
+			~CheckpointReader();
+
+			// Maps the file and validates the header and the chunk table
+			bool open(const std::string& filename);
+			void close();
+
+			unsigned int version() const { return header ? header->version : 0; }
+			std::string solver() const;
+			bool has(const char* name) const { return NULL != find(name); }
+			const ChunkHeader* find(const char* name) const;
+
+			// Decodes a chunk into dest, bytes must match the stored size
+			bool readArray(const char* name, void* dest, size_t bytes) const;
+
+			template <class T>
+			bool readArray(const char* name, std::vector<T>& values) const{
+				const ChunkHeader* chunk = find(name);
+				if(!chunk || chunk->element_size != sizeof(T)) return false;
+				values.resize((size_t)(chunk->raw_size / sizeof(T)));
+				return decode(chunk, values.empty() ? NULL : &values[0], values.size() * sizeof(T));
+			}
+
+			// The grid is resized to the stored dimensions and spacing
+			template <class T>
+			bool readGrid(const char* name, Grid2D<T>& grid) const{
+				const ChunkHeader* chunk = find(name);
+				if(!chunk || CHUNK_TYPE::GRID2D != chunk->type || chunk->element_size != sizeof(T)) return false;
+				grid.Reset(chunk->dims[0], chunk->dims[1], chunk->spacing[0], chunk->spacing[1]);
+				return decode(chunk, grid.data.empty() ? NULL : &grid.data[0], grid.data.size() * sizeof(T));
+			}
+
+			template <class T>
+			bool readGrid(const char* name, Grid3D<T>& grid) const{
+				const ChunkHeader* chunk = find(name);
+				if(!chunk || CHUNK_TYPE::GRID3D != chunk->type || chunk->element_size != sizeof(T)) return false;
+				grid.Reset(chunk->dims[0], chunk->dims[1], chunk->dims[2], chunk->spacing[0], chunk->spacing[1], chunk->spacing[2]);
+				return decode(chunk, grid.data.empty() ? NULL : &grid.data[0], grid.data.size() * sizeof(T));
+			}
+
+			// Pointer into the mapping for raw chunks, NULL for compressed ones
+			const void* view(const char* name, size_t* bytes = NULL) const;
+
+		private:
+			CheckpointReader(const CheckpointReader&);
+			CheckpointReader& operator=(const CheckpointReader&);
+			bool decode(const ChunkHeader* chunk, void* dest, size_t bytes) const;
+			const char* payload(const ChunkHeader* chunk) const { return (const char*)chunk + sizeof(ChunkHeader); }
+
+			MappedFile file;
+			const CheckpointHeader* header;
+			std::vector<const ChunkHeader*> chunks;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,458 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "IO_Compression.h"
+#include "utl/UTL_Parallel.h"
+#include "utl/UTL_Trace.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+namespace VFXEpoch
+{
+	namespace IO
+	{
+		// Control byte c < 128 is followed by c + 1 literal bytes, c >= 128
+		// repeats the next byte c - 128 + MIN_RUN times.
+		static const size_t MIN_RUN = 3;
+		static const size_t MAX_RUN = 127 + MIN_RUN;
+		static const size_t MAX_LITERAL = 128;
+
+		static void
+		shuffle(const unsigned char* src, size_t bytes, size_t element_size, unsigned char* dest){
+			size_t count = bytes / element_size;
+			for(size_t b = 0; b != element_size; b++){
+				unsigned char* plane = dest + b * count;
+				for(size_t i = 0; i != count; i++){
+					plane[i] = src[i * element_size + b];
+				}
+			}
+			memcpy(dest + count * element_size, src + count * element_size, bytes - count * element_size);
+		}
+
+		static void
+		unshuffle(const unsigned char* src, size_t bytes, size_t element_size, unsigned char* dest){
+			size_t count = bytes / element_size;
+			for(size_t b = 0; b != element_size; b++){
+				const unsigned char* plane = src + b * count;
+				for(size_t i = 0; i != count; i++){
+					dest[i * element_size + b] = plane[i];
+				}
+			}
+			memcpy(dest + count * element_size, src + count * element_size, bytes - count * element_size);
+		}
+
+		static size_t
+		run_length(const unsigned char* src, size_t pos, size_t bytes){
+			size_t n = 1;
+			while(pos + n < bytes && n < MAX_RUN && src[pos + n] == src[pos]) n++;
+			return n;
+		}
+
+		static void
+		rle_encode(const unsigned char* src, size_t bytes, std::vector<char>& dest){
+			size_t pos = 0;
+			while(pos < bytes){
+				size_t run = run_length(src, pos, bytes);
+				if(run >= MIN_RUN){
+					dest.push_back((char)(128 + run - MIN_RUN));
+					dest.push_back((char)src[pos]);
+					pos += run;
+					continue;
+				}
+
+				size_t start = pos;
+				while(pos < bytes && pos - start < MAX_LITERAL){
+					if(run_length(src, pos, bytes) >= MIN_RUN) break;
+					pos++;
+				}
+				dest.push_back((char)(pos - start - 1));
+				dest.insert(dest.end(), (const char*)src + start, (const char*)src + pos);
+			}
+		}
+
+		static bool
+		rle_decode(const unsigned char* src, size_t stored, unsigned char* dest, size_t bytes){
+			size_t in = 0, out = 0;
+			while(in < stored){
+				size_t c = src[in++];
+				if(c < 128){
+					size_t n = c + 1;
+					if(in + n > stored || out + n > bytes) return false;
+					memcpy(dest + out, src + in, n);
+					in += n;
+					out += n;
+				}
+				else{
+					size_t n = c - 128 + MIN_RUN;
+					if(in >= stored || out + n > bytes) return false;
+					memset(dest + out, src[in++], n);
+					out += n;
+				}
+			}
+			return out == bytes;
+		}
+
+		// LZ sequences: a token with the literal count in the high nibble and
+		// the match length - LZ_MIN_MATCH in the low one (15 means more length
+		// bytes follow, each 255 adds up), the literals, a 16 bit offset and
+		// the match length bytes. The last sequence has literals only.
+		static const size_t LZ_MIN_MATCH = 4;
+		static const size_t LZ_MAX_OFFSET = 65535;
+		static const int LZ_HASH_BITS = 14;
+
+		typedef struct _tile_stream_header
+		{
+			unsigned int num_tiles;
+			unsigned int tile_bytes;
+			float step;					// Quantisation step, 0 when lossless
+			unsigned int reserved;
+		}TileStreamHeader;
+
+		typedef struct _tile_entry
+		{
+			CODEC codec;				// NONE, SHUFFLE_LZ or QUANTIZE_LZ
+			unsigned int stored;
+		}TileEntry;
+
+		static const size_t TILE_ELEMENTS = 16384;
+		// Keeps the neighbour differences of quantised values within 32 bits
+		static const double QUANTIZE_LIMIT = (double)((1 << 30) - 1);
+
+		static unsigned int
+		read32(const unsigned char* p){
+			unsigned int v;
+			memcpy(&v, p, sizeof(v));
+			return v;
+		}
+
+		static void
+		lz_length(size_t length, std::vector<char>& dest){
+			while(length >= 255){
+				dest.push_back((char)255);
+				length -= 255;
+			}
+			dest.push_back((char)length);
+		}
+
+		static void
+		lz_sequence(const unsigned char* literals, size_t count, size_t offset, size_t match, std::vector<char>& dest){
+			size_t extra = match ? match - LZ_MIN_MATCH : 0;
+			dest.push_back((char)(((count < 15 ? count : 15) << 4) | (extra < 15 ? extra : 15)));
+			if(count >= 15) lz_length(count - 15, dest);
+			dest.insert(dest.end(), (const char*)literals, (const char*)literals + count);
+			if(!match) return;
+			dest.push_back((char)(offset & 0xFF));
+			dest.push_back((char)(offset >> 8));
+			if(extra >= 15) lz_length(extra - 15, dest);
+		}
+
+		static void
+		lz_encode(const unsigned char* src, size_t bytes, std::vector<char>& dest){
+			// Positions + 1 of the last occurence of each hashed 4 byte sequence
+			std::vector<unsigned int> table((size_t)1 << LZ_HASH_BITS, 0);
+			size_t anchor = 0, pos = 0;
+			while(pos + LZ_MIN_MATCH <= bytes){
+				unsigned int sequence = read32(src + pos);
+				unsigned int hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+				size_t candidate = table[hash];
+				table[hash] = (unsigned int)(pos + 1);
+				if(candidate && pos - (candidate - 1) <= LZ_MAX_OFFSET && read32(src + candidate - 1) == sequence){
+					size_t from = candidate - 1;
+					size_t length = LZ_MIN_MATCH;
+					while(pos + length < bytes && src[from + length] == src[pos + length]) length++;
+					lz_sequence(src + anchor, pos - anchor, pos - from, length, dest);
+					pos += length;
+					anchor = pos;
+					continue;
+				}
+				pos++;
+			}
+			lz_sequence(src + anchor, bytes - anchor, 0, 0, dest);
+		}
+
+		static bool
+		lz_extra(const unsigned char* src, size_t stored, size_t& in, size_t& length){
+			unsigned char b;
+			do{
+				if(in >= stored) return false;
+				b = src[in++];
+				length += b;
+			}while(255 == b);
+			return true;
+		}
+
+		static bool
+		lz_decode(const unsigned char* src, size_t stored, unsigned char* dest, size_t bytes){
+			size_t in = 0, out = 0;
+			while(in < stored){
+				unsigned char token = src[in++];
+				size_t count = token >> 4;
+				if(15 == count && !lz_extra(src, stored, in, count)) return false;
+				if(count > stored - in || count > bytes - out) return false;
+				memcpy(dest + out, src + in, count);
+				in += count;
+				out += count;
+				if(in == stored) break;
+
+				if(in + 2 > stored) return false;
+				size_t offset = src[in] | ((size_t)src[in + 1] << 8);
+				in += 2;
+				size_t length = token & 15;
+				if(15 == length && !lz_extra(src, stored, in, length)) return false;
+				length += LZ_MIN_MATCH;
+				if(!offset || offset > out || length > bytes - out) return false;
+				// Byte by byte, a match may overlap the bytes it produces
+				for(size_t i = 0; i != length; i++, out++) dest[out] = dest[out - offset];
+			}
+			return out == bytes;
+		}
+
+		static bool
+		quantize(const float* src, size_t count, double step, unsigned int* dest){
+			long long previous = 0;
+			for(size_t i = 0; i != count; i++){
+				double q = std::floor((double)src[i] / step + 0.5);
+				// Also rejects nan
+				if(!(std::fabs(q) <= QUANTIZE_LIMIT)) return false;
+				long long delta = (long long)q - previous;
+				previous = (long long)q;
+				dest[i] = (unsigned int)((delta << 1) ^ (delta >> 63));
+			}
+			return true;
+		}
+
+		static void
+		dequantize(const unsigned int* src, size_t count, double step, float* dest){
+			long long previous = 0;
+			for(size_t i = 0; i != count; i++){
+				long long delta = (long long)(src[i] >> 1) ^ -(long long)(src[i] & 1);
+				previous += delta;
+				dest[i] = (float)(previous * step);
+			}
+		}
+
+		static void
+		shuffle_lz(const unsigned char* src, size_t bytes, size_t element_size, std::vector<char>& dest){
+			std::vector<unsigned char> planes(bytes);
+			shuffle(src, bytes, element_size, &planes[0]);
+			lz_encode(&planes[0], bytes, dest);
+		}
+
+		static bool
+		unshuffle_lz(const unsigned char* src, size_t stored, size_t element_size, unsigned char* dest, size_t bytes){
+			std::vector<unsigned char> planes(bytes);
+			if(!lz_decode(src, stored, &planes[0], bytes)) return false;
+			unshuffle(&planes[0], bytes, element_size, dest);
+			return true;
+		}
+
+		static void
+		encode_tile(const unsigned char* src, size_t bytes, size_t element_size, double step, TileEntry& entry, std::vector<char>& dest){
+			dest.clear();
+			entry.codec = CODEC::SHUFFLE_LZ;
+			if(step > 0.0 && 0 == bytes % sizeof(float)){
+				std::vector<unsigned int> residuals(bytes / sizeof(float));
+				if(quantize((const float*)src, residuals.size(), step, residuals.empty() ? NULL : &residuals[0])){
+					shuffle_lz((const unsigned char*)&residuals[0], bytes, sizeof(unsigned int), dest);
+					entry.codec = CODEC::QUANTIZE_LZ;
+				}
+			}
+			if(CODEC::SHUFFLE_LZ == entry.codec) shuffle_lz(src, bytes, element_size, dest);
+			if(dest.size() >= bytes){
+				entry.codec = CODEC::NONE;
+				dest.assign((const char*)src, (const char*)src + bytes);
+			}
+			entry.stored = (unsigned int)dest.size();
+		}
+
+		static bool
+		decode_tile(const TileEntry& entry, const unsigned char* src, size_t element_size, double step, unsigned char* dest, size_t bytes){
+			switch(entry.codec){
+			case CODEC::NONE:
+				if(entry.stored != bytes) return false;
+				memcpy(dest, src, bytes);
+				return true;
+			case CODEC::SHUFFLE_LZ:
+				return unshuffle_lz(src, entry.stored, element_size, dest, bytes);
+			case CODEC::QUANTIZE_LZ:{
+				if(!(step > 0.0) || bytes % sizeof(float)) return false;
+				std::vector<unsigned int> residuals(bytes / sizeof(float));
+				if(!unshuffle_lz(src, entry.stored, sizeof(unsigned int), (unsigned char*)&residuals[0], bytes)) return false;
+				dequantize(&residuals[0], residuals.size(), step, (float*)dest);
+				return true;
+			}
+			default:
+				return false;
+			}
+		}
+
+		static void
+		compress_tiles(const CompressionPolicy& policy, const unsigned char* src, size_t bytes, size_t element_size, std::vector<char>& dest){
+			VFXEPOCH_TRACE_SCOPE("IO", "compress_tiles");
+			TileStreamHeader header;
+			memset(&header, 0, sizeof(header));
+			header.tile_bytes = (unsigned int)(TILE_ELEMENTS * element_size);
+			header.num_tiles = (unsigned int)((bytes + header.tile_bytes - 1) / header.tile_bytes);
+			bool lossy = CODEC::QUANTIZE_LZ == policy.codec && sizeof(float) == element_size && policy.tolerance > 0.0f;
+			header.step = lossy ? 2.0f * policy.tolerance : 0.0f;
+
+			std::vector<TileEntry> entries(header.num_tiles);
+			std::vector<std::vector<char> > tiles(header.num_tiles);
+			Parallel::ParallelFor(0, (int)header.num_tiles, [&](int first, int last){
+				for(int t = first; t != last; t++){
+					size_t begin = (size_t)t * header.tile_bytes;
+					size_t size = bytes - begin < header.tile_bytes ? bytes - begin : header.tile_bytes;
+					encode_tile(src + begin, size, element_size, header.step, entries[t], tiles[t]);
+				}
+			}, 1);
+
+			size_t total = sizeof(header) + entries.size() * sizeof(TileEntry);
+			for(size_t t = 0; t != tiles.size(); t++) total += tiles[t].size();
+			dest.reserve(dest.size() + total);
+			dest.insert(dest.end(), (const char*)&header, (const char*)&header + sizeof(header));
+			dest.insert(dest.end(), (const char*)&entries[0], (const char*)&entries[0] + entries.size() * sizeof(TileEntry));
+			for(size_t t = 0; t != tiles.size(); t++) dest.insert(dest.end(), tiles[t].begin(), tiles[t].end());
+		}
+
+		static bool
+		decompress_tiles(const unsigned char* src, size_t stored, size_t element_size, unsigned char* dest, size_t bytes){
+			VFXEPOCH_TRACE_SCOPE("IO", "decompress_tiles");
+			TileStreamHeader header;
+			if(stored < sizeof(header)) return false;
+			memcpy(&header, src, sizeof(header));
+			if(!header.tile_bytes || header.num_tiles != (bytes + header.tile_bytes - 1) / header.tile_bytes) return false;
+			if(header.num_tiles > (stored - sizeof(header)) / sizeof(TileEntry)) return false;
+
+			std::vector<TileEntry> entries(header.num_tiles);
+			memcpy(&entries[0], src + sizeof(header), entries.size() * sizeof(TileEntry));
+			std::vector<size_t> offsets(header.num_tiles);
+			size_t offset = sizeof(header) + entries.size() * sizeof(TileEntry);
+			for(size_t t = 0; t != entries.size(); t++){
+				offsets[t] = offset;
+				offset += entries[t].stored;
+			}
+			if(offset != stored) return false;
+
+			std::atomic<bool> ok(true);
+			Parallel::ParallelFor(0, (int)header.num_tiles, [&](int first, int last){
+				for(int t = first; t != last && ok; t++){
+					size_t begin = (size_t)t * header.tile_bytes;
+					size_t size = bytes - begin < header.tile_bytes ? bytes - begin : header.tile_bytes;
+					if(!decode_tile(entries[t], src + offsets[t], element_size, header.step, dest + begin, size)) ok = false;
+				}
+			}, 1);
+			return ok;
+		}
+
+		void
+		Compress(const CompressionPolicy& policy, const void* src, size_t bytes, size_t element_size, std::vector<char>& dest){
+			if(CODEC::NONE == policy.codec || !bytes){
+				dest.insert(dest.end(), (const char*)src, (const char*)src + bytes);
+				return;
+			}
+			if(!element_size) element_size = 1;
+
+			if(CODEC::SHUFFLE_RLE == policy.codec){
+				std::vector<unsigned char> planes(bytes);
+				shuffle((const unsigned char*)src, bytes, element_size, &planes[0]);
+				rle_encode(&planes[0], bytes, dest);
+				return;
+			}
+			compress_tiles(policy, (const unsigned char*)src, bytes, element_size, dest);
+		}
+
+		bool
+		Decompress(CODEC codec, const void* src, size_t stored, size_t element_size, void* dest, size_t bytes){
+			if(CODEC::NONE == codec){
+				if(stored != bytes) return false;
+				memcpy(dest, src, bytes);
+				return true;
+			}
+			if(!bytes) return 0 == stored;
+			if(!element_size) element_size = 1;
+
+			switch(codec){
+			case CODEC::SHUFFLE_RLE:{
+				std::vector<unsigned char> planes(bytes);
+				if(!rle_decode((const unsigned char*)src, stored, &planes[0], bytes)) return false;
+				unshuffle(&planes[0], bytes, element_size, (unsigned char*)dest);
+				return true;
+			}
+			case CODEC::SHUFFLE_LZ:
+			case CODEC::QUANTIZE_LZ:
+				return decompress_tiles((const unsigned char*)src, stored, element_size, (unsigned char*)dest, bytes);
+			default:
+				return false;
+			}
+		}
+
+		unsigned short
+		FloatToHalf(float value){
+			unsigned int f;
+			memcpy(&f, &value, sizeof(f));
+			unsigned int sign = (f >> 16) & 0x8000;
+			unsigned int exponent = (f >> 23) & 0xFF;
+			unsigned int mantissa = f & 0x7FFFFF;
+
+			if(0xFF == exponent)
+				return (unsigned short)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+			int e = (int)exponent - 127 + 15;
+			if(e >= 31)
+				return (unsigned short)(sign | 0x7C00);
+			if(e <= 0){
+				if(e < -10) return (unsigned short)sign;
+				mantissa |= 0x800000;
+				unsigned int shift = (unsigned int)(14 - e);
+				unsigned int half = mantissa >> shift;
+				unsigned int rest = mantissa & ((1u << shift) - 1);
+				unsigned int halfway = 1u << (shift - 1);
+				if(rest > halfway || (rest == halfway && (half & 1))) half++;
+				return (unsigned short)(sign | half);
+			}
+
+			unsigned int half = sign | ((unsigned int)e << 10) | (mantissa >> 13);
+			unsigned int rest = mantissa & 0x1FFF;
+			if(rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+			return (unsigned short)half;
+		}
+
+		float
+		HalfToFloat(unsigned short value){
+			unsigned int sign = (unsigned int)(value & 0x8000) << 16;
+			unsigned int exponent = (value >> 10) & 0x1F;
+			unsigned int mantissa = value & 0x3FF;
+			unsigned int f;
+
+			if(0 == exponent){
+				if(0 == mantissa){
+					f = sign;
+				}
+				else{
+					exponent = 127 - 15 + 1;
+					while(!(mantissa & 0x400)){
+						mantissa <<= 1;
+						exponent--;
+					}
+					f = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+				}
+			}
+			else if(0x1F == exponent){
+				f = sign | 0x7F800000 | (mantissa << 13);
+			}
+			else{
+				f = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+			}
+
+			float result;
+			memcpy(&result, &f, sizeof(result));
+			return result;
+		}
+	}
+}
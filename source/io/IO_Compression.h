@@ -0,0 +1,75 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Codecs for the binary field formats.
+*
+* SHUFFLE_RLE splits the payload into byte planes (all first bytes of every
+* element, then all second bytes, ...) and run-length encodes the planes.
+* Simulation fields are mostly empty or smooth, so the exponent and high
+* mantissa planes collapse into long runs while the noisy low bytes pass
+* through as literals.
+*
+* SHUFFLE_LZ and QUANTIZE_LZ cut the payload into 64KB tiles which are
+* encoded in parallel on the shared task pool and decoded the same way:
+*   SHUFFLE_LZ   lossless, byte planes followed by an LZ77 pass in the
+*                spirit of LZ4 (byte aligned tokens, 64KB window), which also
+*                catches the repeated patterns RLE misses
+*   QUANTIZE_LZ  float fields only, values are rounded to multiples of
+*                2 * tolerance so the error never exceeds tolerance (plus the
+*                float rounding of the result), the differences between
+*                neighbours are then stored as SHUFFLE_LZ integers. Tiles
+*                holding inf/nan or values too large for the step fall back
+*                to the lossless path.
+* A tile that does not shrink is stored raw. Choose the codec per field with
+* a CompressionPolicy: lossy for smoke densities written for playback,
+* lossless for anything a restart has to reproduce bit for bit.
+*******************************************************************************/
+#ifndef _IO_COMPRESSION_H_
+#define _IO_COMPRESSION_H_
+
+#include <vector>
+#include <cstddef>
+
+namespace VFXEpoch
+{
+	namespace IO
+	{
+		enum class CODEC : unsigned int
+		{
+			NONE = 0,
+			SHUFFLE_RLE = 1,
+			SHUFFLE_LZ = 2,
+			QUANTIZE_LZ = 3
+		};
+
+		struct CompressionPolicy
+		{
+			CompressionPolicy(CODEC _codec = CODEC::SHUFFLE_LZ, float _tolerance = 0.0f) : codec(_codec), tolerance(_tolerance){}
+			CODEC codec;
+			float tolerance;			// Max absolute error of QUANTIZE_LZ, 0 keeps it lossless
+		};
+
+		// Appends the encoded bytes to dest. element_size is the stride used
+		// to shuffle, bytes need not be a multiple of it.
+		void Compress(const CompressionPolicy& policy, const void* src, size_t bytes, size_t element_size, std::vector<char>& dest);
+		inline void Compress(CODEC codec, const void* src, size_t bytes, size_t element_size, std::vector<char>& dest){
+			Compress(CompressionPolicy(codec), src, bytes, element_size, dest);
+		}
+		// Decodes exactly bytes bytes into dest, false on malformed input
+		bool Decompress(CODEC codec, const void* src, size_t stored, size_t element_size, void* dest, size_t bytes);
+
+		// IEEE 754 binary16, rounds to nearest even and keeps inf/nan
+		unsigned short FloatToHalf(float value);
+		float HalfToFloat(unsigned short value);
+	}
+}
+
+#endif
@@ -0,0 +1,253 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "IO_FrameWriter.h"
+#include "utl/UTL_Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace VFXEpoch
+{
+	namespace IO
+	{
+		void
+		Frame::setChannel(const char* name, const Grid2DfScalarField& grid){
+			FrameChannel* dest = NULL;
+			for(int i = 0; i != num_channels; i++){
+				if(channels[i].name == name) dest = &channels[i];
+			}
+			if(!dest){
+				if((int)channels.size() == num_channels) channels.push_back(FrameChannel());
+				dest = &channels[num_channels++];
+				dest->name = name;
+			}
+			dest->dims[0] = grid.m_xCell;
+			dest->dims[1] = grid.m_yCell;
+			dest->spacing = grid.dx;
+			dest->data.assign(grid.data.begin(), grid.data.end());
+		}
+
+		void
+		Frame::setParticles(const std::vector<Particle2Df>& particles){
+			float* xyz = mapPoints((int)particles.size());
+			for(size_t i = 0; i != particles.size(); i++){
+				xyz[i * 3 + 0] = particles[i].pos.m_x;
+				xyz[i * 3 + 1] = particles[i].pos.m_y;
+				xyz[i * 3 + 2] = 0.0f;
+			}
+		}
+
+		void
+		Frame::setParticles(const ParticleView2Df& particles){
+			float* xyz = mapPoints(particles.count);
+			for(int i = 0; i != particles.count; i++){
+				xyz[i * 3 + 0] = particles.pos_x[i];
+				xyz[i * 3 + 1] = particles.pos_y[i];
+				xyz[i * 3 + 2] = 0.0f;
+			}
+			if(particles.id && particles.count)
+				memcpy(mapIds(), particles.id, (size_t)particles.count * sizeof(unsigned long long));
+		}
+
+		void
+		Frame::setPoints(const float* xyz, int count){
+			float* dest = mapPoints(count);
+			if(count) memcpy(dest, xyz, (size_t)count * 3 * sizeof(float));
+		}
+
+		const FrameChannel*
+		Frame::channel(const char* name) const{
+			for(int i = 0; i != num_channels; i++){
+				if(channels[i].name == name) return &channels[i];
+			}
+			return NULL;
+		}
+
+		// Storage is never cleared or shrunk, only the counts are
+		void
+		Frame::reset(){
+			index = 0;
+			num_channels = 0;
+			num_points = 0;
+			num_attributes = 0;
+			has_ids = false;
+		}
+
+		float*
+		Frame::mapPoints(int count){
+			num_points = count > 0 ? count : 0;
+			has_ids = false;
+			num_attributes = 0;
+			if(points.size() < (size_t)num_points * 3) points.resize((size_t)num_points * 3);
+			return points.empty() ? NULL : &points[0];
+		}
+
+		unsigned long long*
+		Frame::mapIds(){
+			has_ids = true;
+			if(ids.size() < (size_t)num_points) ids.resize((size_t)num_points);
+			return ids.empty() ? NULL : &ids[0];
+		}
+
+		float*
+		Frame::mapAttribute(const char* name, int components){
+			FrameAttribute* dest = NULL;
+			for(int i = 0; i != num_attributes; i++){
+				if(attributes[i].name == name) dest = &attributes[i];
+			}
+			if(!dest){
+				// Reuse the slot that held the same attribute last time if possible
+				int slot = num_attributes;
+				for(int i = num_attributes; i < (int)attributes.size(); i++){
+					if(attributes[i].name == name){
+						slot = i;
+						break;
+					}
+				}
+				if(slot == (int)attributes.size()) attributes.push_back(FrameAttribute());
+				std::swap(attributes[slot], attributes[num_attributes]);
+				dest = &attributes[num_attributes++];
+				dest->name = name;
+			}
+			dest->components = components;
+			size_t size = (size_t)num_points * components;
+			if(dest->data.size() < size) dest->data.resize(size);
+			return dest->data.empty() ? NULL : &dest->data[0];
+		}
+
+		const FrameAttribute*
+		Frame::attribute(const char* name) const{
+			for(int i = 0; i != num_attributes; i++){
+				if(attributes[i].name == name) return &attributes[i];
+			}
+			return NULL;
+		}
+
+		bool
+		RawParticleSink::write(const Frame& frame){
+			char filename[1024];
+			snprintf(filename, sizeof(filename), pattern.c_str(), frame.index);
+			FILE* f = fopen(filename, "wb");
+			if(!f) return false;
+
+			int num = frame.num_points;
+			scratch.resize((size_t)num * 4);
+			for(int i = 0; i != num; i++){
+				scratch[i * 4 + 0] = frame.points[i * 3 + 0];
+				scratch[i * 4 + 1] = frame.points[i * 3 + 1];
+				scratch[i * 4 + 2] = frame.points[i * 3 + 2];
+				scratch[i * 4 + 3] = 1.0f;
+			}
+			bool ok = 1 == fwrite(&num, sizeof(int), 1, f);
+			if(num) ok = ok && scratch.size() == fwrite(&scratch[0], sizeof(float), scratch.size(), f);
+			return 0 == fclose(f) && ok;
+		}
+
+		AsyncFrameWriter::AsyncFrameWriter(int pool_size) : busy(0), failures(0), stalled(0.0), stopping(false){
+			pool.resize(pool_size > 0 ? pool_size : 1);
+			for(size_t i = 0; i != pool.size(); i++){
+				free_frames.push_back(&pool[i]);
+			}
+			worker = std::thread(&AsyncFrameWriter::run, this);
+		}
+
+		AsyncFrameWriter::~AsyncFrameWriter(){
+			close();
+		}
+
+		void
+		AsyncFrameWriter::addSink(FrameSink* sink){
+			std::lock_guard<std::mutex> lock(mutex);
+			sinks.push_back(sink);
+		}
+
+		Frame*
+		AsyncFrameWriter::acquire(){
+			VFXEPOCH_TRACE_SCOPE("IO", "acquire_frame");
+			std::unique_lock<std::mutex> lock(mutex);
+			if(free_frames.empty()){
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				frame_done.wait(lock, [this]{ return !free_frames.empty(); });
+				stalled += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+			Frame* frame = free_frames.back();
+			free_frames.pop_back();
+			frame->reset();
+			return frame;
+		}
+
+		void
+		AsyncFrameWriter::submit(Frame* frame){
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				queue.push_back(frame);
+			}
+			frame_ready.notify_one();
+		}
+
+		void
+		AsyncFrameWriter::flush(){
+			std::unique_lock<std::mutex> lock(mutex);
+			frame_done.wait(lock, [this]{ return queue.empty() && 0 == busy; });
+		}
+
+		void
+		AsyncFrameWriter::close(){
+			if(!worker.joinable()) return;
+			flush();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			frame_ready.notify_one();
+			worker.join();
+
+			for(size_t i = 0; i != sinks.size(); i++){
+				sinks[i]->close();
+				delete sinks[i];
+			}
+			sinks.clear();
+		}
+
+		void
+		AsyncFrameWriter::run(){
+			std::unique_lock<std::mutex> lock(mutex);
+			while(true){
+				frame_ready.wait(lock, [this]{ return stopping || !queue.empty(); });
+				if(queue.empty()) return;
+
+				Frame* frame = queue.front();
+				queue.pop_front();
+				busy++;
+				std::vector<FrameSink*> targets = sinks;
+				lock.unlock();
+
+				int failed = 0;
+				{
+					VFXEPOCH_TRACE_SCOPE("IO", "write_frame");
+					for(size_t i = 0; i != targets.size(); i++){
+						if(!targets[i]->write(*frame)){
+							std::cout << "WARNING: Failed to write frame " << frame->index << std::endl;
+							failed++;
+						}
+					}
+				}
+
+				lock.lock();
+				busy--;
+				failures += failed;
+				free_frames.push_back(frame);
+				frame_done.notify_all();
+			}
+		}
+	}
+}
@@ -0,0 +1,177 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Asynchronous frame output.
+*
+* The simulation thread copies the fields and particles it wants to keep into
+* a Frame taken from a small pool and submits it, a background thread hands
+* the frame to every sink and returns it to the pool. Disk I/O of frame N
+* overlaps with the simulation of frame N + 1.
+*
+* The pool is bounded (two frames, double buffering, by default): acquire()
+* blocks while every frame is still queued or being written, so a slow disk
+* throttles the simulation instead of piling up memory.
+*
+*   VFXEpoch::IO::AsyncFrameWriter writer;
+*   writer.addSink(new VFXEpoch::IO::RawParticleSink("particles_%04d.bin"));
+*   for(...){
+*     solver.step();
+*     VFXEpoch::IO::Frame* frame = writer.acquire();
+*     frame->index = i;
+*     frame->setParticles(solver.get_particle_view());
+*     writer.submit(frame);
+*   }
+*   writer.close();
+*
+* Points are kept as one array per attribute (positions, ids, velocities,
+* ...). Large particle counts should be copied straight into the pooled
+* storage with mapPoints() / mapIds() / mapAttribute(): the storage only
+* grows, so once a frame has held the largest count no snapshot allocates
+* or clears memory, and the sinks hand the arrays to their writers as is.
+*
+*   float* xyz = frame->mapPoints(n);
+*   unsigned long long* id = frame->mapIds();
+*   float* v = frame->mapAttribute("velocity", 3);
+*******************************************************************************/
+#ifndef _IO_FRAME_WRITER_H_
+#define _IO_FRAME_WRITER_H_
+
+#include "utl/UTL_General.h"
+#include "utl/UTL_Grid.h"
+#include "utl/UTL_Particles.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace VFXEpoch
+{
+	namespace IO
+	{
+		typedef struct _frame_channel
+		{
+			std::string name;
+			int dims[2];			// Columns, rows
+			float spacing;
+			std::vector<float> data;
+		}FrameChannel;
+
+		typedef struct _frame_attribute
+		{
+			std::string name;
+			int components;
+			std::vector<float> data;	// components values per point
+		}FrameAttribute;
+
+		// Storage is kept when a frame goes back to the pool, so after the
+		// first few frames snapshots do not allocate
+		class Frame
+		{
+		public:
+			Frame() : index(0), num_channels(0), num_points(0), num_attributes(0), has_ids(false){}
+
+			// Copies a scalar grid into the channel of that name
+			void setChannel(const char* name, const Grid2DfScalarField& grid);
+			// Points are stored as xyz, particles get z = 0
+			void setParticles(const std::vector<Particle2Df>& particles);
+			// Also maps the ids, a solver may reorder its particles between frames
+			void setParticles(const ParticleView2Df& particles);
+			void setPoints(const float* xyz, int count);
+			const FrameChannel* channel(const char* name) const;
+			void reset();
+
+			// Sizes the frame for count points, returns the xyz storage
+			float* mapPoints(int count);
+			// Storage for the ids of the mapped points. An id has to stay with
+			// its point for the point's whole life, sinks match points by it.
+			unsigned long long* mapIds();
+			// Storage for a per point attribute of the mapped points
+			float* mapAttribute(const char* name, int components);
+			const FrameAttribute* attribute(const char* name) const;
+
+			int index;
+			int num_channels;	// Only the first num_channels channels are valid
+			int num_points;		// Only the first num_points entries of points, ids
+			int num_attributes;	// and of each attribute are valid
+			bool has_ids;
+			std::vector<FrameChannel> channels;
+			std::vector<float> points;
+			std::vector<unsigned long long> ids;	// Optional, one per point
+			std::vector<FrameAttribute> attributes;
+		};
+
+		class FrameSink
+		{
+		public:
+			virtual ~FrameSink(){}
+			// Runs on the writer thread, false reports a failed write
+			virtual bool write(const Frame& frame) = 0;
+			virtual void close(){}
+		};
+
+		// Legacy particle dump read by the matlab scripts: an int count then
+		// x, y, z, 1 floats per point. pattern is a printf format of the index.
+		class RawParticleSink : public FrameSink
+		{
+		public:
+			RawParticleSink(const std::string& _pattern) : pattern(_pattern){}
+			bool write(const Frame& frame);
+		private:
+			std::string pattern;
+			std::vector<float> scratch;
+		};
+
+		class AsyncFrameWriter
+		{
+		public:
+			AsyncFrameWriter(int pool_size = 2);
+			~AsyncFrameWriter();
+
+			// The writer owns the sinks and deletes them in close()
+			void addSink(FrameSink* sink);
+			// Blocks while every frame of the pool is in flight
+			Frame* acquire();
+			void submit(Frame* frame);
+			// Waits until every submitted frame is written
+			void flush();
+			// Flushes, stops the thread and closes the sinks
+			void close();
+
+			int failed() const { return failures; }
+			// Total time the simulation thread spent blocked in acquire()
+			double stalled_seconds() const { return stalled; }
+
+		private:
+			AsyncFrameWriter(const AsyncFrameWriter&);
+			AsyncFrameWriter& operator=(const AsyncFrameWriter&);
+			void run();
+
+			std::vector<Frame> pool;
+			std::vector<Frame*> free_frames;
+			std::deque<Frame*> queue;
+			std::vector<FrameSink*> sinks;
+			std::mutex mutex;
+			std::condition_variable frame_ready, frame_done;
+			std::thread worker;
+			int busy;
+			// Written by the worker, read by failed() without the lock
+			std::atomic<int> failures;
+			double stalled;
+			bool stopping;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "IO_Stream.h"
+
+#include <cstring>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VFXEPOCH_HAS_MMAP
+#endif
+
+namespace VFXEpoch
+{
+	namespace IO
+	{
+		FileWriter::FileWriter(size_t buffer_size) : file(NULL), used(0), offset(0), failed(false){
+			buffer.resize(buffer_size);
+		}
+
+		FileWriter::~FileWriter(){
+			close();
+		}
+
+		bool
+		FileWriter::open(const std::string& filename){
+			close();
+			file = fopen(filename.c_str(), "wb");
+			used = 0;
+			offset = 0;
+			failed = NULL == file;
+			return !failed;
+		}
+
+		bool
+		FileWriter::flush(){
+			if(!file || failed) return false;
+			if(used && used != fwrite(&buffer[0], 1, used, file)) failed = true;
+			used = 0;
+			return !failed;
+		}
+
+		bool
+		FileWriter::write(const void* data, size_t bytes){
+			if(!file || failed) return false;
+			offset += bytes;
+			if(used + bytes <= buffer.size()){
+				memcpy(&buffer[used], data, bytes);
+				used += bytes;
+				return true;
+			}
+
+			if(!flush()) return false;
+			if(bytes >= buffer.size()){
+				if(bytes != fwrite(data, 1, bytes, file)) failed = true;
+				return !failed;
+			}
+			memcpy(&buffer[0], data, bytes);
+			used = bytes;
+			return true;
+		}
+
+		bool
+		FileWriter::align(size_t alignment){
+			static const char zeros[64] = {0};
+			size_t pad = (size_t)((alignment - offset % alignment) % alignment);
+			while(pad){
+				size_t n = pad < sizeof(zeros) ? pad : sizeof(zeros);
+				if(!write(zeros, n)) return false;
+				pad -= n;
+			}
+			return true;
+		}
+
+		bool
+		FileWriter::close(){
+			if(!file) return false;
+			flush();
+			if(0 != fclose(file)) failed = true;
+			file = NULL;
+			return !failed;
+		}
+
+		MappedFile::MappedFile() : ptr(NULL), bytes(0), mapped(false){}
+
+		MappedFile::~MappedFile(){
+			close();
+		}
+
+		bool
+		MappedFile::open(const std::string& filename){
+			close();
+#ifdef VFXEPOCH_HAS_MMAP
+			int fd = ::open(filename.c_str(), O_RDONLY);
+			if(fd < 0) return false;
+			struct stat st;
+			if(0 == fstat(fd, &st) && st.st_size > 0){
+				void* addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if(MAP_FAILED != addr){
+					ptr = (const char*)addr;
+					bytes = (size_t)st.st_size;
+					mapped = true;
+				}
+			}
+			::close(fd);
+			if(mapped) return true;
+#endif
+			FILE* f = fopen(filename.c_str(), "rb");
+			if(!f) return false;
+			fseek(f, 0, SEEK_END);
+			long size = ftell(f);
+			fseek(f, 0, SEEK_SET);
+			if(size > 0){
+				fallback.resize((size_t)size);
+				if((size_t)size == fread(&fallback[0], 1, (size_t)size, f)){
+					ptr = &fallback[0];
+					bytes = (size_t)size;
+				}
+			}
+			fclose(f);
+			return NULL != ptr;
+		}
+
+		void
+		MappedFile::close(){
+#ifdef VFXEPOCH_HAS_MMAP
+			if(mapped) munmap((void*)ptr, bytes);
+#endif
+			ptr = NULL;
+			bytes = 0;
+			mapped = false;
+			std::vector<char>().swap(fallback);
+		}
+
+		void
+		MappedFile::willNeed(size_t offset, size_t length) const{
+#ifdef VFXEPOCH_HAS_MMAP
+			if(!mapped || offset >= bytes) return;
+			size_t page = (size_t)sysconf(_SC_PAGESIZE);
+			size_t begin = offset / page * page;
+			size_t end = offset + length < bytes ? offset + length : bytes;
+			madvise((void*)(ptr + begin), end - begin, MADV_WILLNEED);
+#endif
+		}
+
+		unsigned int
+		Checksum(const void* data, size_t bytes){
+			const unsigned char* p = (const unsigned char*)data;
+			unsigned int hash = 2166136261u;
+			for(size_t i = 0; i != bytes; i++){
+				hash ^= p[i];
+				hash *= 16777619u;
+			}
+			return hash;
+		}
+	}
+}
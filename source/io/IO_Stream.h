@@ -0,0 +1,94 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Low level file access used by the binary formats in io/.
+*
+* FileWriter appends to a file through a fixed size staging buffer, large
+* blocks bypass the buffer and go straight to the file, so a writer never
+* holds more than one field in memory at a time.
+*
+* MappedFile maps a whole file read-only. Readers hand out pointers into the
+* mapping instead of copying, on platforms without mmap the file is read into
+* memory once.
+*******************************************************************************/
+#ifndef _IO_STREAM_H_
+#define _IO_STREAM_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace VFXEpoch
+{
+	namespace IO
+	{
+		class FileWriter
+		{
+		public:
+			FileWriter(size_t buffer_size = 1u << 20);
+			~FileWriter();
+
+			bool open(const std::string& filename);
+			bool write(const void* data, size_t bytes);
+			// Zero pads the file up to the next multiple of alignment
+			bool align(size_t alignment);
+			// Flushes and closes, returns false if any write failed
+			bool close();
+
+			template <class T>
+			bool writeValue(const T& value){ return write(&value, sizeof(T)); }
+
+			unsigned long long tell() const { return offset; }
+			bool good() const { return NULL != file && !failed; }
+
+		private:
+			FileWriter(const FileWriter&);
+			FileWriter& operator=(const FileWriter&);
+			bool flush();
+
+			FILE* file;
+			std::vector<char> buffer;
+			size_t used;
+			unsigned long long offset;
+			bool failed;
+		};
+
+		class MappedFile
+		{
+		public:
+			MappedFile();
+			~MappedFile();
+
+			bool open(const std::string& filename);
+			void close();
+
+			const char* data() const { return ptr; }
+			size_t size() const { return bytes; }
+			bool isOpen() const { return NULL != ptr; }
+			// Asks the kernel to start paging in a range, no-op without mmap
+			void willNeed(size_t offset, size_t length) const;
+
+		private:
+			MappedFile(const MappedFile&);
+			MappedFile& operator=(const MappedFile&);
+
+			const char* ptr;
+			size_t bytes;
+			bool mapped;
+			std::vector<char> fallback;
+		};
+
+		// FNV-1a, used to validate chunk payloads
+		unsigned int Checksum(const void* data, size_t bytes);
+	}
+}
+
+#endif
@@ -0,0 +1,312 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "IO_Volume.h"
+#include "IO_Compression.h"
+#include "utl/UTL_Trace.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace VFXEpoch
+{
+	namespace IO
+	{
+		static const char VOLUME_MAGIC[8] = {'V', 'F', 'X', 'E', 'V', 'O', 'L', 'M'};
+		static const size_t VOLUME_ALIGNMENT = 16;
+
+		static_assert(0 == sizeof(VolumeHeader) % VOLUME_ALIGNMENT, "Volume header breaks the block alignment");
+		static_assert(0 == sizeof(VolumeGridHeader) % VOLUME_ALIGNMENT, "Grid header breaks the block alignment");
+		static_assert(0 == sizeof(VolumeTile) % 8, "Volume tiles must keep their offsets aligned");
+
+		static size_t
+		value_size(VOLUME_PRECISION precision){
+			return VOLUME_PRECISION::HALF == precision ? sizeof(unsigned short) : sizeof(float);
+		}
+
+		VolumeWriter::VolumeWriter(){}
+
+		VolumeWriter::~VolumeWriter(){
+			if(file.good()) close();
+		}
+
+		bool
+		VolumeWriter::open(const std::string& filename){
+			if(!file.open(filename)){
+				std::cout << "WARNING: Cannot open volume " << filename << " for writing" << std::endl;
+				return false;
+			}
+			VolumeHeader header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, VOLUME_MAGIC, sizeof(header.magic));
+			header.version = VOLUME_VERSION;
+			return file.writeValue(header);
+		}
+
+		bool
+		VolumeWriter::close(){
+			if(!file.good()){
+				file.close();
+				return false;
+			}
+			VolumeGridHeader end;
+			memset(&end, 0, sizeof(end));
+			file.writeValue(end);
+			std::vector<VolumeTile>().swap(tiles);
+			std::vector<char>().swap(values);
+			return file.close();
+		}
+
+		bool
+		VolumeWriter::writeGrid(const char* name, const Grid2DfScalarField& grid, const VolumeOptions& options, VolumeStats* stats){
+			int dims[3] = {grid.m_xCell, grid.m_yCell, 1};
+			float spacing[3] = {grid.dx, grid.dy, 0.0f};
+			return writeGrid(name, grid.data.empty() ? NULL : &grid.data[0], dims, spacing, options, stats);
+		}
+
+		bool
+		VolumeWriter::writeGrid(const char* name, const Grid3D<float>& grid, const VolumeOptions& options, VolumeStats* stats){
+			int dims[3] = {grid.m_xCell, grid.m_yCell, grid.m_zCell};
+			float spacing[3] = {grid.dx, grid.dy, grid.dz};
+			return writeGrid(name, grid.data.empty() ? NULL : &grid.data[0], dims, spacing, options, stats);
+		}
+
+		bool
+		VolumeWriter::writeGrid(const char* name, const float* data, const int dims[3], const float spacing[3],
+		                        const VolumeOptions& options, VolumeStats* stats){
+			VFXEPOCH_TRACE_SCOPE("IO", "write_volume");
+			if(!name || !name[0] || !file.good()) return false;
+
+			int tile[3] = {std::max(options.tile_size, 1), std::max(options.tile_size, 1), dims[2] > 1 ? std::max(options.tile_size, 1) : 1};
+			int num[3];
+			for(int a = 0; a != 3; a++){
+				num[a] = (dims[a] + tile[a] - 1) / tile[a];
+			}
+			size_t stride = value_size(options.precision);
+			tiles.clear();
+			values.clear();
+			unsigned long long active_cells = 0;
+
+			for(int tz = 0; tz < num[2]; tz++){
+				for(int ty = 0; ty < num[1]; ty++){
+					for(int tx = 0; tx < num[0]; tx++){
+						int lo[3] = {tx * tile[0], ty * tile[1], tz * tile[2]};
+						int hi[3] = {std::min(lo[0] + tile[0], dims[0]), std::min(lo[1] + tile[1], dims[1]), std::min(lo[2] + tile[2], dims[2])};
+						VolumeTile t;
+						for(int a = 0; a != 3; a++){
+							t.bbox_min[a] = INT_MAX;
+							t.bbox_max[a] = INT_MIN;
+						}
+
+						for(int z = lo[2]; z < hi[2]; z++){
+							for(int y = lo[1]; y < hi[1]; y++){
+								const float* row = data + ((size_t)z * dims[1] + y) * dims[0];
+								for(int x = lo[0]; x < hi[0]; x++){
+									if(!(fabs(row[x] - options.background) > options.threshold)) continue;
+									t.bbox_min[0] = std::min(t.bbox_min[0], x); t.bbox_max[0] = std::max(t.bbox_max[0], x + 1);
+									t.bbox_min[1] = std::min(t.bbox_min[1], y); t.bbox_max[1] = std::max(t.bbox_max[1], y + 1);
+									t.bbox_min[2] = std::min(t.bbox_min[2], z); t.bbox_max[2] = std::max(t.bbox_max[2], z + 1);
+								}
+							}
+						}
+						if(t.bbox_max[0] < 0) continue;
+
+						t.offset = values.size();
+						for(int z = t.bbox_min[2]; z < t.bbox_max[2]; z++){
+							for(int y = t.bbox_min[1]; y < t.bbox_max[1]; y++){
+								const float* row = data + ((size_t)z * dims[1] + y) * dims[0];
+								for(int x = t.bbox_min[0]; x < t.bbox_max[0]; x++){
+									if(VOLUME_PRECISION::HALF == options.precision){
+										unsigned short h = FloatToHalf(row[x]);
+										values.insert(values.end(), (const char*)&h, (const char*)&h + sizeof(h));
+									}
+									else{
+										values.insert(values.end(), (const char*)&row[x], (const char*)&row[x] + sizeof(float));
+									}
+								}
+							}
+						}
+						active_cells += (values.size() - t.offset) / stride;
+						tiles.push_back(t);
+					}
+				}
+			}
+
+			size_t table = tiles.size() * sizeof(VolumeTile);
+			size_t block = table + values.size();
+			block += (VOLUME_ALIGNMENT - block % VOLUME_ALIGNMENT) % VOLUME_ALIGNMENT;
+
+			VolumeGridHeader header;
+			memset(&header, 0, sizeof(header));
+			strncpy(header.name, name, sizeof(header.name) - 1);
+			memcpy(header.dims, dims, sizeof(header.dims));
+			memcpy(header.spacing, spacing, sizeof(header.spacing));
+			memcpy(header.tile_size, tile, sizeof(header.tile_size));
+			header.precision = options.precision;
+			header.background = options.background;
+			header.num_tiles = (unsigned int)tiles.size();
+			header.block_size = block;
+
+			bool ok = file.writeValue(header) &&
+			          (tiles.empty() || file.write(&tiles[0], table)) &&
+			          (values.empty() || file.write(&values[0], values.size())) &&
+			          file.align(VOLUME_ALIGNMENT);
+
+			if(stats){
+				stats->total_tiles = (unsigned int)(num[0] * num[1] * num[2]);
+				stats->active_tiles = (unsigned int)tiles.size();
+				stats->active_cells = active_cells;
+				stats->dense_bytes = (unsigned long long)dims[0] * dims[1] * dims[2] * sizeof(float);
+				stats->stored_bytes = sizeof(VolumeGridHeader) + block;
+			}
+			return ok;
+		}
+
+		VolumeReader::VolumeReader(){}
+
+		VolumeReader::~VolumeReader(){
+			close();
+		}
+
+		bool
+		VolumeReader::open(const std::string& filename){
+			close();
+			if(!file.open(filename)){
+				std::cout << "WARNING: Cannot open volume " << filename << std::endl;
+				return false;
+			}
+
+			const char* begin = file.data();
+			size_t size = file.size();
+			if(size < sizeof(VolumeHeader) || 0 != memcmp(begin, VOLUME_MAGIC, sizeof(VOLUME_MAGIC))){
+				std::cout << "WARNING: " << filename << " is not a VFXEpoch volume" << std::endl;
+				close();
+				return false;
+			}
+			if(((const VolumeHeader*)begin)->version > VOLUME_VERSION){
+				std::cout << "WARNING: " << filename << " has volume version " << ((const VolumeHeader*)begin)->version
+				          << ", this build reads up to version " << VOLUME_VERSION << std::endl;
+				close();
+				return false;
+			}
+
+			size_t offset = sizeof(VolumeHeader);
+			while(offset + sizeof(VolumeGridHeader) <= size){
+				const VolumeGridHeader* header = (const VolumeGridHeader*)(begin + offset);
+				if(!header->name[0]) return true;
+				if(header->block_size > size - offset - sizeof(VolumeGridHeader) ||
+				   (unsigned long long)header->num_tiles * sizeof(VolumeTile) > header->block_size) break;
+				grids.push_back(header);
+				offset += sizeof(VolumeGridHeader) + (size_t)header->block_size;
+			}
+
+			std::cout << "WARNING: Volume " << filename << " is truncated" << std::endl;
+			close();
+			return false;
+		}
+
+		void
+		VolumeReader::close(){
+			grids.clear();
+			file.close();
+		}
+
+		const VolumeGridHeader*
+		VolumeReader::find(const char* name) const{
+			for(size_t i = 0; i != grids.size(); i++){
+				if(0 == strncmp(grids[i]->name, name, sizeof(grids[i]->name))) return grids[i];
+			}
+			return NULL;
+		}
+
+		bool
+		VolumeReader::readGrid(const char* name, Grid2DfScalarField& grid) const{
+			const VolumeGridHeader* header = find(name);
+			if(!header || 1 != header->dims[2]) return false;
+			grid.Reset(header->dims[0], header->dims[1], header->spacing[0], header->spacing[1]);
+			return readBlock(header, grid.data.empty() ? NULL : &grid.data[0]);
+		}
+
+		bool
+		VolumeReader::readGrid(const char* name, Grid3D<float>& grid) const{
+			const VolumeGridHeader* header = find(name);
+			if(!header) return false;
+			grid.Reset(header->dims[0], header->dims[1], header->dims[2], header->spacing[0], header->spacing[1], header->spacing[2]);
+			return readBlock(header, grid.data.empty() ? NULL : &grid.data[0]);
+		}
+
+		bool
+		VolumeReader::readBlock(const VolumeGridHeader* header, float* data) const{
+			VFXEPOCH_TRACE_SCOPE("IO", "read_volume");
+			const int* dims = header->dims;
+			std::fill(data, data + (size_t)dims[0] * dims[1] * dims[2], header->background);
+
+			const VolumeTile* tiles = (const VolumeTile*)(header + 1);
+			const char* values = (const char*)(tiles + header->num_tiles);
+			size_t available = (size_t)header->block_size - header->num_tiles * sizeof(VolumeTile);
+			size_t stride = value_size(header->precision);
+
+			for(unsigned int i = 0; i != header->num_tiles; i++){
+				const VolumeTile& t = tiles[i];
+				size_t count = 1;
+				for(int a = 0; a != 3; a++){
+					if(t.bbox_min[a] < 0 || t.bbox_max[a] > dims[a] || t.bbox_min[a] >= t.bbox_max[a]){
+						std::cout << "WARNING: Volume grid " << header->name << " has a corrupted tile" << std::endl;
+						return false;
+					}
+					count *= (size_t)(t.bbox_max[a] - t.bbox_min[a]);
+				}
+				if(t.offset > available || count * stride > available - t.offset){
+					std::cout << "WARNING: Volume grid " << header->name << " has a corrupted tile" << std::endl;
+					return false;
+				}
+
+				const char* src = values + t.offset;
+				for(int z = t.bbox_min[2]; z < t.bbox_max[2]; z++){
+					for(int y = t.bbox_min[1]; y < t.bbox_max[1]; y++){
+						float* row = data + ((size_t)z * dims[1] + y) * dims[0];
+						int width = t.bbox_max[0] - t.bbox_min[0];
+						if(VOLUME_PRECISION::HALF == header->precision){
+							for(int x = 0; x != width; x++){
+								unsigned short h;
+								memcpy(&h, src + x * sizeof(h), sizeof(h));
+								row[t.bbox_min[0] + x] = HalfToFloat(h);
+							}
+						}
+						else{
+							memcpy(row + t.bbox_min[0], src, width * sizeof(float));
+						}
+						src += width * stride;
+					}
+				}
+			}
+			return true;
+		}
+
+		bool
+		VolumeFrameSink::write(const Frame& frame){
+			if(!frame.num_channels) return true;
+			char filename[1024];
+			snprintf(filename, sizeof(filename), pattern.c_str(), frame.index);
+			if(!writer.open(filename)) return false;
+
+			bool ok = true;
+			for(int i = 0; i != frame.num_channels; i++){
+				const FrameChannel& channel = frame.channels[i];
+				int dims[3] = {channel.dims[0], channel.dims[1], 1};
+				float spacing[3] = {channel.spacing, channel.spacing, 0.0f};
+				ok = writer.writeGrid(channel.name.c_str(), channel.data.empty() ? NULL : &channel.data[0], dims, spacing, options) && ok;
+			}
+			return writer.close() && ok;
+		}
+	}
+}
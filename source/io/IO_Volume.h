@@ -0,0 +1,166 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Sparse volumes for rendering scalar fields (density, temperature, curl).
+*
+* A grid is cut into tiles (16 x 16 in 2D, 16^3 in 3D by default). A tile is
+* active when one of its cells differs from the background by more than the
+* threshold, inactive tiles are not stored at all and active ones only store
+* the bounding box of their active cells. Values can be stored as half
+* floats. A mostly empty smoke domain is typically 10-20x smaller than the
+* dense float dump.
+*
+* Layout (little endian):
+*   VolumeHeader
+*   VolumeGridHeader, VolumeTile[num_tiles], tile values    (per grid)
+*   ...
+*   VolumeGridHeader with an empty name                      (end marker)
+*
+* Tile values are stored x fastest then y then z, matching the Grid2D/Grid3D
+* memory layout, and every grid block starts on a 16 byte boundary.
+*******************************************************************************/
+#ifndef _IO_VOLUME_H_
+#define _IO_VOLUME_H_
+
+#include "utl/UTL_Grid.h"
+#include "io/IO_Stream.h"
+#include "io/IO_FrameWriter.h"
+
+#include <string>
+#include <vector>
+
+namespace VFXEpoch
+{
+	namespace IO
+	{
+		static const unsigned int VOLUME_VERSION = 1;
+
+		enum class VOLUME_PRECISION : unsigned int
+		{
+			FLOAT32 = 0,
+			HALF = 1
+		};
+
+		struct VolumeOptions
+		{
+			VolumeOptions() : tile_size(16), threshold(0.0f), background(0.0f), precision(VOLUME_PRECISION::FLOAT32){}
+			int tile_size;
+			float threshold;			// Cells within threshold of the background are inactive
+			float background;
+			VOLUME_PRECISION precision;
+		};
+
+		typedef struct _volume_header
+		{
+			char magic[8];				// "VFXEVOLM"
+			unsigned int version;
+			unsigned int reserved;
+		}VolumeHeader;
+
+		typedef struct _volume_grid_header
+		{
+			char name[32];
+			int dims[3];				// x, y, z cells, z is 1 for 2D grids
+			float spacing[3];
+			int tile_size[3];
+			VOLUME_PRECISION precision;
+			float background;
+			unsigned int num_tiles;
+			unsigned int reserved[2];
+			unsigned long long block_size;	// Tiles and values, without this header
+		}VolumeGridHeader;
+
+		typedef struct _volume_tile
+		{
+			int bbox_min[3];			// Active cells of the tile, min inclusive
+			int bbox_max[3];			// max exclusive, absolute cell coordinates
+			unsigned long long offset;	// Bytes from the end of the tile table
+		}VolumeTile;
+
+		typedef struct _volume_stats
+		{
+			unsigned int total_tiles;
+			unsigned int active_tiles;
+			unsigned long long active_cells;
+			unsigned long long dense_bytes;
+			unsigned long long stored_bytes;
+		}VolumeStats;
+
+		class VolumeWriter
+		{
+		public:
+			VolumeWriter();
+			~VolumeWriter();
+
+			bool open(const std::string& filename);
+			// Writes the end marker and closes the file
+			bool close();
+
+			bool writeGrid(const char* name, const Grid2DfScalarField& grid,
+			               const VolumeOptions& options = VolumeOptions(), VolumeStats* stats = NULL);
+			bool writeGrid(const char* name, const Grid3D<float>& grid,
+			               const VolumeOptions& options = VolumeOptions(), VolumeStats* stats = NULL);
+			// Dense x fastest array of dims[0] * dims[1] * dims[2] values
+			bool writeGrid(const char* name, const float* data, const int dims[3], const float spacing[3],
+			               const VolumeOptions& options = VolumeOptions(), VolumeStats* stats = NULL);
+
+		private:
+			VolumeWriter(const VolumeWriter&);
+			VolumeWriter& operator=(const VolumeWriter&);
+
+			FileWriter file;
+			std::vector<VolumeTile> tiles;
+			std::vector<char> values;
+		};
+
+		class VolumeReader
+		{
+		public:
+			VolumeReader();
+			~VolumeReader();
+
+			bool open(const std::string& filename);
+			void close();
+
+			int numGrids() const { return (int)grids.size(); }
+			const VolumeGridHeader* grid(int i) const { return grids[i]; }
+			const VolumeGridHeader* find(const char* name) const;
+
+			// Resizes the grid and fills it with the background then the tiles
+			bool readGrid(const char* name, Grid2DfScalarField& grid) const;
+			bool readGrid(const char* name, Grid3D<float>& grid) const;
+
+		private:
+			VolumeReader(const VolumeReader&);
+			VolumeReader& operator=(const VolumeReader&);
+			bool readBlock(const VolumeGridHeader* header, float* data) const;
+
+			MappedFile file;
+			std::vector<const VolumeGridHeader*> grids;
+		};
+
+		// Writes every channel of a frame into one volume file per frame,
+		// pattern is a printf format of the frame index
+		class VolumeFrameSink : public FrameSink
+		{
+		public:
+			VolumeFrameSink(const std::string& _pattern, const VolumeOptions& _options = VolumeOptions()) :
+				pattern(_pattern), options(_options){}
+			bool write(const Frame& frame);
+		private:
+			std::string pattern;
+			VolumeOptions options;
+			VolumeWriter writer;
+		};
+	}
+}
+
+#endif
@@ -1,53 +1,327 @@
 #ifndef BLAS_WRAPPER_H
 #define BLAS_WRAPPER_H
 
-// Simple placeholder code for BLAS calls - replace with calls to a real BLAS library
+// Vector kernels of the PCG solver (dot, norms, axpy style updates), named
+// after the BLAS routines they stand in for.
+//
+// The loops run in parallel over blocks of BLAS_BLOCK_SIZE entries, with SSE2
+// kernels inside a block where the compiler targets it. The scalar fallbacks
+// keep the same running sums as the SSE2 kernels, so a block gives the same
+// bits either way.
+//
+// Reduction order: with the default REDUCTION::FIXED_ORDER, reductions keep
+// one partial result per block and add the blocks up in block order, so dots
+// and norms give the same result on any number of threads, with or without
+// SSE2. REDUCTION::ANY_ORDER adds thread sized chunks as they finish instead,
+// which saves the partial array but may change the last bits from run to run.
+//
+// Every function also takes float vectors: the values are widened to double
+// for the arithmetic and dots and norms are accumulated in double, only the
+// stored results are rounded to float.
 
+#include <algorithm>
+#include <cmath>
+#include <mutex>
 #include <vector>
+#include "../UTL_Parallel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLAS_SSE2
+#endif
 
 namespace BLAS{
 
-// dot products ==============================================================
+const int BLAS_BLOCK_SIZE = 4096;
+
+enum class REDUCTION { FIXED_ORDER, ANY_ORDER };
+
+// Process wide, only change it while no solve is running
+inline REDUCTION& reduction_mode()
+{
+   static REDUCTION mode = REDUCTION::FIXED_ORDER;
+   return mode;
+}
+
+inline void set_reduction(REDUCTION mode)
+{ reduction_mode() = mode; }
+
+inline int block_count(size_t n)
+{ return (int)((n + BLAS_BLOCK_SIZE - 1) / BLAS_BLOCK_SIZE); }
+
+// Per block results of a fixed order reduction. Every thread reuses one buffer
+// so the PCG loop does not allocate on each dot product, a reduction started
+// while the buffer is taken (by a task run during the wait) gets its own
+class BlockPartials
+{
+public:
+   explicit BlockPartials(int blocks) : owner(!taken())
+   {
+      data = owner ? &shared() : &local;
+      if(owner) taken() = true;
+      if(data->size() < (size_t)blocks) data->resize(blocks);
+   }
+   ~BlockPartials()
+   { if(owner) taken() = false; }
+
+   double& operator[](int b)
+   { return (*data)[b]; }
+
+private:
+   BlockPartials(const BlockPartials&);
+   BlockPartials& operator=(const BlockPartials&);
+
+   static std::vector<double>& shared()
+   {
+      static thread_local std::vector<double> partial;
+      return partial;
+   }
+   static bool& taken()
+   {
+      static thread_local bool flag = false;
+      return flag;
+   }
 
-inline double dot(const std::vector<double> &x, const std::vector<double> &y)
-{ 
-   //return cblas_ddot((int)x.size(), &x[0], 1, &y[0], 1); 
+   bool owner;
+   std::vector<double> local;
+   std::vector<double>* data;
+};
 
+// Sum of block(begin, end) over [0, n)
+template<class Block>
+inline double reduce_sum(size_t n, Block block)
+{
+   int blocks = block_count(n);
+   if(blocks <= 1) return n ? block(0, n) : 0.0;
+   if(REDUCTION::ANY_ORDER == reduction_mode()){
+      std::mutex lock;
+      double sum = 0;
+      VFXEpoch::Parallel::ParallelFor(0, (int)n, [&](int begin, int end){
+         double part = block(begin, end);
+         std::lock_guard<std::mutex> guard(lock);
+         sum += part;
+      }, BLAS_BLOCK_SIZE);
+      return sum;
+   }
+   BlockPartials partial(blocks);
+   VFXEpoch::Parallel::ParallelFor(0, blocks, [&](int first, int last){
+      for(int b = first; b < last; ++b)
+         partial[b] = block((size_t)b * BLAS_BLOCK_SIZE, std::min(n, (size_t)(b + 1) * BLAS_BLOCK_SIZE));
+   }, 1);
    double sum = 0;
-   for(int i = 0; i < x.size(); ++i)
-      sum += x[i]*y[i];
+   for(int b = 0; b < blocks; ++b)
+      sum += partial[b];
    return sum;
 }
 
-// inf-norm (maximum absolute value: index of max returned) ==================
+// Maximum of block(begin, end) over [0, n), exact in any order
+template<class Block>
+inline double reduce_max(size_t n, Block block)
+{
+   int blocks = block_count(n);
+   if(blocks <= 1) return n ? block(0, n) : 0.0;
+   BlockPartials partial(blocks);
+   VFXEpoch::Parallel::ParallelFor(0, blocks, [&](int first, int last){
+      for(int b = first; b < last; ++b)
+         partial[b] = block((size_t)b * BLAS_BLOCK_SIZE, std::min(n, (size_t)(b + 1) * BLAS_BLOCK_SIZE));
+   }, 1);
+   double result = partial[0];
+   for(int b = 1; b < blocks; ++b)
+      result = std::max(result, partial[b]);
+   return result;
+}
 
-inline int index_abs_max(const std::vector<double> &x)
-{ 
-   //return cblas_idamax((int)x.size(), &x[0], 1); 
-   int maxind = 0;
+// Kernels over [0, n) of raw arrays =========================================
+// The scalar versions keep the same four running sums as the SSE2 ones, so
+// both give the same bits
+
+inline double dot_kernel(const double *x, const double *y, size_t n)
+{
+   size_t i = 0;
+#ifdef BLAS_SSE2
+   __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+   for(; i + 4 <= n; i += 4){
+      s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+      s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+   }
+   double lanes[2];
+   _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+   double sum = lanes[0] + lanes[1];
+#else
+   double s[4] = {0, 0, 0, 0};
+   for(; i + 4 <= n; i += 4){
+      s[0] += x[i]*y[i];
+      s[1] += x[i + 1]*y[i + 1];
+      s[2] += x[i + 2]*y[i + 2];
+      s[3] += x[i + 3]*y[i + 3];
+   }
+   double sum = (s[0] + s[2]) + (s[1] + s[3]);
+#endif
+   for(; i < n; ++i)
+      sum += x[i]*y[i];
+   return sum;
+}
+
+inline double abs_max_kernel(const double *x, size_t n)
+{
+   size_t i = 0;
    double maxvalue = 0;
-   for(int i = 0; i < x.size(); ++i) {
-      if(fabs(x[i]) > maxvalue) {
-         maxvalue = fabs(x[i]);
-         maxind = i;
-      }
+#ifdef BLAS_SSE2
+   const __m128d magnitude = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+   __m128d m0 = _mm_setzero_pd(), m1 = _mm_setzero_pd();
+   for(; i + 4 <= n; i += 4){
+      // max_pd returns its second operand when either is NaN, NaNs are skipped
+      // as in the scalar loop
+      m0 = _mm_max_pd(_mm_and_pd(_mm_loadu_pd(x + i), magnitude), m0);
+      m1 = _mm_max_pd(_mm_and_pd(_mm_loadu_pd(x + i + 2), magnitude), m1);
    }
-   return maxind;
+   double lanes[2];
+   _mm_storeu_pd(lanes, _mm_max_pd(m0, m1));
+   maxvalue = std::max(lanes[0], lanes[1]);
+#endif
+   for(; i < n; ++i)
+      if(std::fabs(x[i]) > maxvalue) maxvalue = std::fabs(x[i]);
+   return maxvalue;
+}
+
+inline void add_scaled_kernel(double alpha, const double *x, double *y, size_t n)
+{
+   size_t i = 0;
+#ifdef BLAS_SSE2
+   __m128d a = _mm_set1_pd(alpha);
+   for(; i + 2 <= n; i += 2)
+      _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_mul_pd(a, _mm_loadu_pd(x + i))));
+#endif
+   for(; i < n; ++i)
+      y[i] += alpha*x[i];
+}
+
+inline double dot_kernel(const float *x, const float *y, size_t n)
+{
+   size_t i = 0;
+#ifdef BLAS_SSE2
+   __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+   for(; i + 4 <= n; i += 4){
+      __m128 xf = _mm_loadu_ps(x + i), yf = _mm_loadu_ps(y + i);
+      s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_cvtps_pd(xf), _mm_cvtps_pd(yf)));
+      s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(xf, xf)), _mm_cvtps_pd(_mm_movehl_ps(yf, yf))));
+   }
+   double lanes[2];
+   _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+   double sum = lanes[0] + lanes[1];
+#else
+   double s[4] = {0, 0, 0, 0};
+   for(; i + 4 <= n; i += 4){
+      s[0] += (double)x[i]*y[i];
+      s[1] += (double)x[i + 1]*y[i + 1];
+      s[2] += (double)x[i + 2]*y[i + 2];
+      s[3] += (double)x[i + 3]*y[i + 3];
+   }
+   double sum = (s[0] + s[2]) + (s[1] + s[3]);
+#endif
+   for(; i < n; ++i)
+      sum += (double)x[i]*y[i];
+   return sum;
+}
+
+inline double abs_max_kernel(const float *x, size_t n)
+{
+   size_t i = 0;
+   float maxvalue = 0;
+#ifdef BLAS_SSE2
+   const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+   __m128 m0 = _mm_setzero_ps(), m1 = _mm_setzero_ps();
+   for(; i + 8 <= n; i += 8){
+      m0 = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(x + i), magnitude), m0);
+      m1 = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(x + i + 4), magnitude), m1);
+   }
+   float lanes[4];
+   _mm_storeu_ps(lanes, _mm_max_ps(m0, m1));
+   maxvalue = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+   for(; i < n; ++i)
+      if(std::fabs(x[i]) > maxvalue) maxvalue = std::fabs(x[i]);
+   return maxvalue;
+}
+
+inline void add_scaled_kernel(double alpha, const float *x, float *y, size_t n)
+{
+   size_t i = 0;
+#ifdef BLAS_SSE2
+   __m128d a = _mm_set1_pd(alpha);
+   for(; i + 4 <= n; i += 4){
+      __m128 xf = _mm_loadu_ps(x + i), yf = _mm_loadu_ps(y + i);
+      __m128d lo = _mm_add_pd(_mm_cvtps_pd(yf), _mm_mul_pd(a, _mm_cvtps_pd(xf)));
+      __m128d hi = _mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(yf, yf)), _mm_mul_pd(a, _mm_cvtps_pd(_mm_movehl_ps(xf, xf))));
+      _mm_storeu_ps(y + i, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+   }
+#endif
+   for(; i < n; ++i)
+      y[i] = (float)(y[i] + alpha*x[i]);
+}
+
+// dot products ==============================================================
+
+template<class T>
+inline double dot(const std::vector<T> &x, const std::vector<T> &y)
+{
+   //return cblas_ddot((int)x.size(), &x[0], 1, &y[0], 1);
+   const T *px = x.data(), *py = y.data();
+   return reduce_sum(x.size(), [px, py](size_t begin, size_t end){
+      return dot_kernel(px + begin, py + begin, end - begin);
+   });
 }
 
 // inf-norm (maximum absolute value) =========================================
 // technically not part of BLAS, but useful
 
-inline double abs_max(const std::vector<double> &x)
-{ return std::fabs(x[index_abs_max(x)]); }
+template<class T>
+inline double abs_max(const std::vector<T> &x)
+{
+   const T *px = x.data();
+   return reduce_max(x.size(), [px](size_t begin, size_t end){
+      return abs_max_kernel(px + begin, end - begin);
+   });
+}
+
+// inf-norm (maximum absolute value: index of max returned) ==================
+
+template<class T>
+inline int index_abs_max(const std::vector<T> &x)
+{
+   //return cblas_idamax((int)x.size(), &x[0], 1);
+   // the first index of the largest value, the same as a serial scan
+   double maxvalue = abs_max(x);
+   for(size_t i = 0; i < x.size(); ++i)
+      if(std::fabs(x[i]) == maxvalue) return (int)i;
+   return 0;
+}
 
 // saxpy (y=alpha*x+y) =======================================================
 
-inline void add_scaled(double alpha, const std::vector<double> &x, std::vector<double> &y)
-{ 
-   //cblas_daxpy((int)x.size(), alpha, &x[0], 1, &y[0], 1); 
-   for(int i = 0; i < x.size(); ++i)
-      y[i] += alpha*x[i];
+template<class T>
+inline void add_scaled(double alpha, const std::vector<T> &x, std::vector<T> &y)
+{
+   //cblas_daxpy((int)x.size(), alpha, &x[0], 1, &y[0], 1);
+   const T *px = x.data();
+   T *py = y.data();
+   VFXEpoch::Parallel::ParallelFor(0, (int)x.size(), [=](int begin, int end){
+      add_scaled_kernel(alpha, px + begin, py + begin, end - begin);
+   }, BLAS_BLOCK_SIZE);
+}
+
+// fused passes ==============================================================
+
+// y=alpha*x+y, returns the inf-norm of the new y
+template<class T>
+inline double add_scaled_abs_max(double alpha, const std::vector<T> &x, std::vector<T> &y)
+{
+   const T *px = x.data();
+   T *py = y.data();
+   return reduce_max(x.size(), [=](size_t begin, size_t end){
+      add_scaled_kernel(alpha, px + begin, py + begin, end - begin);
+      return abs_max_kernel(py + begin, end - begin);
+   });
 }
 
 }
@@ -6,10 +6,19 @@
 // Note that this only handles symmetric positive (semi-)definite matrices,
 // with guarantees made only for M-matrices (where off-diagonal entries are all
 // non-positive, and row sums are non-negative).
+//
+// PCGSolver<float> is the mixed precision variant: the matrix, the vectors and
+// the preconditioner are stored in float, which halves the memory traffic of
+// every pass, while dot products, norms and matrix rows are accumulated in
+// double. Its accuracy is still bounded by the float solution, solve_refined()
+// keeps the solution and the residual in double and only solves for the
+// corrections in float (iterative refinement).
 
 #include <cmath>
+#include <functional>
 #include "sparse_matrix.h"
 #include "blas_wrapper.h"
+#include "../UTL_Trace.h"
 
 //============================================================================
 // A simple compressed sparse column data structure (with separate diagonal)
@@ -82,8 +91,35 @@ struct SparseColumnLowerFactor
 // problems in factorization: if a pivot is this much less than the diagonal
 // entry from the original matrix, the original matrix entry is used instead.
 
+// Row access shared by the dynamic and the compressed matrix, so both can be
+// factored without a copy
+
+template<class T>
+inline unsigned int row_length(const SparseMatrix<T> &matrix, unsigned int i)
+{ return (unsigned int)matrix.index[i].size(); }
+
+template<class T>
+inline unsigned int row_column(const SparseMatrix<T> &matrix, unsigned int i, unsigned int k)
+{ return matrix.index[i][k]; }
+
+template<class T>
+inline T row_value(const SparseMatrix<T> &matrix, unsigned int i, unsigned int k)
+{ return matrix.value[i][k]; }
+
 template<class T>
-void factor_modified_incomplete_cholesky0(const SparseMatrix<T> &matrix, SparseColumnLowerFactor<T> &factor,
+inline unsigned int row_length(const FixedSparseMatrix<T> &matrix, unsigned int i)
+{ return matrix.rowstart[i+1]-matrix.rowstart[i]; }
+
+template<class T>
+inline unsigned int row_column(const FixedSparseMatrix<T> &matrix, unsigned int i, unsigned int k)
+{ return matrix.colindex[matrix.rowstart[i]+k]; }
+
+template<class T>
+inline T row_value(const FixedSparseMatrix<T> &matrix, unsigned int i, unsigned int k)
+{ return matrix.value[matrix.rowstart[i]+k]; }
+
+template<class Matrix, class T>
+void factor_modified_incomplete_cholesky0(const Matrix &matrix, SparseColumnLowerFactor<T> &factor,
                                           T modification_parameter=0.97, T min_diagonal_ratio=0.25)
 {
    // first copy lower triangle of matrix into factor (Note: assuming A is symmetric of course!)
@@ -94,12 +130,12 @@ void factor_modified_incomplete_cholesky0(const SparseMatrix<T> &matrix, SparseC
    zero(factor.adiag);
    for(unsigned int i=0; i<matrix.n; ++i){
       factor.colstart[i]=(unsigned int)factor.rowindex.size();
-      for(unsigned int j=0; j<matrix.index[i].size(); ++j){
-         if(matrix.index[i][j]>i){
-            factor.rowindex.push_back(matrix.index[i][j]);
-            factor.value.push_back(matrix.value[i][j]);
-         }else if(matrix.index[i][j]==i){
-            factor.invdiag[i]=factor.adiag[i]=matrix.value[i][j];
+      for(unsigned int j=0; j<row_length(matrix, i); ++j){
+         if(row_column(matrix, i, j)>i){
+            factor.rowindex.push_back(row_column(matrix, i, j));
+            factor.value.push_back(row_value(matrix, i, j));
+         }else if(row_column(matrix, i, j)==i){
+            factor.invdiag[i]=factor.adiag[i]=row_value(matrix, i, j);
          }
       }
    }
@@ -143,10 +179,10 @@ void factor_modified_incomplete_cholesky0(const SparseMatrix<T> &matrix, SparseC
          unsigned int b=0;
          while(a<factor.colstart[k+1] && factor.rowindex[a]<j){
             // look for factor.rowindex[a] in matrix.index[j] starting at b
-            while(b<matrix.index[j].size()){
-               if(matrix.index[j][b]<factor.rowindex[a])
+            while(b<row_length(matrix, j)){
+               if(row_column(matrix, j, b)<factor.rowindex[a])
                   ++b;
-               else if(matrix.index[j][b]==factor.rowindex[a])
+               else if(row_column(matrix, j, b)==factor.rowindex[a])
                   break;
                else{
                   missing+=factor.value[a];
@@ -229,6 +265,7 @@ struct PCGSolver
    PCGSolver(void)
    {
       set_solver_parameters(1e-5, 100, 0.97, 0.25);
+      set_refinement_passes(3);
    }
 
    void set_solver_parameters(T tolerance_factor_, int max_iterations_, T modified_incomplete_cholesky_parameter_=0.97, T min_diagonal_ratio_=0.25)
@@ -240,48 +277,75 @@ struct PCGSolver
       min_diagonal_ratio=min_diagonal_ratio_;
    }
 
+   // Replaces MIC(0) by result=M^-1*x from the caller, with M symmetric
+   // positive (semi)definite. An empty function goes back to MIC(0)
+   void set_preconditioner(const std::function<void(const std::vector<T>&, std::vector<T>&)> &apply)
+   {
+      custom_preconditioner=apply;
+   }
+
+   // Extra passes of solve_refined() after the first one, they share the
+   // max_iterations budget
+   void set_refinement_passes(int refinement_passes_)
+   {
+      refinement_passes=refinement_passes_;
+   }
+
    bool solve(const SparseMatrix<T> &matrix, const std::vector<T> &rhs, std::vector<T> &result, T &residual_out, int &iterations_out) 
    {
+      fixed_matrix.construct_from_matrix(matrix);
+      return solve(fixed_matrix, rhs, result, residual_out, iterations_out);
+   }
+
+   // The iteration always runs on the compressed rows: the products are split
+   // by rows over the threads, the vector operations by blocks. The product
+   // returns its dot with s and the residual update its inf-norm, saving two
+   // passes over the vectors per iteration
+   bool solve(const FixedSparseMatrix<T> &matrix, const std::vector<T> &rhs, std::vector<T> &result, T &residual_out, int &iterations_out)
+   {
+      VFXEPOCH_TRACE_SCOPE("PCGSolver", "solve");
       unsigned int n=matrix.n;
       if(m.size()!=n){ m.resize(n); s.resize(n); z.resize(n); r.resize(n); }
       zero(result);
       r=rhs;
-      residual_out=BLAS::abs_max(r);
-      if(residual_out==0) {
-         iterations_out=0;
-         return true;
-      }
+      residual_out=(T)BLAS::abs_max(r);
+      iterations_out=0;
+      if(residual_out==0) return true;
       double tol=tolerance_factor*residual_out;
 
       form_preconditioner(matrix);
-      apply_preconditioner(r, z);
-      double rho=BLAS::dot(z, r);
-      if(rho==0 || rho!=rho) {
-         iterations_out=0;
-         return false;
-      }
+      return iterate(matrix, tol, result, residual_out, iterations_out);
+   }
 
-      s=z;
+   // Iterative refinement on a system assembled in double: every pass solves
+   // A*e=r in T from the residual r=rhs-A*result recomputed in double, then
+   // adds e to result. Succeeds once that residual meets the tolerance, which
+   // is then what residual_out holds
+   bool solve_refined(const SparseMatrix<double> &matrix, const std::vector<double> &rhs, std::vector<double> &result, double &residual_out, int &iterations_out)
+   {
+      VFXEPOCH_TRACE_SCOPE("PCGSolver", "solve_refined");
+      unsigned int n=matrix.n;
+      if(m.size()!=n){ m.resize(n); s.resize(n); z.resize(n); r.resize(n); }
       fixed_matrix.construct_from_matrix(matrix);
-      int iteration;
-      for(iteration=0; iteration<max_iterations; ++iteration){
-         multiply(fixed_matrix, s, z);
-         double alpha=rho/BLAS::dot(s, z);
-         BLAS::add_scaled(alpha, s, result);
-         BLAS::add_scaled(-alpha, z, r);
-         residual_out=BLAS::abs_max(r);
-         if(residual_out<=tol) {
-            iterations_out=iteration+1;
-            return true; 
-         }
-         apply_preconditioner(r, z);
-         double rho_new=BLAS::dot(z, r);
-         double beta=rho_new/rho;
-         BLAS::add_scaled(beta, s, z); s.swap(z); // s=beta*s+z
-         rho=rho_new;
+      refined_matrix.construct_from_matrix(matrix);
+      result.assign(n, 0);
+      refined_residual=rhs;
+      residual_out=BLAS::abs_max(refined_residual);
+      iterations_out=0;
+      if(residual_out==0) return true;
+      double tol=tolerance_factor*residual_out;
+
+      form_preconditioner(fixed_matrix);
+      for(int pass=0; ; ++pass){
+         for(unsigned int i=0; i<n; ++i) r[i]=(T)refined_residual[i];
+         zero(m);
+         T correction_residual;
+         bool converged=iterate(fixed_matrix, tol, m, correction_residual, iterations_out);
+         for(unsigned int i=0; i<n; ++i) result[i]+=m[i];
+         residual_out=residual_and_abs_max(refined_matrix, result, rhs, refined_residual);
+         if(residual_out<=tol) return true;
+         if(!converged || pass==refinement_passes) return false;
       }
-      iterations_out=iteration;
-      return false;
    }
 
    inline void clear(void){
@@ -290,6 +354,8 @@ struct PCGSolver
        s.clear();
        r.clear();
        fixed_matrix.clear();
+       refined_matrix.clear();
+       refined_residual.clear();
    }
 
    protected:
@@ -298,20 +364,53 @@ struct PCGSolver
    SparseColumnLowerFactor<T> ic_factor; // modified incomplete cholesky factor
    std::vector<T> m, z, s, r; // temporary vectors for PCG
    FixedSparseMatrix<T> fixed_matrix; // used within loop
+   FixedSparseMatrix<double> refined_matrix; // residuals of solve_refined
+   std::vector<double> refined_residual;
 
    // parameters
    T tolerance_factor;
    int max_iterations;
    T modified_incomplete_cholesky_parameter;
    T min_diagonal_ratio;
+   int refinement_passes;
+   std::function<void(const std::vector<T>&, std::vector<T>&)> custom_preconditioner;
+
+   // PCG from the residual in r, adding the correction into result
+   bool iterate(const FixedSparseMatrix<T> &matrix, double tol, std::vector<T> &result, T &residual_out, int &iterations_out)
+   {
+      apply_preconditioner(r, z);
+      double rho=BLAS::dot(z, r);
+      if(rho==0 || rho!=rho) return false;
+
+      s=z;
+      while(iterations_out<max_iterations){
+         double alpha=rho/multiply_and_dot(matrix, s, z); // z=A*s
+         BLAS::add_scaled(alpha, s, result);
+         residual_out=(T)BLAS::add_scaled_abs_max(-alpha, z, r);
+         ++iterations_out;
+         if(residual_out<=tol) return true;
+         apply_preconditioner(r, z);
+         double rho_new=BLAS::dot(z, r);
+         double beta=rho_new/rho;
+         BLAS::add_scaled(beta, s, z); s.swap(z); // s=beta*s+z
+         rho=rho_new;
+      }
+      return false;
+   }
 
-   void form_preconditioner(const SparseMatrix<T>& matrix)
+   void form_preconditioner(const FixedSparseMatrix<T>& matrix)
    {
+      VFXEPOCH_TRACE_SCOPE("PCGSolver", "form_preconditioner");
+      if(custom_preconditioner) return;
       factor_modified_incomplete_cholesky0(matrix, ic_factor);
    }
 
    void apply_preconditioner(const std::vector<T> &x, std::vector<T> &result)
    {
+      if(custom_preconditioner){
+         custom_preconditioner(x, result);
+         return;
+      }
       solve_lower(ic_factor, x, result);
       solve_lower_transpose_in_place(ic_factor,result);
    }
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <vector>
 #include "util.h"
+#include "blas_wrapper.h"
+#include "../UTL_Parallel.h"
 
 //============================================================================
 // Dynamic compressed sparse row matrix.
@@ -214,7 +216,9 @@ struct FixedSparseMatrix
       rowstart.resize(n+1);
    }
 
-   void construct_from_matrix(const SparseMatrix<T> &matrix)
+   // the source may hold another precision, its values are converted
+   template<class S>
+   void construct_from_matrix(const SparseMatrix<S> &matrix)
    {
       resize(matrix.n);
       rowstart[0]=0;
@@ -223,14 +227,16 @@ struct FixedSparseMatrix
       }
       value.resize(rowstart[n]);
       colindex.resize(rowstart[n]);
-      unsigned int j=0;
-      for(unsigned int i=0; i<n; ++i){
-         for(unsigned int k=0; k<matrix.index[i].size(); ++k){
-            value[j]=matrix.value[i][k];
-            colindex[j]=matrix.index[i][k];
-            ++j;
+      // rows are copied in parallel, each one knows where it starts
+      VFXEpoch::Parallel::ParallelFor(0, (int)n, [&](int begin, int end){
+         for(int i=begin; i<end; ++i){
+            unsigned int j=rowstart[i];
+            for(unsigned int k=0; k<matrix.index[i].size(); ++k, ++j){
+               value[j]=(T)matrix.value[i][k];
+               colindex[j]=matrix.index[i][k];
+            }
          }
-      }
+      }, 4096);
    }
 
    void write_matlab(std::ostream &output, const char *variable_name)
@@ -260,18 +266,25 @@ struct FixedSparseMatrix
 typedef FixedSparseMatrix<float> FixedSparseMatrixf;
 typedef FixedSparseMatrix<double> FixedSparseMatrixd;
 
+// rows per task in the parallel products, every row is summed by one
+// thread in a fixed order so the result does not depend on the thread count
+const int SPARSE_ROWS_PER_TASK=4096;
+
 // perform result=matrix*x
 template<class T>
 void multiply(const FixedSparseMatrix<T> &matrix, const std::vector<T> &x, std::vector<T> &result)
 {
    assert(matrix.n==x.size());
    result.resize(matrix.n);
-   for(unsigned int i=0; i<matrix.n; ++i){
-      result[i]=0;
-      for(unsigned int j=matrix.rowstart[i]; j<matrix.rowstart[i+1]; ++j){
-         result[i]+=matrix.value[j]*x[matrix.colindex[j]];
+   VFXEpoch::Parallel::ParallelFor(0, (int)matrix.n, [&](int begin, int end){
+      for(int i=begin; i<end; ++i){
+         T sum=0;
+         for(unsigned int j=matrix.rowstart[i]; j<matrix.rowstart[i+1]; ++j){
+            sum+=matrix.value[j]*x[matrix.colindex[j]];
+         }
+         result[i]=sum;
       }
-   }
+   }, SPARSE_ROWS_PER_TASK);
 }
 
 // perform result=result-matrix*x
@@ -280,11 +293,56 @@ void multiply_and_subtract(const FixedSparseMatrix<T> &matrix, const std::vector
 {
    assert(matrix.n==x.size());
    result.resize(matrix.n);
-   for(unsigned int i=0; i<matrix.n; ++i){
-      for(unsigned int j=matrix.rowstart[i]; j<matrix.rowstart[i+1]; ++j){
-         result[i]-=matrix.value[j]*x[matrix.colindex[j]];
+   VFXEpoch::Parallel::ParallelFor(0, (int)matrix.n, [&](int begin, int end){
+      for(int i=begin; i<end; ++i){
+         for(unsigned int j=matrix.rowstart[i]; j<matrix.rowstart[i+1]; ++j){
+            result[i]-=matrix.value[j]*x[matrix.colindex[j]];
+         }
       }
-   }
+   }, SPARSE_ROWS_PER_TASK);
+}
+
+// perform result=matrix*x and return dot(x, result) in the same pass, the
+// sum runs over the blocks of BLAS::dot so both give the same bits. Rows are
+// summed in double whatever T is
+template<class T>
+double multiply_and_dot(const FixedSparseMatrix<T> &matrix, const std::vector<T> &x, std::vector<T> &result)
+{
+   assert(matrix.n==x.size());
+   result.resize(matrix.n);
+   const T *px=x.data();
+   T *presult=result.data();
+   return BLAS::reduce_sum(matrix.n, [&matrix, px, presult](size_t begin, size_t end){
+      for(size_t i=begin; i<end; ++i){
+         double sum=0;
+         for(unsigned int j=matrix.rowstart[i]; j<matrix.rowstart[i+1]; ++j){
+            sum+=(double)matrix.value[j]*px[matrix.colindex[j]];
+         }
+         presult[i]=(T)sum;
+      }
+      return BLAS::dot_kernel(px+begin, presult+begin, end-begin);
+   });
+}
+
+// perform result=rhs-matrix*x with every row summed in double, and return
+// the inf-norm of result
+template<class T>
+double residual_and_abs_max(const FixedSparseMatrix<T> &matrix, const std::vector<T> &x, const std::vector<T> &rhs, std::vector<T> &result)
+{
+   assert(matrix.n==x.size() && matrix.n==rhs.size());
+   result.resize(matrix.n);
+   const T *px=x.data(), *prhs=rhs.data();
+   T *presult=result.data();
+   return BLAS::reduce_max(matrix.n, [&matrix, px, prhs, presult](size_t begin, size_t end){
+      for(size_t i=begin; i<end; ++i){
+         double sum=prhs[i];
+         for(unsigned int j=matrix.rowstart[i]; j<matrix.rowstart[i+1]; ++j){
+            sum-=(double)matrix.value[j]*px[matrix.colindex[j]];
+         }
+         presult[i]=(T)sum;
+      }
+      return BLAS::abs_max_kernel(presult+begin, end-begin);
+   });
 }
 
 #endif
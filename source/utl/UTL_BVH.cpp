@@ -0,0 +1,357 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "UTL_BVH.h"
+#include "UTL_Parallel.h"
+#include "UTL_Trace.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <map>
+
+namespace VFXEpoch
+{
+	static const int LEAF_SIZE = 4;
+	// Subtrees over more primitives than this are built as tasks
+	static const int TASK_SIZE = 2048;
+
+	// Top down median split build over primitive boxes given as 3 floats per
+	// primitive, 2D primitives leave the z bounds at 0
+	struct BVHBuilder
+	{
+		int dims;
+		std::vector<float> lo, hi, centroid;
+		std::vector<BVHNode>* nodes;
+		std::vector<int>* order;
+		std::map<int, int> subtree_size;
+
+		// Nodes of the subtree over n primitives. Filled before the build, the
+		// tasks only read it
+		int count_nodes(int n){
+			std::map<int, int>::iterator found = subtree_size.find(n);
+			if(found != subtree_size.end()) return found->second;
+			int size = n <= LEAF_SIZE ? 1 : 1 + count_nodes(n / 2) + count_nodes(n - n / 2);
+			subtree_size[n] = size;
+			return size;
+		}
+
+		void run(std::vector<BVHNode>& _nodes, std::vector<int>& _order){
+			int n = (int)lo.size() / 3;
+			nodes = &_nodes;
+			order = &_order;
+			order->resize(n);
+			for(int p = 0; p != n; p++) (*order)[p] = p;
+			nodes->assign(n > 0 ? count_nodes(n) : 0, BVHNode());
+			if(n > 0) build(0, 0, n);
+		}
+
+		void build(int node, int begin, int end){
+			BVHNode& b = (*nodes)[node];
+			float centroid_lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, centroid_hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+			for(int a = 0; a != 3; a++){
+				b.lo[a] = FLT_MAX;
+				b.hi[a] = -FLT_MAX;
+			}
+			for(int q = begin; q != end; q++){
+				int p = (*order)[q];
+				for(int a = 0; a != 3; a++){
+					b.lo[a] = std::min(b.lo[a], lo[3 * p + a]);
+					b.hi[a] = std::max(b.hi[a], hi[3 * p + a]);
+					centroid_lo[a] = std::min(centroid_lo[a], centroid[3 * p + a]);
+					centroid_hi[a] = std::max(centroid_hi[a], centroid[3 * p + a]);
+				}
+			}
+			int n = end - begin;
+			if(n <= LEAF_SIZE){
+				b.first = begin;
+				b.count = n;
+				return;
+			}
+
+			int axis = 0;
+			for(int a = 1; a != dims; a++){
+				if(centroid_hi[a] - centroid_lo[a] > centroid_hi[axis] - centroid_lo[axis]) axis = a;
+			}
+			int mid = begin + n / 2;
+			// Ties by index, the split does not depend on the input order
+			const std::vector<float>& c = centroid;
+			std::nth_element(order->begin() + begin, order->begin() + mid, order->begin() + end, [&c, axis](int p, int q){
+				float cp = c[3 * p + axis], cq = c[3 * q + axis];
+				return cp < cq || (cp == cq && p < q);
+			});
+			int left = node + 1, right = left + subtree_size.find(mid - begin)->second;
+			b.first = right;
+			b.count = 0;
+			if(n > TASK_SIZE){
+				Parallel::TaskGroup group;
+				group.run([this, left, begin, mid](){ build(left, begin, mid); });
+				build(right, mid, end);
+				group.wait();
+			} else {
+				build(left, begin, mid);
+				build(right, mid, end);
+			}
+		}
+	};
+
+	// Squared distance from p to the box of a node
+	static inline float
+	box_distance2(const BVHNode& node, const float* p, int dims){
+		float d2 = 0.0f;
+		for(int a = 0; a != dims; a++){
+			float d = std::max(0.0f, std::max(node.lo[a] - p[a], p[a] - node.hi[a]));
+			d2 += d * d;
+		}
+		return d2;
+	}
+
+	// Best first walk of the tree, leaf(first, count, best2) tests the
+	// primitives of a leaf and lowers best2
+	template <class Leaf>
+	static inline void
+	traverse(const std::vector<BVHNode>& nodes, const float* p, int dims, float& best2, Leaf leaf){
+		if(nodes.empty()) return;
+		int stack[128];
+		int top = 0;
+		stack[top++] = 0;
+		while(top){
+			int index = stack[--top];
+			const BVHNode& node = nodes[index];
+			if(box_distance2(node, p, dims) >= best2) continue;
+			if(node.count){
+				leaf(node.first, node.count, best2);
+				continue;
+			}
+			int near_child = index + 1, far_child = node.first;
+			float near_d2 = box_distance2(nodes[near_child], p, dims), far_d2 = box_distance2(nodes[far_child], p, dims);
+			if(far_d2 < near_d2){
+				std::swap(near_child, far_child);
+				std::swap(near_d2, far_d2);
+			}
+			if(far_d2 < best2) stack[top++] = far_child;
+			if(near_d2 < best2) stack[top++] = near_child;
+		}
+	}
+
+	// Closest point to p on the triangle abc, from Ericson, Real-Time Collision
+	// Detection 5.1.5
+	static inline void
+	closest_on_triangle(const float* p, const float* a, const float* b, const float* c, float* result){
+		float ab[3], ac[3], ap[3];
+		for(int k = 0; k != 3; k++){
+			ab[k] = b[k] - a[k];
+			ac[k] = c[k] - a[k];
+			ap[k] = p[k] - a[k];
+		}
+		float d1 = ab[0] * ap[0] + ab[1] * ap[1] + ab[2] * ap[2];
+		float d2 = ac[0] * ap[0] + ac[1] * ap[1] + ac[2] * ap[2];
+		if(d1 <= 0.0f && d2 <= 0.0f){
+			for(int k = 0; k != 3; k++) result[k] = a[k];
+			return;
+		}
+		float bp[3];
+		for(int k = 0; k != 3; k++) bp[k] = p[k] - b[k];
+		float d3 = ab[0] * bp[0] + ab[1] * bp[1] + ab[2] * bp[2];
+		float d4 = ac[0] * bp[0] + ac[1] * bp[1] + ac[2] * bp[2];
+		if(d3 >= 0.0f && d4 <= d3){
+			for(int k = 0; k != 3; k++) result[k] = b[k];
+			return;
+		}
+		float vc = d1 * d4 - d3 * d2;
+		if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f){
+			float v = d1 / (d1 - d3);
+			for(int k = 0; k != 3; k++) result[k] = a[k] + v * ab[k];
+			return;
+		}
+		float cp[3];
+		for(int k = 0; k != 3; k++) cp[k] = p[k] - c[k];
+		float d5 = ab[0] * cp[0] + ab[1] * cp[1] + ab[2] * cp[2];
+		float d6 = ac[0] * cp[0] + ac[1] * cp[1] + ac[2] * cp[2];
+		if(d6 >= 0.0f && d5 <= d6){
+			for(int k = 0; k != 3; k++) result[k] = c[k];
+			return;
+		}
+		float vb = d5 * d2 - d1 * d6;
+		if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f){
+			float w = d2 / (d2 - d6);
+			for(int k = 0; k != 3; k++) result[k] = a[k] + w * ac[k];
+			return;
+		}
+		float va = d3 * d6 - d5 * d4;
+		if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f){
+			float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+			for(int k = 0; k != 3; k++) result[k] = b[k] + w * (c[k] - b[k]);
+			return;
+		}
+		float denom = 1.0f / (va + vb + vc);
+		float v = vb * denom, w = vc * denom;
+		for(int k = 0; k != 3; k++) result[k] = a[k] + ab[k] * v + ac[k] * w;
+	}
+
+	PolylineBVH::PolylineBVH(){
+	}
+
+	PolylineBVH::~PolylineBVH(){
+	}
+
+	void
+	PolylineBVH::build(const std::vector<Vector2Df>& _vertices, const std::vector<Vector2Di>& _segments){
+		VFXEPOCH_TRACE_SCOPE("BVH", "build_polyline");
+		vertices = _vertices;
+		segments = _segments;
+		int n = (int)segments.size();
+		BVHBuilder builder;
+		builder.dims = 2;
+		builder.lo.assign(3 * n, 0.0f);
+		builder.hi.assign(3 * n, 0.0f);
+		builder.centroid.assign(3 * n, 0.0f);
+		Parallel::ParallelFor(0, n, [&](int begin, int end){
+			for(int s = begin; s != end; s++){
+				const Vector2Df& a = vertices[segments[s].m_x];
+				const Vector2Df& b = vertices[segments[s].m_y];
+				builder.lo[3 * s] = std::min(a.m_x, b.m_x); builder.hi[3 * s] = std::max(a.m_x, b.m_x);
+				builder.lo[3 * s + 1] = std::min(a.m_y, b.m_y); builder.hi[3 * s + 1] = std::max(a.m_y, b.m_y);
+				builder.centroid[3 * s] = 0.5f * (a.m_x + b.m_x);
+				builder.centroid[3 * s + 1] = 0.5f * (a.m_y + b.m_y);
+			}
+		});
+		builder.run(nodes, order);
+	}
+
+	void
+	PolylineBVH::clear(){
+		vertices.clear();
+		segments.clear();
+		nodes.clear();
+		order.clear();
+	}
+
+	bool
+	PolylineBVH::empty() const {
+		return nodes.empty();
+	}
+
+	float
+	PolylineBVH::closest_point(const Vector2Df& p, float max_distance, Vector2Df& point, int& segment) const {
+		float q[2] = {p.m_x, p.m_y};
+		float best2 = max_distance * max_distance;
+		segment = -1;
+		traverse(nodes, q, 2, best2, [&](int first, int count, float& best){
+			for(int l = first; l != first + count; l++){
+				int s = order[l];
+				const Vector2Df& a = vertices[segments[s].m_x];
+				const Vector2Df& b = vertices[segments[s].m_y];
+				float ex = b.m_x - a.m_x, ey = b.m_y - a.m_y;
+				float length2 = ex * ex + ey * ey;
+				float t = length2 > 0.0f ? ((q[0] - a.m_x) * ex + (q[1] - a.m_y) * ey) / length2 : 0.0f;
+				t = std::max(0.0f, std::min(1.0f, t));
+				float x = a.m_x + t * ex, y = a.m_y + t * ey;
+				float d2 = (q[0] - x) * (q[0] - x) + (q[1] - y) * (q[1] - y);
+				if(d2 < best){
+					best = d2;
+					point = Vector2Df(x, y);
+					segment = s;
+				}
+			}
+		});
+		return segment < 0 ? max_distance : std::sqrt(best2);
+	}
+
+	void
+	PolylineBVH::get_bounds(Vector2Df& lo, Vector2Df& hi) const {
+		if(nodes.empty()){
+			lo = hi = Vector2Df(0.0f, 0.0f);
+			return;
+		}
+		lo = Vector2Df(nodes[0].lo[0], nodes[0].lo[1]);
+		hi = Vector2Df(nodes[0].hi[0], nodes[0].hi[1]);
+	}
+
+	TriangleBVH::TriangleBVH(){
+	}
+
+	TriangleBVH::~TriangleBVH(){
+	}
+
+	void
+	TriangleBVH::build(const std::vector<Vector3Df>& _vertices, const std::vector<Vector3Di>& _triangles){
+		VFXEPOCH_TRACE_SCOPE("BVH", "build_mesh");
+		vertices = _vertices;
+		triangles = _triangles;
+		int n = (int)triangles.size();
+		BVHBuilder builder;
+		builder.dims = 3;
+		builder.lo.assign(3 * n, 0.0f);
+		builder.hi.assign(3 * n, 0.0f);
+		builder.centroid.assign(3 * n, 0.0f);
+		Parallel::ParallelFor(0, n, [&](int begin, int end){
+			for(int t = begin; t != end; t++){
+				const Vector3Df& v0 = vertices[triangles[t].m_x];
+				const Vector3Df& v1 = vertices[triangles[t].m_y];
+				const Vector3Df& v2 = vertices[triangles[t].m_z];
+				float corners[3][3] = {{v0.m_x, v1.m_x, v2.m_x}, {v0.m_y, v1.m_y, v2.m_y}, {v0.m_z, v1.m_z, v2.m_z}};
+				for(int a = 0; a != 3; a++){
+					float x0 = corners[a][0], x1 = corners[a][1], x2 = corners[a][2];
+					builder.lo[3 * t + a] = std::min(x0, std::min(x1, x2));
+					builder.hi[3 * t + a] = std::max(x0, std::max(x1, x2));
+					builder.centroid[3 * t + a] = (x0 + x1 + x2) * (1.0f / 3.0f);
+				}
+			}
+		});
+		builder.run(nodes, order);
+	}
+
+	void
+	TriangleBVH::clear(){
+		vertices.clear();
+		triangles.clear();
+		nodes.clear();
+		order.clear();
+	}
+
+	bool
+	TriangleBVH::empty() const {
+		return nodes.empty();
+	}
+
+	float
+	TriangleBVH::closest_point(const Vector3Df& p, float max_distance, Vector3Df& point, int& triangle) const {
+		float q[3] = {p.m_x, p.m_y, p.m_z};
+		float best2 = max_distance * max_distance;
+		triangle = -1;
+		traverse(nodes, q, 3, best2, [&](int first, int count, float& best){
+			for(int l = first; l != first + count; l++){
+				int t = order[l];
+				const Vector3Df& a = vertices[triangles[t].m_x];
+				const Vector3Df& b = vertices[triangles[t].m_y];
+				const Vector3Df& c = vertices[triangles[t].m_z];
+				float pa[3] = {a.m_x, a.m_y, a.m_z}, pb[3] = {b.m_x, b.m_y, b.m_z}, pc[3] = {c.m_x, c.m_y, c.m_z};
+				float r[3];
+				closest_on_triangle(q, pa, pb, pc, r);
+				float d2 = (q[0] - r[0]) * (q[0] - r[0]) + (q[1] - r[1]) * (q[1] - r[1]) + (q[2] - r[2]) * (q[2] - r[2]);
+				if(d2 < best){
+					best = d2;
+					point = Vector3Df(r[0], r[1], r[2]);
+					triangle = t;
+				}
+			}
+		});
+		return triangle < 0 ? max_distance : std::sqrt(best2);
+	}
+
+	void
+	TriangleBVH::get_bounds(Vector3Df& lo, Vector3Df& hi) const {
+		if(nodes.empty()){
+			lo = hi = Vector3Df(0.0f, 0.0f, 0.0f);
+			return;
+		}
+		lo = Vector3Df(nodes[0].lo[0], nodes[0].lo[1], nodes[0].lo[2]);
+		hi = Vector3Df(nodes[0].hi[0], nodes[0].hi[1], nodes[0].hi[2]);
+	}
+}
@@ -0,0 +1,94 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Bounding volume hierarchies over 2D polylines and 3D triangle meshes for
+* closest point queries.
+*
+* The tree is built top down, splitting the primitives at the median centroid
+* along the widest axis of the centroid bounds down to leaves of 4. The median
+* split fixes the size of every subtree in advance, so large subtrees are
+* built as tasks, each writing into its own slice of the node array, and the
+* tree comes out the same on any number of threads.
+*
+* Queries walk the nearer child first and skip every box further away than
+* the best distance so far, or than the max_distance given by the caller.
+*******************************************************************************/
+#ifndef _UTL_BVH_H_
+#define _UTL_BVH_H_
+
+#include "UTL_Vector.h"
+
+#include <vector>
+
+namespace VFXEpoch
+{
+	// Leaf when count > 0, its primitives are order[first, first + count).
+	// An inner node's left child follows it, first is the right child
+	struct BVHNode
+	{
+		float lo[3], hi[3];
+		int first, count;
+	};
+
+	class PolylineBVH
+	{
+	public:
+		PolylineBVH();
+		~PolylineBVH();
+
+		// Segment s joins vertices[segments[s].m_x] and vertices[segments[s].m_y]
+		void build(const std::vector<Vector2Df>& vertices, const std::vector<Vector2Di>& segments);
+		void clear();
+		bool empty() const;
+
+		// Closest point of the polyline to p that is no further than
+		// max_distance. Returns the distance, or max_distance with segment = -1
+		// when there is none
+		float closest_point(const Vector2Df& p, float max_distance, Vector2Df& point, int& segment) const;
+
+		const std::vector<Vector2Df>& get_vertices() const { return vertices; }
+		const std::vector<Vector2Di>& get_segments() const { return segments; }
+		void get_bounds(Vector2Df& lo, Vector2Df& hi) const;
+
+	private:
+		std::vector<Vector2Df> vertices;
+		std::vector<Vector2Di> segments;
+		std::vector<BVHNode> nodes;
+		std::vector<int> order;
+	};
+
+	class TriangleBVH
+	{
+	public:
+		TriangleBVH();
+		~TriangleBVH();
+
+		// Triangle t is vertices[triangles[t].m_x], [m_y] and [m_z]
+		void build(const std::vector<Vector3Df>& vertices, const std::vector<Vector3Di>& triangles);
+		void clear();
+		bool empty() const;
+
+		// Same as PolylineBVH::closest_point
+		float closest_point(const Vector3Df& p, float max_distance, Vector3Df& point, int& triangle) const;
+
+		const std::vector<Vector3Df>& get_vertices() const { return vertices; }
+		const std::vector<Vector3Di>& get_triangles() const { return triangles; }
+		void get_bounds(Vector3Df& lo, Vector3Df& hi) const;
+
+	private:
+		std::vector<Vector3Df> vertices;
+		std::vector<Vector3Di> triangles;
+		std::vector<BVHNode> nodes;
+		std::vector<int> order;
+	};
+}
+
+#endif
@@ -0,0 +1,459 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "UTL_DistanceField.h"
+#include "UTL_Parallel.h"
+#include "UTL_Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <vector>
+
+namespace VFXEpoch
+{
+	namespace DistanceField
+	{
+		// Flat field of nx * ny * nz samples, x fastest. A 2D grid is nz = 1
+		struct Field
+		{
+			float* phi;
+			int nx, ny, nz;
+			float h;
+			int size() const { return nx * ny * nz; }
+		};
+
+		// Distance of the smallest solution of the upwind eikonal update from
+		// the neighbour distances a, b and c along the three axes
+		static inline float
+		solve_eikonal(float a, float b, float c, float h){
+			if(a > b) std::swap(a, b);
+			if(b > c) std::swap(b, c);
+			if(a > b) std::swap(a, b);
+			float d = a + h;
+			if(d <= b) return d;
+			d = 0.5f * (a + b + std::sqrt(2.0f * h * h - (a - b) * (a - b)));
+			if(d <= c) return d;
+			// The discriminant cancels badly in float, far corners would keep
+			// creeping by a rounding error every round of sweeps
+			double sum = (double)a + b + c;
+			double discriminant = sum * sum - 3.0 * ((double)a * a + (double)b * b + (double)c * c - (double)h * h);
+			return (float)((sum + std::sqrt(std::max(0.0, discriminant))) / 3.0);
+		}
+
+		// Upwind update of sample (i, j, k) from dist, only reading neighbours
+		// that pass the known test
+		template <class Known>
+		static inline float
+		update(const Field& f, const std::vector<float>& dist, int i, int j, int k, Known known){
+			int c = (i * f.ny + j) * f.nx + k;
+			int sy = f.nx, sz = f.nx * f.ny;
+			float a = FLT_MAX, b = FLT_MAX, e = FLT_MAX;
+			if(k > 0 && known(c - 1)) a = dist[c - 1];
+			if(k + 1 < f.nx && known(c + 1)) a = std::min(a, dist[c + 1]);
+			if(j > 0 && known(c - sy)) b = dist[c - sy];
+			if(j + 1 < f.ny && known(c + sy)) b = std::min(b, dist[c + sy]);
+			if(i > 0 && known(c - sz)) e = dist[c - sz];
+			if(i + 1 < f.nz && known(c + sz)) e = std::min(e, dist[c + sz]);
+			if(FLT_MAX == a && FLT_MAX == b && FLT_MAX == e) return FLT_MAX;
+			return solve_eikonal(a, b, e, f.h);
+		}
+
+		// Distance of every sample next to a sign change, FLT_MAX elsewhere. Per
+		// axis the nearest crossing is taken, the crossings of the axes span a
+		// plane whose distance is the estimate
+		static void
+		initialize(const Field& f, std::vector<float>& dist, std::vector<unsigned char>& seed){
+			dist.assign(f.size(), FLT_MAX);
+			seed.assign(f.size(), 0);
+			Parallel::ParallelFor(0, f.nz * f.ny, [&](int begin, int end){
+				int sy = f.nx, sz = f.nx * f.ny;
+				for(int row = begin; row != end; row++){
+					int i = row / f.ny, j = row % f.ny;
+					for(int k = 0; k != f.nx; k++){
+						int c = row * f.nx + k;
+						float p = f.phi[c];
+						if(0.0f == p){
+							dist[c] = 0.0f;
+							seed[c] = 1;
+							continue;
+						}
+						bool inside = p < 0.0f;
+						int neighbours[6] = {k > 0 ? c - 1 : -1, k + 1 < f.nx ? c + 1 : -1,
+						                     j > 0 ? c - sy : -1, j + 1 < f.ny ? c + sy : -1,
+						                     i > 0 ? c - sz : -1, i + 1 < f.nz ? c + sz : -1};
+						float inverse = 0.0f;
+						for(int axis = 0; axis != 3; axis++){
+							float nearest = FLT_MAX;
+							for(int side = 0; side != 2; side++){
+								int n = neighbours[2 * axis + side];
+								if(n < 0 || (f.phi[n] < 0.0f) == inside) continue;
+								nearest = std::min(nearest, f.h * p / (p - f.phi[n]));
+							}
+							if(FLT_MAX != nearest) inverse += 1.0f / (nearest * nearest);
+						}
+						if(inverse > 0.0f){
+							dist[c] = 1.0f / std::sqrt(inverse);
+							seed[c] = 1;
+						}
+					}
+				}
+			});
+		}
+
+		// One Gauss-Seidel pass over the field in the axis ordering given by
+		// the bits of direction
+		static void
+		sweep(const Field& f, std::vector<float>& dist, const std::vector<unsigned char>& seed, int direction){
+			int k0 = direction & 1 ? f.nx - 1 : 0, k1 = direction & 1 ? -1 : f.nx, dk = direction & 1 ? -1 : 1;
+			int j0 = direction & 2 ? f.ny - 1 : 0, j1 = direction & 2 ? -1 : f.ny, dj = direction & 2 ? -1 : 1;
+			int i0 = direction & 4 ? f.nz - 1 : 0, i1 = direction & 4 ? -1 : f.nz, di = direction & 4 ? -1 : 1;
+			for(int i = i0; i != i1; i += di){
+				for(int j = j0; j != j1; j += dj){
+					for(int k = k0; k != k1; k += dk){
+						int c = (i * f.ny + j) * f.nx + k;
+						if(seed[c]) continue;
+						float d = update(f, dist, i, j, k, [&dist](int n){ return FLT_MAX != dist[n]; });
+						if(d < dist[c]) dist[c] = d;
+					}
+				}
+			}
+		}
+
+		static void
+		fast_sweeping(const Field& f, std::vector<float>& dist, const std::vector<unsigned char>& seed, float max_distance){
+			VFXEPOCH_TRACE_SCOPE("DistanceField", "fast_sweeping");
+			int directions = f.nz > 1 ? 8 : 4;
+			std::vector<std::vector<float> > copies(directions);
+			// Far samples start at the clamp, they never need to get further
+			Parallel::ParallelFor(0, f.size(), [&](int begin, int end){
+				for(int c = begin; c != end; c++) dist[c] = std::min(dist[c], max_distance);
+			});
+			for(int round = 0; round != 64; round++){
+				Parallel::ParallelFor(0, directions, [&](int first, int last){
+					for(int direction = first; direction != last; direction++){
+						copies[direction] = dist;
+						sweep(f, copies[direction], seed, direction);
+					}
+				}, 1);
+				// Merge in slabs, each slab reports whether anything got closer
+				float tolerance = 1e-3f * f.h;
+				int slabs = std::max(1, std::min(Parallel::NumThreads() * 4, f.size() / 4096));
+				std::vector<unsigned char> slab_changed(slabs, 0);
+				Parallel::ParallelFor(0, slabs, [&](int first, int last){
+					for(int s = first; s != last; s++){
+						int begin = (int)((long long)f.size() * s / slabs), end = (int)((long long)f.size() * (s + 1) / slabs);
+						for(int c = begin; c != end; c++){
+							float d = dist[c];
+							for(int direction = 0; direction != directions; direction++) d = std::min(d, copies[direction][c]);
+							// Orderings may reach the same value with different rounding,
+							// only a real improvement asks for another round
+							if(d < dist[c] - tolerance) slab_changed[s] = 1;
+							dist[c] = d;
+						}
+					}
+				}, 1);
+				if(std::find(slab_changed.begin(), slab_changed.end(), 1) == slab_changed.end()) break;
+			}
+		}
+
+		static void
+		fast_marching(const Field& f, std::vector<float>& dist, const std::vector<unsigned char>& seed, float max_distance){
+			VFXEPOCH_TRACE_SCOPE("DistanceField", "fast_marching");
+			// Smaller distance first, ties by index so the order is fixed
+			typedef std::pair<float, int> Entry;
+			std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > trial;
+			std::vector<unsigned char> known(seed);
+			int sy = f.nx, sz = f.nx * f.ny;
+			auto is_known = [&known](int n){ return 0 != known[n]; };
+			// Recomputes the unknown neighbours of c and queues the ones that got closer
+			auto grow = [&](int c){
+				int k = c % f.nx, j = c / f.nx % f.ny, i = c / sz;
+				int neighbours[6] = {k > 0 ? c - 1 : -1, k + 1 < f.nx ? c + 1 : -1,
+				                     j > 0 ? c - sy : -1, j + 1 < f.ny ? c + sy : -1,
+				                     i > 0 ? c - sz : -1, i + 1 < f.nz ? c + sz : -1};
+				for(int q = 0; q != 6; q++){
+					int n = neighbours[q];
+					if(n < 0 || known[n]) continue;
+					float candidate = update(f, dist, n / sz, n / f.nx % f.ny, n % f.nx, is_known);
+					if(candidate < dist[n]){
+						dist[n] = candidate;
+						trial.push(Entry(candidate, n));
+					}
+				}
+			};
+
+			for(int c = 0; c != f.size(); c++){
+				if(seed[c]) grow(c);
+			}
+			while(!trial.empty()){
+				Entry top = trial.top();
+				trial.pop();
+				int c = top.second;
+				// Entries of samples that got closer after they were queued are stale
+				if(known[c] || top.first > dist[c]) continue;
+				if(top.first >= max_distance) break;
+				known[c] = 1;
+				grow(c);
+			}
+		}
+
+		static void
+		redistance(const Field& f, METHOD method, float max_distance){
+			std::vector<float> dist;
+			std::vector<unsigned char> seed;
+			initialize(f, dist, seed);
+			if(METHOD::FAST_MARCHING == method) fast_marching(f, dist, seed, max_distance);
+			else fast_sweeping(f, dist, seed, max_distance);
+			Parallel::ParallelFor(0, f.size(), [&](int begin, int end){
+				for(int c = begin; c != end; c++){
+					float d = std::min(dist[c], max_distance);
+					f.phi[c] = f.phi[c] < 0.0f ? -d : d;
+				}
+			});
+		}
+
+		void
+		Redistance(VFXEpoch::Grid2DfScalarField& phi, float h, METHOD method, float max_distance){
+			VFXEPOCH_TRACE_SCOPE("DistanceField", "Redistance");
+			if(phi.data.empty()) return;
+			Field f = {&phi.data[0], phi.getDimX(), phi.getDimY(), 1, h};
+			redistance(f, method, max_distance);
+		}
+
+		void
+		Redistance(VFXEpoch::Grid3DfScalarField& phi, float h, METHOD method, float max_distance){
+			VFXEPOCH_TRACE_SCOPE("DistanceField", "Redistance");
+			if(phi.data.empty()) return;
+			Field f = {&phi.data[0], phi.getDimX(), phi.getDimY(), phi.getDimZ(), h};
+			redistance(f, method, max_distance);
+		}
+
+		void
+		FromOccupancy(VFXEpoch::Grid2DfScalarField& phi, const VFXEpoch::Grid2DiScalarField& occupancy, float h,
+		              METHOD method, float max_distance){
+			phi.Reset(occupancy.getDimX(), occupancy.getDimY(), h, h);
+			for(size_t c = 0; c != occupancy.data.size(); c++) phi.data[c] = occupancy.data[c] ? -0.5f * h : 0.5f * h;
+			Redistance(phi, h, method, max_distance);
+		}
+
+		void
+		FromOccupancy(VFXEpoch::Grid3DfScalarField& phi, const VFXEpoch::Grid3DiScalarField& occupancy, float h,
+		              METHOD method, float max_distance){
+			phi.Reset(occupancy.getDimX(), occupancy.getDimY(), occupancy.getDimZ(), h, h, h);
+			for(size_t c = 0; c != occupancy.data.size(); c++) phi.data[c] = occupancy.data[c] ? -0.5f * h : 0.5f * h;
+			Redistance(phi, h, method, max_distance);
+		}
+
+		void
+		FromMask(VFXEpoch::Grid2DfScalarField& phi, const VFXEpoch::Grid2DCellTypes& mask, float h,
+		         METHOD method, float max_distance){
+			phi.Reset(mask.getDimX(), mask.getDimY(), h, h);
+			for(size_t c = 0; c != mask.data.size(); c++)
+				phi.data[c] = VFXEpoch::BOUNDARY_MASK::SOMETHING == mask.data[c] ? -0.5f * h : 0.5f * h;
+			Redistance(phi, h, method, max_distance);
+		}
+
+		// Unsigned distance from the exact band, clamped, then signed by inside
+		static void
+		finish(const Field& f, std::vector<float>& dist, const std::vector<unsigned char>& seed,
+		       const std::vector<unsigned char>& inside, float max_distance){
+			fast_sweeping(f, dist, seed, max_distance);
+			Parallel::ParallelFor(0, f.size(), [&](int begin, int end){
+				for(int c = begin; c != end; c++){
+					float d = std::min(dist[c], max_distance);
+					f.phi[c] = inside[c] ? -d : d;
+				}
+			});
+		}
+
+		// Inside samples along each row of x, from the crossings of the row with
+		// the segments that span it
+		static void
+		polyline_parity(const Field& f, const VFXEpoch::PolylineBVH& polyline, const VFXEpoch::Vector2Df& origin,
+		                std::vector<unsigned char>& inside){
+			const std::vector<VFXEpoch::Vector2Df>& vertices = polyline.get_vertices();
+			const std::vector<VFXEpoch::Vector2Di>& segments = polyline.get_segments();
+			inside.assign(f.size(), 0);
+			// Segments binned by the rows they may cross
+			std::vector<int> row_start(f.ny + 1, 0), row_segments;
+			for(int pass = 0; pass != 2; pass++){
+				std::vector<int> fill(row_start.begin(), row_start.end() - 1);
+				for(int s = 0; s != (int)segments.size(); s++){
+					float y0 = vertices[segments[s].m_x].m_y, y1 = vertices[segments[s].m_y].m_y;
+					int r0 = std::max(0, (int)std::floor((std::min(y0, y1) - origin.m_y) / f.h));
+					int r1 = std::min(f.ny - 1, (int)std::ceil((std::max(y0, y1) - origin.m_y) / f.h));
+					for(int r = r0; r <= r1; r++){
+						if(0 == pass) row_start[r + 1]++;
+						else row_segments[fill[r]++] = s;
+					}
+				}
+				if(0 == pass){
+					for(int r = 0; r != f.ny; r++) row_start[r + 1] += row_start[r];
+					row_segments.resize(row_start[f.ny]);
+				}
+			}
+			Parallel::ParallelFor(0, f.ny, [&](int begin, int end){
+				std::vector<float> crossings;
+				for(int j = begin; j != end; j++){
+					float y = origin.m_y + j * f.h;
+					crossings.clear();
+					for(int q = row_start[j]; q != row_start[j + 1]; q++){
+						const VFXEpoch::Vector2Df& a = vertices[segments[row_segments[q]].m_x];
+						const VFXEpoch::Vector2Df& b = vertices[segments[row_segments[q]].m_y];
+						// Half open in y, a row through a vertex counts it once
+						if((a.m_y <= y) == (b.m_y <= y)) continue;
+						crossings.push_back(a.m_x + (y - a.m_y) * (b.m_x - a.m_x) / (b.m_y - a.m_y));
+					}
+					std::sort(crossings.begin(), crossings.end());
+					size_t passed = 0;
+					for(int k = 0; k != f.nx; k++){
+						float x = origin.m_x + k * f.h;
+						while(passed != crossings.size() && crossings[passed] < x) passed++;
+						inside[j * f.nx + k] = passed & 1;
+					}
+				}
+			});
+		}
+
+		// 2D edge function of r against the edge pq in the (y, z) plane
+		static inline double
+		edge_yz(const VFXEpoch::Vector3Df& p, const VFXEpoch::Vector3Df& q, double ry, double rz){
+			return ((double)q.m_y - p.m_y) * (rz - p.m_z) - ((double)q.m_z - p.m_z) * (ry - p.m_y);
+		}
+
+		// Whether the line (y, z) passes the edge pq on the side of the third
+		// vertex. On the edge itself exactly one of the two triangles sharing it
+		// takes the hit, the one on the positive side of the edge ordered by (y, z)
+		static inline bool
+		inside_edge(const VFXEpoch::Vector3Df& p, const VFXEpoch::Vector3Df& q, double side, double e){
+			if(0.0 != e) return (e > 0.0) == (side > 0.0);
+			bool ordered = p.m_y < q.m_y || (p.m_y == q.m_y && p.m_z < q.m_z);
+			return (ordered ? side : -side) > 0.0;
+		}
+
+		// Inside samples along each line of x, from the crossings of the line
+		// with the triangles that span it
+		static void
+		mesh_parity(const Field& f, const VFXEpoch::TriangleBVH& mesh, const VFXEpoch::Vector3Df& origin,
+		            std::vector<unsigned char>& inside){
+			const std::vector<VFXEpoch::Vector3Df>& vertices = mesh.get_vertices();
+			const std::vector<VFXEpoch::Vector3Di>& triangles = mesh.get_triangles();
+			inside.assign(f.size(), 0);
+			// Grid aligned meshes put vertices and edges right on the sample
+			// lines, the lines are moved off them by a fraction of a cell that no
+			// sample distance resolves anyway
+			double shift_y = 1.37e-4 * f.h, shift_z = 0.91e-4 * f.h;
+			// Triangles binned by the z slices they may cross
+			std::vector<int> slice_start(f.nz + 1, 0), slice_triangles;
+			for(int pass = 0; pass != 2; pass++){
+				std::vector<int> fill(slice_start.begin(), slice_start.end() - 1);
+				for(int t = 0; t != (int)triangles.size(); t++){
+					float z0 = vertices[triangles[t].m_x].m_z, z1 = vertices[triangles[t].m_y].m_z, z2 = vertices[triangles[t].m_z].m_z;
+					int s0 = std::max(0, (int)std::floor((std::min(z0, std::min(z1, z2)) - origin.m_z) / f.h));
+					int s1 = std::min(f.nz - 1, (int)std::ceil((std::max(z0, std::max(z1, z2)) - origin.m_z) / f.h));
+					for(int s = s0; s <= s1; s++){
+						if(0 == pass) slice_start[s + 1]++;
+						else slice_triangles[fill[s]++] = t;
+					}
+				}
+				if(0 == pass){
+					for(int s = 0; s != f.nz; s++) slice_start[s + 1] += slice_start[s];
+					slice_triangles.resize(slice_start[f.nz]);
+				}
+			}
+			Parallel::ParallelFor(0, f.nz, [&](int begin, int end){
+				std::vector<std::vector<float> > crossings(f.ny);
+				for(int i = begin; i != end; i++){
+					double z = origin.m_z + i * f.h + shift_z;
+					for(int j = 0; j != f.ny; j++) crossings[j].clear();
+					for(int q = slice_start[i]; q != slice_start[i + 1]; q++){
+						const VFXEpoch::Vector3Di& triangle = triangles[slice_triangles[q]];
+						const VFXEpoch::Vector3Df& a = vertices[triangle.m_x];
+						const VFXEpoch::Vector3Df& b = vertices[triangle.m_y];
+						const VFXEpoch::Vector3Df& c = vertices[triangle.m_z];
+						double area = edge_yz(a, b, c.m_y, c.m_z);
+						// Edge on triangles never cross a line, their neighbours do
+						if(0.0 == area) continue;
+						float y_lo = std::min(a.m_y, std::min(b.m_y, c.m_y)), y_hi = std::max(a.m_y, std::max(b.m_y, c.m_y));
+						int j0 = std::max(0, (int)std::floor((y_lo - origin.m_y) / f.h));
+						int j1 = std::min(f.ny - 1, (int)std::ceil((y_hi - origin.m_y) / f.h));
+						for(int j = j0; j <= j1; j++){
+							double y = origin.m_y + j * f.h + shift_y;
+							double ea = edge_yz(b, c, y, z), eb = edge_yz(c, a, y, z), ec = edge_yz(a, b, y, z);
+							if(!inside_edge(b, c, area, ea) || !inside_edge(c, a, area, eb) || !inside_edge(a, b, area, ec)) continue;
+							crossings[j].push_back((float)((ea * a.m_x + eb * b.m_x + ec * c.m_x) / area));
+						}
+					}
+					for(int j = 0; j != f.ny; j++){
+						std::vector<float>& line = crossings[j];
+						std::sort(line.begin(), line.end());
+						size_t passed = 0;
+						for(int k = 0; k != f.nx; k++){
+							float x = origin.m_x + k * f.h;
+							while(passed != line.size() && line[passed] < x) passed++;
+							inside[(i * f.ny + j) * f.nx + k] = passed & 1;
+						}
+					}
+				}
+			}, 1);
+		}
+
+		void
+		FromPolyline(VFXEpoch::Grid2DfScalarField& phi, const VFXEpoch::PolylineBVH& polyline,
+		             const VFXEpoch::Vector2Df& origin, float h, int band, float max_distance){
+			VFXEPOCH_TRACE_SCOPE("DistanceField", "FromPolyline");
+			if(phi.data.empty()) return;
+			Field f = {&phi.data[0], phi.getDimX(), phi.getDimY(), 1, h};
+			std::vector<float> dist(f.size(), FLT_MAX);
+			std::vector<unsigned char> seed(f.size(), 0), inside;
+			float band_distance = std::min(max_distance, band * h);
+			Parallel::ParallelFor(0, f.ny, [&](int begin, int end){
+				for(int j = begin; j != end; j++){
+					for(int k = 0; k != f.nx; k++){
+						VFXEpoch::Vector2Df point;
+						int segment;
+						float d = polyline.closest_point(VFXEpoch::Vector2Df(origin.m_x + k * h, origin.m_y + j * h), band_distance, point, segment);
+						if(segment < 0) continue;
+						dist[j * f.nx + k] = d;
+						seed[j * f.nx + k] = 1;
+					}
+				}
+			});
+			polyline_parity(f, polyline, origin, inside);
+			finish(f, dist, seed, inside, max_distance);
+		}
+
+		void
+		FromMesh(VFXEpoch::Grid3DfScalarField& phi, const VFXEpoch::TriangleBVH& mesh,
+		         const VFXEpoch::Vector3Df& origin, float h, int band, float max_distance){
+			VFXEPOCH_TRACE_SCOPE("DistanceField", "FromMesh");
+			if(phi.data.empty()) return;
+			Field f = {&phi.data[0], phi.getDimX(), phi.getDimY(), phi.getDimZ(), h};
+			std::vector<float> dist(f.size(), FLT_MAX);
+			std::vector<unsigned char> seed(f.size(), 0), inside;
+			float band_distance = std::min(max_distance, band * h);
+			Parallel::ParallelFor(0, f.nz * f.ny, [&](int begin, int end){
+				for(int row = begin; row != end; row++){
+					int i = row / f.ny, j = row % f.ny;
+					for(int k = 0; k != f.nx; k++){
+						VFXEpoch::Vector3Df point;
+						int triangle;
+						VFXEpoch::Vector3Df p(origin.m_x + k * h, origin.m_y + j * h, origin.m_z + i * h);
+						float d = mesh.closest_point(p, band_distance, point, triangle);
+						if(triangle < 0) continue;
+						dist[row * f.nx + k] = d;
+						seed[row * f.nx + k] = 1;
+					}
+				}
+			});
+			mesh_parity(f, mesh, origin, inside);
+			finish(f, dist, seed, inside, max_distance);
+		}
+	}
+}
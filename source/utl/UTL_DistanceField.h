@@ -0,0 +1,76 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Signed distance construction on 2D and 3D sample grids.
+*
+* Samples next to the interface are initialized from the zero crossings along
+* the grid axes, found by linear interpolation between samples of opposite
+* sign, which is exact for planar interfaces. The distance everywhere else is
+* the solution of the eikonal equation |grad phi| = 1 from those samples:
+*
+* FAST_SWEEPING: Gauss-Seidel sweeps in the 4 (2D) or 8 (3D) axis orderings.
+*   The orderings run at the same time on private copies of the field and are
+*   merged by taking the minimum, repeated until nothing changes. O(N) per
+*   round and a handful of rounds, at the price of one field copy per ordering.
+* FAST_MARCHING: the front is grown from the interface in order of distance
+*   with a heap, O(N log N) and serial, but it stops at max_distance, so a
+*   narrow band costs only its own size.
+*
+* Either way the result does not depend on the number of threads. Distances
+* are clamped to max_distance; with no interface at all every sample gets
+* plus or minus max_distance.
+*
+* Polylines and triangle meshes are voxelized through their BVH: samples
+* within a narrow band of the surface get the exact distance to the closest
+* point, the rest is fast swept from the band. Inside is decided by the
+* parity of surface crossings along x, so the geometry has to be closed.
+*******************************************************************************/
+#ifndef _UTL_DISTANCE_FIELD_H_
+#define _UTL_DISTANCE_FIELD_H_
+
+#include "UTL_Grid.h"
+#include "UTL_BVH.h"
+
+#include <cfloat>
+
+namespace VFXEpoch
+{
+	namespace DistanceField
+	{
+		enum class METHOD { FAST_SWEEPING, FAST_MARCHING };
+
+		// phi keeps its sign, |phi| becomes the distance to the zero crossings
+		// of phi. h is the sample spacing
+		void Redistance(VFXEpoch::Grid2DfScalarField& phi, float h, METHOD method = METHOD::FAST_SWEEPING, float max_distance = FLT_MAX);
+		void Redistance(VFXEpoch::Grid3DfScalarField& phi, float h, METHOD method = METHOD::FAST_SWEEPING, float max_distance = FLT_MAX);
+
+		// Nonzero occupancy is inside (negative). The surface is put halfway
+		// between inside and outside samples. phi is resized to the occupancy
+		void FromOccupancy(VFXEpoch::Grid2DfScalarField& phi, const VFXEpoch::Grid2DiScalarField& occupancy, float h,
+		                   METHOD method = METHOD::FAST_SWEEPING, float max_distance = FLT_MAX);
+		void FromOccupancy(VFXEpoch::Grid3DfScalarField& phi, const VFXEpoch::Grid3DiScalarField& occupancy, float h,
+		                   METHOD method = METHOD::FAST_SWEEPING, float max_distance = FLT_MAX);
+
+		// Same with BOUNDARY_MASK::SOMETHING as the inside
+		void FromMask(VFXEpoch::Grid2DfScalarField& phi, const VFXEpoch::Grid2DCellTypes& mask, float h,
+		              METHOD method = METHOD::FAST_SWEEPING, float max_distance = FLT_MAX);
+
+		// Signed distance to a closed polyline or triangle mesh, negative inside.
+		// phi keeps its size, sample (i, j) or (i, j, k) lies at origin + (j, i) * h
+		// or origin + (k, j, i) * h. Exact up to band * h from the surface
+		void FromPolyline(VFXEpoch::Grid2DfScalarField& phi, const VFXEpoch::PolylineBVH& polyline,
+		                  const VFXEpoch::Vector2Df& origin, float h, int band = 3, float max_distance = FLT_MAX);
+		void FromMesh(VFXEpoch::Grid3DfScalarField& phi, const VFXEpoch::TriangleBVH& mesh,
+		              const VFXEpoch::Vector3Df& origin, float h, int band = 3, float max_distance = FLT_MAX);
+	}
+}
+
+#endif
@@ -0,0 +1,503 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "UTL_FastPoisson.h"
+#include "UTL_Parallel.h"
+#include "UTL_Trace.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace VFXEpoch
+{
+	typedef std::complex<double> Complex;
+
+	static const double PI = 3.14159265358979323846;
+
+	// Plain product, operator* of std::complex goes through the C99 NaN checks
+	static inline Complex
+	multiply(const Complex& a, const Complex& b){
+		return Complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+	}
+
+	FFTPlan::FFTPlan() : n(0), m(0){
+	}
+
+	FFTPlan::~FFTPlan(){
+	}
+
+	void
+	FFTPlan::init(int _n){
+		n = _n;
+		m = 1;
+		while(m < n) m <<= 1;
+		// Bluestein turns the transform into a cyclic convolution of length m
+		if(m != n){
+			m = 1;
+			while(m < 2 * n - 1) m <<= 1;
+		}
+		int bits = 0;
+		while((1 << bits) < m) bits++;
+		roots.resize(m / 2);
+		for(int k = 0; k != m / 2; k++){
+			roots[k] = Complex(std::cos(2.0 * PI * k / m), -std::sin(2.0 * PI * k / m));
+		}
+		reversal.resize(m);
+		for(int i = 0; i != m; i++){
+			int r = 0;
+			for(int b = 0; b != bits; b++){
+				if(i & (1 << b)) r |= 1 << (bits - 1 - b);
+			}
+			reversal[i] = r;
+		}
+
+		chirp.clear();
+		kernel.clear();
+		if(m == n) return;
+		chirp.resize(n);
+		for(int k = 0; k != n; k++){
+			// k^2 mod 2n keeps the angle small
+			long long q = (long long)k * k % (2LL * n);
+			chirp[k] = Complex(std::cos(PI * q / n), -std::sin(PI * q / n));
+		}
+		kernel.assign(m, Complex(0.0, 0.0));
+		kernel[0] = std::conj(chirp[0]);
+		for(int k = 1; k != n; k++){
+			kernel[k] = kernel[m - k] = std::conj(chirp[k]);
+		}
+		radix2(&kernel[0], false);
+		for(int k = 0; k != m; k++){
+			kernel[k] /= (double)m;
+		}
+	}
+
+	int
+	FFTPlan::work_size() const {
+		return m == n ? 0 : m;
+	}
+
+	// Unscaled, the inverse uses the conjugate roots
+	void
+	FFTPlan::radix2(Complex* x, bool inverse) const {
+		for(int i = 0; i != m; i++){
+			if(i < reversal[i]) std::swap(x[i], x[reversal[i]]);
+		}
+		for(int len = 2; len <= m; len <<= 1){
+			int half = len >> 1, step = m / len;
+			for(int i = 0; i < m; i += len){
+				for(int k = 0; k != half; k++){
+					Complex w = inverse ? std::conj(roots[k * step]) : roots[k * step];
+					Complex t = multiply(w, x[i + k + half]);
+					x[i + k + half] = x[i + k] - t;
+					x[i + k] += t;
+				}
+			}
+		}
+	}
+
+	void
+	FFTPlan::forward(Complex* x, Complex* work) const {
+		if(m == n){
+			radix2(x, false);
+			return;
+		}
+		// X_k = chirp_k * sum_j (x_j chirp_j) conj(chirp_(k-j))
+		for(int k = 0; k != n; k++) work[k] = multiply(x[k], chirp[k]);
+		for(int k = n; k != m; k++) work[k] = Complex(0.0, 0.0);
+		radix2(work, false);
+		for(int k = 0; k != m; k++) work[k] = multiply(work[k], kernel[k]);
+		radix2(work, true);
+		for(int k = 0; k != n; k++) x[k] = multiply(work[k], chirp[k]);
+	}
+
+	// Value of a ghost cell next to inner for the boundary type, ghost is its
+	// current value
+	static inline double
+	ghost_value(BOUNDARY type, double ghost, double inner){
+		switch(type){
+		case BOUNDARY::DIRICHLET: return ghost;
+		case BOUNDARY::NEUMANN_CLOSE: return -inner;
+		case BOUNDARY::NEUMANN_OPEN: return inner;
+		default: return 0.0;
+		}
+	}
+
+	// 0 for ghosts held at a value, 1 for ghosts mirrored with the opposite
+	// sign, 2 for plain mirrors and -1 when not supported
+	static inline int
+	boundary_family(BOUNDARY type){
+		if(BOUNDARY::STREAK == type || BOUNDARY::DIRICHLET == type) return 0;
+		if(BOUNDARY::NEUMANN_CLOSE == type) return 1;
+		if(BOUNDARY::NEUMANN_OPEN == type) return 2;
+		return -1;
+	}
+
+	FastPoissonSolver::FastPoissonSolver(){
+		clear();
+	}
+
+	FastPoissonSolver::~FastPoissonSolver(){
+	}
+
+	void
+	FastPoissonSolver::clear(){
+		dimension = 0;
+		dims[0] = dims[1] = dims[2] = 0;
+		values.clear();
+	}
+
+	bool
+	FastPoissonSolver::setup(int dimX, int dimY, const BndConditionPerEdge b[4]){
+		BOUNDARY edge[4];
+		bool found[4] = {false, false, false, false};
+		for(int e = 0; e != 4; e++){
+			int s = (int)b[e].side;
+			edge[s] = b[e].boundaryType;
+			found[s] = true;
+		}
+		BOUNDARY lx = edge[(int)EDGES_2DSIM::LEFT], hx = edge[(int)EDGES_2DSIM::RIGHT];
+		BOUNDARY ly = edge[(int)EDGES_2DSIM::TOP], hy = edge[(int)EDGES_2DSIM::BOTTOM];
+		if(2 == dimension && found[0] && found[1] && found[2] && found[3] &&
+		   dimX - 2 == dims[0] && dimY - 2 == dims[1] &&
+		   lx == low[0] && hx == high[0] && ly == low[1] && hy == high[1]) return true;
+		clear();
+		if(!found[0] || !found[1] || !found[2] || !found[3]) return false;
+		dims[2] = 1;
+		if(!setup_axis(0, dimX - 2, lx, hx) || !setup_axis(1, dimY - 2, ly, hy)){
+			clear();
+			return false;
+		}
+		dimension = 2;
+		return true;
+	}
+
+	bool
+	FastPoissonSolver::setup(int dimX, int dimY, int dimZ, const BoundaryState3D b[6]){
+		BOUNDARY face[6];
+		bool found[6] = {false, false, false, false, false, false};
+		for(int f = 0; f != 6; f++){
+			int s = (int)b[f].face;
+			face[s] = b[f].boundaryType;
+			found[s] = true;
+		}
+		bool complete = true;
+		for(int f = 0; f != 6; f++){
+			complete = complete && found[f];
+		}
+		BOUNDARY lo[3] = {face[(int)FACES_3DSIM::LEFT], face[(int)FACES_3DSIM::TOP], face[(int)FACES_3DSIM::FRONT]};
+		BOUNDARY hi[3] = {face[(int)FACES_3DSIM::RIGHT], face[(int)FACES_3DSIM::BOTTOM], face[(int)FACES_3DSIM::REAR]};
+		int cells[3] = {dimX - 2, dimY - 2, dimZ - 2};
+		if(3 == dimension && complete){
+			bool same = true;
+			for(int axis = 0; axis != 3; axis++){
+				same = same && cells[axis] == dims[axis] && lo[axis] == low[axis] && hi[axis] == high[axis];
+			}
+			if(same) return true;
+		}
+		clear();
+		if(!complete) return false;
+		for(int axis = 0; axis != 3; axis++){
+			if(!setup_axis(axis, cells[axis], lo[axis], hi[axis])){
+				clear();
+				return false;
+			}
+		}
+		dimension = 3;
+		return true;
+	}
+
+	bool
+	FastPoissonSolver::setup_axis(int axis, int cells, BOUNDARY lo, BOUNDARY hi){
+		if(cells < 1) return false;
+		int f0 = boundary_family(lo), f1 = boundary_family(hi);
+		if(f0 < 0 || f1 < 0) return false;
+
+		Axis& a = axes[axis];
+		int n = cells;
+		a.n = n;
+		a.odd = true;
+		// Pairs that differ are set up low family first and run backwards
+		a.flip = f0 > f1;
+		if(a.flip) std::swap(f0, f1);
+		int L;
+		double scale;
+		int fwd[4] = {1, 1, 1, 1}, inv[4] = {1, 1, 1, 1};
+		a.halve = -1;
+		a.mu.resize(n);
+		if(0 == f0 && 0 == f1){
+			// DST-I, ghost held at both ends
+			L = 2 * (n + 1);
+			scale = 2.0 / (n + 1);
+			for(int k = 0; k != n; k++) a.mu[k] = 2.0 * std::cos(PI * (k + 1) / (n + 1));
+		} else if(1 == f0 && 1 == f1){
+			// DST-II, inverse DST-III
+			L = 4 * n;
+			fwd[1] = 2; inv[3] = 2; a.halve = n - 1;
+			scale = 2.0 / n;
+			for(int k = 0; k != n; k++) a.mu[k] = 2.0 * std::cos(PI * (k + 1) / n);
+		} else if(2 == f0 && 2 == f1){
+			// DCT-II, inverse DCT-III
+			a.odd = false;
+			L = 4 * n;
+			fwd[1] = 2; fwd[2] = 0; inv[0] = 0; inv[3] = 2; a.halve = 0;
+			scale = 2.0 / n;
+			for(int k = 0; k != n; k++) a.mu[k] = 2.0 * std::cos(PI * k / n);
+		} else if(0 == f0 && 1 == f1){
+			// Held at the low end, odd mirror at the high end: sin(2 pi (j + 1) (k + 1) / (2n + 1))
+			L = 2 * n + 1;
+			scale = 4.0 / (2 * n + 1);
+			for(int k = 0; k != n; k++) a.mu[k] = 2.0 * std::cos(2.0 * PI * (k + 1) / (2 * n + 1));
+		} else if(0 == f0){
+			// Held at the low end, even mirror at the high end: sin(pi (j + 1) (2k + 1) / (2n + 1))
+			L = 4 * n + 2;
+			fwd[3] = 2; inv[1] = 2;
+			scale = 4.0 / (2 * n + 1);
+			for(int k = 0; k != n; k++) a.mu[k] = 2.0 * std::cos(PI * (2 * k + 1) / (2 * n + 1));
+		} else {
+			// DST-IV, odd and even mirror
+			L = 8 * n;
+			fwd[1] = fwd[3] = inv[1] = inv[3] = 2;
+			scale = 2.0 / n;
+			for(int k = 0; k != n; k++) a.mu[k] = 2.0 * std::cos(PI * (2 * k + 1) / (2 * n));
+		}
+		for(int i = 0; i != 4; i++){
+			a.forward[i] = fwd[i];
+			a.inverse[i] = inv[i];
+		}
+		a.scale = scale;
+		a.fft.init(L);
+		dims[axis] = n;
+		low[axis] = lo;
+		high[axis] = hi;
+		return true;
+	}
+
+	void
+	FastPoissonSolver::transform_axis(int axis, bool inverse){
+		const Axis& a = axes[axis];
+		int n = a.n, L = a.fft.size();
+		const int* pq = inverse ? a.inverse : a.forward;
+		int p0 = pq[0], p1 = pq[1], q0 = pq[2], q1 = pq[3];
+		int halve = inverse ? a.halve : -1;
+		bool odd = a.odd;
+		// The FFT gives twice the sums
+		double scale = 0.5 * (inverse ? a.scale : 1.0);
+		// Only the cell index runs backwards, not the mode index
+		bool flip_in = a.flip && !inverse, flip_out = a.flip && inverse;
+
+		int stride = 0 == axis ? 1 : (1 == axis ? dims[0] : dims[0] * dims[1]);
+		int lines = dims[0] * dims[1] * dims[2] / n;
+		int pairs = (lines + 1) / 2;
+		double* data = &values[0];
+		// Two real lines go through one FFT as its real and imaginary parts
+		VFXEpoch::Parallel::ParallelFor(0, pairs, [&](int begin, int end){
+			std::vector<Complex> buffer(L), work(a.fft.work_size());
+			for(int pair = begin; pair != end; pair++){
+				int l1 = 2 * pair, l2 = 2 * pair + 1;
+				bool second = l2 < lines;
+				double* line1 = data + (l1 / stride) * stride * n + l1 % stride;
+				double* line2 = second ? data + (l2 / stride) * stride * n + l2 % stride : line1;
+				std::fill(buffer.begin(), buffer.end(), Complex(0.0, 0.0));
+				for(int j = 0; j != n; j++){
+					int src = (flip_in ? n - 1 - j : j) * stride;
+					double w = j == halve ? 0.5 : 1.0;
+					Complex v(w * line1[src], second ? w * line2[src] : 0.0);
+					int p = p0 + p1 * j;
+					buffer[p] += v;
+					buffer[(L - p) % L] += odd ? -v : v;
+				}
+				a.fft.forward(&buffer[0], work.empty() ? 0 : &work[0]);
+				for(int k = 0; k != n; k++){
+					const Complex& F = buffer[q0 + q1 * k];
+					int dst = (flip_out ? n - 1 - k : k) * stride;
+					line1[dst] = scale * (odd ? -F.imag() : F.real());
+					if(second) line2[dst] = scale * (odd ? F.real() : F.imag());
+				}
+			}
+		}, std::max(1, 65536 / L));
+	}
+
+	void
+	FastPoissonSolver::solve_interior(double a, double c){
+		VFXEPOCH_TRACE_SCOPE("FastPoisson", "solve");
+		for(int axis = 0; axis != dimension; axis++){
+			transform_axis(axis, false);
+		}
+		// Modes the operator maps to (almost) zero are dropped
+		double threshold = 1e-12 * (std::fabs(c) + 2 * dimension * std::fabs(a));
+		int nx = dims[0], ny = dims[1];
+		VFXEpoch::Parallel::ParallelFor(0, ny * dims[2], [&](int begin, int end){
+			for(int row = begin; row != end; row++){
+				double mu = axes[1].mu[row % ny];
+				if(3 == dimension) mu += axes[2].mu[row / ny];
+				double* v = &values[(size_t)row * nx];
+				for(int i = 0; i != nx; i++){
+					double lambda = c - a * (axes[0].mu[i] + mu);
+					v[i] = std::fabs(lambda) > threshold ? v[i] / lambda : 0.0;
+				}
+			}
+		}, std::max(1, 4096 / nx));
+		for(int axis = 0; axis != dimension; axis++){
+			transform_axis(axis, true);
+		}
+	}
+
+	template<class T>
+	void
+	FastPoissonSolver::solve_grid(Grid2D<T>& x, const Grid2D<T>& rhs, double a, double c){
+		assert(2 == dimension);
+		int nx = dims[0], ny = dims[1];
+		assert(x.getDimX() == nx + 2 && x.getDimY() == ny + 2);
+		assert(rhs.getDimX() == nx + 2 && rhs.getDimY() == ny + 2);
+		values.resize((size_t)nx * ny);
+		for(int i = 1; i <= ny; i++){
+			for(int j = 1; j <= nx; j++){
+				values[(i - 1) * nx + j - 1] = rhs(i, j);
+			}
+		}
+		// Held ghosts move to the right hand side
+		for(int i = 1; i <= ny; i++){
+			if(BOUNDARY::DIRICHLET == low[0]) values[(i - 1) * nx] += a * x(i, 0);
+			if(BOUNDARY::DIRICHLET == high[0]) values[(i - 1) * nx + nx - 1] += a * x(i, nx + 1);
+		}
+		for(int j = 1; j <= nx; j++){
+			if(BOUNDARY::DIRICHLET == low[1]) values[j - 1] += a * x(0, j);
+			if(BOUNDARY::DIRICHLET == high[1]) values[(ny - 1) * nx + j - 1] += a * x(ny + 1, j);
+		}
+		solve_interior(a, c);
+		for(int i = 1; i <= ny; i++){
+			for(int j = 1; j <= nx; j++){
+				x(i, j) = (T)values[(i - 1) * nx + j - 1];
+			}
+		}
+		for(int i = 1; i <= ny; i++){
+			x(i, 0) = (T)ghost_value(low[0], x(i, 0), x(i, 1));
+			x(i, nx + 1) = (T)ghost_value(high[0], x(i, nx + 1), x(i, nx));
+		}
+		for(int j = 1; j <= nx; j++){
+			x(0, j) = (T)ghost_value(low[1], x(0, j), x(1, j));
+			x(ny + 1, j) = (T)ghost_value(high[1], x(ny + 1, j), x(ny, j));
+		}
+		x.setBoundariesOnCorners();
+	}
+
+	template<class T>
+	void
+	FastPoissonSolver::solve_grid(Grid3D<T>& x, const Grid3D<T>& rhs, double a, double c){
+		assert(3 == dimension);
+		int nx = dims[0], ny = dims[1], nz = dims[2];
+		assert(x.getDimX() == nx + 2 && x.getDimY() == ny + 2 && x.getDimZ() == nz + 2);
+		assert(rhs.getDimX() == nx + 2 && rhs.getDimY() == ny + 2 && rhs.getDimZ() == nz + 2);
+		values.resize((size_t)nx * ny * nz);
+		for(int i = 1; i <= nz; i++){
+			for(int j = 1; j <= ny; j++){
+				double* v = &values[((size_t)(i - 1) * ny + j - 1) * nx];
+				for(int k = 1; k <= nx; k++){
+					v[k - 1] = rhs(i, j, k);
+				}
+				if(BOUNDARY::DIRICHLET == low[0]) v[0] += a * x(i, j, 0);
+				if(BOUNDARY::DIRICHLET == high[0]) v[nx - 1] += a * x(i, j, nx + 1);
+			}
+		}
+		for(int i = 1; i <= nz; i++){
+			for(int k = 1; k <= nx; k++){
+				if(BOUNDARY::DIRICHLET == low[1]) values[((size_t)(i - 1) * ny) * nx + k - 1] += a * x(i, 0, k);
+				if(BOUNDARY::DIRICHLET == high[1]) values[((size_t)(i - 1) * ny + ny - 1) * nx + k - 1] += a * x(i, ny + 1, k);
+			}
+		}
+		for(int j = 1; j <= ny; j++){
+			for(int k = 1; k <= nx; k++){
+				if(BOUNDARY::DIRICHLET == low[2]) values[(size_t)(j - 1) * nx + k - 1] += a * x(0, j, k);
+				if(BOUNDARY::DIRICHLET == high[2]) values[((size_t)(nz - 1) * ny + j - 1) * nx + k - 1] += a * x(nz + 1, j, k);
+			}
+		}
+		solve_interior(a, c);
+		for(int i = 1; i <= nz; i++){
+			for(int j = 1; j <= ny; j++){
+				const double* v = &values[((size_t)(i - 1) * ny + j - 1) * nx];
+				for(int k = 1; k <= nx; k++){
+					x(i, j, k) = (T)v[k - 1];
+				}
+				x(i, j, 0) = (T)ghost_value(low[0], x(i, j, 0), x(i, j, 1));
+				x(i, j, nx + 1) = (T)ghost_value(high[0], x(i, j, nx + 1), x(i, j, nx));
+			}
+		}
+		for(int i = 1; i <= nz; i++){
+			for(int k = 1; k <= nx; k++){
+				x(i, 0, k) = (T)ghost_value(low[1], x(i, 0, k), x(i, 1, k));
+				x(i, ny + 1, k) = (T)ghost_value(high[1], x(i, ny + 1, k), x(i, ny, k));
+			}
+		}
+		for(int j = 1; j <= ny; j++){
+			for(int k = 1; k <= nx; k++){
+				x(0, j, k) = (T)ghost_value(low[2], x(0, j, k), x(1, j, k));
+				x(nz + 1, j, k) = (T)ghost_value(high[2], x(nz + 1, j, k), x(nz, j, k));
+			}
+		}
+		x.setBoundariesOnEdges();
+		x.setBoundariesOnCorners();
+	}
+
+	template<class T>
+	void
+	FastPoissonSolver::solve_vector(const std::vector<T>& rhs, std::vector<T>& x, double a, double c){
+		assert(0 != dimension);
+		int nx = dims[0], ny = dims[1], nz = dims[2];
+		int fx = nx + 2, fy = ny + 2, oz = 3 == dimension ? 1 : 0;
+		size_t size = (size_t)fx * fy * (nz + 2 * oz);
+		assert(rhs.size() == size);
+		values.resize((size_t)nx * ny * nz);
+		for(int i = 0; i != nz; i++){
+			for(int j = 0; j != ny; j++){
+				const T* r = &rhs[((size_t)(i + oz) * fy + j + 1) * fx + 1];
+				double* v = &values[((size_t)i * ny + j) * nx];
+				for(int k = 0; k != nx; k++) v[k] = r[k];
+			}
+		}
+		solve_interior(a, c);
+		x.assign(size, T(0));
+		for(int i = 0; i != nz; i++){
+			for(int j = 0; j != ny; j++){
+				T* r = &x[((size_t)(i + oz) * fy + j + 1) * fx + 1];
+				const double* v = &values[((size_t)i * ny + j) * nx];
+				for(int k = 0; k != nx; k++) r[k] = (T)v[k];
+			}
+		}
+	}
+
+	void
+	FastPoissonSolver::solve(Grid2DfScalarField& x, const Grid2DfScalarField& rhs, double a, double c){
+		solve_grid(x, rhs, a, c);
+	}
+
+	void
+	FastPoissonSolver::solve(Grid2DdScalarField& x, const Grid2DdScalarField& rhs, double a, double c){
+		solve_grid(x, rhs, a, c);
+	}
+
+	void
+	FastPoissonSolver::solve(Grid3DfScalarField& x, const Grid3DfScalarField& rhs, double a, double c){
+		solve_grid(x, rhs, a, c);
+	}
+
+	void
+	FastPoissonSolver::solve(Grid3DdScalarField& x, const Grid3DdScalarField& rhs, double a, double c){
+		solve_grid(x, rhs, a, c);
+	}
+
+	void
+	FastPoissonSolver::solve(const std::vector<float>& rhs, std::vector<float>& x, double a, double c){
+		solve_vector(rhs, x, a, c);
+	}
+
+	void
+	FastPoissonSolver::solve(const std::vector<double>& rhs, std::vector<double>& x, double a, double c){
+		solve_vector(rhs, x, a, c);
+	}
+}
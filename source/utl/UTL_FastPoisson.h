@@ -0,0 +1,125 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Direct solver for c * x - a * (sum of the 2 or 3 pairs of neighbours of x)
+* = rhs on the interior cells of an obstacle free Grid2D or Grid3D, the system
+* LinearSolver::GSSolve iterates on.
+*
+* The ghost ring follows the boundary types as Grid2D::setBoundaries sets
+* them: STREAK holds the ghosts at zero, DIRICHLET at the values x has on
+* entry, NEUMANN_CLOSE mirrors the cell next to it with the opposite sign and
+* NEUMANN_OPEN with the same sign. Along each axis the operator is then
+* diagonal in a sine or cosine basis picked by the pair of ends (DST-I, DST-II,
+* DCT-II, DST-IV and two odd length sine transforms for ends that differ), so
+* the solve is a forward transform along every axis, a division by the
+* eigenvalues and the inverse transforms, O(N log N) in the number of cells.
+* ROBIN and CAUCHY are not supported.
+*
+* The transforms run through a complex FFT of the line extended by symmetry,
+* two lines at a time as the real and the imaginary part. Lines are spread
+* over the threads and every line is computed the same way whatever thread
+* runs it.
+*
+* Singular modes (pure Neumann pressure) are dropped, so the result has zero
+* mean there.
+*******************************************************************************/
+#ifndef _UTL_FAST_POISSON_H_
+#define _UTL_FAST_POISSON_H_
+
+#include "UTL_Grid.h"
+
+#include <complex>
+#include <vector>
+
+namespace VFXEpoch
+{
+	// Complex FFT of any length: iterative radix 2 for powers of two and
+	// Bluestein's algorithm on top of it otherwise
+	class FFTPlan
+	{
+	public:
+		FFTPlan();
+		~FFTPlan();
+
+		void init(int n);
+		int size() const { return n; }
+		// Scratch values forward() needs besides the data
+		int work_size() const;
+		// x[k] = sum_j x[j] * exp(-2 pi i j k / n)
+		void forward(std::complex<double>* x, std::complex<double>* work) const;
+
+	private:
+		int n, m;
+		std::vector<std::complex<double> > roots; // exp(-2 pi i k / m), k < m / 2
+		std::vector<int> reversal;
+		std::vector<std::complex<double> > chirp; // exp(-i pi k^2 / n)
+		std::vector<std::complex<double> > kernel; // transformed conj(chirp) / m
+		void radix2(std::complex<double>* x, bool inverse) const;
+	};
+
+	class FastPoissonSolver
+	{
+	public:
+		FastPoissonSolver();
+		~FastPoissonSolver();
+
+		// Grids of dimX x dimY (x dimZ) cells ghost ring included, with one
+		// boundary per edge or face. Returns false, and ready() stays false,
+		// when the boundaries are not supported. Setting up again with the same
+		// grid and boundaries keeps the transforms
+		bool setup(int dimX, int dimY, const BndConditionPerEdge b[4]);
+		bool setup(int dimX, int dimY, int dimZ, const BoundaryState3D b[6]);
+		bool ready() const { return 0 != dimension; }
+		void clear();
+
+		// Ghosts of rhs are ignored, those of x are set from the boundaries
+		void solve(Grid2DfScalarField& x, const Grid2DfScalarField& rhs, double a, double c);
+		void solve(Grid2DdScalarField& x, const Grid2DdScalarField& rhs, double a, double c);
+		void solve(Grid3DfScalarField& x, const Grid3DfScalarField& rhs, double a, double c);
+		void solve(Grid3DdScalarField& x, const Grid3DdScalarField& rhs, double a, double c);
+		// The same on vectors over all cells of the grid, as the pressure solvers
+		// lay them out. DIRICHLET ghosts count as zero and the ghosts of x are
+		// zeroed, which makes it usable as a PCG preconditioner
+		void solve(const std::vector<float>& rhs, std::vector<float>& x, double a, double c);
+		void solve(const std::vector<double>& rhs, std::vector<double>& x, double a, double c);
+
+	private:
+		// The transform is a sine or cosine sum taken from the FFT of the line
+		// spread over positions p0 + p1 * j and mirrored, with the sign flipped
+		// for sines, to L - p0 - p1 * j. Output k sits at q0 + q1 * k
+		struct Axis
+		{
+			int n;
+			bool odd; // sine transform
+			bool flip; // the line runs backwards through the transform
+			int forward[4], inverse[4]; // p0, p1, q0, q1
+			int halve; // input of the inverse weighed by half, -1 for none
+			double scale; // of the inverse
+			FFTPlan fft;
+			std::vector<double> mu; // eigenvalues of the neighbour sum along the axis
+		};
+
+		int dimension;
+		int dims[3]; // interior cells along x, y and z
+		Axis axes[3];
+		BOUNDARY low[3], high[3]; // boundary at index 0 and at the last index of each axis
+		std::vector<double> values; // interior cells, x fastest
+
+		bool setup_axis(int axis, int cells, BOUNDARY lo, BOUNDARY hi);
+		void transform_axis(int axis, bool inverse);
+		void solve_interior(double a, double c);
+		template<class T> void solve_grid(Grid2D<T>& x, const Grid2D<T>& rhs, double a, double c);
+		template<class T> void solve_grid(Grid3D<T>& x, const Grid3D<T>& rhs, double a, double c);
+		template<class T> void solve_vector(const std::vector<T>& rhs, std::vector<T>& x, double a, double c);
+	};
+}
+
+#endif
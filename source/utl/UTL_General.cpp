@@ -208,6 +208,37 @@ VFXEpoch::InterpolateGradient(Vector2Dd& gradient, Vector2Dd pos, VFXEpoch::Grid
 	return VFXEpoch::Bilerp(fx, fy, field(i, j), field(i, j+1), field(i+1, j), field(i+1, j+1));
 }
 
+void
+VFXEpoch::InterpolateGrid(const float* x, const float* y, int count, const Grid2DfScalarField& field, float* result){
+	int nx = field.getDimX(), ny = field.getDimY();
+	const float* data = &field.data[0];
+	for(int p = 0; p != count; p++){
+		int i, j;
+		float fx, fy;
+		VFXEpoch::get_barycentric(x[p], j, fx, 0, nx);
+		VFXEpoch::get_barycentric(y[p], i, fy, 0, ny);
+		const float* row = data + i * nx + j;
+		result[p] = VFXEpoch::Bilerp(fx, fy, row[0], row[1], row[nx], row[nx + 1]);
+	}
+}
+
+void
+VFXEpoch::InterpolateGradient(const float* x, const float* y, int count, const Grid2DfScalarField& field,
+                              float* gradient_x, float* gradient_y, float* result){
+	int nx = field.getDimX(), ny = field.getDimY();
+	const float* data = &field.data[0];
+	for(int p = 0; p != count; p++){
+		int i, j;
+		float fx, fy;
+		VFXEpoch::get_barycentric(x[p], j, fx, 0, nx);
+		VFXEpoch::get_barycentric(y[p], i, fy, 0, ny);
+		const float* row = data + i * nx + j;
+		gradient_x[p] = VFXEpoch::Lerp(fy, row[1] - row[0], row[nx + 1] - row[nx]);
+		gradient_y[p] = VFXEpoch::Lerp(fx, row[nx] - row[0], row[nx + 1] - row[1]);
+		result[p] = VFXEpoch::Bilerp(fx, fy, row[0], row[1], row[nx], row[nx + 1]);
+	}
+}
+
 float
 VFXEpoch::InteralFrac(float left, float right){
 	if(left < 0 && right < 0) return 1.0f;
@@ -76,6 +76,11 @@ namespace VFXEpoch
 	double InterpolateGrid(Vector2Dd pos, VFXEpoch::Grid2DdScalarField& field);
 	float InterpolateGradient(Vector2Df& gradient, Vector2Df pos, VFXEpoch::Grid2DfScalarField& field);
 	double InterpolateGradient(Vector2Dd& gradient, Vector2Dd pos, VFXEpoch::Grid2DdScalarField& field);
+	// Batched forms for particle loops, x and y are in grid index space. Same
+	// results as the single position calls, without a call per sample.
+	void InterpolateGrid(const float* x, const float* y, int count, const VFXEpoch::Grid2DfScalarField& field, float* result);
+	void InterpolateGradient(const float* x, const float* y, int count, const VFXEpoch::Grid2DfScalarField& field,
+	                         float* gradient_x, float* gradient_y, float* result);
 	float InteralFrac(float left, float right);
 	void DataFromVectorToGrid(const std::vector<float> vec, VFXEpoch::Grid2DfScalarField& grid);
 	void DataFromVectorToGrid(const std::vector<double> vec, VFXEpoch::Grid2DdScalarField& grid);
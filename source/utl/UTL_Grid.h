@@ -322,7 +322,7 @@ namespace VFXEpoch
 			data[IDX2D(i, j)] = _data;
 		}
 
-		T getData(int i, int j)	{
+		T getData(int i, int j) const {
 			assert(i >= 0 && i <= (m_yCell - 1) && j >= 0 && j <= (m_xCell - 1));
 			return data[IDX2D(i, j)];
 		}
@@ -340,19 +340,19 @@ namespace VFXEpoch
 			return boundaryState;
 		}
 
-		inline int getDimY(){
+		inline int getDimY() const {
 			return m_yCell;
 		}
 
-		inline int getDimX(){
+		inline int getDimX() const {
 			return m_xCell;
 		}
 
-		inline float getDy(){
+		inline float getDy() const {
 			return dy;
 		}
 
-		inline float getDx(){
+		inline float getDx() const {
 			return dx;
 		}
 
@@ -544,7 +544,7 @@ namespace VFXEpoch
 		Grid3D(){ m_xCell = m_yCell = m_zCell = 0; dx = dy = dz = 0.0f; data.clear(); }
 		Grid3D(int x, int y, int z){ m_xCell = x; m_yCell = y; m_zCell = z; }
 		Grid3D(int x, int y, int z, float _dx, float _dy, float _dz) : m_xCell(x), m_yCell(y), m_zCell(z), dx(_dx), dy(_dy), dz(_dz){ data.clear(); data.resize(m_xCell * m_yCell * m_zCell); }
-		Grid3D(const Grid3D& source){ m_xCell = source.m_xCell; m_yCell = source.m_yCell; m_zCell = source.m_zCell; dx = source.dx; dy = source.dx; data = source.data; }
+		Grid3D(const Grid3D& source){ m_xCell = source.m_xCell; m_yCell = source.m_yCell; m_zCell = source.m_zCell; dx = source.dx; dy = source.dy; dz = source.dz; data = source.data; }
 		Grid3D& operator=(const Grid3D& source)
 		{
 			m_xCell = source.m_xCell;
@@ -559,6 +559,17 @@ namespace VFXEpoch
 		}
 		~Grid3D(){ clear(); }
 
+		// i is the depth (z), j the row (y) and k the column (x), as in IDX3D
+		const T& operator()(int i, int j, int k) const {
+			assert(i >= 0 && i <= m_zCell - 1 && j >= 0 && j <= m_yCell - 1 && k >= 0 && k <= m_xCell - 1);
+			return data[IDX3D(i, j, k)];
+		}
+
+		T& operator()(int i, int j, int k) {
+			assert(i >= 0 && i <= m_zCell - 1 && j >= 0 && j <= m_yCell - 1 && k >= 0 && k <= m_xCell - 1);
+			return data[IDX3D(i, j, k)];
+		}
+
 	public:
 		void zeroVectors(){
 			int size = m_xCell * m_yCell * m_zCell;
@@ -618,7 +629,7 @@ namespace VFXEpoch
 				data[IDX3D(i, j, k)] = _data;
 		}
 
-		T getData(int i, int j, int k)	{
+		T getData(int i, int j, int k) const {
 			if (i >(m_yCell - 1) || j >(m_xCell - 1) || k >(m_zCell - 1) || i < 0 || j < 0 || k < 0)
 				assert(i <= (m_yCell - 1) && j <= (m_xCell - 1) && k <= (m_zCell - 1));
 			else
@@ -640,27 +651,27 @@ namespace VFXEpoch
 			return boundaryState;
 		}
 
-		inline int getDimY(){
+		inline int getDimY() const {
 			return m_yCell;
 		}
 
-		inline int getDimX(){
+		inline int getDimX() const {
 			return m_xCell;
 		}
 
-		inline int getDimZ(){
+		inline int getDimZ() const {
 			return m_zCell;
 		}
 
-		inline float getDx(){
+		inline float getDx() const {
 			return dx;
 		}
 
-		inline float getDy(){
+		inline float getDy() const {
 			return dy;
 		}
 
-		inline float getDz(){
+		inline float getDz() const {
 			return dz;
 		}
 
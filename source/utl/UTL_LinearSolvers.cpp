@@ -7,6 +7,11 @@
     the MIT license as written in the LICENSE file.
 *******************************************************************************/
 #include "UTL_LinearSolvers.h"
+#include "UTL_Parallel.h"
+#include "UTL_Trace.h"
+
+#include <algorithm>
+#include <vector>
 
 namespace VFXEpoch
 {
@@ -14,6 +19,7 @@ namespace VFXEpoch
 	{
 		void
 		GSSolve(VFXEpoch::Grid2DfScalarField& x, VFXEpoch::Grid2DfScalarField x0, VFXEpoch::BndConditionPerEdge b[], float coefMatrixAElement, float c, int iterations)	{
+			VFXEPOCH_TRACE_SCOPE("LinearSolver", "GSSolve");
 			for (int m = 0; m != iterations; m++)	{
 				for (int i = 1; i != x.getDimY() - 1; i++)	{
 					for (int j = 1; j != x.getDimX() - 1; j++)	{
@@ -34,6 +40,7 @@ namespace VFXEpoch
 
 		void
 		GSSolve(VFXEpoch::Grid2DdScalarField& x, VFXEpoch::Grid2DdScalarField x0, VFXEpoch::BndConditionPerEdge b[], float coefMatrixAElement, float c, int iterations)	{
+			VFXEPOCH_TRACE_SCOPE("LinearSolver", "GSSolve");
 			for (int m = 0; m != iterations; m++)	{
 				for (int i = 1; i != x.getDimY() - 1; i++)	{
 					for (int j = 1; j != x.getDimX() - 1; j++)	{
@@ -52,31 +59,100 @@ namespace VFXEpoch
 			}
 		}
 
-		void
-		RBGSSolve(float h, VFXEpoch::Grid2DfScalarField& x, VFXEpoch::Grid2DfScalarField x0, VFXEpoch::BndConditionPerEdge b[], float coefMatrixAElement, float c) {
-			for (int rb = 0; rb != 2; rb++)	{
-				for (int i = 1; i != x.getDimY() - 1; i++) {
-					for (int j = 1; j != x.getDimX() - 1; j++) {
-						if ((i + j) % 2 == rb)	{
-							float sumFluxout = x(i + 1, j) + x(i - 1, j) + x(i, j + 1) + x(i, j - 1);
-							sumFluxout *= coefMatrixAElement;
-							float curApproximation = x0(i, j) + sumFluxout;
-							curApproximation /= c;
-							x(i, j) = curApproximation;
-						}
+		// Cells of one colour, (i + j) % 2 == colour, in rows [begin, end).
+		// Only the cells of the colour are visited and the loop has no branch.
+		// Returns the largest |residual| met before the updates
+		template<class T>
+		static T
+		sor_rows(T* x, const T* x0, int dimX, int colour, int begin, int end, T a, T c, T omega){
+			T scale = omega / c;
+			T largest = 0;
+			for (int i = begin; i != end; i++)	{
+				T* row = x + (size_t)i * dimX;
+				const T* up = row - dimX;
+				const T* down = row + dimX;
+				const T* rhs = x0 + (size_t)i * dimX;
+				for (int j = 1 + (i + 1 + colour) % 2; j < dimX - 1; j += 2)	{
+					T r = rhs[j] + a * (up[j] + down[j] + row[j - 1] + row[j + 1]) - c * row[j];
+					row[j] += scale * r;
+					T magnitude = std::fabs(r);
+					largest = magnitude > largest ? magnitude : largest;
+				}
+			}
+			return largest;
+		}
+
+		template<class T>
+		static int
+		sor_solve(VFXEpoch::Grid2D<T>& x, const VFXEpoch::Grid2D<T>& x0, VFXEpoch::BndConditionPerEdge b[], T a, T c, T omega, int iterations, T tolerance){
+			int dimX = x.getDimX(), dimY = x.getDimY();
+			if (dimX < 3 || dimY < 3) return 0;
+			T* px = &x.data[0];
+			const T* px0 = &x0.data[0];
+			int grain = std::max(1, 4096 / dimX);
+			// One partial per row, the maximum does not depend on the order
+			std::vector<T> partial(dimY, T(0));
+			T limit = 0;
+			if (tolerance > 0)	{
+				VFXEpoch::Parallel::ParallelFor(1, dimY - 1, [&](int begin, int end){
+					for (int i = begin; i != end; i++)	{
+						const T* rhs = px0 + (size_t)i * dimX;
+						T largest = 0;
+						for (int j = 1; j < dimX - 1; j++)	largest = std::max(largest, (T)std::fabs(rhs[j]));
+						partial[i] = largest;
 					}
+				}, grain);
+				limit = tolerance * *std::max_element(partial.begin(), partial.end());
+			}
+			for (int m = 0; m != iterations; m++)	{
+				T largest = 0;
+				for (int colour = 0; colour != 2; colour++)	{
+					VFXEpoch::Parallel::ParallelFor(1, dimY - 1, [&](int begin, int end){
+						for (int i = begin; i != end; i++)
+							partial[i] = sor_rows(px, px0, dimX, colour, i, i + 1, a, c, omega);
+					}, grain);
+					largest = std::max(largest, *std::max_element(partial.begin(), partial.end()));
+					x.setBoundaries(b[0].boundaryType, b[0].side);
+					x.setBoundaries(b[1].boundaryType, b[1].side);
+					x.setBoundaries(b[2].boundaryType, b[2].side);
+					x.setBoundaries(b[3].boundaryType, b[3].side);
+					x.setBoundariesOnCorners();
 				}
-				// TODO: Boundary values need to be set
-				x.setBoundaries(b[0].boundaryType, b[0].side);
-				x.setBoundaries(b[1].boundaryType, b[1].side);
-				x.setBoundaries(b[2].boundaryType, b[2].side);
-				x.setBoundaries(b[3].boundaryType, b[3].side);
-				x.setBoundariesOnCorners();
+				if (tolerance > 0 && largest <= limit) return m + 1;
 			}
+			return iterations;
+		}
+
+		void
+		RBGSSolve(float h, VFXEpoch::Grid2DfScalarField& x, VFXEpoch::Grid2DfScalarField x0, VFXEpoch::BndConditionPerEdge b[], float coefMatrixAElement, float c) {
+			VFXEPOCH_TRACE_SCOPE("LinearSolver", "RBGSSolve");
+			sor_solve(x, x0, b, coefMatrixAElement, c, 1.0f, 1, 0.0f);
+		}
+
+		int
+		RBSORSolve(VFXEpoch::Grid2DfScalarField& x, const VFXEpoch::Grid2DfScalarField& x0, VFXEpoch::BndConditionPerEdge b[], float coefMatrixAElement, float c, float omega, int iterations, float tolerance)	{
+			VFXEPOCH_TRACE_SCOPE("LinearSolver", "RBSORSolve");
+			return sor_solve(x, x0, b, coefMatrixAElement, c, omega, iterations, tolerance);
+		}
+
+		int
+		RBSORSolve(VFXEpoch::Grid2DdScalarField& x, const VFXEpoch::Grid2DdScalarField& x0, VFXEpoch::BndConditionPerEdge b[], float coefMatrixAElement, float c, float omega, int iterations, float tolerance)	{
+			VFXEPOCH_TRACE_SCOPE("LinearSolver", "RBSORSolve");
+			return sor_solve(x, x0, b, (double)coefMatrixAElement, (double)c, (double)omega, iterations, (double)tolerance);
+		}
+
+		float
+		SOROmega(int dimX, int dimY, float coefMatrixAElement, float c)	{
+			const double pi = 3.14159265358979323846;
+			if (dimX < 3 || dimY < 3) return 1.0f;
+			double rho = coefMatrixAElement / c * (2.0 * std::cos(pi / (dimX - 1)) + 2.0 * std::cos(pi / (dimY - 1)));
+			rho = std::min(std::fabs(rho), 0.9999);
+			return (float)(2.0 / (1.0 + std::sqrt(1.0 - rho * rho)));
 		}
 
 		void
 		JacobiSolve(VFXEpoch::Grid2DfScalarField& x, VFXEpoch::Grid2DfScalarField x0, VFXEpoch::BndConditionPerEdge b[], float coefMatrixAElement, float c, int iterations)	{
+			VFXEPOCH_TRACE_SCOPE("LinearSolver", "JacobiSolve");
 				// Extra memory to avoid covering previous value
 				VFXEpoch::Grid2DfScalarField auxiliary(x0.getDimX(), x0.getDimY(), (float)(1 / (x0.getDimX() - 1)), (float)(1 / (x0.getDimY() - 1)));
 
@@ -112,6 +188,7 @@ namespace VFXEpoch
 		// TODO: Fix bugs in V-Cycle Multigrid algorithm
 		void
 		MultigridSolve_V_Cycle(float h, VFXEpoch::Grid2DfScalarField& x, VFXEpoch::Grid2DfScalarField x0, VFXEpoch::BndConditionPerEdge b[], float coefMatrixAElement, float c, int nSmooth) {
+			VFXEPOCH_TRACE_SCOPE("LinearSolver", "MultigridSolve_V_Cycle");
 			int L = x.getDimY() - 2;
 			if (L == 1){
 				x(1, 1) = 0.25f * (x(0, 1) + x(1, 0) + x(1, 2) + x(2, 1) + x0(1, 1));
@@ -29,6 +29,23 @@ namespace VFXEpoch
 		void
 		RBGSSolve(float h, VFXEpoch::Grid2DfScalarField& x, VFXEpoch::Grid2DfScalarField x0, VFXEpoch::BndConditionPerEdge b[], float coefMatrixAElement, float c);
 
+		// Red-black SOR on the system GSSolve iterates on. A colour only reads
+		// the other one, so the rows of each half sweep run in parallel with the
+		// same result on any number of threads. omega 1 is red-black Gauss-Seidel.
+		// Stops after iterations sweeps, or earlier once the largest residual of
+		// a sweep is at most tolerance times the largest |x0| (tolerance 0 never
+		// stops early). Returns the sweeps done
+		int
+		RBSORSolve(VFXEpoch::Grid2DfScalarField& x, const VFXEpoch::Grid2DfScalarField& x0, VFXEpoch::BndConditionPerEdge b[], float coefMatrixAElement, float c, float omega, int iterations, float tolerance = 0.0f);
+
+		int
+		RBSORSolve(VFXEpoch::Grid2DdScalarField& x, const VFXEpoch::Grid2DdScalarField& x0, VFXEpoch::BndConditionPerEdge b[], float coefMatrixAElement, float c, float omega, int iterations, float tolerance = 0.0f);
+
+		// The omega RBSORSolve converges fastest with on a dimX x dimY grid,
+		// from the spectral radius of the Jacobi iteration on the same system
+		float
+		SOROmega(int dimX, int dimY, float coefMatrixAElement, float c);
+
 		void
 		JacobiSolve(VFXEpoch::Grid2DfScalarField& x, VFXEpoch::Grid2DfScalarField x0, VFXEpoch::BndConditionPerEdge b[], float coefMatrixAElement, float c, int iterations);
 
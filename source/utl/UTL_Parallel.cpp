@@ -0,0 +1,257 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "UTL_Parallel.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace VFXEpoch
+{
+	namespace Parallel
+	{
+		typedef struct _task
+		{
+			std::function<void()> func;
+			TaskGroup* group;
+		}Task;
+
+		class TaskScheduler
+		{
+		public:
+			static TaskScheduler& Instance(){
+				static TaskScheduler scheduler;
+				return scheduler;
+			}
+
+			~TaskScheduler(){ stop(); }
+
+			int size() const { return (int)workers.size() + 1; }
+
+			void resize(int n){
+				stop();
+				start(std::max(1, n) - 1);
+			}
+
+			void spawn(TaskGroup* group, const std::function<void()>& func){
+				Task task;
+				task.func = func;
+				task.group = group;
+				group->pending.fetch_add(1);
+
+				// Workers push onto their own deque, everybody else onto the
+				// shared injection queue at index 0
+				Queue& queue = *queues[t_index < 0 ? 0 : t_index];
+				{
+					std::lock_guard<std::mutex> lock(queue.lock);
+					queue.tasks.push_back(task);
+				}
+				queued.fetch_add(1);
+				{
+					std::lock_guard<std::mutex> lock(sleep_lock);
+				}
+				wake.notify_one();
+			}
+
+			// Runs one task of the given group (any group when NULL).
+			// Returns false when none could be found.
+			bool run_one(TaskGroup* only){
+				Task task;
+				if(!take(only, task)) return false;
+				execute(task);
+				return true;
+			}
+
+			// Outside of any task a waiting thread may run anything, inside
+			// one it is restricted to the group it waits for
+			bool is_nested() const { return t_depth > 0; }
+
+		private:
+			struct Queue
+			{
+				std::mutex lock;
+				std::deque<Task> tasks;
+			};
+
+			TaskScheduler(){
+				int n = (int)std::thread::hardware_concurrency();
+				const char* env = getenv("VFXEPOCH_NUM_THREADS");
+				if(env && atoi(env) > 0) n = atoi(env);
+				start(std::max(1, n) - 1);
+			}
+
+			void start(int num_workers){
+				quit = false;
+				queued = 0;
+				next_victim = 0;
+				queues.resize(num_workers + 1);
+				for(int i = 0; i != num_workers + 1; i++) queues[i] = new Queue();
+				for(int i = 0; i != num_workers; i++)
+					workers.push_back(std::thread(&TaskScheduler::worker_loop, this, i + 1));
+			}
+
+			void stop(){
+				{
+					std::lock_guard<std::mutex> lock(sleep_lock);
+					quit = true;
+				}
+				wake.notify_all();
+				for(size_t i = 0; i != workers.size(); i++) workers[i].join();
+				workers.clear();
+				for(size_t i = 0; i != queues.size(); i++) delete queues[i];
+				queues.clear();
+			}
+
+			static bool matches(const Task& task, TaskGroup* only){
+				return NULL == only || task.group == only;
+			}
+
+			bool take(TaskGroup* only, Task& out){
+				int self = t_index < 0 ? 0 : t_index;
+				int count = (int)queues.size();
+
+				// Own deque first, newest task first (LIFO keeps caches warm)
+				if(t_index >= 0 && pop_back(*queues[self], only, out)) return true;
+				// The injection queue holds new top level jobs
+				if(self != 0 && pop_front(*queues[0], only, out)) return true;
+				// Steal the oldest task of the others, starting at a random victim
+				int start = count > 1 ? (int)(next_victim.fetch_add(1) % count) : 0;
+				for(int k = 0; k != count; k++){
+					int victim = (start + k) % count;
+					if(victim == self || 0 == victim) continue;
+					if(pop_front(*queues[victim], only, out)) return true;
+				}
+				// An external thread also drains the injection queue
+				if(0 == self && pop_back(*queues[0], only, out)) return true;
+				return false;
+			}
+
+			bool pop_back(Queue& queue, TaskGroup* only, Task& out){
+				std::lock_guard<std::mutex> lock(queue.lock);
+				for(std::deque<Task>::reverse_iterator ite = queue.tasks.rbegin(); ite != queue.tasks.rend(); ite++){
+					if(!matches(*ite, only)) continue;
+					out = *ite;
+					queue.tasks.erase(--(ite.base()));
+					queued.fetch_sub(1);
+					return true;
+				}
+				return false;
+			}
+
+			bool pop_front(Queue& queue, TaskGroup* only, Task& out){
+				std::lock_guard<std::mutex> lock(queue.lock);
+				for(std::deque<Task>::iterator ite = queue.tasks.begin(); ite != queue.tasks.end(); ite++){
+					if(!matches(*ite, only)) continue;
+					out = *ite;
+					queue.tasks.erase(ite);
+					queued.fetch_sub(1);
+					return true;
+				}
+				return false;
+			}
+
+			void execute(Task& task){
+				t_depth++;
+				task.func();
+				t_depth--;
+				task.group->pending.fetch_sub(1, std::memory_order_acq_rel);
+			}
+
+			void worker_loop(int index){
+				t_index = index;
+				for(;;){
+					Task task;
+					if(take(NULL, task)){
+						execute(task);
+						continue;
+					}
+					std::unique_lock<std::mutex> lock(sleep_lock);
+					wake.wait(lock, [this]{ return quit || queued.load() > 0; });
+					if(quit) break;
+				}
+				t_index = -1;
+			}
+
+			std::vector<Queue*> queues;
+			std::vector<std::thread> workers;
+			std::atomic<int> queued;
+			std::atomic<unsigned int> next_victim;
+			std::mutex sleep_lock;
+			std::condition_variable wake;
+			bool quit;
+
+			static thread_local int t_index;
+			static thread_local int t_depth;
+		};
+
+		thread_local int TaskScheduler::t_index = -1;
+		thread_local int TaskScheduler::t_depth = 0;
+
+		/******************************** TaskGroup ******************************/
+		TaskGroup::TaskGroup() : pending(0){}
+
+		TaskGroup::~TaskGroup(){
+			wait();
+		}
+
+		void
+		TaskGroup::run(const std::function<void()>& task){
+			TaskScheduler& scheduler = TaskScheduler::Instance();
+			if(1 == scheduler.size()){
+				task();
+				return;
+			}
+			scheduler.spawn(this, task);
+		}
+
+		void
+		TaskGroup::wait(){
+			TaskScheduler& scheduler = TaskScheduler::Instance();
+			TaskGroup* only = scheduler.is_nested() ? this : NULL;
+			while(pending.load(std::memory_order_acquire) > 0){
+				if(!scheduler.run_one(only)) std::this_thread::yield();
+			}
+		}
+
+		/********************************* Helpers *******************************/
+		int
+		NumThreads(){
+			return TaskScheduler::Instance().size();
+		}
+
+		void
+		SetNumThreads(int n){
+			TaskScheduler& scheduler = TaskScheduler::Instance();
+			if(scheduler.size() != std::max(1, n)) scheduler.resize(n);
+		}
+
+		void
+		ParallelFor(int begin, int end, const std::function<void(int, int)>& body, int grain){
+			if(end <= begin) return;
+			int threads = NumThreads();
+			// About four chunks per thread leaves room for stealing
+			if(grain <= 0) grain = std::max(1, (end - begin) / (threads * 4));
+			if(1 == threads || end - begin <= grain){
+				body(begin, end);
+				return;
+			}
+
+			TaskGroup group;
+			for(int chunk = begin; chunk < end; chunk += grain){
+				int chunk_end = std::min(end, chunk + grain);
+				group.run([&body, chunk, chunk_end]{ body(chunk, chunk_end); });
+			}
+			group.wait();
+		}
+	}
+}
@@ -0,0 +1,69 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Work-stealing task scheduler shared by every solver in the process.
+*
+* Each worker owns a deque: it pushes and pops its own tasks at the back and
+* steals from the front of the others when it runs dry. Tasks spawned by a
+* thread outside the pool go to a shared injection queue which idle workers
+* check first. Running many simulations at once, every core ends up owning a
+* whole simulation and the row chunks of its ParallelFor loops stay local
+* (inter-sim parallelism); once there are fewer simulations left than cores,
+* the idle workers start stealing those chunks (intra-sim parallelism).
+*
+* A thread waiting on a TaskGroup helps by running tasks of that same group,
+* so it never picks up an unrelated long running job while an inner loop of
+* its own simulation is still pending.
+*
+* The pool size defaults to the hardware concurrency and can be overridden
+* by the VFXEPOCH_NUM_THREADS environment variable or SetNumThreads().
+*******************************************************************************/
+#ifndef _UTL_PARALLEL_H_
+#define _UTL_PARALLEL_H_
+
+#include <atomic>
+#include <functional>
+
+namespace VFXEpoch
+{
+	namespace Parallel
+	{
+		class TaskGroup
+		{
+		public:
+			TaskGroup();
+			~TaskGroup();
+
+			// Queues a task, it may start right away on another thread
+			void run(const std::function<void()>& task);
+			// Returns once every task of the group has finished
+			void wait();
+
+		private:
+			TaskGroup(const TaskGroup&);
+			TaskGroup& operator=(const TaskGroup&);
+			friend class TaskScheduler;
+			std::atomic<int> pending;
+		};
+
+		// Total threads that execute tasks, the calling thread included.
+		// Changing it is only allowed while no task is running.
+		int NumThreads();
+		void SetNumThreads(int n);
+
+		// Splits [begin, end) into chunks of at least grain items and calls
+		// body(chunk_begin, chunk_end) for each of them in parallel. Returns
+		// when every chunk is done. A grain of 0 picks one from the pool size.
+		void ParallelFor(int begin, int end, const std::function<void(int, int)>& body, int grain = 0);
+	}
+}
+
+#endif
@@ -0,0 +1,179 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "UTL_Particles.h"
+#include "UTL_Parallel.h"
+
+#include <algorithm>
+
+namespace VFXEpoch
+{
+	void
+	ParticleStore2Df::resize(int n){
+		for(int i = size(); i < n; i++) id.push_back(next_id++);
+		id.resize(n);
+		pos_x.resize(n); pos_y.resize(n);
+		vel_x.resize(n); vel_y.resize(n);
+		for(int c = 0; c != 3; c++) color[c].resize(n);
+		for(int c = 0; c != 4; c++) affine[c].resize(n);
+	}
+
+	void
+	ParticleStore2Df::reserve(int n){
+		id.reserve(n);
+		pos_x.reserve(n); pos_y.reserve(n);
+		vel_x.reserve(n); vel_y.reserve(n);
+		for(int c = 0; c != 3; c++) color[c].reserve(n);
+		for(int c = 0; c != 4; c++) affine[c].reserve(n);
+	}
+
+	void
+	ParticleStore2Df::clear(){
+		id.clear();
+		next_id = 0;
+		pos_x.clear(); pos_y.clear();
+		vel_x.clear(); vel_y.clear();
+		for(int c = 0; c != 3; c++) color[c].clear();
+		for(int c = 0; c != 4; c++) affine[c].clear();
+	}
+
+	void
+	ParticleStore2Df::push_back(const Particle2Df& p){
+		id.push_back(next_id++);
+		pos_x.push_back(p.pos.m_x); pos_y.push_back(p.pos.m_y);
+		vel_x.push_back(p.vel.m_x); vel_y.push_back(p.vel.m_y);
+		color[0].push_back(p.color.m_x);
+		color[1].push_back(p.color.m_y);
+		color[2].push_back(p.color.m_z);
+		for(int c = 0; c != 4; c++) affine[c].push_back(0.0f);
+	}
+
+	Particle2Df
+	ParticleStore2Df::get(int i) const{
+		Particle2Df p;
+		p.pos = Vector2Df(pos_x[i], pos_y[i]);
+		p.vel = Vector2Df(vel_x[i], vel_y[i]);
+		p.color = Vector3Df(color[0][i], color[1][i], color[2][i]);
+		return p;
+	}
+
+	void
+	ParticleStore2Df::set(int i, const Particle2Df& p){
+		pos_x[i] = p.pos.m_x; pos_y[i] = p.pos.m_y;
+		vel_x[i] = p.vel.m_x; vel_y[i] = p.vel.m_y;
+		color[0][i] = p.color.m_x;
+		color[1][i] = p.color.m_y;
+		color[2][i] = p.color.m_z;
+	}
+
+	void
+	ParticleStore2Df::assign(const std::vector<Particle2Df>& particles){
+		clear();
+		resize((int)particles.size());
+		for(int i = 0; i != (int)particles.size(); i++) set(i, particles[i]);
+	}
+
+	void
+	ParticleStore2Df::copyTo(std::vector<Particle2Df>& particles) const{
+		particles.resize(size());
+		for(int i = 0; i != size(); i++) particles[i] = get(i);
+	}
+
+	ParticleView2Df
+	ParticleStore2Df::view() const{
+		ParticleView2Df v;
+		bool none = empty();
+		v.pos_x = none ? NULL : &pos_x[0];
+		v.pos_y = none ? NULL : &pos_y[0];
+		v.vel_x = none ? NULL : &vel_x[0];
+		v.vel_y = none ? NULL : &vel_y[0];
+		for(int c = 0; c != 3; c++) v.color[c] = none ? NULL : &color[c][0];
+		v.id = none ? NULL : &id[0];
+		v.count = size();
+		return v;
+	}
+
+	template <class T>
+	static void
+	gather(std::vector<T>& values, const std::vector<int>& order, std::vector<T>& scratch){
+		scratch.resize(order.size());
+		Parallel::ParallelFor(0, (int)order.size(), [&](int begin, int end){
+			for(int i = begin; i != end; i++) scratch[i] = values[order[i]];
+		});
+		values.swap(scratch);
+	}
+
+	void
+	ParticleStore2Df::sortByKey(const std::vector<int>& keys, int num_keys, std::vector<int>& key_start){
+		int n = size();
+		// One counting pass into key_start itself, shifted by one key so that
+		// the prefix sum leaves the start of every key in place
+		key_start.assign(num_keys + 1, 0);
+		for(int i = 0; i != n; i++) key_start[keys[i] + 1]++;
+		for(int k = 0; k != num_keys; k++) key_start[k + 1] += key_start[k];
+
+		// Scattering in particle order keeps the sort stable. Every key's
+		// cursor runs up to the start of the next key, shifting the cursors
+		// back down restores the starts
+		std::vector<int>& order = sort_order;
+		order.resize(n);
+		for(int i = 0; i != n; i++) order[key_start[keys[i]]++] = i;
+		for(int k = num_keys; k > 0; k--) key_start[k] = key_start[k - 1];
+		key_start[0] = 0;
+
+		permute();
+	}
+
+	int
+	ParticleStore2Df::compact(const std::vector<unsigned char>& keep){
+		int n = size();
+		int chunks = std::max(1, std::min(Parallel::NumThreads(), n / 4096));
+		std::vector<int>& offsets = sort_offsets;
+		offsets.assign(chunks + 1, 0);
+		Parallel::ParallelFor(0, chunks, [&](int first, int last){
+			for(int c = first; c != last; c++){
+				int count = 0;
+				for(int i = (int)((long long)n * c / chunks); i != (int)((long long)n * (c + 1) / chunks); i++) count += keep[i] ? 1 : 0;
+				offsets[c + 1] = count;
+			}
+		}, 1);
+		for(int c = 0; c != chunks; c++) offsets[c + 1] += offsets[c];
+		if(offsets[chunks] == n) return n;
+
+		std::vector<int>& order = sort_order;
+		order.resize(offsets[chunks]);
+		Parallel::ParallelFor(0, chunks, [&](int first, int last){
+			for(int c = first; c != last; c++){
+				int next = offsets[c];
+				for(int i = (int)((long long)n * c / chunks); i != (int)((long long)n * (c + 1) / chunks); i++){
+					if(keep[i]) order[next++] = i;
+				}
+			}
+		}, 1);
+		permute();
+		return size();
+	}
+
+	// Particle i of the result is particle sort_order[i] of the current arrays
+	void
+	ParticleStore2Df::permute(){
+		gather(pos_x, sort_order, sort_scratch); gather(pos_y, sort_order, sort_scratch);
+		gather(vel_x, sort_order, sort_scratch); gather(vel_y, sort_order, sort_scratch);
+		for(int c = 0; c != 3; c++) gather(color[c], sort_order, sort_scratch);
+		for(int c = 0; c != 4; c++) gather(affine[c], sort_order, sort_scratch);
+		gather(id, sort_order, sort_id_scratch);
+	}
+
+	void
+	CountKeys(const std::vector<int>& keys, int num_keys, std::vector<int>& counts){
+		counts.assign(num_keys, 0);
+		for(size_t i = 0; i != keys.size(); i++){
+			if(keys[i] >= 0) counts[keys[i]]++;
+		}
+	}
+}
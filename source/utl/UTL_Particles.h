@@ -0,0 +1,105 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Structure of arrays particle storage.
+*
+* ParticleStore2Df keeps every attribute of Particle2Df in its own array, so
+* a pass that only moves particles streams through the positions and leaves
+* velocities and colors out of the cache, and blocks of particles can be fed
+* to the batched grid interpolation in UTL_General.
+*
+* ParticleView2Df is a read-only window on a store: plain pointers and a
+* count, valid until the store is resized. Writers and OpenGL take them as
+* they are, without the copy get_particles() style accessors make.
+*
+* Every particle gets an id when it is added, ids follow the particles when
+* the store is reordered. sortByKey() is a stable counting sort, used to keep
+* particles of the same grid cell next to each other in memory so that
+* interpolation walks the grid in order; the start offset of every key comes
+* out as a by-product and is the only per key memory it needs. The attributes
+* are then moved in parallel. compact() removes particles in parallel chunks,
+* both keep the relative order of the particles they move.
+*******************************************************************************/
+#ifndef _UTL_PARTICLES_H_
+#define _UTL_PARTICLES_H_
+
+#include "UTL_General.h"
+
+#include <vector>
+
+namespace VFXEpoch
+{
+	typedef struct _particle_view_2df
+	{
+		const float* pos_x;
+		const float* pos_y;
+		const float* vel_x;
+		const float* vel_y;
+		const float* color[3];
+		const unsigned long long* id;
+		int count;
+
+		int size() const { return count; }
+		Vector2Df pos(int i) const { return Vector2Df(pos_x[i], pos_y[i]); }
+	}ParticleView2Df;
+
+	class ParticleStore2Df
+	{
+	public:
+		ParticleStore2Df() : next_id(0){}
+
+		int size() const { return (int)pos_x.size(); }
+		bool empty() const { return pos_x.empty(); }
+		// New particles are all zero, with fresh ids
+		void resize(int n);
+		void reserve(int n);
+		void clear();
+
+		void push_back(const Particle2Df& p);
+		Particle2Df get(int i) const;
+		void set(int i, const Particle2Df& p);
+
+		// Conversions from and to the array of structures layout
+		void assign(const std::vector<Particle2Df>& particles);
+		void copyTo(std::vector<Particle2Df>& particles) const;
+
+		ParticleView2Df view() const;
+
+		// Reorders the particles by keys[i] in [0, num_keys), keeping the
+		// order of equal keys. Particles of key k end up in
+		// [key_start[k], key_start[k + 1]), key_start gets num_keys + 1 entries.
+		void sortByKey(const std::vector<int>& keys, int num_keys, std::vector<int>& key_start);
+		// Keeps the particles with keep[i] != 0, returns the new size
+		int compact(const std::vector<unsigned char>& keep);
+
+		std::vector<float> pos_x, pos_y;
+		std::vector<float> vel_x, vel_y;
+		std::vector<float> color[3];
+		// APIC velocity gradients du/dx, du/dy, dv/dx, dv/dy per grid cell
+		std::vector<float> affine[4];
+		std::vector<unsigned long long> id;
+		unsigned long long next_id;
+
+	private:
+		// Kept between sorts, a sort every few steps should not page fault
+		// its temporaries in again
+		std::vector<int> sort_offsets, sort_order;
+		std::vector<float> sort_scratch;
+		std::vector<unsigned long long> sort_id_scratch;
+
+		void permute();
+	};
+
+	// counts[k] is the number of keys equal to k, negative keys are skipped
+	void CountKeys(const std::vector<int>& keys, int num_keys, std::vector<int>& counts);
+}
+
+#endif
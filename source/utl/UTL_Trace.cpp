@@ -0,0 +1,242 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "UTL_Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+
+namespace VFXEpoch
+{
+	namespace Trace
+	{
+		// Every slot carries a sequence number so that a reader can tell a
+		// finished event from a slot that is still being written or that
+		// belongs to an older lap of the ring.
+		// The fields are relaxed atomics so that a reader copying a slot that is
+		// being rewritten gets stale values rather than a data race
+		struct Slot
+		{
+			std::atomic<unsigned long long> seq;
+			std::atomic<const char*> name;
+			std::atomic<const char*> category;
+			std::atomic<long long> timestamp;
+			std::atomic<unsigned int> tid;
+			std::atomic<char> phase;
+		};
+
+		struct Ring
+		{
+			Slot* slots;
+			unsigned long long capacity;
+		};
+
+		std::atomic<bool> g_enabled(false);
+
+		static std::atomic<Ring*> g_ring(NULL);
+		// Rings replaced by Enable() with another capacity are never freed, a
+		// thread that loaded one before a Disable() may still be writing to it
+		static std::vector<Ring*> g_retired;
+		static std::atomic<unsigned long long> g_head(0);
+		static std::atomic<unsigned int> g_next_tid(0);
+		// Nanoseconds of the steady clock when tracing was enabled
+		static std::atomic<long long> g_epoch(0);
+
+		static inline long long
+		clock_ns(){
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		void
+		Enable(unsigned int capacity){
+			if(g_enabled.load()) return;
+
+			unsigned long long size = 1;
+			while(size < capacity) size <<= 1;
+			Ring* ring = g_ring.load(std::memory_order_relaxed);
+			if(!ring || size != ring->capacity){
+				if(ring) g_retired.push_back(ring);
+				// A retired ring of the same size is taken back, so memory only
+				// grows with the number of distinct capacities
+				ring = NULL;
+				for(size_t i = 0; i != g_retired.size(); i++){
+					if(size != g_retired[i]->capacity) continue;
+					ring = g_retired[i];
+					g_retired.erase(g_retired.begin() + i);
+					break;
+				}
+				if(!ring){
+					ring = new Ring;
+					ring->slots = new Slot[size];
+					ring->capacity = size;
+				}
+			}
+			g_epoch.store(clock_ns(), std::memory_order_relaxed);
+			// Publishes the slots to the recording threads
+			g_ring.store(ring, std::memory_order_release);
+			Clear();
+			g_enabled.store(true, std::memory_order_release);
+		}
+
+		void
+		Disable(){
+			g_enabled.store(false, std::memory_order_release);
+		}
+
+		void
+		Clear(){
+			Ring* ring = g_ring.load(std::memory_order_acquire);
+			if(!ring) return;
+			for(unsigned long long i = 0; i != ring->capacity; i++){
+				ring->slots[i].seq.store(0, std::memory_order_relaxed);
+			}
+			g_head.store(0);
+		}
+
+		unsigned int
+		ThreadID(){
+			thread_local unsigned int tid = g_next_tid.fetch_add(1);
+			return tid;
+		}
+
+		void
+		Record(const char* category, const char* name, PHASE phase){
+			if(!g_enabled.load(std::memory_order_relaxed)) return;
+			Ring* ring = g_ring.load(std::memory_order_acquire);
+			if(!ring) return;
+
+			long long now = clock_ns() - g_epoch.load(std::memory_order_relaxed);
+			unsigned long long idx = g_head.fetch_add(1, std::memory_order_relaxed);
+			Slot& slot = ring->slots[idx & (ring->capacity - 1)];
+			// Seqlock write: readers that see seq == 0, or a different seq after
+			// copying, drop the slot
+			slot.seq.store(0, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			slot.name.store(name, std::memory_order_relaxed);
+			slot.category.store(category, std::memory_order_relaxed);
+			slot.timestamp.store(now, std::memory_order_relaxed);
+			slot.tid.store(ThreadID(), std::memory_order_relaxed);
+			slot.phase.store((char)phase, std::memory_order_relaxed);
+			slot.seq.store(idx + 1, std::memory_order_release);
+		}
+
+		std::vector<TraceEvent>
+		Snapshot(){
+			std::vector<TraceEvent> events;
+			Ring* ring = g_ring.load(std::memory_order_acquire);
+			if(!ring) return events;
+			unsigned long long head = g_head.load(std::memory_order_acquire);
+			unsigned long long first = head > ring->capacity ? head - ring->capacity : 0;
+			events.reserve(head - first);
+			for(unsigned long long idx = first; idx != head; idx++){
+				const Slot& slot = ring->slots[idx & (ring->capacity - 1)];
+				if(slot.seq.load(std::memory_order_acquire) != idx + 1) continue;
+				TraceEvent event;
+				event.name = slot.name.load(std::memory_order_relaxed);
+				event.category = slot.category.load(std::memory_order_relaxed);
+				event.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+				event.tid = slot.tid.load(std::memory_order_relaxed);
+				event.phase = (PHASE)slot.phase.load(std::memory_order_relaxed);
+				// The slot may have been rewritten while it was copied
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if(slot.seq.load(std::memory_order_relaxed) == idx + 1)
+					events.push_back(event);
+			}
+
+			std::stable_sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b){
+				return a.timestamp < b.timestamp;
+			});
+
+			// Drop the END events whose BEGIN was overwritten by the ring buffer
+			std::map<unsigned int, int> depth;
+			std::vector<TraceEvent> balanced;
+			balanced.reserve(events.size());
+			for(size_t i = 0; i != events.size(); i++){
+				int& d = depth[events[i].tid];
+				if(PHASE::BEGIN == events[i].phase) ++d;
+				else if(0 == d) continue;
+				else --d;
+				balanced.push_back(events[i]);
+			}
+			return balanced;
+		}
+
+		std::vector<TraceSummary>
+		Summarize(){
+			std::vector<TraceEvent> events = Snapshot();
+			std::map<unsigned int, std::vector<TraceEvent> > stacks;
+			std::map<std::pair<std::string, std::string>, size_t> index;
+			std::vector<TraceSummary> summary;
+
+			for(size_t i = 0; i != events.size(); i++){
+				std::vector<TraceEvent>& stack = stacks[events[i].tid];
+				if(PHASE::BEGIN == events[i].phase){
+					stack.push_back(events[i]);
+					continue;
+				}
+				const TraceEvent& begin = stack.back();
+				std::pair<std::string, std::string> key(begin.category, begin.name);
+				if(!index.count(key)){
+					TraceSummary entry = {begin.name, begin.category, 0, 0};
+					index[key] = summary.size();
+					summary.push_back(entry);
+				}
+				TraceSummary& entry = summary[index[key]];
+				entry.calls++;
+				entry.total += events[i].timestamp - begin.timestamp;
+				stack.pop_back();
+			}
+			return summary;
+		}
+
+		static void
+		write_json_string(FILE* f, const char* str){
+			fputc('"', f);
+			for(const char* c = str ? str : ""; *c; c++){
+				if('"' == *c || '\\' == *c) fputc('\\', f);
+				fputc(*c, f);
+			}
+			fputc('"', f);
+		}
+
+		bool
+		ExportChromeJSON(const std::string& filename){
+			FILE* f = fopen(filename.c_str(), "w");
+			if(!f) return false;
+
+			std::vector<TraceEvent> events = Snapshot();
+			fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+			fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"VFXEpoch\"}}");
+
+			std::map<unsigned int, bool> threads;
+			for(size_t i = 0; i != events.size(); i++){
+				if(threads.count(events[i].tid)) continue;
+				threads[events[i].tid] = true;
+				fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"Thread %u\"}}",
+						events[i].tid, events[i].tid);
+			}
+
+			for(size_t i = 0; i != events.size(); i++){
+				const TraceEvent& e = events[i];
+				fprintf(f, ",\n{\"name\":");
+				write_json_string(f, e.name);
+				fprintf(f, ",\"cat\":");
+				write_json_string(f, e.category);
+				fprintf(f, ",\"ph\":\"%c\",\"ts\":%lld.%03lld,\"pid\":0,\"tid\":%u}",
+						(char)e.phase, e.timestamp / 1000, e.timestamp % 1000, e.tid);
+			}
+			fprintf(f, "\n]}\n");
+
+			bool ok = !ferror(f);
+			fclose(f);
+			return ok;
+		}
+	}
+}
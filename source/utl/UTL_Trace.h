@@ -0,0 +1,108 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Lightweight event tracing for the solvers. Begin/End events are pushed into
+* a fixed size ring buffer by any thread without taking a lock (one atomic
+* increment per event), and the buffer can be exported as Chrome Trace Event
+* JSON which loads directly in chrome://tracing or https://ui.perfetto.dev
+*
+* Usage:
+*   VFXEpoch::Trace::Enable();
+*   ... run simulation ...
+*   VFXEpoch::Trace::ExportChromeJSON("trace.json");
+*
+* Event names and categories are NOT copied, they must be string literals (or
+* have static storage duration).
+* When tracing is disabled a scope costs a single relaxed atomic load. Enable,
+* Disable and Clear are meant to be called from one controlling thread;
+* Snapshot and the exports may run while other threads record, events being
+* written at that moment are left out.
+*******************************************************************************/
+#ifndef _UTL_TRACE_H_
+#define _UTL_TRACE_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define VFXEPOCH_TRACE_CONCAT_IMPL(a, b) a##b
+#define VFXEPOCH_TRACE_CONCAT(a, b) VFXEPOCH_TRACE_CONCAT_IMPL(a, b)
+#define VFXEPOCH_TRACE_SCOPE(category, name) \
+	VFXEpoch::Trace::ScopedEvent VFXEPOCH_TRACE_CONCAT(_vfxepoch_trace_scope_, __LINE__)(category, name)
+
+namespace VFXEpoch
+{
+	namespace Trace
+	{
+		enum class PHASE : char
+		{
+			BEGIN = 'B',
+			END = 'E'
+		};
+
+		typedef struct _trace_event
+		{
+			const char* name;
+			const char* category;
+			long long timestamp;	// Nanoseconds since the tracer was enabled
+			unsigned int tid;
+			PHASE phase;
+		}TraceEvent;
+
+		typedef struct _trace_summary
+		{
+			const char* name;
+			const char* category;
+			long long calls;
+			long long total;	// Inclusive nanoseconds over all calls
+		}TraceSummary;
+
+		// Capacity is rounded up to a power of two. Older events are
+		// overwritten once the ring buffer is full.
+		void Enable(unsigned int capacity = 1u << 20);
+		void Disable();
+		void Clear();
+		void Record(const char* category, const char* name, PHASE phase);
+		unsigned int ThreadID();
+
+		// Events still being written are skipped
+		std::vector<TraceEvent> Snapshot();
+		bool ExportChromeJSON(const std::string& filename);
+		// Pairs up Begin/End events and accumulates time per category and name
+		std::vector<TraceSummary> Summarize();
+
+		extern std::atomic<bool> g_enabled;
+
+		inline bool IsEnabled(){
+			return g_enabled.load(std::memory_order_relaxed);
+		}
+
+		class ScopedEvent
+		{
+		public:
+			ScopedEvent(const char* _category, const char* _name) : category(_category), name(_name){
+				active = IsEnabled();
+				if(active) Record(category, name, PHASE::BEGIN);
+			}
+			~ScopedEvent(){
+				if(active) Record(category, name, PHASE::END);
+			}
+		private:
+			ScopedEvent(const ScopedEvent&);
+			ScopedEvent& operator=(const ScopedEvent&);
+			const char* category;
+			const char* name;
+			bool active;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,408 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "Benchmark.h"
+#include "Flags.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#ifndef VFXEPOCH_GIT_VERSION
+#define VFXEPOCH_GIT_VERSION "unknown"
+#endif
+
+#ifndef VFXEPOCH_BUILD_TYPE
+#define VFXEPOCH_BUILD_TYPE "unknown"
+#endif
+
+using namespace Bench;
+
+/********************************** State ************************************/
+State::State(long long _max_iterations, const std::vector<long long>& _args){
+	max_iterations = _max_iterations;
+	args = _args;
+	completed = 0;
+	started = running = false;
+	real_seconds = cpu_seconds = 0.0;
+	items_processed = bytes_processed = 0;
+	cpu_start = 0;
+}
+
+bool
+State::KeepRunning(){
+	if(!started){
+		started = true;
+		ResumeTiming();
+	}
+	if(completed < max_iterations){
+		++completed;
+		return true;
+	}
+	if(running) PauseTiming();
+	return false;
+}
+
+void
+State::PauseTiming(){
+	if(!running) return;
+	real_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - real_start).count();
+	cpu_seconds += (double)(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+	running = false;
+}
+
+void
+State::ResumeTiming(){
+	if(running) return;
+	running = true;
+	cpu_start = std::clock();
+	real_start = std::chrono::steady_clock::now();
+}
+
+/******************************** Benchmark **********************************/
+Benchmark*
+Benchmark::Arg(long long a){
+	args.push_back(std::vector<long long>(1, a));
+	return this;
+}
+
+Benchmark*
+Benchmark::Args(const std::vector<long long>& a){
+	args.push_back(a);
+	return this;
+}
+
+Benchmark*
+Benchmark::Range(long long lo, long long hi, int multiplier){
+	for(long long a = lo; a < hi; a *= multiplier) Arg(a);
+	return Arg(hi);
+}
+
+Benchmark*
+Benchmark::Iterations(long long n){
+	fixed_iterations = n;
+	return this;
+}
+
+static std::vector<Benchmark*>&
+registry(){
+	static std::vector<Benchmark*> benchmarks;
+	return benchmarks;
+}
+
+Benchmark*
+Bench::RegisterBenchmark(const std::string& name, BenchFunc func){
+	registry().push_back(new Benchmark(name, func));
+	return registry().back();
+}
+
+/********************************** Runner ***********************************/
+namespace Bench
+{
+	struct Result
+	{
+		std::string name, run_name, run_type, aggregate_name, label;
+		int repetitions, repetition_index;
+		long long iterations;
+		double real_time, cpu_time;		// nanoseconds per iteration
+		double items_per_second, bytes_per_second;
+		std::map<std::string, double> counters;
+	};
+
+	struct Options
+	{
+		std::string filter;
+		std::string format;
+		std::string out;
+		std::string out_format;
+		double min_time;
+		int repetitions;
+		bool list;
+	};
+
+	class Runner
+	{
+	public:
+		static Result run(Benchmark* bench, const std::string& run_name, const std::vector<long long>& args, double min_time){
+			long long iterations = bench->fixed_iterations > 0 ? bench->fixed_iterations : 1;
+			for(;;){
+				State state(iterations, args);
+				bench->func(state);
+				state.PauseTiming();
+
+				bool done = bench->fixed_iterations > 0 || state.real_seconds >= min_time || iterations >= 1000000000LL;
+				if(done){
+					Result r;
+					r.name = r.run_name = run_name;
+					r.run_type = "iteration";
+					r.label = state.label;
+					r.repetitions = 1;
+					r.repetition_index = 0;
+					r.iterations = state.completed > 0 ? state.completed : 1;
+					r.real_time = state.real_seconds * 1e9 / r.iterations;
+					r.cpu_time = state.cpu_seconds * 1e9 / r.iterations;
+					r.items_per_second = state.items_processed > 0 && state.real_seconds > 0.0 ? state.items_processed / state.real_seconds : 0.0;
+					r.bytes_per_second = state.bytes_processed > 0 && state.real_seconds > 0.0 ? state.bytes_processed / state.real_seconds : 0.0;
+					for(std::map<std::string, double>::iterator ite = state.counters.begin(); ite != state.counters.end(); ite++)
+						r.counters[ite->first] = ite->second / r.iterations;
+					return r;
+				}
+
+				// Same growth rule as google-benchmark: aim 40% past the minimum time
+				double multiplier = min_time * 1.4 / std::max(state.real_seconds, 1e-9);
+				if(state.real_seconds / min_time <= 0.1) multiplier = std::min(multiplier, 10.0);
+				long long next = (long long)(iterations * multiplier);
+				iterations = std::max(iterations + 1, std::min(next, 1000000000LL));
+			}
+		}
+	};
+}
+
+static std::string
+make_run_name(const Benchmark* bench, const std::vector<long long>& args){
+	std::stringstream ss;
+	ss << bench->name;
+	for(size_t i = 0; i != args.size(); i++) ss << "/" << args[i];
+	return ss.str();
+}
+
+// 0: mean, 1: median, 2: sample standard deviation
+static double
+aggregate(std::vector<double> values, int kind){
+	double n = (double)values.size(), mean = 0.0;
+	for(size_t i = 0; i != values.size(); i++) mean += values[i] / n;
+	if(0 == kind) return mean;
+	if(1 == kind){
+		std::sort(values.begin(), values.end());
+		size_t m = values.size() / 2;
+		return values.size() % 2 ? values[m] : 0.5 * (values[m - 1] + values[m]);
+	}
+	double var = 0.0;
+	for(size_t i = 0; i != values.size(); i++) var += (values[i] - mean) * (values[i] - mean);
+	return std::sqrt(var / (n - 1));
+}
+
+static void
+append_aggregates(std::vector<Result>& results, const std::vector<Result>& reps){
+	if(reps.size() < 2) return;
+	const char* names[3] = {"mean", "median", "stddev"};
+	for(int a = 0; a != 3; a++){
+		Result r = reps[0];
+		r.name = reps[0].run_name + "_" + names[a];
+		r.run_type = "aggregate";
+		r.aggregate_name = names[a];
+		r.repetitions = (int)reps.size();
+
+		std::vector<double> real, cpu, items, bytes;
+		for(size_t i = 0; i != reps.size(); i++){
+			real.push_back(reps[i].real_time);
+			cpu.push_back(reps[i].cpu_time);
+			items.push_back(reps[i].items_per_second);
+			bytes.push_back(reps[i].bytes_per_second);
+		}
+		r.real_time = aggregate(real, a);
+		r.cpu_time = aggregate(cpu, a);
+		r.items_per_second = aggregate(items, a);
+		r.bytes_per_second = aggregate(bytes, a);
+		for(std::map<std::string, double>::iterator ite = r.counters.begin(); ite != r.counters.end(); ite++){
+			std::vector<double> values;
+			for(size_t i = 0; i != reps.size(); i++) values.push_back(reps[i].counters.at(ite->first));
+			ite->second = aggregate(values, a);
+		}
+		results.push_back(r);
+	}
+}
+
+/********************************* Reporters *********************************/
+static void
+json_string(FILE* f, const std::string& s){
+	fputc('"', f);
+	for(size_t i = 0; i != s.size(); i++){
+		if('"' == s[i] || '\\' == s[i]) fputc('\\', f);
+		fputc(s[i], f);
+	}
+	fputc('"', f);
+}
+
+static void
+report_json(FILE* f, const std::vector<Result>& results, const char* executable){
+	char date[64] = {0};
+	std::time_t now = std::time(NULL);
+	std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+	char host[256] = "unknown";
+#ifdef __linux__
+	gethostname(host, sizeof(host) - 1);
+#endif
+
+	fprintf(f, "{\n  \"context\": {\n");
+	fprintf(f, "    \"date\": "); json_string(f, date);
+	fprintf(f, ",\n    \"host_name\": "); json_string(f, host);
+	fprintf(f, ",\n    \"executable\": "); json_string(f, executable);
+	fprintf(f, ",\n    \"num_cpus\": %u", std::thread::hardware_concurrency());
+	fprintf(f, ",\n    \"library_version\": "); json_string(f, VFXEPOCH_GIT_VERSION);
+	fprintf(f, ",\n    \"library_build_type\": "); json_string(f, VFXEPOCH_BUILD_TYPE);
+	fprintf(f, "\n  },\n  \"benchmarks\": [");
+	for(size_t i = 0; i != results.size(); i++){
+		const Result& r = results[i];
+		fprintf(f, "%s\n    {\n      \"name\": ", i ? "," : "");
+		json_string(f, r.name);
+		fprintf(f, ",\n      \"run_name\": "); json_string(f, r.run_name);
+		fprintf(f, ",\n      \"run_type\": "); json_string(f, r.run_type);
+		if(!r.aggregate_name.empty()){
+			fprintf(f, ",\n      \"aggregate_name\": "); json_string(f, r.aggregate_name);
+		}
+		fprintf(f, ",\n      \"repetitions\": %d,\n      \"repetition_index\": %d,\n      \"threads\": 1", r.repetitions, r.repetition_index);
+		fprintf(f, ",\n      \"iterations\": %lld,\n      \"real_time\": %.6e,\n      \"cpu_time\": %.6e,\n      \"time_unit\": \"ns\"",
+				r.iterations, r.real_time, r.cpu_time);
+		if(r.items_per_second > 0.0) fprintf(f, ",\n      \"items_per_second\": %.6e", r.items_per_second);
+		if(r.bytes_per_second > 0.0) fprintf(f, ",\n      \"bytes_per_second\": %.6e", r.bytes_per_second);
+		for(std::map<std::string, double>::const_iterator ite = r.counters.begin(); ite != r.counters.end(); ite++){
+			fprintf(f, ",\n      "); json_string(f, ite->first); fprintf(f, ": %.6e", ite->second);
+		}
+		if(!r.label.empty()){
+			fprintf(f, ",\n      \"label\": "); json_string(f, r.label);
+		}
+		fprintf(f, "\n    }");
+	}
+	fprintf(f, "\n  ]\n}\n");
+}
+
+static void
+report_csv(FILE* f, const std::vector<Result>& results){
+	fprintf(f, "name,iterations,real_time,cpu_time,time_unit,bytes_per_second,items_per_second,label\n");
+	for(size_t i = 0; i != results.size(); i++){
+		const Result& r = results[i];
+		fprintf(f, "\"%s\",%lld,%g,%g,ns,", r.name.c_str(), r.iterations, r.real_time, r.cpu_time);
+		if(r.bytes_per_second > 0.0) fprintf(f, "%g", r.bytes_per_second);
+		fprintf(f, ",");
+		if(r.items_per_second > 0.0) fprintf(f, "%g", r.items_per_second);
+		fprintf(f, ",\"%s\"\n", r.label.c_str());
+	}
+}
+
+static std::string
+human_time(double ns){
+	char buf[64];
+	if(ns < 1e3) snprintf(buf, sizeof(buf), "%.1f ns", ns);
+	else if(ns < 1e6) snprintf(buf, sizeof(buf), "%.2f us", ns * 1e-3);
+	else if(ns < 1e9) snprintf(buf, sizeof(buf), "%.2f ms", ns * 1e-6);
+	else snprintf(buf, sizeof(buf), "%.3f s", ns * 1e-9);
+	return buf;
+}
+
+static void
+report_console(FILE* f, const std::vector<Result>& results){
+	size_t width = 10;
+	for(size_t i = 0; i != results.size(); i++) width = std::max(width, results[i].name.size());
+	std::string line(width + 48, '-');
+	fprintf(f, "%s\n%-*s %15s %15s %12s\n%s\n", line.c_str(), (int)width, "Benchmark", "Time", "CPU", "Iterations", line.c_str());
+	for(size_t i = 0; i != results.size(); i++){
+		const Result& r = results[i];
+		fprintf(f, "%-*s %15s %15s %12lld", (int)width, r.name.c_str(), human_time(r.real_time).c_str(), human_time(r.cpu_time).c_str(), r.iterations);
+		if(r.items_per_second > 0.0) fprintf(f, " items/s=%.4g", r.items_per_second);
+		for(std::map<std::string, double>::const_iterator ite = r.counters.begin(); ite != r.counters.end(); ite++)
+			fprintf(f, " %s=%.4g", ite->first.c_str(), ite->second);
+		if(!r.label.empty()) fprintf(f, " %s", r.label.c_str());
+		fprintf(f, "\n");
+	}
+}
+
+static void
+report(FILE* f, const std::string& format, const std::vector<Result>& results, const char* executable){
+	if("json" == format) report_json(f, results, executable);
+	else if("csv" == format) report_csv(f, results);
+	else report_console(f, results);
+	fflush(f);
+}
+
+int
+Bench::RunSpecifiedBenchmarks(int argc, char** argv){
+	Options opt;
+	opt.filter = ".";
+	opt.format = "console";
+	opt.out_format = "json";
+	opt.min_time = 0.5;
+	opt.repetitions = 1;
+	opt.list = false;
+
+	for(int i = 1; i < argc; i++){
+		std::string value;
+		if(Flags::Parse(argv[i], "--benchmark_filter", value)) opt.filter = value;
+		else if(Flags::Parse(argv[i], "--benchmark_format", value)) opt.format = value;
+		else if(Flags::Parse(argv[i], "--benchmark_out_format", value)) opt.out_format = value;
+		else if(Flags::Parse(argv[i], "--benchmark_out", value)) opt.out = value;
+		else if(Flags::Parse(argv[i], "--benchmark_min_time", value)) opt.min_time = atof(value.c_str());
+		else if(Flags::Parse(argv[i], "--benchmark_repetitions", value)) opt.repetitions = std::max(1, atoi(value.c_str()));
+		else if(Flags::Parse(argv[i], "--benchmark_list_tests", value)) opt.list = "false" != value;
+		else {
+			fprintf(stderr, "ERROR: Unrecognized argument %s\n", argv[i]);
+			return -1;
+		}
+	}
+
+	std::regex filter;
+	try{
+		filter = std::regex(opt.filter);
+	}
+	catch(const std::regex_error&){
+		fprintf(stderr, "ERROR: Invalid --benchmark_filter %s\n", opt.filter.c_str());
+		return -1;
+	}
+
+	// Library code reports progress through std::cout; keep stdout machine readable
+	std::stringstream sink;
+	std::vector<Result> results;
+	for(size_t b = 0; b != registry().size(); b++){
+		Benchmark* bench = registry()[b];
+		std::vector<std::vector<long long> > arg_sets = bench->args;
+		if(arg_sets.empty()) arg_sets.push_back(std::vector<long long>());
+
+		for(size_t a = 0; a != arg_sets.size(); a++){
+			std::string run_name = make_run_name(bench, arg_sets[a]);
+			if(!std::regex_search(run_name, filter)) continue;
+			if(opt.list){ printf("%s\n", run_name.c_str()); continue; }
+
+			fprintf(stderr, "Running %s\n", run_name.c_str());
+			std::vector<Result> reps;
+			for(int r = 0; r != opt.repetitions; r++){
+				std::streambuf* old = std::cout.rdbuf(sink.rdbuf());
+				Result result = Runner::run(bench, run_name, arg_sets[a], opt.min_time);
+				std::cout.rdbuf(old);
+				sink.str("");
+				result.repetitions = opt.repetitions;
+				result.repetition_index = r;
+				reps.push_back(result);
+			}
+			results.insert(results.end(), reps.begin(), reps.end());
+			append_aggregates(results, reps);
+		}
+	}
+	if(opt.list) return 0;
+
+	report(stdout, opt.format, results, argv[0]);
+	if(!opt.out.empty()){
+		FILE* f = fopen(opt.out.c_str(), "w");
+		if(!f){
+			fprintf(stderr, "ERROR: Unable to open %s\n", opt.out.c_str());
+			return -1;
+		}
+		report(f, opt.out_format, results, argv[0]);
+		fclose(f);
+	}
+	return 0;
+}
@@ -0,0 +1,115 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* A small, dependency free benchmark harness that follows the google-benchmark
+* interface and output format, so its JSON can be fed to the usual comparison
+* scripts (e.g. google-benchmark's compare.py).
+*
+*   static void BM_Foo(Bench::State& state){
+*     int n = state.range(0);
+*     ... setup ...
+*     while(state.KeepRunning()){ ... timed work ... }
+*   }
+*   VFXEPOCH_BENCHMARK(BM_Foo)->Arg(128)->Arg(256);
+*
+* Command line flags:
+*   --benchmark_filter=<regex>       --benchmark_min_time=<seconds>
+*   --benchmark_repetitions=<n>      --benchmark_format=<console|json|csv>
+*   --benchmark_out=<file>           --benchmark_out_format=<console|json|csv>
+*   --benchmark_list_tests
+*******************************************************************************/
+#ifndef _BENCHMARK_H_
+#define _BENCHMARK_H_
+
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Bench
+{
+	class State
+	{
+	public:
+		State(long long _max_iterations, const std::vector<long long>& _args);
+
+		// Google-benchmark style loop, the first call starts the timer
+		bool KeepRunning();
+		void PauseTiming();
+		void ResumeTiming();
+
+		long long range(int i = 0) const { return args[i]; }
+		long long iterations() const { return completed; }
+		void SetItemsProcessed(long long n) { items_processed = n; }
+		void SetBytesProcessed(long long n) { bytes_processed = n; }
+		void SetLabel(const std::string& _label) { label = _label; }
+
+		// Extra per-run values, averaged over the iterations in the report
+		std::map<std::string, double> counters;
+
+	private:
+		friend class Runner;
+		long long max_iterations;
+		long long completed;
+		bool started, running;
+		std::vector<long long> args;
+		std::chrono::steady_clock::time_point real_start;
+		std::clock_t cpu_start;
+		double real_seconds, cpu_seconds;
+		long long items_processed, bytes_processed;
+		std::string label;
+	};
+
+	typedef void (*BenchFunc)(State&);
+
+	class Benchmark
+	{
+	public:
+		Benchmark(const std::string& _name, BenchFunc _func) : name(_name), func(_func), fixed_iterations(0){}
+		Benchmark* Arg(long long a);
+		Benchmark* Args(const std::vector<long long>& a);
+		Benchmark* Range(long long lo, long long hi, int multiplier = 2);
+		Benchmark* Iterations(long long n);
+
+		std::string name;
+		BenchFunc func;
+		std::vector<std::vector<long long> > args;
+		long long fixed_iterations;
+	};
+
+	Benchmark* RegisterBenchmark(const std::string& name, BenchFunc func);
+	int RunSpecifiedBenchmarks(int argc, char** argv);
+
+	// Keeps the compiler from eliding a computed value
+	template <class T>
+	inline void DoNotOptimize(const T& value){
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : "r,m"(value) : "memory");
+#else
+		static volatile const T* sink;
+		sink = &value;
+#endif
+	}
+
+	inline void ClobberMemory(){
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : : "memory");
+#endif
+	}
+}
+
+#define VFXEPOCH_BENCHMARK_CONCAT_IMPL(a, b) a##b
+#define VFXEPOCH_BENCHMARK_CONCAT(a, b) VFXEPOCH_BENCHMARK_CONCAT_IMPL(a, b)
+#define VFXEPOCH_BENCHMARK(func) \
+	static Bench::Benchmark* VFXEPOCH_BENCHMARK_CONCAT(_vfxepoch_bench_, __LINE__) = Bench::RegisterBenchmark(#func, func)
+
+#endif
@@ -0,0 +1,40 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#ifndef _FLAGS_H_
+#define _FLAGS_H_
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace Flags
+{
+	// Matches "--flag=value" or a bare "--flag" (value becomes "true")
+	inline bool Parse(const char* arg, const char* flag, std::string& value){
+		size_t len = strlen(flag);
+		if(strncmp(arg, flag, len) != 0) return false;
+		if('=' == arg[len]){ value = arg + len + 1; return true; }
+		if('\0' == arg[len]){ value = "true"; return true; }
+		return false;
+	}
+
+	inline std::vector<std::string> Split(const std::string& list, char separator = ','){
+		std::vector<std::string> result;
+		size_t start = 0;
+		while(start <= list.size()){
+			size_t end = list.find(separator, start);
+			if(std::string::npos == end) end = list.size();
+			if(end > start) result.push_back(list.substr(start, end - start));
+			start = end + 1;
+		}
+		return result;
+	}
+}
+
+#endif
@@ -0,0 +1,317 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+#include "Json.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+using namespace Json;
+
+/*********************************** Value ***********************************/
+size_t
+Value::size() const {
+	if(TYPE::ARRAY == type) return items.size();
+	if(TYPE::OBJECT == type) return members.size();
+	return 0;
+}
+
+const Value&
+Value::operator[](int i) const {
+	static const Value null_value;
+	if(i < 0 || (size_t)i >= items.size()) return null_value;
+	return items[i];
+}
+
+Value&
+Value::append(const Value& v){
+	if(TYPE::NUL == type) type = TYPE::ARRAY;
+	items.push_back(v);
+	return items.back();
+}
+
+bool
+Value::has(const std::string& key) const {
+	for(size_t i = 0; i != members.size(); i++)
+		if(members[i].first == key) return true;
+	return false;
+}
+
+const Value&
+Value::operator[](const std::string& key) const {
+	static const Value null_value;
+	for(size_t i = 0; i != members.size(); i++)
+		if(members[i].first == key) return members[i].second;
+	return null_value;
+}
+
+Value&
+Value::operator[](const std::string& key){
+	if(TYPE::NUL == type) type = TYPE::OBJECT;
+	for(size_t i = 0; i != members.size(); i++)
+		if(members[i].first == key) return members[i].second;
+	members.push_back(std::make_pair(key, Value()));
+	return members.back().second;
+}
+
+std::vector<std::string>
+Value::keys() const {
+	std::vector<std::string> result;
+	for(size_t i = 0; i != members.size(); i++) result.push_back(members[i].first);
+	return result;
+}
+
+/********************************** Parser ***********************************/
+namespace Json
+{
+	class Parser
+	{
+	public:
+		Parser(const std::string& _text) : text(_text), pos(0){}
+
+		bool parse(Value& out, std::string& error){
+			if(!value(out, 0)){
+				error = message;
+				return false;
+			}
+			skip();
+			if(pos != text.size()){
+				fail("trailing characters");
+				error = message;
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		bool fail(const char* what){
+			int line = 1;
+			for(size_t i = 0; i < pos && i < text.size(); i++) if('\n' == text[i]) line++;
+			std::stringstream ss;
+			ss << what << " at line " << line;
+			message = ss.str();
+			return false;
+		}
+
+		void skip(){
+			while(pos < text.size()){
+				char c = text[pos];
+				if(' ' == c || '\t' == c || '\n' == c || '\r' == c) pos++;
+				// Scene files are hand written, allow line comments
+				else if('/' == c && pos + 1 < text.size() && '/' == text[pos + 1]){
+					while(pos < text.size() && '\n' != text[pos]) pos++;
+				}
+				else break;
+			}
+		}
+
+		bool literal(const char* word){
+			size_t len = std::string(word).size();
+			if(text.compare(pos, len, word) != 0) return false;
+			pos += len;
+			return true;
+		}
+
+		bool string(std::string& out){
+			if(text[pos] != '"') return fail("expected string");
+			pos++;
+			out.clear();
+			while(pos < text.size() && '"' != text[pos]){
+				char c = text[pos++];
+				if('\\' != c){ out += c; continue; }
+				if(pos >= text.size()) break;
+				c = text[pos++];
+				switch(c){
+				case 'n': out += '\n'; break;
+				case 't': out += '\t'; break;
+				case 'r': out += '\r'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'u':
+					// Only the ASCII range is needed by the tools
+					if(pos + 4 > text.size()) return fail("bad unicode escape");
+					out += (char)strtol(text.substr(pos, 4).c_str(), NULL, 16);
+					pos += 4;
+					break;
+				default: out += c; break;
+				}
+			}
+			if(pos >= text.size()) return fail("unterminated string");
+			pos++;
+			return true;
+		}
+
+		bool value(Value& out, int depth){
+			if(depth > 64) return fail("nesting too deep");
+			skip();
+			if(pos >= text.size()) return fail("unexpected end of input");
+			char c = text[pos];
+			if('{' == c){
+				out = Value::Object();
+				pos++;
+				skip();
+				if(pos < text.size() && '}' == text[pos]){ pos++; return true; }
+				for(;;){
+					skip();
+					std::string key;
+					if(pos >= text.size() || !string(key)) return fail("expected key");
+					skip();
+					if(pos >= text.size() || ':' != text[pos]) return fail("expected ':'");
+					pos++;
+					Value member;
+					if(!value(member, depth + 1)) return false;
+					out.members.push_back(std::make_pair(key, member));
+					skip();
+					if(pos < text.size() && ',' == text[pos]){ pos++; continue; }
+					if(pos < text.size() && '}' == text[pos]){ pos++; return true; }
+					return fail("expected ',' or '}'");
+				}
+			}
+			if('[' == c){
+				out = Value::Array();
+				pos++;
+				skip();
+				if(pos < text.size() && ']' == text[pos]){ pos++; return true; }
+				for(;;){
+					Value item;
+					if(!value(item, depth + 1)) return false;
+					out.items.push_back(item);
+					skip();
+					if(pos < text.size() && ',' == text[pos]){ pos++; continue; }
+					if(pos < text.size() && ']' == text[pos]){ pos++; return true; }
+					return fail("expected ',' or ']'");
+				}
+			}
+			if('"' == c){
+				std::string s;
+				if(!string(s)) return false;
+				out = Value(s);
+				return true;
+			}
+			if(literal("true")){ out = Value(true); return true; }
+			if(literal("false")){ out = Value(false); return true; }
+			if(literal("null")){ out = Value(); return true; }
+
+			const char* begin = text.c_str() + pos;
+			char* end = NULL;
+			double number = strtod(begin, &end);
+			if(end == begin) return fail("unexpected character");
+			pos += end - begin;
+			out = Value(number);
+			return true;
+		}
+
+		const std::string& text;
+		size_t pos;
+		std::string message;
+	};
+}
+
+bool
+Json::Parse(const std::string& text, Value& out, std::string& error){
+	Parser parser(text);
+	return parser.parse(out, error);
+}
+
+bool
+Json::ParseFile(const std::string& filename, Value& out, std::string& error){
+	std::ifstream file(filename.c_str());
+	if(!file){
+		error = "unable to open " + filename;
+		return false;
+	}
+	std::stringstream ss;
+	ss << file.rdbuf();
+	if(!Parse(ss.str(), out, error)){
+		error = filename + ": " + error;
+		return false;
+	}
+	return true;
+}
+
+/********************************** Writer ***********************************/
+static void
+write_string(std::string& out, const std::string& s){
+	out += '"';
+	for(size_t i = 0; i != s.size(); i++){
+		char c = s[i];
+		if('"' == c || '\\' == c){ out += '\\'; out += c; }
+		else if('\n' == c) out += "\\n";
+		else if('\t' == c) out += "\\t";
+		else out += c;
+	}
+	out += '"';
+}
+
+static void
+write_value(std::string& out, const Value& value, int indent, int level){
+	std::string pad(indent * (level + 1), ' '), close_pad(indent * level, ' ');
+	const char* newline = indent > 0 ? "\n" : "";
+	switch(value.getType()){
+	case TYPE::NUL: out += "null"; break;
+	case TYPE::BOOLEAN: out += value.asBool() ? "true" : "false"; break;
+	case TYPE::NUMBER: {
+		char buf[64];
+		double n = value.asNumber();
+		if(std::isfinite(n) && n == std::floor(n) && std::fabs(n) < 1e15) snprintf(buf, sizeof(buf), "%.0f", n);
+		else if(std::isfinite(n)) snprintf(buf, sizeof(buf), "%.9g", n);
+		else snprintf(buf, sizeof(buf), "null");
+		out += buf;
+		break;
+	}
+	case TYPE::STRING: write_string(out, value.asString()); break;
+	case TYPE::ARRAY:
+		if(0 == value.size()){ out += "[]"; break; }
+		out += "["; out += newline;
+		for(size_t i = 0; i != value.size(); i++){
+			out += pad;
+			write_value(out, value[i], indent, level + 1);
+			if(i + 1 != value.size()) out += ",";
+			out += newline;
+		}
+		out += close_pad + "]";
+		break;
+	case TYPE::OBJECT: {
+		if(0 == value.size()){ out += "{}"; break; }
+		std::vector<std::string> keys = value.keys();
+		out += "{"; out += newline;
+		for(size_t i = 0; i != keys.size(); i++){
+			out += pad;
+			write_string(out, keys[i]);
+			out += indent > 0 ? ": " : ":";
+			write_value(out, value[keys[i]], indent, level + 1);
+			if(i + 1 != keys.size()) out += ",";
+			out += newline;
+		}
+		out += close_pad + "}";
+		break;
+	}
+	}
+}
+
+std::string
+Json::Write(const Value& value, int indent){
+	std::string out;
+	write_value(out, value, indent, 0);
+	out += "\n";
+	return out;
+}
+
+bool
+Json::WriteFile(const std::string& filename, const Value& value){
+	FILE* f = fopen(filename.c_str(), "w");
+	if(!f) return false;
+	std::string text = Write(value);
+	fwrite(text.data(), 1, text.size(), f);
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
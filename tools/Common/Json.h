@@ -0,0 +1,93 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Minimal JSON document used by the tools for baselines and scene files.
+* Objects keep their keys in insertion order so written files diff cleanly.
+*******************************************************************************/
+#ifndef _JSON_H_
+#define _JSON_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Json
+{
+	enum class TYPE
+	{
+		NUL,
+		BOOLEAN,
+		NUMBER,
+		STRING,
+		ARRAY,
+		OBJECT
+	};
+
+	class Value
+	{
+	public:
+		Value() : type(TYPE::NUL), boolean(false), number(0.0){}
+		Value(bool _b) : type(TYPE::BOOLEAN), boolean(_b), number(0.0){}
+		Value(int _n) : type(TYPE::NUMBER), boolean(false), number(_n){}
+		Value(long long _n) : type(TYPE::NUMBER), boolean(false), number((double)_n){}
+		Value(double _n) : type(TYPE::NUMBER), boolean(false), number(_n){}
+		Value(const char* _s) : type(TYPE::STRING), boolean(false), number(0.0), str(_s){}
+		Value(const std::string& _s) : type(TYPE::STRING), boolean(false), number(0.0), str(_s){}
+		static Value Array(){ Value v; v.type = TYPE::ARRAY; return v; }
+		static Value Object(){ Value v; v.type = TYPE::OBJECT; return v; }
+
+	public:
+		TYPE getType() const { return type; }
+		bool isNull() const { return TYPE::NUL == type; }
+		bool isNumber() const { return TYPE::NUMBER == type; }
+		bool isString() const { return TYPE::STRING == type; }
+		bool isArray() const { return TYPE::ARRAY == type; }
+		bool isObject() const { return TYPE::OBJECT == type; }
+
+		// Return the fallback when the value holds another type
+		double asNumber(double fallback = 0.0) const { return TYPE::NUMBER == type ? number : fallback; }
+		int asInt(int fallback = 0) const { return TYPE::NUMBER == type ? (int)number : fallback; }
+		bool asBool(bool fallback = false) const { return TYPE::BOOLEAN == type ? boolean : fallback; }
+		std::string asString(const std::string& fallback = "") const { return TYPE::STRING == type ? str : fallback; }
+
+		// Arrays
+		size_t size() const;
+		const Value& operator[](size_t i) const { return items[i]; }
+		Value& operator[](size_t i) { return items[i]; }
+		// Keeps a literal 0 from matching the key overloads, out of range reads as null
+		const Value& operator[](int i) const;
+		Value& append(const Value& v);
+
+		// Objects, a missing key reads as null
+		bool has(const std::string& key) const;
+		const Value& operator[](const std::string& key) const;
+		Value& operator[](const std::string& key);
+		const Value& operator[](const char* key) const { return (*this)[std::string(key)]; }
+		Value& operator[](const char* key) { return (*this)[std::string(key)]; }
+		std::vector<std::string> keys() const;
+
+	private:
+		friend class Parser;
+		TYPE type;
+		bool boolean;
+		double number;
+		std::string str;
+		std::vector<Value> items;
+		std::vector<std::pair<std::string, Value> > members;
+	};
+
+	bool Parse(const std::string& text, Value& out, std::string& error);
+	bool ParseFile(const std::string& filename, Value& out, std::string& error);
+	std::string Write(const Value& value, int indent = 2);
+	bool WriteFile(const std::string& filename, const Value& value);
+}
+
+#endif
@@ -0,0 +1,304 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Headless batch driver for EulerGAS2D. Reads a scene description, expands its
+* parameter sweep into wedges and runs all of them concurrently on the shared
+* work-stealing scheduler (see utl/UTL_Parallel.h), which hands whole
+* simulations to idle cores first and lets them steal loop chunks of the
+* simulations still running once the queue is empty.
+*
+*   vfxepoch_batch scene.json [--threads=<n>] [--out=<results.json>]
+*                             [--trace=<trace.json>] [--dry-run]
+*
+* Scene file (see tools/batch/scenes/smoke_wedge.json):
+*   "name", "resolution": [nx, ny], "steps",
+*   "parameters": any EulerGAS2D::Parameters field by name ("h" defaults to
+*                 1 / nx),
+*   "sources": [[i, j], ...], "forces": [{"component": "x"|"y", "cell": [i, j]}],
+*   "boundary": [{"type": "circle", "center": [x, y], "radius": r} or
+*                {"type": "box", "min": [x, y], "max": [x, y]}, with
+*                "fluid_inside": true|false (default true)],
+*   "sweep": {"parameters.dt": [...], "resolution": [[64, 64], ...], ...}
+* Every sweep key is a dotted path into the scene and the wedges are the
+* cartesian product of all value lists.
+*******************************************************************************/
+#include "Common/Flags.h"
+#include "Common/Json.h"
+
+#include "utl/UTL_Parallel.h"
+#include "utl/UTL_Trace.h"
+#include "fluids/euler/SIM_EulerGAS.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+
+typedef struct _job
+{
+	std::string name;
+	Json::Value scene;
+	Json::Value wedge;		// The sweep values of this job
+	bool ok;
+	std::string error;
+	int steps;
+	double seconds;
+	long long pcg_iterations;
+}Job;
+
+static std::mutex g_print_lock;
+
+/*********************************** Scene ***********************************/
+static void
+set_path(Json::Value& root, const std::string& path, const Json::Value& value){
+	std::vector<std::string> keys = Flags::Split(path, '.');
+	Json::Value* node = &root;
+	for(size_t i = 0; i != keys.size(); i++) node = &(*node)[keys[i]];
+	*node = value;
+}
+
+static std::vector<Job>
+expand_sweep(const Json::Value& scene){
+	const Json::Value& sweep = scene["sweep"];
+	std::vector<std::string> keys = sweep.keys();
+	std::vector<size_t> counter(keys.size(), 0);
+	std::vector<Job> jobs;
+
+	size_t total = 1;
+	for(size_t k = 0; k != keys.size(); k++) total *= std::max((size_t)1, sweep[keys[k]].size());
+
+	for(size_t w = 0; w != total; w++){
+		Job job;
+		job.scene = scene;
+		job.wedge = Json::Value::Object();
+		for(size_t k = 0; k != keys.size(); k++){
+			if(0 == sweep[keys[k]].size()) continue;
+			const Json::Value& value = sweep[keys[k]][counter[k]];
+			set_path(job.scene, keys[k], value);
+			job.wedge[keys[k]] = value;
+		}
+		std::stringstream name;
+		name << scene["name"].asString("scene");
+		if(total > 1){
+			char suffix[16];
+			snprintf(suffix, sizeof(suffix), "_w%03d", (int)w);
+			name << suffix;
+		}
+		job.name = name.str();
+		job.ok = false;
+		job.steps = 0;
+		job.seconds = 0.0;
+		job.pcg_iterations = 0;
+		jobs.push_back(job);
+
+		// Odometer over the sweep keys, the last key changes fastest
+		for(int k = (int)keys.size() - 1; k >= 0; k--){
+			if(++counter[k] < sweep[keys[k]].size()) break;
+			counter[k] = 0;
+		}
+	}
+	return jobs;
+}
+
+static float
+shape_phi(const Json::Value& shape, float x, float y){
+	float phi = 0.0f;
+	std::string type = shape["type"].asString();
+	if("circle" == type){
+		float cx = shape["center"][0].asNumber(), cy = shape["center"][1].asNumber();
+		phi = shape["radius"].asNumber() - std::sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy));
+	}
+	else if("box" == type){
+		// Positive inside, negative outside
+		float dx = std::min(x - (float)shape["min"][0].asNumber(), (float)shape["max"][0].asNumber() - x);
+		float dy = std::min(y - (float)shape["min"][1].asNumber(), (float)shape["max"][1].asNumber() - y);
+		phi = std::min(dx, dy);
+		if(dx < 0.0f && dy < 0.0f) phi = -std::sqrt(dx * dx + dy * dy);
+	}
+	return shape["fluid_inside"].asBool(true) ? phi : -phi;
+}
+
+static bool
+setup_solver(VFXEpoch::Solvers::EulerGAS2D& solver, const Json::Value& scene, std::string& error){
+	int nx = scene["resolution"][0].asInt(), ny = scene["resolution"][1].asInt();
+	if(nx <= 0 || ny <= 0){
+		error = "resolution must be two positive integers";
+		return false;
+	}
+
+	const Json::Value& p = scene["parameters"];
+	VFXEpoch::Solvers::EulerGAS2D::Parameters params;
+	params.dimension = VFXEpoch::Vector2Di(nx, ny);
+	params.origin = VFXEpoch::Vector2Df(p["origin"][0].asNumber(), p["origin"][1].asNumber());
+	params.h = p["h"].asNumber(1.0 / nx);
+	params.dt = p["dt"].asNumber(0.005);
+	params.buoyancy_alpha = p["buoyancy_alpha"].asNumber(0.1);
+	params.buoyancy_beta = p["buoyancy_beta"].asNumber(0.3);
+	params.vort_conf_eps = p["vort_conf_eps"].asNumber(0.55);
+	params.min_tolerance = p["min_tolerance"].asNumber(1e-5);
+	params.max_iterations = p["max_iterations"].asInt(300);
+	params.density_source = p["density_source"].asNumber(20.0);
+	params.external_force_strength = p["external_force_strength"].asNumber(10.0);
+	params.diff = p["diff"].asNumber(0.01);
+	params.visc = p["visc"].asNumber(0.01);
+	params.num_particles = p["num_particles"].asInt(0);
+	params.use_gravity = p["use_gravity"].asBool(true);
+
+	solver.set_user_params(params);
+	if(!solver.init(params)){
+		error = "solver init failed";
+		return false;
+	}
+	solver.set_verbose(false);
+
+	const Json::Value& sources = scene["sources"];
+	for(size_t i = 0; i != sources.size(); i++){
+		int r = sources[i][0].asInt(-1), c = sources[i][1].asInt(-1);
+		if(r < 0 || c < 0 || r >= ny || c >= nx){
+			error = "source outside of the grid";
+			return false;
+		}
+		solver.set_source_location(r, c);
+	}
+
+	const Json::Value& forces = scene["forces"];
+	for(size_t i = 0; i != forces.size(); i++){
+		std::string component = forces[i]["component"].asString("y");
+		int r = forces[i]["cell"][0].asInt(-1), c = forces[i]["cell"][1].asInt(-1);
+		if(r < 0 || c < 0 || r >= ny || c >= nx){
+			error = "force outside of the grid";
+			return false;
+		}
+		solver.set_external_force_location("x" == component ? VFXEpoch::VECTOR_COMPONENTS::X : VFXEpoch::VECTOR_COMPONENTS::Y, r, c);
+	}
+
+	// Solid wherever any shape says so, all fluid without shapes
+	const Json::Value& boundary = scene["boundary"];
+	VFXEpoch::Grid2DfScalarField phi(nx + 1, ny + 1, params.h, params.h);
+	LOOP_GRID2D(phi){
+		float x = j * params.h + params.origin.m_x, y = i * params.h + params.origin.m_y;
+		float value = 1e6f;
+		for(size_t s = 0; s != boundary.size(); s++) value = std::min(value, shape_phi(boundary[s], x, y));
+		phi(i, j) = value;
+	}
+	solver.set_static_boundary(phi);
+	return true;
+}
+
+static void
+run_job(Job& job){
+	VFXEPOCH_TRACE_SCOPE("Batch", "job");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	VFXEpoch::Solvers::EulerGAS2D solver;
+	job.steps = job.scene["steps"].asInt(100);
+	job.ok = setup_solver(solver, job.scene, job.error);
+	if(job.ok){
+		for(int i = 0; i != job.steps; i++){
+			solver.step();
+			job.pcg_iterations += solver.get_user_params().out_iterations;
+		}
+	}
+	solver.close();
+	job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::lock_guard<std::mutex> lock(g_print_lock);
+	if(job.ok) fprintf(stderr, "Done %s: %d steps in %.2f s\n", job.name.c_str(), job.steps, job.seconds);
+	else fprintf(stderr, "FAILED %s: %s\n", job.name.c_str(), job.error.c_str());
+}
+
+/************************************ Main ***********************************/
+int
+main(int argc, char** argv){
+	std::string scene_file, out_file, trace_file;
+	int threads = 0;
+	bool dry_run = false;
+
+	for(int i = 1; i < argc; i++){
+		std::string value;
+		if(Flags::Parse(argv[i], "--threads", value)) threads = atoi(value.c_str());
+		else if(Flags::Parse(argv[i], "--out", value)) out_file = value;
+		else if(Flags::Parse(argv[i], "--trace", value)) trace_file = value;
+		else if(Flags::Parse(argv[i], "--dry-run", value)) dry_run = true;
+		else if('-' != argv[i][0] && scene_file.empty()) scene_file = argv[i];
+		else {
+			fprintf(stderr, "ERROR: Unrecognized argument %s\n", argv[i]);
+			return 2;
+		}
+	}
+	if(scene_file.empty()){
+		fprintf(stderr, "Usage: %s scene.json [--threads=<n>] [--out=<file>] [--trace=<file>] [--dry-run]\n", argv[0]);
+		return 2;
+	}
+
+	Json::Value scene;
+	std::string error;
+	if(!Json::ParseFile(scene_file, scene, error)){
+		fprintf(stderr, "ERROR: %s\n", error.c_str());
+		return 2;
+	}
+
+	if(threads > 0) VFXEpoch::Parallel::SetNumThreads(threads);
+	std::vector<Job> jobs = expand_sweep(scene);
+	fprintf(stderr, "%d job(s) on %d thread(s)\n", (int)jobs.size(), VFXEpoch::Parallel::NumThreads());
+	if(dry_run){
+		for(size_t i = 0; i != jobs.size(); i++)
+			printf("%s %s", jobs[i].name.c_str(), Json::Write(jobs[i].wedge, 0).c_str());
+		return 0;
+	}
+
+	if(!trace_file.empty()) VFXEpoch::Trace::Enable();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	{
+		VFXEpoch::Parallel::TaskGroup group;
+		for(size_t i = 0; i != jobs.size(); i++){
+			Job* job = &jobs[i];
+			group.run([job]{ run_job(*job); });
+		}
+		group.wait();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if(!trace_file.empty()){
+		VFXEpoch::Trace::Disable();
+		VFXEpoch::Trace::ExportChromeJSON(trace_file);
+	}
+
+	int failed = 0;
+	Json::Value results = Json::Value::Object();
+	results["scene"] = scene_file;
+	results["threads"] = VFXEpoch::Parallel::NumThreads();
+	results["seconds"] = seconds;
+	Json::Value& list = results["jobs"] = Json::Value::Array();
+	for(size_t i = 0; i != jobs.size(); i++){
+		Json::Value entry = Json::Value::Object();
+		entry["name"] = jobs[i].name;
+		entry["wedge"] = jobs[i].wedge;
+		entry["ok"] = jobs[i].ok;
+		if(!jobs[i].ok) entry["error"] = jobs[i].error;
+		entry["steps"] = jobs[i].steps;
+		entry["seconds"] = jobs[i].seconds;
+		entry["pcg_iterations_per_step"] = jobs[i].steps > 0 ? (double)jobs[i].pcg_iterations / jobs[i].steps : 0.0;
+		list.append(entry);
+		if(!jobs[i].ok) failed++;
+	}
+
+	if(!out_file.empty()){
+		if(!Json::WriteFile(out_file, results)){
+			fprintf(stderr, "ERROR: Unable to write %s\n", out_file.c_str());
+			return 2;
+		}
+	}
+	else printf("%s", Json::Write(results).c_str());
+	fprintf(stderr, "%d job(s) in %.2f s, %d failed\n", (int)jobs.size(), seconds, failed);
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,343 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Headless micro and macro benchmarks of the library. Run with
+*   vfxepoch_bench --benchmark_format=json --benchmark_out=bench.json
+* and compare two JSON files to catch regressions between library versions.
+*******************************************************************************/
+#include "Common/Benchmark.h"
+
+#include "utl/UTL_General.h"
+#include "utl/UTL_Analysis.h"
+#include "utl/UTL_LinearSolvers.h"
+#include "fluids/euler/SIM_EulerGAS.h"
+#include "fluids/lbm/SIM_LBM.h"
+
+#include <cstdlib>
+
+/********************************** Helpers **********************************/
+// Seeded and cheap, VFXEpoch::RandomF reseeds from std::random_device per call
+static float
+frand(float a, float b){
+	return (b - a) * ((float)rand() / (float)RAND_MAX) + a;
+}
+
+static void
+random_fill(VFXEpoch::Grid2DfScalarField& field){
+	srand(1);
+	LOOP_GRID2D(field){
+		field(i, j) = frand(-1.0f, 1.0f);
+	}
+}
+
+static void
+random_fill(VFXEpoch::Grid2DVector2DfField& field){
+	srand(1);
+	LOOP_GRID2D(field){
+		field(i, j) = VFXEpoch::Vector2Df(frand(-1.0f, 1.0f), frand(-1.0f, 1.0f));
+	}
+}
+
+static void
+closed_boundaries(VFXEpoch::BndConditionPerEdge b[]){
+	b[0].side = VFXEpoch::EDGES_2DSIM::TOP;
+	b[1].side = VFXEpoch::EDGES_2DSIM::BOTTOM;
+	b[2].side = VFXEpoch::EDGES_2DSIM::LEFT;
+	b[3].side = VFXEpoch::EDGES_2DSIM::RIGHT;
+	for(int i = 0; i != 4; i++) b[i].boundaryType = VFXEpoch::BOUNDARY::NEUMANN_CLOSE;
+}
+
+// 5-point Laplacian on the n x n interior, the outer ring is Dirichlet zero
+// like the matrix EulerGAS2D assembles for a box without obstacles.
+static void
+pressure_matrix(int n, SparseMatrixd& A, std::vector<double>& rhs){
+	A.resize(n * n);
+	A.zero();
+	rhs.assign(n * n, 0.0);
+	srand(1);
+	for(int i = 0; i != n; i++){
+		for(int j = 0; j != n; j++){
+			int idx = i * n + j;
+			A.set_element(idx, idx, 4.0);
+			if(i > 0) A.set_element(idx, idx - n, -1.0);
+			if(i < n - 1) A.set_element(idx, idx + n, -1.0);
+			if(j > 0) A.set_element(idx, idx - 1, -1.0);
+			if(j < n - 1) A.set_element(idx, idx + 1, -1.0);
+			rhs[idx] = frand(-1.0f, 1.0f);
+		}
+	}
+}
+
+static VFXEpoch::Vector2Df g_circle_center(0.5f, 0.5f);
+
+static float
+circle_phi(const VFXEpoch::Vector2Df& position){
+	return 0.4f - VFXEpoch::Dist2D(position, g_circle_center);
+}
+
+/******************************* Micro benchmarks ****************************/
+static void
+BM_InterpolateGrid(Bench::State& state){
+	int n = state.range(0);
+	VFXEpoch::Grid2DfScalarField field(n, n, 1.0f / n, 1.0f / n);
+	random_fill(field);
+
+	const int samples = 4096;
+	std::vector<VFXEpoch::Vector2Df> positions(samples);
+	for(int s = 0; s != samples; s++)
+		positions[s] = VFXEpoch::Vector2Df(frand(0.0f, n - 1.0f), frand(0.0f, n - 1.0f));
+
+	while(state.KeepRunning()){
+		float sum = 0.0f;
+		for(int s = 0; s != samples; s++) sum += VFXEpoch::InterpolateGrid(positions[s], field);
+		Bench::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * samples);
+}
+VFXEPOCH_BENCHMARK(BM_InterpolateGrid)->Arg(128)->Arg(1024);
+
+#define VFXEPOCH_BENCH_CURL_UNIFORM(func) \
+	static void \
+	BM_##func(Bench::State& state){ \
+		int n = state.range(0); \
+		VFXEpoch::Grid2DVector2DfField ref(n, n, 1.0f / n, 1.0f / n); \
+		VFXEpoch::Grid2DfScalarField dest(n, n, 1.0f / n, 1.0f / n); \
+		random_fill(ref); \
+		while(state.KeepRunning()){ \
+			VFXEpoch::Analysis::func(dest, ref); \
+			Bench::ClobberMemory(); \
+		} \
+		state.SetItemsProcessed(state.iterations() * n * n); \
+	} \
+	VFXEPOCH_BENCHMARK(BM_##func)->Arg(128)->Arg(256)->Arg(512)
+
+VFXEPOCH_BENCH_CURL_UNIFORM(computeCurl_uniform);
+VFXEPOCH_BENCH_CURL_UNIFORM(computeCurl_uniform_Stokes);
+VFXEPOCH_BENCH_CURL_UNIFORM(computeCurl_uniform_LS);
+VFXEPOCH_BENCH_CURL_UNIFORM(computeCurl_uniform_Richardson);
+VFXEPOCH_BENCH_CURL_UNIFORM(computeDivergence_uniform);
+
+static void
+BM_computeCurl_mac(Bench::State& state){
+	int n = state.range(0);
+	float h = 1.0f / n;
+	VFXEpoch::Grid2DfScalarField u(n + 1, n, h, h), v(n, n + 1, h, h), dest(n + 1, n + 1, h, h);
+	random_fill(u);
+	random_fill(v);
+	while(state.KeepRunning()){
+		VFXEpoch::Analysis::computeCurl_mac(dest, u, v);
+		Bench::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * n * n);
+}
+VFXEPOCH_BENCHMARK(BM_computeCurl_mac)->Arg(128)->Arg(256)->Arg(512);
+
+static void
+BM_computeDivergence_with_weights_mac(Bench::State& state){
+	int n = state.range(0);
+	VFXEpoch::Grid2DfScalarField u(n + 1, n), v(n, n + 1), uw(n + 1, n), vw(n, n + 1);
+	VFXEpoch::Grid2DdScalarField dest(n, n);
+	random_fill(u);
+	random_fill(v);
+	LOOP_GRID2D(uw) uw(i, j) = 1.0f;
+	LOOP_GRID2D(vw) vw(i, j) = 1.0f;
+	while(state.KeepRunning()){
+		VFXEpoch::Analysis::computeDivergence_with_weights_mac(dest, 1.0f / n, u, v, uw, vw);
+		Bench::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * n * n);
+}
+VFXEPOCH_BENCHMARK(BM_computeDivergence_with_weights_mac)->Arg(128)->Arg(256)->Arg(512);
+
+/******************************* Linear solvers ******************************/
+// Same coefficients the examples use for a diffusion solve
+static const float k_diffusion = 0.25f;
+
+static void
+BM_GSSolve(Bench::State& state){
+	int n = state.range(0), iterations = 20;
+	VFXEpoch::BndConditionPerEdge b[4];
+	closed_boundaries(b);
+	VFXEpoch::Grid2DfScalarField x(n + 2, n + 2), x0(n + 2, n + 2);
+	random_fill(x0);
+	while(state.KeepRunning()){
+		VFXEpoch::Zeros(x);
+		VFXEpoch::LinearSolver::GSSolve(x, x0, b, k_diffusion, 1.0f + 4.0f * k_diffusion, iterations);
+		Bench::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * n * n * iterations);
+}
+VFXEPOCH_BENCHMARK(BM_GSSolve)->Arg(128)->Arg(256)->Arg(512);
+
+static void
+BM_RBGSSolve(Bench::State& state){
+	int n = state.range(0);
+	VFXEpoch::BndConditionPerEdge b[4];
+	closed_boundaries(b);
+	VFXEpoch::Grid2DfScalarField x(n + 2, n + 2), x0(n + 2, n + 2);
+	random_fill(x0);
+	while(state.KeepRunning()){
+		VFXEpoch::LinearSolver::RBGSSolve(1.0f / n, x, x0, b, k_diffusion, 1.0f + 4.0f * k_diffusion);
+		Bench::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * n * n);
+}
+VFXEPOCH_BENCHMARK(BM_RBGSSolve)->Arg(128)->Arg(256)->Arg(512);
+
+static void
+BM_RBSORSolve(Bench::State& state){
+	int n = state.range(0), iterations = 20;
+	VFXEpoch::BndConditionPerEdge b[4];
+	closed_boundaries(b);
+	VFXEpoch::Grid2DfScalarField x(n + 2, n + 2), x0(n + 2, n + 2);
+	random_fill(x0);
+	float omega = VFXEpoch::LinearSolver::SOROmega(n + 2, n + 2, k_diffusion, 1.0f + 4.0f * k_diffusion);
+	while(state.KeepRunning()){
+		VFXEpoch::Zeros(x);
+		VFXEpoch::LinearSolver::RBSORSolve(x, x0, b, k_diffusion, 1.0f + 4.0f * k_diffusion, omega, iterations);
+		Bench::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * n * n * iterations);
+}
+VFXEPOCH_BENCHMARK(BM_RBSORSolve)->Arg(128)->Arg(256)->Arg(512);
+
+static void
+BM_JacobiSolve(Bench::State& state){
+	int n = state.range(0), iterations = 20;
+	VFXEpoch::BndConditionPerEdge b[4];
+	closed_boundaries(b);
+	VFXEpoch::Grid2DfScalarField x(n + 2, n + 2), x0(n + 2, n + 2);
+	random_fill(x0);
+	while(state.KeepRunning()){
+		VFXEpoch::Zeros(x);
+		VFXEpoch::LinearSolver::JacobiSolve(x, x0, b, k_diffusion, 1.0f + 4.0f * k_diffusion, iterations);
+		Bench::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * n * n * iterations);
+}
+VFXEPOCH_BENCHMARK(BM_JacobiSolve)->Arg(128)->Arg(256)->Arg(512);
+
+static void
+BM_PCGSolve(Bench::State& state){
+	int n = state.range(0);
+	SparseMatrixd A;
+	std::vector<double> rhs, pressure;
+	pressure_matrix(n, A, rhs);
+
+	PCGSolver<double> solver;
+	solver.set_solver_parameters(1e-5, 1000);
+	double residual = 0.0;
+	int iterations = 0;
+	long long total_iterations = 0;
+	while(state.KeepRunning()){
+		pressure.assign(n * n, 0.0);
+		solver.solve(A, rhs, pressure, residual, iterations);
+		total_iterations += iterations;
+	}
+	state.counters["pcg_iterations"] = (double)total_iterations;
+	state.SetItemsProcessed(state.iterations() * n * n);
+}
+VFXEPOCH_BENCHMARK(BM_PCGSolve)->Arg(64)->Arg(128)->Arg(256)->Arg(512);
+
+// Same system in float with the refinement in double
+static void
+BM_PCGSolveMixed(Bench::State& state){
+	int n = state.range(0);
+	SparseMatrixd A;
+	std::vector<double> rhs, pressure;
+	pressure_matrix(n, A, rhs);
+
+	PCGSolver<float> solver;
+	solver.set_solver_parameters(1e-5f, 1000);
+	double residual = 0.0;
+	int iterations = 0;
+	long long total_iterations = 0;
+	while(state.KeepRunning()){
+		solver.solve_refined(A, rhs, pressure, residual, iterations);
+		total_iterations += iterations;
+	}
+	state.counters["pcg_iterations"] = (double)total_iterations;
+	state.SetItemsProcessed(state.iterations() * n * n);
+}
+VFXEPOCH_BENCHMARK(BM_PCGSolveMixed)->Arg(64)->Arg(128)->Arg(256)->Arg(512);
+
+/********************************* LBM kernels *******************************/
+static void
+BM_LBM2D_Stream(Bench::State& state){
+	int n = state.range(0);
+	VFXEpoch::Solvers::LBM2D lbm(n + 2, n + 2);
+	lbm._set_sim_params(1.0f, 0.6f);
+	lbm._set_equilibrium(1.0f, 0.05f, 0.0f);
+	while(state.KeepRunning()){
+		lbm._stream();
+	}
+	state.SetItemsProcessed(state.iterations() * n * n);
+}
+VFXEPOCH_BENCHMARK(BM_LBM2D_Stream)->Arg(128)->Arg(256)->Arg(512)->Arg(1024);
+
+static void
+BM_LBM2D_Collide(Bench::State& state){
+	int n = state.range(0);
+	VFXEpoch::Solvers::LBM2D lbm(n + 2, n + 2);
+	lbm._set_sim_params(1.0f, 0.6f);
+	lbm._set_equilibrium(1.0f, 0.05f, 0.0f);
+	while(state.KeepRunning()){
+		lbm._collide();
+	}
+	state.SetItemsProcessed(state.iterations() * n * n);
+}
+VFXEPOCH_BENCHMARK(BM_LBM2D_Collide)->Arg(128)->Arg(256)->Arg(512)->Arg(1024);
+
+/******************************* Macro benchmark *****************************/
+// The examiner scene: a circular container with a smoke source and an upward
+// force at its centre.
+static void
+BM_EulerGAS2D_Step(Bench::State& state){
+	int n = state.range(0);
+	VFXEpoch::Solvers::EulerGAS2D solver;
+	VFXEpoch::Solvers::EulerGAS2D::Parameters params;
+	params.dimension = VFXEpoch::Vector2Di(n, n);
+	params.h = 1.0 / n;
+	params.dt = 0.005;
+	params.buoyancy_alpha = 0.1;
+	params.buoyancy_beta = 0.3;
+	params.vort_conf_eps = 0.55;
+	params.density_source = 20;
+	params.external_force_strength = 10;
+	params.max_iterations = 300;
+	params.min_tolerance = 1e-5;
+	params.diff = 0.01;
+	params.visc = 0.01;
+	solver.set_user_params(params);
+	if(!solver.init(params)){
+		state.SetLabel("init failed");
+		return;
+	}
+	solver.set_verbose(false);
+	solver.set_source_location(n / 2, n / 2);
+	solver.set_external_force_location(VFXEpoch::VECTOR_COMPONENTS::Y, n / 2, n / 2);
+	solver.set_static_boundary(circle_phi);
+
+	long long pcg_iterations = 0;
+	while(state.KeepRunning()){
+		solver.step();
+		pcg_iterations += solver.get_user_params().out_iterations;
+	}
+	solver.close();
+	state.counters["pcg_iterations"] = (double)pcg_iterations;
+	state.SetItemsProcessed(state.iterations() * n * n);
+}
+VFXEPOCH_BENCHMARK(BM_EulerGAS2D_Step)->Range(128, 2048);
+
+int
+main(int argc, char** argv){
+	return Bench::RunSpecifiedBenchmarks(argc, argv);
+}
@@ -0,0 +1,517 @@
+/*******************************************************************************
+    VFXEPOCH - Physically based simulation VFX
+
+    Copyright (c) 2016 Snow Tsui <trevor.miscellaneous@gmail.com>
+
+    All rights reserved. Use of this source code is governed by
+    the MIT license as written in the LICENSE file.
+*******************************************************************************/
+
+/*******************************************************************************
+* Desc:
+* Performance regression harness. Runs a fixed set of canonical scenes for N
+* steps and records time per solver stage (from the trace buffer), PCG
+* iterations and peak memory. The result can be stored as a baseline and later
+* runs compared against it:
+*
+*   vfxepoch_regress --out=baseline.json
+*   vfxepoch_regress --baseline=baseline.json --out=current.json
+*
+* The comparison prints a diff table and exits with 1 when any metric grows
+* past its threshold, 2 on usage or I/O errors and 0 otherwise.
+*
+* Flags:
+*   --scenes=<a,b,...>        --steps=<n>                --repetitions=<n>
+*   --out=<file>              --baseline=<file>          --list
+*   --time-threshold=<frac>   --iteration-threshold=<frac>
+*   --memory-threshold=<frac> --min-stage-ms=<ms>
+* Thresholds are relative growth (0.1 = 10%). A baseline may carry its own
+* "thresholds" object, flags on the command line take precedence.
+*******************************************************************************/
+#include "Common/Flags.h"
+#include "Common/Json.h"
+
+#include "utl/UTL_General.h"
+#include "utl/UTL_Trace.h"
+#include "fluids/euler/SIM_EulerGAS.h"
+#include "fluids/lbm/SIM_LBM.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#ifndef VFXEPOCH_GIT_VERSION
+#define VFXEPOCH_GIT_VERSION "unknown"
+#endif
+
+#ifndef VFXEPOCH_BUILD_TYPE
+#define VFXEPOCH_BUILD_TYPE "unknown"
+#endif
+
+/*********************************** Memory **********************************/
+// Reads a "VmXXX:  1234 kB" line of /proc/self/status
+static long long
+proc_status_kb(const char* key){
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	size_t len = strlen(key);
+	while(std::getline(status, line)){
+		if(line.compare(0, len, key) == 0) return atoll(line.c_str() + len + 1);
+	}
+	return -1;
+}
+
+// Resets the high water mark of the resident set (Linux 4.0+)
+static bool
+reset_peak_memory(){
+#ifdef __GLIBC__
+	// Give freed heap pages back first, or the next scene reuses them for free
+	malloc_trim(0);
+#endif
+	FILE* f = fopen("/proc/self/clear_refs", "w");
+	if(!f) return false;
+	bool ok = fputs("5", f) >= 0;
+	return 0 == fclose(f) && ok;
+}
+
+static long long
+peak_memory_kb(){
+	long long hwm = proc_status_kb("VmHWM:");
+	if(hwm >= 0) return hwm;
+#ifdef __linux__
+	struct rusage usage;
+	if(0 == getrusage(RUSAGE_SELF, &usage)) return usage.ru_maxrss;
+#endif
+	return 0;
+}
+
+/*********************************** Scenes **********************************/
+typedef struct _scene_stats
+{
+	long long pcg_iterations;
+}SceneStats;
+
+typedef struct _scene
+{
+	const char* name;
+	const char* desc;
+	int default_steps;
+	void (*run)(int steps, SceneStats& stats);
+	// Only scenes with an iterative solver fill stats and report iterations
+	bool has_solver_stats;
+}Scene;
+
+// The examiner setup: 64 x 64 smoke inside a circular container of radius 0.4
+// with a density source and an upward force at the centre.
+static float
+container_phi(const VFXEpoch::Vector2Df& position){
+	return 0.4f - VFXEpoch::Dist2D(position, VFXEpoch::Vector2Df(0.5f, 0.5f));
+}
+
+static void
+run_smoke_circle(int steps, SceneStats& stats){
+	const int N = 64;
+	VFXEpoch::Solvers::EulerGAS2D solver;
+	VFXEpoch::Solvers::EulerGAS2D::Parameters params;
+	params.dimension = VFXEpoch::Vector2Di(N, N);
+	params.h = 1.0 / N;
+	params.dt = 0.005;
+	params.buoyancy_alpha = 0.1;
+	params.buoyancy_beta = 0.3;
+	params.vort_conf_eps = 0.55;
+	params.density_source = 20;
+	params.external_force_strength = 10;
+	params.max_iterations = 300;
+	params.min_tolerance = 1e-5;
+	params.diff = 0.01;
+	params.visc = 0.01;
+	solver.set_user_params(params);
+	if(!solver.init(params)) return;
+	solver.set_verbose(false);
+	solver.set_source_location(N / 2, N / 2);
+	solver.set_external_force_location(VFXEpoch::VECTOR_COMPONENTS::Y, N / 2, N / 2);
+	solver.set_static_boundary(container_phi);
+
+	for(int i = 0; i != steps; i++){
+		solver.step();
+		stats.pcg_iterations += solver.get_user_params().out_iterations;
+	}
+	solver.close();
+}
+
+// 256 x 64 channel with solid walls on top and bottom and a cylinder of radius
+// 8 cells a quarter of the way in. The outer ring keeps its initial uniform
+// flow equilibrium and acts as inflow/outflow.
+static void
+run_lbm_cylinder(int steps, SceneStats& stats){
+	(void)stats;
+	const int X = 256, Y = 64, R = 8;
+	VFXEpoch::Solvers::LBM2D lbm(X, Y);
+	lbm._set_sim_params(1.0f, 0.6f);
+	lbm._set_equilibrium(1.0f, 0.05f, 0.0f);
+	for(int x = 0; x != X; x++){
+		lbm._set_solid_at_cell(VFXEpoch::BOUNDARY_MASK::SOMETHING, x, 1);
+		lbm._set_solid_at_cell(VFXEpoch::BOUNDARY_MASK::SOMETHING, x, Y - 2);
+	}
+	for(int y = 0; y != Y; y++){
+		for(int x = 0; x != X; x++){
+			int dx = x - X / 4, dy = y - Y / 2;
+			if(dx * dx + dy * dy <= R * R) lbm._set_solid_at_cell(VFXEpoch::BOUNDARY_MASK::SOMETHING, x, y);
+		}
+	}
+
+	for(int i = 0; i != steps; i++){
+		lbm._stream();
+		lbm._bounce_back();
+		lbm._collide();
+	}
+}
+
+// The vortex_rings_2d example: two leapfrogging vortex ring pairs (mollified
+// Biot-Savart) advecting passive tracers with RK3, four substeps per frame.
+typedef struct _vortex2D
+{
+	double x, y, vort;
+}Vortex2D;
+
+static void
+vortex_velocity(double x, double y, const std::vector<Vortex2D>& vortices, int skip, double& u, double& v){
+	const double eps = 0.01, pi = 3.1415926;
+	u = v = 0.0;
+	for(int i = 0; i != (int)vortices.size(); i++){
+		if(i == skip) continue;
+		double r2 = (x - vortices[i].x) * (x - vortices[i].x) + (y - vortices[i].y) * (y - vortices[i].y);
+		double k = vortices[i].vort / (r2 * pi) * 0.5 * (1.0 - exp(-r2 / (eps * eps)));
+		u += k * (vortices[i].y - y);
+		v += k * (x - vortices[i].x);
+	}
+}
+
+// Same seeded generator as the example, VFXEpoch::RandomF reseeds per call
+static double
+frand(double a, double b){
+	return (b - a) * ((double)rand() / (double)RAND_MAX) + a;
+}
+
+static void
+run_vortex_rings(int steps, SceneStats& stats){
+	(void)stats;
+	const int num_tracers = 20000;
+	const double dt = 0.1;
+	Vortex2D init[4] = {{0.0, 1.0, 1.0}, {0.0, -1.0, -1.0}, {0.0, 0.3, 1.0}, {0.0, -0.3, -1.0}};
+	std::vector<Vortex2D> vortices(init, init + 4);
+
+	srand(1);
+	std::vector<double> px(num_tracers), py(num_tracers);
+	for(int i = 0; i != num_tracers; i++){
+		px[i] = frand(-0.5, 0.5);
+		py[i] = frand(-1.5, 1.5);
+	}
+
+	for(int frame = 0; frame != steps; frame++){
+		for(int substep = 0; substep != 4; substep++){
+			{
+				VFXEPOCH_TRACE_SCOPE("VortexRings", "advect_tracers");
+				for(int i = 0; i != num_tracers; i++){
+					double u0, v0, u1, v1, u2, v2;
+					vortex_velocity(px[i], py[i], vortices, -1, u0, v0);
+					vortex_velocity(px[i] + 0.5 * dt * u0, py[i] + 0.5 * dt * v0, vortices, -1, u1, v1);
+					vortex_velocity(px[i] + 0.75 * dt * u1, py[i] + 0.75 * dt * v1, vortices, -1, u2, v2);
+					px[i] += dt * (2.0 * u0 + 3.0 * u1 + 4.0 * u2) / 9.0;
+					py[i] += dt * (2.0 * v0 + 3.0 * v1 + 4.0 * v2) / 9.0;
+				}
+			}
+			{
+				VFXEPOCH_TRACE_SCOPE("VortexRings", "advect_vortices");
+				std::vector<Vortex2D> moved = vortices;
+				for(int i = 0; i != (int)vortices.size(); i++){
+					double u, v;
+					vortex_velocity(vortices[i].x, vortices[i].y, vortices, i, u, v);
+					moved[i].x += dt * u;
+					moved[i].y += dt * v;
+				}
+				vortices = moved;
+			}
+		}
+	}
+}
+
+static const Scene g_scenes[] = {
+	{"smoke_circle", "EulerGAS2D 64x64 examiner setup", 100, run_smoke_circle, true},
+	{"lbm_cylinder", "LBM2D 256x64 cylinder in channel", 200, run_lbm_cylinder, false},
+	{"vortex_rings", "Vortex ring leapfrog, 20000 tracers", 20, run_vortex_rings, false},
+};
+static const int g_num_scenes = sizeof(g_scenes) / sizeof(g_scenes[0]);
+
+/********************************** Measure **********************************/
+static Json::Value
+measure(const Scene& scene, int steps, int repetitions){
+	Json::Value result = Json::Value::Object();
+	double best_ms = -1.0;
+	long long peak_kb = 0;
+	SceneStats stats;
+	std::map<std::string, double> best_stage;
+	std::vector<std::string> stage_order;
+
+	for(int r = 0; r != repetitions; r++){
+		stats.pcg_iterations = 0;
+		bool reset = reset_peak_memory();
+		long long rss_start = proc_status_kb("VmRSS:");
+
+		VFXEpoch::Trace::Enable();
+		VFXEpoch::Trace::Clear();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		scene.run(steps, stats);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		VFXEpoch::Trace::Disable();
+
+		// Growth of the resident set over the scene when the high water mark
+		// could be reset, otherwise the process wide peak
+		long long peak = peak_memory_kb();
+		if(reset && rss_start >= 0) peak -= rss_start;
+		peak_kb = std::max(peak_kb, peak);
+
+		// Keep the fastest repetition of every timing, it is the least noisy
+		if(best_ms < 0.0 || ms < best_ms) best_ms = ms;
+		std::vector<VFXEpoch::Trace::TraceSummary> summary = VFXEpoch::Trace::Summarize();
+		for(size_t i = 0; i != summary.size(); i++){
+			std::string key = std::string(summary[i].category) + "/" + summary[i].name;
+			double stage_ms = summary[i].total * 1e-6;
+			if(!best_stage.count(key)){
+				best_stage[key] = stage_ms;
+				stage_order.push_back(key);
+			}
+			else best_stage[key] = std::min(best_stage[key], stage_ms);
+		}
+	}
+
+	result["steps"] = steps;
+	result["repetitions"] = repetitions;
+	result["ms_per_step"] = best_ms / steps;
+	if(scene.has_solver_stats) result["pcg_iterations_per_step"] = (double)stats.pcg_iterations / steps;
+	result["peak_memory_kb"] = peak_kb;
+	Json::Value& stages = result["stages"] = Json::Value::Object();
+	for(size_t i = 0; i != stage_order.size(); i++)
+		stages[stage_order[i]] = best_stage[stage_order[i]] / steps;
+	return result;
+}
+
+/********************************** Compare **********************************/
+typedef struct _thresholds
+{
+	double time, iterations, memory, min_stage_ms;
+}Thresholds;
+
+typedef struct _diff_row
+{
+	std::string scene, metric, status;
+	double baseline, current;
+}DiffRow;
+
+static int
+compare_metric(std::vector<DiffRow>& rows, const std::string& scene, const std::string& metric,
+			   const Json::Value& baseline, const Json::Value& current, double threshold, double floor_value){
+	DiffRow row;
+	row.scene = scene;
+	row.metric = metric;
+	row.baseline = baseline.asNumber(-1.0);
+	row.current = current.asNumber(-1.0);
+	int regressions = 0;
+	if(!baseline.isNumber()) row.status = "new";
+	else if(!current.isNumber()) row.status = "missing";
+	else if(std::max(row.baseline, row.current) < floor_value) row.status = "ignored";
+	else if(row.current > row.baseline * (1.0 + threshold) && row.current > row.baseline){
+		row.status = "REGRESSED";
+		regressions++;
+	}
+	else if(row.current < row.baseline * (1.0 - threshold)) row.status = "improved";
+	else row.status = "ok";
+	rows.push_back(row);
+	return regressions;
+}
+
+static int
+compare(const Json::Value& baseline, const Json::Value& current, const Thresholds& thresholds){
+	std::vector<DiffRow> rows;
+	int regressions = 0;
+	std::vector<std::string> scenes = current["scenes"].keys();
+	for(size_t s = 0; s != scenes.size(); s++){
+		const Json::Value& base = baseline["scenes"][scenes[s]];
+		const Json::Value& cur = current["scenes"][scenes[s]];
+		if(base.isNull()){
+			printf("Scene %s is not in the baseline, skipped\n", scenes[s].c_str());
+			continue;
+		}
+		if(base["steps"].asInt() != cur["steps"].asInt()){
+			printf("WARNING: %s ran %d steps, the baseline has %d. Per step values are compared.\n",
+				   scenes[s].c_str(), cur["steps"].asInt(), base["steps"].asInt());
+		}
+		regressions += compare_metric(rows, scenes[s], "ms_per_step", base["ms_per_step"], cur["ms_per_step"], thresholds.time, 0.0);
+		// Only scenes with an iterative solver have iterations
+		if(base.has("pcg_iterations_per_step") || cur.has("pcg_iterations_per_step"))
+			regressions += compare_metric(rows, scenes[s], "pcg_iterations_per_step", base["pcg_iterations_per_step"],
+										  cur["pcg_iterations_per_step"], thresholds.iterations, 1e-9);
+		regressions += compare_metric(rows, scenes[s], "peak_memory_kb", base["peak_memory_kb"], cur["peak_memory_kb"], thresholds.memory, 1.0);
+
+		std::vector<std::string> stages = cur["stages"].keys();
+		std::vector<std::string> base_stages = base["stages"].keys();
+		for(size_t i = 0; i != base_stages.size(); i++)
+			if(!cur["stages"].has(base_stages[i])) stages.push_back(base_stages[i]);
+		for(size_t i = 0; i != stages.size(); i++){
+			regressions += compare_metric(rows, scenes[s], stages[i], base["stages"][stages[i]], cur["stages"][stages[i]],
+										  thresholds.time, thresholds.min_stage_ms);
+		}
+	}
+
+	size_t scene_w = 5, metric_w = 6;
+	for(size_t i = 0; i != rows.size(); i++){
+		scene_w = std::max(scene_w, rows[i].scene.size());
+		metric_w = std::max(metric_w, rows[i].metric.size());
+	}
+	std::string line(scene_w + metric_w + 52, '-');
+	printf("%s\n%-*s  %-*s %12s %12s %9s  %s\n%s\n", line.c_str(), (int)scene_w, "Scene", (int)metric_w, "Metric",
+		   "Baseline", "Current", "Change", "Status", line.c_str());
+	for(size_t i = 0; i != rows.size(); i++){
+		const DiffRow& r = rows[i];
+		char change[32] = "";
+		if(r.baseline > 0.0 && r.current >= 0.0) snprintf(change, sizeof(change), "%+.1f%%", 100.0 * (r.current - r.baseline) / r.baseline);
+		printf("%-*s  %-*s %12.4g %12.4g %9s  %s\n", (int)scene_w, r.scene.c_str(), (int)metric_w, r.metric.c_str(),
+			   r.baseline, r.current, change, r.status.c_str());
+	}
+	printf("%s\n", line.c_str());
+	printf("Thresholds: time %.1f%%, iterations %.1f%%, memory %.1f%%, stages under %.3f ms/step ignored\n",
+		   thresholds.time * 100.0, thresholds.iterations * 100.0, thresholds.memory * 100.0, thresholds.min_stage_ms);
+	printf("%d regression(s)\n", regressions);
+	return regressions;
+}
+
+/************************************ Main ***********************************/
+static Json::Value
+make_context(){
+	Json::Value context = Json::Value::Object();
+	char date[64] = {0};
+	std::time_t now = std::time(NULL);
+	std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+	char host[256] = "unknown";
+#ifdef __linux__
+	gethostname(host, sizeof(host) - 1);
+#endif
+	context["date"] = date;
+	context["host_name"] = host;
+	context["library_version"] = VFXEPOCH_GIT_VERSION;
+	context["library_build_type"] = VFXEPOCH_BUILD_TYPE;
+	return context;
+}
+
+int
+main(int argc, char** argv){
+	std::string scene_list, out_file, baseline_file;
+	int steps = 0, repetitions = 1;
+	bool list = false;
+	// Negative means "not given", filled from the baseline or the defaults
+	Thresholds cli = {-1.0, -1.0, -1.0, -1.0};
+
+	for(int i = 1; i < argc; i++){
+		std::string value;
+		if(Flags::Parse(argv[i], "--scenes", value)) scene_list = value;
+		else if(Flags::Parse(argv[i], "--steps", value)) steps = atoi(value.c_str());
+		else if(Flags::Parse(argv[i], "--repetitions", value)) repetitions = std::max(1, atoi(value.c_str()));
+		else if(Flags::Parse(argv[i], "--out", value)) out_file = value;
+		else if(Flags::Parse(argv[i], "--baseline", value)) baseline_file = value;
+		else if(Flags::Parse(argv[i], "--time-threshold", value)) cli.time = atof(value.c_str());
+		else if(Flags::Parse(argv[i], "--iteration-threshold", value)) cli.iterations = atof(value.c_str());
+		else if(Flags::Parse(argv[i], "--memory-threshold", value)) cli.memory = atof(value.c_str());
+		else if(Flags::Parse(argv[i], "--min-stage-ms", value)) cli.min_stage_ms = atof(value.c_str());
+		else if(Flags::Parse(argv[i], "--list", value)) list = true;
+		else {
+			fprintf(stderr, "ERROR: Unrecognized argument %s\n", argv[i]);
+			return 2;
+		}
+	}
+
+	if(list){
+		for(int s = 0; s != g_num_scenes; s++)
+			printf("%-14s %4d steps  %s\n", g_scenes[s].name, g_scenes[s].default_steps, g_scenes[s].desc);
+		return 0;
+	}
+
+	Json::Value baseline;
+	if(!baseline_file.empty()){
+		std::string error;
+		if(!Json::ParseFile(baseline_file, baseline, error)){
+			fprintf(stderr, "ERROR: %s\n", error.c_str());
+			return 2;
+		}
+	}
+
+	std::vector<const Scene*> selected;
+	std::vector<std::string> names = Flags::Split(scene_list);
+	for(int s = 0; s != g_num_scenes; s++){
+		if(names.empty() || std::find(names.begin(), names.end(), g_scenes[s].name) != names.end())
+			selected.push_back(&g_scenes[s]);
+	}
+	if(selected.size() != (names.empty() ? (size_t)g_num_scenes : names.size())){
+		fprintf(stderr, "ERROR: Unknown scene in --scenes=%s, see --list\n", scene_list.c_str());
+		return 2;
+	}
+
+	// Allocate the trace buffer up front so it does not count as scene memory
+	VFXEpoch::Trace::Enable();
+	VFXEpoch::Trace::Disable();
+
+	Json::Value run = Json::Value::Object();
+	run["context"] = make_context();
+	Json::Value& scenes = run["scenes"] = Json::Value::Object();
+	for(size_t s = 0; s != selected.size(); s++){
+		// Reuse the step count of the baseline so the runs stay comparable
+		int n = steps > 0 ? steps : baseline["scenes"][selected[s]->name]["steps"].asInt(selected[s]->default_steps);
+		fprintf(stderr, "Running %s (%d steps)\n", selected[s]->name, n);
+		scenes[selected[s]->name] = measure(*selected[s], n, repetitions);
+	}
+
+	Thresholds defaults = {0.10, 0.05, 0.10, 0.05};
+	const Json::Value& stored = baseline["thresholds"];
+	Thresholds thresholds;
+	thresholds.time = cli.time >= 0.0 ? cli.time : stored["time"].asNumber(defaults.time);
+	thresholds.iterations = cli.iterations >= 0.0 ? cli.iterations : stored["iterations"].asNumber(defaults.iterations);
+	thresholds.memory = cli.memory >= 0.0 ? cli.memory : stored["memory"].asNumber(defaults.memory);
+	thresholds.min_stage_ms = cli.min_stage_ms >= 0.0 ? cli.min_stage_ms : stored["min_stage_ms"].asNumber(defaults.min_stage_ms);
+
+	Json::Value& written = run["thresholds"] = Json::Value::Object();
+	written["time"] = thresholds.time;
+	written["iterations"] = thresholds.iterations;
+	written["memory"] = thresholds.memory;
+	written["min_stage_ms"] = thresholds.min_stage_ms;
+
+	if(!out_file.empty() && !Json::WriteFile(out_file, run)){
+		fprintf(stderr, "ERROR: Unable to write %s\n", out_file.c_str());
+		return 2;
+	}
+	if(baseline_file.empty()){
+		if(out_file.empty()) printf("%s", Json::Write(run).c_str());
+		return 0;
+	}
+
+	if(baseline["context"]["library_build_type"].asString() != VFXEPOCH_BUILD_TYPE){
+		printf("WARNING: baseline was built as %s, this run is %s\n",
+			   baseline["context"]["library_build_type"].asString("unknown").c_str(), VFXEPOCH_BUILD_TYPE);
+	}
+	printf("Baseline %s (%s), current %s\n", baseline["context"]["library_version"].asString("unknown").c_str(),
+		   baseline["context"]["date"].asString("unknown").c_str(), VFXEPOCH_GIT_VERSION);
+	return compare(baseline, run, thresholds) > 0 ? 1 : 0;
+}